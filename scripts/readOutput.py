@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+#
+# CIRCULATION
+# readOutput.py
+#
+# Reads attribute files written by the OutputWriter (see src/OutputWriter.h) into numpy arrays.
+#
+# usage:
+#   python3 readOutput.py <directory>/<attributeName>.json
+# or from python:
+#   from readOutput import readOutput
+#   data, description = readOutput("output/geopotential.json")  # data has shape (frames, ny, nx)
+#
+# Uncompressed files are memory mapped. Compressed files are decoded frame by frame:
+# undo packbits, gather the 4 byte planes (least significant byte first) into uint32 and undo the xor with the previous value.
+#
+
+import json
+import os
+import sys
+
+import numpy as np
+
+
+def unpackbits(chunk, size):
+    """undo packbits: n in [0,127] -> n+1 literal bytes follow, n in [-127,-1] -> next byte is repeated 1-n times, -128 is skipped"""
+    out = np.empty(size, dtype=np.uint8)
+    i = 0
+    o = 0
+    while i < len(chunk):
+        n = int(np.int8(chunk[i]))
+        i += 1
+        if n >= 0:
+            out[o:o + n + 1] = chunk[i:i + n + 1]
+            i += n + 1
+            o += n + 1
+        elif n != -128:
+            out[o:o + 1 - n] = chunk[i]
+            i += 1
+            o += 1 - n
+    if o != size:
+        raise ValueError("compressed frame does not match the expected size")
+    return out
+
+
+def decompressFrame(chunk, count):
+    """decode one frame of count float32 values"""
+    planes = unpackbits(chunk, count * 4).reshape(4, count).astype(np.uint32)
+    delta = planes[0] | (planes[1] << 8) | (planes[2] << 16) | (planes[3] << 24)
+    return np.bitwise_xor.accumulate(delta).view(np.float32)
+
+
+def readOutput(jsonFile):
+    """returns the frames of an attribute as array of shape (frames, ny, nx) and the parsed json description"""
+    with open(jsonFile) as f:
+        description = json.load(f)
+    rawFile = os.path.join(os.path.dirname(jsonFile), description["file"])
+    shape = tuple(description["shape"])
+
+    if description["compression"] == "none":
+        return np.memmap(rawFile, dtype=description["dtype"], mode="r", shape=shape, order=description["order"]), description
+
+    count = shape[1] * shape[2]
+    raw = np.memmap(rawFile, dtype=np.uint8, mode="r")
+    data = np.empty(shape, dtype=np.float32)
+    for frame, (offset, size) in enumerate(zip(description["chunk_offsets"], description["chunk_bytes"])):
+        data[frame] = decompressFrame(raw[offset:offset + size], count).reshape(shape[1], shape[2])
+    return data, description
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("usage: readOutput.py <attribute>.json")
+        sys.exit(1)
+    data, description = readOutput(sys.argv[1])
+    print(description["attribute"], "frames:", data.shape[0], "size:", data.shape[1:], "compression:", description["compression"])
+    for step, time, frame in zip(description["steps"], description["times"], data):
+        print("step", step, "time", time, "min", frame.min(), "max", frame.max())
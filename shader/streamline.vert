@@ -1,28 +1,34 @@
 #version 450 core
 
-// includes
-#include "mathConst.glsl"
+// input
+layout(location=0) in vec4 vertex; // cartesian position of the line vertex, w is the length of the vector at the vertex
 
-// include oordinate system
-#if defined(CARTESIAN_COORDINATES_2D)
-    #include "coordinateSystems/cartesianCoordinates2D.glsl"
-#else if defined(GEOGRAPHICAL_COORDINATES_2D)
-    #include "coordinateSystems/geographicalCoordinates2D.glsl"
-#endif
+// uniforms
+uniform mat4 projectionMat;
+uniform mat4 viewMat;
+uniform mat4 modelMat;
+uniform mat4 modelViewProjectionMat;
 
-void main()
-{
+uniform vec3 constantColor;
+uniform bool scalarColor = false;
+uniform float minScalar;
+uniform float maxScalar;
+uniform vec3 minScalarColor;
+uniform vec3 maxScalarColor;
 
-    // http://extremelearning.com.au/unreasonable-effectiveness-of-quasirandom-sequences/
-    float g = 1.32471795724474602596;
-    float a1 = 1.0/g;
-    float a2 = 1.0/(g*g);
-    float a3 = 1.0/(g*g*g);
+// out
+out vec3 cellColor; // actually the vertex color on the line
 
-    vec2 randomPoint;
-    randomPoint.x = mod(0.5+a1*gl_VertexID,1);
-    randomPoint.y = mod(0.5+a2*gl_VertexID,1);
+void main()
+{
+    if(scalarColor)
+    {
+        float f = (vertex.w - minScalar) / (maxScalar - minScalar);
+        f = clamp(f,0,1);
+        cellColor = mix(minScalarColor,maxScalarColor,f);
+    }
+    else
+        cellColor = constantColor;
 
-    // map into range of the coordinate system
-    gl_Position = vec4( cs_getMinCoord().xy + randomPoint.xy * ( cs_getMaxCoord().xy - cs_getMinCoord().xy ) ,0,1);
+    gl_Position = modelViewProjectionMat * vec4( 1.001*vertex.xyz,1);
 }
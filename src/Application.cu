@@ -15,6 +15,7 @@
 //--------------------
 #include "Application.h"
 #include <random>
+#include "LaunchTuner.h"
 //--------------------
 
 // function definitions of the Application class
@@ -46,6 +47,9 @@ Application::Application(int width, int height)
     addInputs();
     setKeybindings();
 
+    // write checkpoint before being terminated
+    CheckpointWriter::installSignalHandler();
+
     // try to load existing settings
     try {
         m_persist.open(persistFilename);
@@ -94,6 +98,15 @@ bool Application::run()
     if( !m_window.frameBegin())
         return false;
 
+    // save simulation and close when we receive SIGTERM
+    if(CheckpointWriter::signalReceived())
+    {
+        logINFO("Application") << "Received SIGTERM, writing checkpoint and closing.";
+        saveCheckpoint();
+        m_checkpointWriter.wait();
+        return false;
+    }
+
     // -------------------------
     // handle user interface
     // draw main menu
@@ -107,6 +120,7 @@ bool Application::run()
     if(m_showKeybindingsWindow) showKeybindingsWindow(&m_showKeybindingsWindow);
     if(m_showRendererWindow) m_renderer.showGui(&m_showRendererWindow);
     if(m_showSimulationWindow && m_simulation != nullptr) m_simulation->showGui(&m_showSimulationWindow);
+    if(m_showOutputWindow) showOutputWindow(&m_showOutputWindow);
 
     // open new simulation modal on startup
     static struct Once{Once(){ImGui::OpenPopup("New Simulation");}}once;
@@ -123,7 +137,12 @@ bool Application::run()
     m_renderer.setViewMat(m_camera.viewMatrix());
     if(m_grid)
     {
+        PROFILE_SCOPE("render");
+        m_grid->setRenderedBuffers(m_renderer.getDisplayedBuffers());
+        m_grid->setRenderLevel(*m_cs, m_renderer.getRenderLevel());
         m_grid->startRendering();
+        if(m_grid->newRenderDataReady())
+            m_renderer.notifyNewData();
         m_renderer.draw();
         m_grid->renderDone();
     }
@@ -210,6 +229,64 @@ void Application::resetCamera()
     m_camera.setTarget(center);
 }
 
+void Application::setSimulation(std::unique_ptr<Simulation> simulation, std::shared_ptr<GridBase> grid)
+{
+    m_outputWriter.stop();
+    m_outputWriter.clearAttributes();
+
+    m_simulation = std::move(simulation);
+    m_grid = std::move(grid);
+    m_simulation->setStepCallback([this](GridBase& g, const SimulationState& state){ m_outputWriter.onStep(g, state); });
+    m_simulation->setDiagnosticFieldsFilter([this](int step){ return m_outputWriter.isDue(step); });
+}
+
+void Application::saveCheckpoint()
+{
+    if(!m_simulation)
+        return;
+    m_checkpointWriter.write(checkpointFilename, *m_simulation, *m_grid, *m_cs);
+}
+
+void Application::loadCheckpoint()
+{
+    try
+    {
+        CheckpointFile checkpoint(checkpointFilename);
+
+        std::unique_ptr<Simulation> simulation;
+        switch(checkpoint.getModelType())
+        {
+            case SimModel::renderDemo:
+                simulation = std::make_unique<RenderDemoSimulation>();
+                break;
+            case SimModel::testSimulation:
+                simulation = std::make_unique<TestSimulation>();
+                break;
+            case SimModel::shallowWaterModel:
+                simulation = std::make_unique<ShallowWaterModel>();
+                break;
+            default:
+                logERROR("Application") << "Checkpoint uses unsupported simulation model " << int(checkpoint.getModelType());
+                throw std::runtime_error("Unsupported simulation model in checkpoint.");
+        }
+
+        std::shared_ptr<CoordinateSystem> cs = checkpoint.createCoordinateSystem();
+        std::shared_ptr<GridBase> grid = simulation->recreate(cs);
+        checkpoint.restore(*simulation, *grid);
+        simulation->pause();
+
+        m_cs = cs;
+        setSimulation(std::move(simulation), grid);
+        m_renderer.setCS(m_cs);
+        setupVisualization(checkpoint.getModelType());
+        resetCamera();
+    }
+    catch (const std::exception& e)
+    {
+        logWARNING("Application") << "Could not load checkpoint " << checkpointFilename;
+    }
+}
+
 void Application::mainMenuBar()
 {
     bool newSimPressed=false; // was Simulation -> New selected?
@@ -222,6 +299,9 @@ void Application::mainMenuBar()
             if(ImGui::MenuItem("New"))
                 newSimPressed=true; // needed for some imGui id stack thing
 
+            if(ImGui::MenuItem("Load checkpoint"))
+                loadCheckpoint();
+
             // disable menue in case simulation is not valid
             if(!m_simulation)
             {
@@ -244,14 +324,19 @@ void Application::mainMenuBar()
 
             if(ImGui::MenuItem("Reset"))
             {
+                m_outputWriter.stop();
                 m_grid = m_simulation->recreate(m_cs);
                 m_grid->addRenderBufferToVao(m_renderer.getVAO(), 0);
                 m_grid->bindRenderBuffer(0, GL_SHADER_STORAGE_BUFFER);
             }
 
+            if(ImGui::MenuItem("Save checkpoint"))
+                saveCheckpoint();
+
             ImGui::Separator();
 
             ImGui::MenuItem("Show Simulation window", nullptr, &m_showSimulationWindow);
+            ImGui::MenuItem("Show Output window", nullptr, &m_showOutputWindow);
 
             if(!m_simulation)
             {
@@ -282,6 +367,7 @@ void Application::mainMenuBar()
             ImGui::MenuItem("performance", nullptr, &m_showPerfWindow);
             ImGui::MenuItem("visualization", nullptr, &m_showRendererWindow);
             ImGui::MenuItem("simulation", nullptr, &m_showSimulationWindow);
+            ImGui::MenuItem("output", nullptr, &m_showOutputWindow);
             ImGui::MenuItem("camera debug window", nullptr, &m_showCameraDebugWindow);
             ImGui::Separator();
             ImGui::MenuItem("ImGui demo window", nullptr, &m_showImGuiDemoWindow);
@@ -314,6 +400,82 @@ void Application::showPerfWindow(bool* show)
 
         if(ImGui::Checkbox("V-Sync",&m_vsync))
             mpu::gph::enableVsync(m_vsync);
+
+        if(ImGui::CollapsingHeader("Phases", ImGuiTreeNodeFlags_DefaultOpen))
+        {
+            Profiler::instance().updateStatistics();
+            Profiler::instance().showGui();
+        }
+
+        if(ImGui::CollapsingHeader("Launch tuning"))
+            LaunchTuner::instance().showGui();
+    }
+    ImGui::End();
+}
+
+void Application::showOutputWindow(bool* show)
+{
+    ImGui::SetNextWindowSize({0,0},ImGuiCond_FirstUseEver);
+    if(ImGui::Begin("output",show))
+    {
+        if(!m_grid)
+        {
+            ImGui::Text("Create a simulation first.");
+            ImGui::End();
+            return;
+        }
+
+        if(m_outputWriter.isRunning())
+        {
+            ImGui::Text("Writing to: %s", m_outputWriter.getDirectory().c_str());
+            ImGui::Text("Frames written: %zu dropped: %zu", m_outputWriter.getFramesWritten(), m_outputWriter.getFramesDropped());
+            ImGui::Text("Write rate: %f MB/s", m_outputWriter.getWriteRate());
+            ImGui::Text("Compression ratio: %f", m_outputWriter.getCompressionRatio());
+            if(ImGui::Button("Stop"))
+                m_outputWriter.stop();
+        }
+        else
+        {
+            static char directory[256] = "output";
+            ImGui::InputText("Directory", directory, sizeof(directory));
+
+            int interval = m_outputWriter.getInterval();
+            if(ImGui::DragInt("Every n steps", &interval, 0.1f, 1, 100000))
+                m_outputWriter.setInterval(interval);
+
+            bool compress = m_outputWriter.getCompression();
+            if(ImGui::Checkbox("Lossless compression", &compress))
+                m_outputWriter.setCompression(compress);
+
+            // select attributes of the current grid
+            ImGui::Text("Attributes");
+            static int stride[2] = {1,1};
+            ImGui::DragInt2("Stride", stride, 0.1f, 1, 64);
+            auto& selected = m_outputWriter.attributes();
+            for(AT a : m_grid->getAttributeTypes())
+            {
+                auto it = std::find_if(selected.begin(), selected.end(), [a](const OutputAttribute& o){ return o.attribute == a; });
+                bool isSelected = it != selected.end();
+                if(ImGui::Checkbox(getAttributeName(a), &isSelected))
+                {
+                    if(isSelected)
+                        selected.push_back({a, stride[0], stride[1]});
+                    else
+                        selected.erase(it);
+                }
+            }
+
+            if(ImGui::Button("Start"))
+            {
+                for(auto& o : selected)
+                {
+                    o.strideX = stride[0];
+                    o.strideY = stride[1];
+                }
+                m_outputWriter.setDirectory(directory);
+                m_outputWriter.start(*m_grid, *m_cs);
+            }
+        }
     }
     ImGui::End();
 }
@@ -429,12 +591,13 @@ void Application::newSimulationModal()
         static auto testSim = std::make_unique<TestSimulation>();
         static auto rdSim = std::make_unique<RenderDemoSimulation>();
         static auto shallowSim = std::make_unique<ShallowWaterModel>();
+        static auto ensembleSim = std::make_unique<ShallowWaterEnsemble>();
         static int selctedModelId = 2;
         static Simulation* selectedeModel = shallowSim.get();
 
         // select simulation model
         ImGui::Text("Simulation Model");
-        if( ImGui::Combo("Model", &selctedModelId, "Render Demo \0Test Simulation \0Shallow Water Model \0\0") )
+        if( ImGui::Combo("Model", &selctedModelId, "Render Demo \0Test Simulation \0Shallow Water Model \0Shallow Water Ensemble \0\0") )
         {
             switch(static_cast<SimModel>(selctedModelId))
             {
@@ -447,6 +610,9 @@ void Application::newSimulationModal()
                 case SimModel::shallowWaterModel:
                     selectedeModel = shallowSim.get();
                     break;
+                case SimModel::shallowWaterEnsemble:
+                    selectedeModel = ensembleSim.get();
+                    break;
             }
         }
 
@@ -546,71 +712,75 @@ void Application::newSimulationModal()
             m_renderer.setCS(m_cs);
 
             // create simulation and grid
-            m_simulation = selectedeModel->clone();
-            m_grid = m_simulation->recreate(m_cs);
-            m_simulation->pause();
-
-            // setup visualization
-            switch(static_cast<SimModel>(selctedModelId))
-            {
-                case SimModel::renderDemo:
-                {
-                    m_grid->addRenderBufferToVao(m_renderer.getVAO(), 0);
-                    m_grid->bindRenderBuffer(0, GL_SHADER_STORAGE_BUFFER);
-
-                    std::vector<std::pair<std::string,int>> scalarFields;
-                    scalarFields.emplace_back("density",0);
-                    scalarFields.emplace_back("velocity_x",1);
-                    scalarFields.emplace_back("velocity_y",2);
-                    m_renderer.setScalarFields(scalarFields);
-
-                    std::vector<std::pair<std::string,std::pair<int,int>>> vectorFields;
-                    vectorFields.emplace_back("velocity",std::pair<int,int>(1,2));
-                    m_renderer.setVecFields(vectorFields);
-                    break;
-                }
-                case SimModel::testSimulation:
-                {
-                    m_grid->addRenderBufferToVao(m_renderer.getVAO(), 0);
-                    m_grid->bindRenderBuffer(0, GL_SHADER_STORAGE_BUFFER);
-
-                    std::vector<std::pair<std::string,int>> scalarFields;
-                    scalarFields.emplace_back("density",0);
-                    scalarFields.emplace_back("density_laplace",5);
-                    scalarFields.emplace_back("velocity_divergence",6);
-                    scalarFields.emplace_back("velocity_curl",7);
-                    scalarFields.emplace_back("temperature",8);
-                    m_renderer.setScalarFields(scalarFields);
-
-                    std::vector<std::pair<std::string,std::pair<int,int>>> vectorFields;
-                    vectorFields.emplace_back("velocity",std::pair<int,int>(1,2));
-                    vectorFields.emplace_back("density_gradient",std::pair<int,int>(3,4));
-                    vectorFields.emplace_back("temperature_gradient",std::pair<int,int>(9,10));
-                    m_renderer.setVecFields(vectorFields);
-                    break;
-                }
-                case SimModel::shallowWaterModel:
-                {
-                    m_grid->addRenderBufferToVao(m_renderer.getVAO(), 0);
-                    m_grid->bindRenderBuffer(0, GL_SHADER_STORAGE_BUFFER);
-
-                    std::vector<std::pair<std::string,int>> scalarFields;
-                    scalarFields.emplace_back("geopotential at free surface",2);
-                    scalarFields.emplace_back("potential vorticity",3);
-                    m_renderer.setScalarFields(scalarFields, 0);
-
-                    std::vector<std::pair<std::string,std::pair<int,int>>> vectorFields;
-                    vectorFields.emplace_back("velocity",std::pair<int,int>(0,1));
-                    m_renderer.setVecFields(vectorFields, 0);
-                    break;
-                }
-            }
-
+            auto simulation = selectedeModel->clone();
+            auto grid = simulation->recreate(m_cs);
+            simulation->pause();
+            setSimulation(std::move(simulation), grid);
 
+            setupVisualization(static_cast<SimModel>(selctedModelId));
             resetCamera();
         }
         ImGui::SetItemDefaultFocus();
 
         ImGui::EndPopup();
     }
-}
\ No newline at end of file
+}
+
+void Application::setupVisualization(SimModel model)
+{
+    switch(model)
+    {
+        case SimModel::renderDemo:
+        {
+            m_grid->addRenderBufferToVao(m_renderer.getVAO(), 0);
+            m_grid->bindRenderBuffer(0, GL_SHADER_STORAGE_BUFFER);
+
+            std::vector<std::pair<std::string,int>> scalarFields;
+            scalarFields.emplace_back("density",0);
+            scalarFields.emplace_back("velocity_x",1);
+            scalarFields.emplace_back("velocity_y",2);
+            m_renderer.setScalarFields(scalarFields);
+
+            std::vector<std::pair<std::string,std::pair<int,int>>> vectorFields;
+            vectorFields.emplace_back("velocity",std::pair<int,int>(1,2));
+            m_renderer.setVecFields(vectorFields);
+            break;
+        }
+        case SimModel::testSimulation:
+        {
+            m_grid->addRenderBufferToVao(m_renderer.getVAO(), 0);
+            m_grid->bindRenderBuffer(0, GL_SHADER_STORAGE_BUFFER);
+
+            std::vector<std::pair<std::string,int>> scalarFields;
+            scalarFields.emplace_back("density",0);
+            scalarFields.emplace_back("density_laplace",5);
+            scalarFields.emplace_back("velocity_divergence",6);
+            scalarFields.emplace_back("velocity_curl",7);
+            scalarFields.emplace_back("temperature",8);
+            m_renderer.setScalarFields(scalarFields);
+
+            std::vector<std::pair<std::string,std::pair<int,int>>> vectorFields;
+            vectorFields.emplace_back("velocity",std::pair<int,int>(1,2));
+            vectorFields.emplace_back("density_gradient",std::pair<int,int>(3,4));
+            vectorFields.emplace_back("temperature_gradient",std::pair<int,int>(9,10));
+            m_renderer.setVecFields(vectorFields);
+            break;
+        }
+        case SimModel::shallowWaterModel:
+        case SimModel::shallowWaterEnsemble:
+        {
+            m_grid->addRenderBufferToVao(m_renderer.getVAO(), 0);
+            m_grid->bindRenderBuffer(0, GL_SHADER_STORAGE_BUFFER);
+
+            std::vector<std::pair<std::string,int>> scalarFields;
+            scalarFields.emplace_back("geopotential at free surface",2);
+            scalarFields.emplace_back("potential vorticity",3);
+            m_renderer.setScalarFields(scalarFields, 0);
+
+            std::vector<std::pair<std::string,std::pair<int,int>>> vectorFields;
+            vectorFields.emplace_back("velocity",std::pair<int,int>(0,1));
+            m_renderer.setVecFields(vectorFields, 0);
+            break;
+        }
+    }
+}
@@ -29,6 +29,9 @@
 #include "simulationModels/RenderDemoSimulation.h"
 #include "simulationModels/TestSimulation.h"
 #include "simulationModels/ShallowWaterModel.h"
+#include "simulationModels/ShallowWaterEnsemble.h"
+#include "Checkpoint.h"
+#include "OutputWriter.h"
 #include "enums.h"
 #include "globalSettings.h"
 //--------------------
@@ -65,6 +68,8 @@ private:
     std::shared_ptr<CoordinateSystem> m_cs{nullptr}; //!< coordinate system currently in use
     std::shared_ptr<GridBase> m_grid; //!< grid used by the current simulation
     std::unique_ptr<Simulation> m_simulation; //!< the currently active simulation model
+    CheckpointWriter m_checkpointWriter; //!< writes checkpoints in the background
+    OutputWriter m_outputWriter; //!< writes selected attributes to disk
 
     // user interface
     bool m_showImGuiDemoWindow{false}; //!< is true ImGUI demo window will be shown
@@ -74,17 +79,23 @@ private:
     bool m_showKeybindingsWindow{false}; //!< if true keybinding window will be drawn
     bool m_showRendererWindow{false}; //!< if true renderer window will be drawn
     bool m_showSimulationWindow{false}; //!< if true the simulation settings window will be drawn
+    bool m_showOutputWindow{false}; //!< if true the output settings window will be drawn
 
     // internal helper functions
     void addInputs(); //!< add some useful input functions
     void setKeybindings(); //!< set keybindings for all the functions
     void resetCamera(); //!< resets the camera
+    void setupVisualization(SimModel model); //!< set up renderer and render buffers for the current grid and simulation model
+    void saveCheckpoint(); //!< write checkpoint of the current simulation
+    void loadCheckpoint(); //!< replace current simulation by the one stored in the checkpoint file
+    void setSimulation(std::unique_ptr<Simulation> simulation, std::shared_ptr<GridBase> grid); //!< replace the current simulation, stops output
 
     // ui windows and menus
     void mainMenuBar(); //!< draw and handle the main menu bar
     void showPerfWindow(bool* show); //!< shows window with performance information and settings
     void showAboutWindow(bool* show); //!< shows window with information on app
     void showKeybindingsWindow(bool* show); //!< shows window with information keybindings
+    void showOutputWindow(bool* show); //!< shows window with settings for file output
     void newSimulationModal(); //!< draws the new simulation modal if needed
 
     mpu::CfgFile m_persist;
@@ -0,0 +1,286 @@
+/*
+ * CIRCULATION
+ * Checkpoint.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the CheckpointWriter and CheckpointFile classes
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "Checkpoint.h"
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <csignal>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "coordinateSystems/CartesianCoordinates2D.h"
+#include "coordinateSystems/GeographicalCoordinates2D.h"
+#include "Profiler.h"
+//--------------------
+
+// variables
+//--------------------
+constexpr char CheckpointHeader::expectedMagic[8];
+namespace {
+    volatile std::sig_atomic_t sigtermReceived = 0; //!< set by the signal handler
+    constexpr uint64_t pageSize = 4096; //!< grid data starts at a multiple of this
+}
+//--------------------
+
+// function definitions of the CheckpointWriter class
+//-------------------------------------------------------------------
+
+CheckpointWriter::CheckpointWriter()
+{
+    m_writerThread = std::thread(&CheckpointWriter::writerLoop, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        m_shouldStop = true;
+    }
+    m_cv.notify_all();
+    m_writerThread.join();
+}
+
+bool CheckpointWriter::write(const std::string& filename, const Simulation& simulation, GridBase& grid, const CoordinateSystem& cs)
+{
+    std::unique_lock<std::mutex> lck(m_mtx);
+    if(m_hasJob)
+    {
+        logWARNING("Checkpoint") << "Previous checkpoint is still being written, skipping checkpoint " << filename;
+        return false;
+    }
+
+    if(simulation.getModelType() == SimModel::shallowWaterEnsemble)
+    {
+        logWARNING("Checkpoint") << "Checkpoints of ensembles are not supported, skipping checkpoint " << filename;
+        return false;
+    }
+
+    std::vector<AT> attributes = grid.getAttributeTypes();
+    assert_critical(attributes.size() <= CheckpointHeader::maxAttributes, "Checkpoint", "Grid has too many attributes for the checkpoint format.");
+
+    // fill header
+    CheckpointHeader& h = m_header;
+    memset(&h, 0, sizeof(CheckpointHeader));
+    memcpy(h.magic, CheckpointHeader::expectedMagic, sizeof(h.magic));
+    h.version = CheckpointHeader::currentVersion;
+    h.headerBytes = sizeof(CheckpointHeader);
+    h.simModel = static_cast<int32_t>(simulation.getModelType());
+    h.csType = static_cast<int32_t>(cs.getType());
+    float3 csMin = cs.getMinCoord();
+    float3 csMax = cs.getMaxCoord();
+    int3 numCells = cs.getNumGridCells3d();
+    h.csMin[0] = csMin.x; h.csMin[1] = csMin.y; h.csMin[2] = csMin.z;
+    h.csMax[0] = csMax.x; h.csMax[1] = csMax.y; h.csMax[2] = csMax.z;
+    h.numGridCells[0] = numCells.x; h.numGridCells[1] = numCells.y; h.numGridCells[2] = numCells.z;
+
+    SimulationState state = simulation.getState();
+    h.totalSimulatedTime = state.totalSimulatedTime;
+    h.step = state.step;
+    h.firstTimestep = state.firstTimestep;
+
+    std::vector<ModelParameter> parameters = simulation.getParameters();
+    assert_critical(parameters.size() <= CheckpointHeader::maxParameters, "Checkpoint", "Simulation has too many parameters for the checkpoint format.");
+    h.numParameters = static_cast<int32_t>(parameters.size());
+    for(size_t i = 0; i < parameters.size(); i++)
+    {
+        strncpy(h.parameterNames[i], parameters[i].name.c_str(), CheckpointHeader::parameterNameLength - 1);
+        h.parameterValues[i] = parameters[i].value;
+    }
+
+    h.numAttributes = static_cast<int32_t>(attributes.size());
+    for(size_t i = 0; i < attributes.size(); i++)
+        h.attributeTypes[i] = static_cast<int32_t>(attributes[i]);
+    h.timeLevelBytes = grid.getTimeLevelBytes();
+    h.numTimeLevels = 2;
+    h.dataOffset = ((sizeof(CheckpointHeader) + pageSize - 1) / pageSize) * pageSize;
+
+    // take snapshot of t and t-1, the buffer is reused between checkpoints
+    {
+        PROFILE_SCOPE("checkpoint snapshot");
+        m_snapshot.resize(h.numTimeLevels * h.timeLevelBytes);
+        grid.downloadTimeLevel(0, m_snapshot.data());
+        grid.downloadTimeLevel(-1, m_snapshot.data() + h.timeLevelBytes);
+    }
+
+    m_filename = filename;
+    m_hasJob = true;
+    lck.unlock();
+    m_cv.notify_all();
+    return true;
+}
+
+void CheckpointWriter::wait()
+{
+    std::unique_lock<std::mutex> lck(m_mtx);
+    m_cv.wait(lck, [this](){ return !m_hasJob; });
+}
+
+bool CheckpointWriter::isBusy()
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    return m_hasJob;
+}
+
+void CheckpointWriter::writerLoop()
+{
+    std::unique_lock<std::mutex> lck(m_mtx);
+    while(true)
+    {
+        m_cv.wait(lck, [this](){ return m_hasJob || m_shouldStop; });
+        if(!m_hasJob)
+            return;
+
+        // the job data is not touched by write() while m_hasJob is set, so we can unlock while writing
+        lck.unlock();
+
+        PROFILE_SCOPE("checkpoint write");
+        mpu::HRStopwatch sw;
+        const std::string tmpFilename = m_filename + ".tmp";
+        bool success = false;
+        FILE* file = fopen(tmpFilename.c_str(), "wb");
+        if(file)
+        {
+            std::vector<char> padding(m_header.dataOffset - sizeof(CheckpointHeader), 0);
+            success = fwrite(&m_header, sizeof(CheckpointHeader), 1, file) == 1
+                      && fwrite(padding.data(), 1, padding.size(), file) == padding.size()
+                      && fwrite(m_snapshot.data(), 1, m_snapshot.size(), file) == m_snapshot.size()
+                      && fflush(file) == 0
+                      && fsync(fileno(file)) == 0;
+            success = (fclose(file) == 0) && success;
+        }
+        if(success)
+            success = rename(tmpFilename.c_str(), m_filename.c_str()) == 0;
+        sw.pause();
+
+        if(success)
+        {
+            const double gigabytes = double(m_header.dataOffset + m_snapshot.size()) / (1024.0*1024.0*1024.0);
+            m_lastThroughput = gigabytes / sw.getSeconds();
+            logINFO("Checkpoint") << "Wrote checkpoint " << m_filename << " (" << gigabytes << " GB in " << sw.getSeconds()
+                                  << "s, " << m_lastThroughput << " GB/s)";
+        }
+        else
+            logERROR("Checkpoint") << "Failed to write checkpoint " << m_filename << ": " << strerror(errno);
+
+        lck.lock();
+        m_hasJob = false;
+        m_cv.notify_all();
+    }
+}
+
+void CheckpointWriter::installSignalHandler()
+{
+    std::signal(SIGTERM, [](int){ sigtermReceived = 1; });
+}
+
+bool CheckpointWriter::signalReceived()
+{
+    return sigtermReceived != 0;
+}
+
+// function definitions of the CheckpointFile class
+//-------------------------------------------------------------------
+
+CheckpointFile::CheckpointFile(const std::string& filename)
+    : m_file(filename), m_filename(filename)
+{
+    m_header = reinterpret_cast<const CheckpointHeader*>(m_file.data());
+
+    // validate
+    std::string error;
+    if(m_file.size() < sizeof(CheckpointHeader))
+        error = "file is too small";
+    else if(memcmp(m_header->magic, CheckpointHeader::expectedMagic, sizeof(m_header->magic)) != 0)
+        error = "not a checkpoint file";
+    else if(m_header->version != CheckpointHeader::currentVersion || m_header->headerBytes != sizeof(CheckpointHeader))
+        error = "unsupported checkpoint version " + std::to_string(m_header->version);
+    else if(m_header->dataOffset + m_header->numTimeLevels * m_header->timeLevelBytes > m_file.size())
+        error = "file is truncated";
+
+    if(!error.empty())
+    {
+        logERROR("Checkpoint") << "Checkpoint " << filename << " is invalid: " << error;
+        throw std::runtime_error("Invalid checkpoint file.");
+    }
+}
+
+std::shared_ptr<CoordinateSystem> CheckpointFile::createCoordinateSystem() const
+{
+    const CheckpointHeader& h = *m_header;
+    int3 numCells{h.numGridCells[0], h.numGridCells[1], h.numGridCells[2]};
+    switch(static_cast<CSType>(h.csType))
+    {
+        case CSType::cartesian2d:
+            return std::make_shared<CartesianCoordinates2D>(float3{h.csMin[0], h.csMin[1], h.csMin[2]},
+                                                            float3{h.csMax[0], h.csMax[1], h.csMax[2]}, numCells);
+        case CSType::geographical2d:
+            return std::make_shared<GeographicalCoordinates2D>(h.csMin[0], h.csMax[0], h.csMin[1], h.csMax[1], numCells, h.csMin[2]);
+        default:
+            logERROR("Checkpoint") << "Checkpoint " << m_filename << " uses unknown coordinate system " << h.csType;
+            throw std::runtime_error("Unknown coordinate system in checkpoint.");
+    }
+}
+
+void CheckpointFile::restore(Simulation& simulation, GridBase& grid) const
+{
+    const CheckpointHeader& h = *m_header;
+
+    // make sure the grid layout matches
+    std::vector<AT> attributes = grid.getAttributeTypes();
+    bool matches = (simulation.getModelType() == getModelType())
+                   && (attributes.size() == static_cast<size_t>(h.numAttributes))
+                   && (grid.getTimeLevelBytes() == h.timeLevelBytes);
+    for(size_t i = 0; matches && i < attributes.size(); i++)
+        matches = static_cast<int32_t>(attributes[i]) == h.attributeTypes[i];
+    if(!matches)
+    {
+        logERROR("Checkpoint") << "Checkpoint " << m_filename << " does not match the simulation and grid.";
+        throw std::runtime_error("Checkpoint does not match simulation.");
+    }
+
+    mpu::HRStopwatch sw;
+    const char* data = m_file.data() + h.dataOffset;
+    grid.uploadTimeLevel(0, data);
+    grid.uploadTimeLevel(-1, data + h.timeLevelBytes);
+    sw.pause();
+
+    // the run continues with the parameters it was written with
+    std::vector<ModelParameter> current = simulation.getParameters();
+    std::vector<ModelParameter> parameters;
+    for(int i = 0; i < h.numParameters && i < CheckpointHeader::maxParameters; i++)
+    {
+        ModelParameter p{std::string(h.parameterNames[i], strnlen(h.parameterNames[i], CheckpointHeader::parameterNameLength)),
+                         h.parameterValues[i]};
+        auto it = std::find_if(current.begin(), current.end(), [&p](const ModelParameter& c){ return c.name == p.name; });
+        if(it == current.end())
+            logWARNING("Checkpoint") << "Parameter " << p.name << " of checkpoint " << m_filename << " is unknown to the simulation, it is ignored.";
+        else if(it->value != p.value)
+            logWARNING("Checkpoint") << "Parameter " << p.name << " is " << it->value << " in the simulation but " << p.value
+                                     << " in checkpoint " << m_filename << ", using the value of the checkpoint.";
+        parameters.push_back(std::move(p));
+    }
+    simulation.setParameters(parameters);
+
+    SimulationState state;
+    state.totalSimulatedTime = h.totalSimulatedTime;
+    state.step = h.step;
+    state.firstTimestep = h.firstTimestep != 0;
+    simulation.setState(state);
+
+    const double gigabytes = double(h.numTimeLevels * h.timeLevelBytes) / (1024.0*1024.0*1024.0);
+    logINFO("Checkpoint") << "Restored checkpoint " << m_filename << " at step " << h.step << " (" << gigabytes << " GB in "
+                          << sw.getSeconds() << "s, " << gigabytes / sw.getSeconds() << " GB/s)";
+}
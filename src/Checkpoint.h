@@ -0,0 +1,150 @@
+/*
+ * CIRCULATION
+ * Checkpoint.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the CheckpointWriter and CheckpointFile classes
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_CHECKPOINT_H
+#define CIRCULATION_CHECKPOINT_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include <mpUtils/mpUtils.h>
+
+#include "Grid.h"
+#include "MappedFile.h"
+#include "coordinateSystems/CoordinateSystem.h"
+#include "simulationModels/Simulation.h"
+#include "enums.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * @brief header at the start of every checkpoint file, followed by the t and t-1 time levels of the grid starting at dataOffset
+ *          Model parameters (see Simulation::getParameters()) are stored by name, so they can be compared on restore.
+ *          All values are stored in native byte order.
+ */
+struct CheckpointHeader
+{
+    static constexpr char expectedMagic[8] = {'C','I','R','C','C','K','P','T'};
+    static constexpr uint32_t currentVersion = 2;
+    static constexpr int maxAttributes = 32;
+    static constexpr int maxParameters = 32;
+    static constexpr int parameterNameLength = 32;
+
+    char magic[8]; //!< identifies the file as a checkpoint
+    uint32_t version; //!< version of the checkpoint format
+    uint32_t headerBytes; //!< sizeof(CheckpointHeader) when the file was written
+
+    int32_t simModel; //!< SimModel of the simulation
+    int32_t csType; //!< CSType of the coordinate system
+    float csMin[3]; //!< result of getMinCoord() of the coordinate system
+    float csMax[3]; //!< result of getMaxCoord() of the coordinate system
+    int32_t numGridCells[3]; //!< result of getNumGridCells3d() of the coordinate system
+
+    double totalSimulatedTime; //!< simulation state
+    int32_t step; //!< simulation state
+    int32_t firstTimestep; //!< simulation state
+
+    int32_t numParameters; //!< number of model parameters
+    char parameterNames[maxParameters][parameterNameLength]; //!< null terminated name of every model parameter
+    float parameterValues[maxParameters]; //!< value of every model parameter
+
+    int32_t numAttributes; //!< number of attributes in the grid
+    int32_t attributeTypes[maxAttributes]; //!< AT of all attributes in storage order
+    uint64_t timeLevelBytes; //!< size of one time level in bytes
+    uint64_t numTimeLevels; //!< number of time levels stored, first is t second is t-1
+    uint64_t dataOffset; //!< offset of the first time level from the start of the file, page aligned
+};
+
+//-------------------------------------------------------------------
+/**
+ * class CheckpointWriter
+ *
+ * Writes checkpoints of simulation and grid in a background thread.
+ *
+ * usage:
+ * Call write() from the thread that runs the simulation, in between timesteps. A snapshot of the grid is copied to
+ * host memory immediately, writing it to disk happens in the background so the simulation can continue.
+ * If the previous checkpoint is still being written the call is ignored and false is returned.
+ * The file is written to "<filename>.tmp" first and renamed when complete, so there is always one valid checkpoint.
+ * Call installSignalHandler() to make the application write a checkpoint on SIGTERM, then check signalReceived() regularly.
+ *
+ */
+class CheckpointWriter
+{
+public:
+    CheckpointWriter();
+    ~CheckpointWriter(); //!< waits for the last checkpoint to be written
+    CheckpointWriter(const CheckpointWriter& other) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter& other) = delete;
+
+    bool write(const std::string& filename, const Simulation& simulation, GridBase& grid, const CoordinateSystem& cs); //!< snapshot and write in the background
+    void wait(); //!< block until the current checkpoint is written
+    bool isBusy(); //!< is a checkpoint currently written?
+    double getLastThroughput() const {return m_lastThroughput;} //!< throughput of the last write in GB/s
+
+    static void installSignalHandler(); //!< sets a signal handler for SIGTERM, that sets a flag that can be checked with signalReceived()
+    static bool signalReceived(); //!< returns true if SIGTERM was received since installSignalHandler() was called
+
+private:
+    void writerLoop(); //!< runs in the writer thread
+
+    std::thread m_writerThread; //!< thread that writes the snapshot to disk
+    std::mutex m_mtx; //!< protects the job data
+    std::condition_variable m_cv; //!< signals a new job or a finished job
+    bool m_hasJob{false}; //!< snapshot is waiting to be written
+    bool m_shouldStop{false}; //!< writer thread should finish
+
+    std::string m_filename; //!< file the current job is written to
+    CheckpointHeader m_header; //!< header of the current job
+    std::vector<char> m_snapshot; //!< snapshot of all time levels of the current job
+    std::atomic<double> m_lastThroughput{0.0}; //!< throughput of the last write in GB/s
+};
+
+//-------------------------------------------------------------------
+/**
+ * class CheckpointFile
+ *
+ * Memory maps a checkpoint file for restarting.
+ *
+ * usage:
+ * Open a checkpoint, use createCoordinateSystem() and getModelType() to recreate the simulation, then call restore()
+ * with the simulation and the grid returned by Simulation::recreate(). Grid data is uploaded directly from the mapped file.
+ * Model parameters of the checkpoint replace the current settings of the simulation, a warning is logged for every
+ * parameter that differs.
+ * Throws std::runtime_error if the file can not be opened or is not a valid checkpoint.
+ *
+ */
+class CheckpointFile
+{
+public:
+    explicit CheckpointFile(const std::string& filename); //!< map and validate a checkpoint file
+
+    const CheckpointHeader& getHeader() const {return *m_header;} //!< access to the file header
+    SimModel getModelType() const {return static_cast<SimModel>(m_header->simModel);} //!< model used to write the checkpoint
+    std::shared_ptr<CoordinateSystem> createCoordinateSystem() const; //!< create the coordinate system stored in the checkpoint
+    void restore(Simulation& simulation, GridBase& grid) const; //!< upload the grid data and restore the simulation state
+
+private:
+    MappedFile m_file; //!< the mapped checkpoint
+    const CheckpointHeader* m_header{nullptr}; //!< header at the start of the mapping
+    std::string m_filename; //!< name of the mapped file
+};
+
+#endif //CIRCULATION_CHECKPOINT_H
@@ -0,0 +1,207 @@
+/*
+ * CIRCULATION
+ * ConservationDiagnostics.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ConservationDiagnostics class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "ConservationDiagnostics.h"
+#include <algorithm>
+#include <mpUtils/mpGraphics.h>
+//--------------------
+
+// function definitions of the ConservationDiagnostics class
+//-------------------------------------------------------------------
+
+ConservationDiagnostics::AccumulatorType ConservationDiagnostics::prepare(dim3 numBlocks)
+{
+    m_numBlocks = numBlocks.x * numBlocks.y * numBlocks.z;
+    if(m_blockPartials.size() < m_numBlocks * numQuantities)
+    {
+        collect();
+        m_blockPartials.resize(m_numBlocks * numQuantities);
+    }
+    return AccumulatorType(m_blockPartials.getVectorReference(), true);
+}
+
+void ConservationDiagnostics::record(int step, double time)
+{
+    // the previous download is done long ago, unless diagnostics are collected every step
+    collect();
+
+    const size_t count = m_numBlocks * numQuantities;
+    if(!m_downloaded)
+    {
+        auto event = new cudaEvent_t;
+        assert_cuda(cudaEventCreateWithFlags(event, cudaEventDisableTiming));
+        m_downloaded = std::shared_ptr<cudaEvent_t>(event, [](cudaEvent_t* e){ cudaEventDestroy(*e); delete e; });
+    }
+    if(m_hostPartialsSize < count)
+    {
+        double* partials;
+        assert_cuda(cudaMallocHost(&partials, count * sizeof(double)));
+        m_hostPartials = std::shared_ptr<double>(partials, [](double* p){ cudaFreeHost(p); });
+        m_hostPartialsSize = count;
+    }
+
+    assert_cuda(cudaMemcpyAsync(m_hostPartials.get(), m_blockPartials.data(), count * sizeof(double), cudaMemcpyDeviceToHost,
+                                cudaStreamPerThread));
+    assert_cuda(cudaEventRecord(*m_downloaded, cudaStreamPerThread));
+    m_pending = true;
+    m_pendingRecord.step = step;
+    m_pendingRecord.time = time;
+    m_pendingBlocks = m_numBlocks;
+}
+
+void ConservationDiagnostics::collect() const
+{
+    if(!m_pending)
+        return;
+    m_pending = false;
+    assert_cuda(cudaEventSynchronize(*m_downloaded));
+
+    // sum block results on the host in block order
+    const double* partials = m_hostPartials.get();
+    KahanSum sums[numQuantities];
+    for(int b = 0; b < m_pendingBlocks; b++)
+        for(int q = 0; q < numQuantities; q++)
+            sums[q].add(partials[b*numQuantities + q]);
+
+    Record r = m_pendingRecord;
+    for(int q = 0; q < numQuantities; q++)
+        r.values[q] = sums[q].result();
+
+    if(m_numRecorded == 0)
+        m_first = r;
+    m_numRecorded++;
+    if(m_series.size() < m_capacity)
+        m_series.push_back(r);
+    else
+    {
+        m_series[m_oldest] = r;
+        m_oldest = (m_oldest + 1) % m_series.size();
+    }
+
+    if(m_output)
+        writeCsvLine(*m_output, r);
+}
+
+void ConservationDiagnostics::reset()
+{
+    if(m_pending)
+        assert_cuda(cudaEventSynchronize(*m_downloaded));
+    m_pending = false;
+    m_series.clear();
+    m_oldest = 0;
+    m_numRecorded = 0;
+}
+
+void ConservationDiagnostics::setCapacity(size_t capacity)
+{
+    m_capacity = std::max(capacity, size_t(1));
+    collect();
+    m_series.clear();
+    m_oldest = 0;
+}
+
+void ConservationDiagnostics::setOutput(std::ostream* stream)
+{
+    collect();
+    m_output = stream;
+    if(m_output)
+        writeCsvHeader(*m_output);
+}
+
+size_t ConservationDiagnostics::getNumRecords() const
+{
+    collect();
+    return m_series.size();
+}
+
+const ConservationDiagnostics::Record& ConservationDiagnostics::getRecord(size_t i) const
+{
+    collect();
+    return m_series[(m_oldest + i) % m_series.size()];
+}
+
+double ConservationDiagnostics::getRelativeDrift(int quantity) const
+{
+    collect();
+    if(m_numRecorded < 2 || m_series.empty() || m_first.values[quantity] == 0.0)
+        return 0.0;
+    const Record& last = getRecord(m_series.size()-1);
+    return (last.values[quantity] - m_first.values[quantity]) / fabs(m_first.values[quantity]);
+}
+
+const char* ConservationDiagnostics::getQuantityName(int quantity)
+{
+    switch(quantity)
+    {
+        case mass: return "mass";
+        case energy: return "energy";
+        case enstrophy: return "enstrophy";
+        case absoluteVorticity: return "absolute vorticity";
+        default: return "unknown";
+    }
+}
+
+void ConservationDiagnostics::showGui()
+{
+    ImGui::Checkbox("Collect diagnostics", &m_enabled);
+    if(ImGui::DragInt("Every n steps", &m_interval, 0.1, 1, 10000))
+        m_interval = std::max(m_interval, 1);
+    ImGui::SameLine();
+    if(ImGui::Button("Clear"))
+        reset();
+
+    const size_t numRecords = getNumRecords();
+    if(numRecords == 0)
+    {
+        ImGui::Text("No diagnostics recorded yet.");
+        return;
+    }
+
+    std::vector<float> values(numRecords);
+    for(int q = 0; q < numQuantities; q++)
+    {
+        for(size_t i = 0; i < numRecords; i++)
+            values[i] = static_cast<float>(getRecord(i).values[q]);
+
+        std::string overlay = std::to_string(getRecord(numRecords-1).values[q]) + " (drift " + std::to_string(getRelativeDrift(q)) + ")";
+        ImGui::PlotLines(getQuantityName(q), values.data(), static_cast<int>(values.size()), 0, overlay.c_str(),
+                         FLT_MAX, FLT_MAX, ImVec2(0,60));
+    }
+}
+
+void ConservationDiagnostics::writeCsvHeader(std::ostream& stream)
+{
+    stream << "step,time";
+    for(int q = 0; q < numQuantities; q++)
+        stream << "," << getQuantityName(q);
+    stream << "\n";
+}
+
+void ConservationDiagnostics::writeCsvLine(std::ostream& stream, const Record& r)
+{
+    const auto precision = stream.precision(17);
+    stream << r.step << "," << r.time;
+    for(int q = 0; q < numQuantities; q++)
+        stream << "," << r.values[q];
+    stream << "\n";
+    stream.precision(precision);
+}
+
+void ConservationDiagnostics::writeCsv(std::ostream& stream) const
+{
+    writeCsvHeader(stream);
+    for(size_t i = 0; i < getNumRecords(); i++)
+        writeCsvLine(stream, getRecord(i));
+}
@@ -0,0 +1,205 @@
+/*
+ * CIRCULATION
+ * ConservationDiagnostics.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ConservationDiagnostics class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_CONSERVATIONDIAGNOSTICS_H
+#define CIRCULATION_CONSERVATIONDIAGNOSTICS_H
+
+// includes
+//--------------------
+#include <vector>
+#include <string>
+#include <ostream>
+#include <memory>
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * @brief compensated summation (Neumaier variant of the kahan summation), keeps the rounding error of long sums small
+ */
+struct KahanSum
+{
+    double sum{0.0}; //!< running sum
+    double compensation{0.0}; //!< accumulated rounding error
+
+    CUDAHOSTDEV void add(double value)
+    {
+        const double t = sum + value;
+        if(fabs(sum) >= fabs(value))
+            compensation += (sum - t) + value;
+        else
+            compensation += (value - t) + sum;
+        sum = t;
+    }
+
+    CUDAHOSTDEV double result() const {return sum + compensation;}
+};
+
+//-------------------------------------------------------------------
+/**
+ * class DiagnosticsAccumulator
+ *
+ * Device side part of the diagnostics. Collects global integrals of numQuantities quantities inside of a simulation kernel.
+ *
+ * usage:
+ * Get an accumulator from ConservationDiagnostics::prepare() and pass it to the kernel by value. Inside the kernel
+ * every thread calls add() for all cells it processes and all threads of the block call storeBlockResult() at the very end
+ * of the kernel. Launch the kernel with sharedMemory() bytes of dynamic shared memory.
+ * If the accumulator is not enabled all functions do nothing.
+ * Per thread sums are compensated, the block reduction and the final sum on the host use a fixed order,
+ * so results are reproducible as long as the launch configuration does not change.
+ *
+ */
+template <int numQuantities>
+class DiagnosticsAccumulator
+{
+public:
+    DiagnosticsAccumulator() = default;
+    DiagnosticsAccumulator(mpu::VectorReference<double> blockPartials, bool enabled)
+        : m_blockPartials(blockPartials), m_enabled(enabled) {}
+
+    CUDAHOSTDEV bool enabled() const {return m_enabled;} //!< check if diagnostics are collected in this launch
+    CUDAHOSTDEV void add(int quantity, double value) {m_sums[quantity].add(value);} //!< add value to the integral of quantity
+    __device__ void storeBlockResult(); //!< reduce sums of all threads of the block and store the result, needs to be called by all threads of the block
+
+    static size_t sharedMemory(dim3 blocksize) {return blocksize.x*blocksize.y*blocksize.z*numQuantities*sizeof(double);} //!< dynamic shared memory needed per block
+
+private:
+    KahanSum m_sums[numQuantities]; //!< per thread sums
+    mpu::VectorReference<double> m_blockPartials; //!< one result per block and quantity
+    bool m_enabled{false}; //!< are diagnostics collected in this launch
+};
+
+//-------------------------------------------------------------------
+/**
+ * class ConservationDiagnostics
+ *
+ * Host side part of the diagnostics. Keeps a time series of area weighted global integrals of
+ * the shallow water model to monitor conservation of mass, energy, enstrophy and absolute vorticity.
+ *
+ * usage:
+ * Before launching the kernel that accumulates the integrals call isDue() with the current step. If it returns true, pass
+ * the result of prepare() to the kernel, otherwise pass a default constructed accumulator. After the kernel call record().
+ * record() only starts the download of the block results into a pinned buffer, the record is added to the time series
+ * when the download is needed, at the latest when the next record is started or the series is accessed.
+ * Only the latest getCapacity() records are kept in memory. To keep all of them, set an output stream with setOutput(),
+ * every record is written to it as a csv line. Call reset() when the simulation is reset.
+ *
+ */
+class ConservationDiagnostics
+{
+public:
+    static constexpr int numQuantities = 4;
+    enum Quantity : int
+    {
+        mass = 0, //!< integral of geopotential
+        energy = 1, //!< integral of phi*K + phi^2/2
+        enstrophy = 2, //!< integral of (vort+f)^2 / (2 phi)
+        absoluteVorticity = 3 //!< integral of vort+f (circulation), not divided by phi like the potential vorticity field
+    };
+
+    struct Record
+    {
+        int step; //!< simulation step the record was taken at
+        double time; //!< simulated time the record was taken at
+        double values[numQuantities]; //!< value of each quantity
+    };
+
+    using AccumulatorType = DiagnosticsAccumulator<numQuantities>;
+
+    bool isDue(int step) const {return m_enabled && m_interval > 0 && step % m_interval == 0;} //!< should diagnostics be collected at this step?
+    AccumulatorType prepare(dim3 numBlocks); //!< get an accumulator for a kernel launched with numBlocks blocks
+    void record(int step, double time); //!< start downloading the block partials of the last launch, they are summed into a record later
+    void reset(); //!< clear the time series
+
+    void setEnabled(bool enabled) {m_enabled = enabled;} //!< enable or disable collection of diagnostics
+    bool isEnabled() const {return m_enabled;} //!< are diagnostics collected
+    void setInterval(int interval) {m_interval = interval;} //!< collect diagnostics every interval steps
+    int getInterval() const {return m_interval;} //!< diagnostics are collected every interval steps
+    void setCapacity(size_t capacity); //!< keep at most capacity records in memory, clears the time series
+    size_t getCapacity() const {return m_capacity;} //!< at most this many records are kept in memory
+    void setOutput(std::ostream* stream); //!< write the csv header and then every record to stream, nullptr to disable
+
+    size_t getNumRecords() const; //!< number of records kept in memory
+    const Record& getRecord(size_t i) const; //!< i-th record kept in memory, oldest first
+    double getRelativeDrift(int quantity) const; //!< relative change of quantity between first and last record, including dropped records
+    static const char* getQuantityName(int quantity); //!< name of a quantity for display
+
+    void showGui(); //!< draws diagnostic settings, latest values and plots of the time series
+    void writeCsv(std::ostream& stream) const; //!< write the records kept in memory as csv to stream
+
+private:
+    static void writeCsvHeader(std::ostream& stream); //!< column names
+    static void writeCsvLine(std::ostream& stream, const Record& r); //!< one record
+    void collect() const; //!< wait for the pending download, sum the block partials and append the record
+
+    bool m_enabled{true}; //!< collect diagnostics
+    int m_interval{10}; //!< collect diagnostics every m_interval steps
+    size_t m_capacity{10000}; //!< maximum number of records in memory
+    std::ostream* m_output{nullptr}; //!< every record is written here, if set
+    int m_numBlocks{0}; //!< number of blocks in the last launch
+    mpu::DeviceVector<double> m_blockPartials; //!< results of each block of the last launch
+
+    // the download is finished lazily, also by const accessors
+    std::shared_ptr<double> m_hostPartials; //!< pinned host copy of the block partials
+    size_t m_hostPartialsSize{0}; //!< number of doubles in m_hostPartials
+    std::shared_ptr<cudaEvent_t> m_downloaded; //!< recorded after the block partials were copied to the host
+    mutable bool m_pending{false}; //!< a download was started and not collected yet
+    mutable Record m_pendingRecord{}; //!< step and time of the pending download
+    mutable int m_pendingBlocks{0}; //!< number of blocks of the pending download
+
+    mutable std::vector<Record> m_series; //!< ring buffer of the latest records
+    mutable size_t m_oldest{0}; //!< index of the oldest record in m_series once it is full
+    mutable Record m_first{}; //!< first record since the last reset, kept for the drift
+    mutable size_t m_numRecorded{0}; //!< records since the last reset, including dropped ones
+};
+
+// template function definitions of the DiagnosticsAccumulator class
+//-------------------------------------------------------------------
+
+template <int numQuantities>
+__device__ void DiagnosticsAccumulator<numQuantities>::storeBlockResult()
+{
+    if(!m_enabled)
+        return;
+
+    extern __shared__ double diagnosticsSharedMemory[];
+    const int numThreads = blockDim.x * blockDim.y * blockDim.z;
+    const int tid = threadIdx.x + blockDim.x * (threadIdx.y + blockDim.y * threadIdx.z);
+
+    for(int q = 0; q < numQuantities; q++)
+        diagnosticsSharedMemory[q*numThreads + tid] = m_sums[q].result();
+    __syncthreads();
+
+    // tree reduction in fixed order, works for any number of threads
+    int stride = 1;
+    while(stride < numThreads)
+        stride <<= 1;
+    for(stride >>= 1; stride > 0; stride >>= 1)
+    {
+        if(tid < stride && tid + stride < numThreads)
+            for(int q = 0; q < numQuantities; q++)
+                diagnosticsSharedMemory[q*numThreads + tid] += diagnosticsSharedMemory[q*numThreads + tid + stride];
+        __syncthreads();
+    }
+
+    if(tid == 0)
+    {
+        const int blockId = blockIdx.x + gridDim.x * (blockIdx.y + gridDim.y * blockIdx.z);
+        for(int q = 0; q < numQuantities; q++)
+            m_blockPartials[blockId*numQuantities + q] = diagnosticsSharedMemory[q*numThreads];
+    }
+}
+
+#endif //CIRCULATION_CONSERVATIONDIAGNOSTICS_H
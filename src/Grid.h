@@ -19,6 +19,10 @@
 #include <mpUtils/mpUtils.h>
 #include <mpUtils/mpGraphics.h>
 #include <mpUtils/mpCuda.h>
+
+#include "Profiler.h"
+#include "mipmap.h"
+#include "coordinateSystems/CoordinateSystem.h"
 //--------------------
 
 // forward declaration
@@ -51,6 +55,15 @@ public:
         m_data[cellId] = std::move<Tin>(data);
     }
 
+    size_t bytes() const {return m_data.size()*sizeof(T);} //!< size of the attribute data in bytes
+    void download(void* dst) const {assert_cuda(cudaMemcpy(dst, m_data.data(), bytes(), cudaMemcpyDeviceToHost));} //!< copy raw data to host memory dst
+    void upload(const void* src) {assert_cuda(cudaMemcpy(m_data.data(), src, bytes(), cudaMemcpyHostToDevice));} //!< copy raw data from host memory src
+    const void* data() const {return m_data.data();} //!< raw device pointer to the attribute data
+    void uploadRange(int firstCell, int numCells, const void* src, cudaStream_t stream) //!< asynchronously copy numCells values from host memory src starting at firstCell
+    {
+        assert_cuda(cudaMemcpyAsync(m_data.data() + firstCell, src, numCells*sizeof(T), cudaMemcpyHostToDevice, stream));
+    }
+
     static constexpr AT type = attributeType;
     using RenderType = RenderAttribute<attributeType, T>;
     using ReferenceType = GridAttributeReference<attributeType, T>;
@@ -124,11 +137,29 @@ public:
             m_bufferMapper = mpu::mapBufferToCuda(m_data);
     }
 
-    void write(const GridAttribute<attributeType,T> & source)
+    void write(const GridAttribute<attributeType,T> & source, const RenderLevel& level = {})
     {
         m_bufferMapper.map();
         assert_true(m_bufferMapper.size() == source.m_data.size(), "Grid", "Render Attribute does not have same size as GridAttribute");
-        mpu::cudaCopy(m_bufferMapper.data(),source.m_data.data(),m_bufferMapper.size());
+        if(level.level <= 0)
+            mpu::cudaCopy(m_bufferMapper.data(),source.m_data.data(),m_bufferMapper.size());
+        else
+        {
+            // build the pyramid up to the requested level, only that level is copied to the start of the render buffer
+            if(m_pyramid.size() < static_cast<size_t>(level.level))
+                m_pyramid.resize(level.level);
+            const T* fine = source.m_data.data();
+            for(int l = 1; l <= level.level; l++)
+            {
+                const int2 fineCells = coarsenedGridSize(level.numGridCells, l-1);
+                const int2 coarseCells = coarsenedGridSize(level.numGridCells, l);
+                if(m_pyramid[l-1].size() != size_t(coarseCells.x) * coarseCells.y)
+                    m_pyramid[l-1] = mpu::DeviceVector<T>(size_t(coarseCells.x) * coarseCells.y);
+                downsampleGrid(fine, m_pyramid[l-1].data(), fineCells, level.periodicX);
+                fine = m_pyramid[l-1].data();
+            }
+            mpu::cudaCopy(m_bufferMapper.data(), fine, m_pyramid[level.level-1].size());
+        }
         m_bufferMapper.unmap();
     }
 
@@ -142,11 +173,13 @@ public:
         using std::swap;
         swap(first.m_data,second.m_data);
         swap(first.m_bufferMapper,second.m_bufferMapper);
+        swap(first.m_pyramid,second.m_pyramid);
     }
 
 private:
     mpu::gph::Buffer<T,true> m_data;
     mpu::GlBufferMapper<T> m_bufferMapper;
+    std::vector<mpu::DeviceVector<T>> m_pyramid; //!< coarser levels of the last written data, level i+1 is stored at i
 };
 
 
@@ -173,6 +206,30 @@ enum class AT
     potentialVort
 };
 
+/**
+ * @brief name of an attribute type, used for file output
+ */
+inline const char* getAttributeName(AT attribute)
+{
+    switch(attribute)
+    {
+        case AT::density: return "density";
+        case AT::velocityX: return "velocityX";
+        case AT::velocityY: return "velocityY";
+        case AT::densityGradX: return "densityGradX";
+        case AT::densityGradY: return "densityGradY";
+        case AT::densityLaplace: return "densityLaplace";
+        case AT::velocityDiv: return "velocityDiv";
+        case AT::velocityCurl: return "velocityCurl";
+        case AT::temperature: return "temperature";
+        case AT::temperatureGradX: return "temperatureGradX";
+        case AT::temperatureGradY: return "temperatureGradY";
+        case AT::geopotential: return "geopotential";
+        case AT::potentialVort: return "potentialVort";
+        default: return "unknown";
+    }
+}
+
 
 using GridDensity = GridAttribute<AT::density,float>;
 using GridVelocityX = GridAttribute<AT::velocityX,float>;
@@ -213,6 +270,12 @@ public:
     template <AT Param, typename T>
     void write(int cellId, T&& data);
 
+    size_t bytes() const; //!< size of all attributes in bytes
+    void download(char* dst) const; //!< copy all attributes to host memory dst, attributes are stored one after the other
+    void upload(const char* src); //!< copy all attributes from host memory src, attributes are stored one after the other
+    void uploadRange(AT attribute, int firstCell, int numCells, const void* src, cudaStream_t stream); //!< asynchronously copy part of a single attribute from host memory
+    const void* data(AT attribute) const; //!< raw device pointer to the data of a single attribute, nullptr if it is not part of the buffer
+
     friend class RenderBuffer<typename Attributes::RenderType...>;
     friend class HostBuffer<typename Attributes::HostType...>;
     friend class GridBufferReference<typename Attributes::ReferenceType...>;
@@ -258,6 +321,45 @@ void GridBuffer<Attributes...>::write(int cellId, T&& data)
     GridAttributeSelector_t<Param,Attributes...>::write(cellId, std::forward<T>(data));
 }
 
+template <typename... Attributes>
+size_t GridBuffer<Attributes...>::bytes() const
+{
+    size_t sum = 0;
+    int t[] = {0, ((void)(sum += Attributes::bytes()),1)...};
+    (void)t[0]; // silence compiler warning abut t being unused
+    return sum;
+}
+
+template <typename... Attributes>
+void GridBuffer<Attributes...>::download(char* dst) const
+{
+    int t[] = {0, ((void)(Attributes::download(dst), dst += Attributes::bytes()),1)...};
+    (void)t[0]; // silence compiler warning abut t being unused
+}
+
+template <typename... Attributes>
+void GridBuffer<Attributes...>::upload(const char* src)
+{
+    int t[] = {0, ((void)(Attributes::upload(src), src += Attributes::bytes()),1)...};
+    (void)t[0]; // silence compiler warning abut t being unused
+}
+
+template <typename... Attributes>
+void GridBuffer<Attributes...>::uploadRange(AT attribute, int firstCell, int numCells, const void* src, cudaStream_t stream)
+{
+    int t[] = {0, ((void)( (Attributes::type == attribute) ? Attributes::uploadRange(firstCell, numCells, src, stream) : void() ),1)...};
+    (void)t[0]; // silence compiler warning abut t being unused
+}
+
+template <typename... Attributes>
+const void* GridBuffer<Attributes...>::data(AT attribute) const
+{
+    const void* result = nullptr;
+    int t[] = {0, ((void)( (Attributes::type == attribute && !result) ? result = Attributes::data() : nullptr ),1)...};
+    (void)t[0]; // silence compiler warning abut t being unused
+    return result;
+}
+
 
 //-------------------------------------------------------------------
 /**
@@ -270,7 +372,7 @@ public:
     explicit RenderBuffer(int numCells=1) : Attributes(numCells)...{};
 
     template<typename ...SourceAttribs>
-    void write(GridBuffer<SourceAttribs...>& source);
+    void write(GridBuffer<SourceAttribs...>& source, uint32_t attributeMask=~0u, const RenderLevel& level={}); //!< copy attributes whose bit in attributeMask is set, bit i is the attribute at storage position i, coarser levels are copied to the start of the buffers
     void bind(GLuint binding, GLenum target);
     void addToVao(mpu::gph::VertexArray& vao, int binding);
 
@@ -282,6 +384,8 @@ public:
     }
 
 private:
+    template<typename ...SourceAttribs, size_t ... I>
+    void writeImpl(GridBuffer<SourceAttribs...>& source, uint32_t attributeMask, const RenderLevel& level, std::index_sequence<I ...>);
     template<size_t ... I>
     void addToVaoImpl(mpu::gph::VertexArray& vao, int binding, std::index_sequence<I ...>);
     template<size_t ... I>
@@ -292,9 +396,16 @@ private:
 //-------------------------------------------------------------------
 template <typename... Attributes>
 template <typename... SourceAttribs>
-void RenderBuffer<Attributes...>::write(GridBuffer<SourceAttribs...>& source)
+void RenderBuffer<Attributes...>::write(GridBuffer<SourceAttribs...>& source, uint32_t attributeMask, const RenderLevel& level)
 {
-    int t[] = {0, ((void)Attributes::write( static_cast<SourceAttribs>(source) ),1)...};
+    writeImpl(source, attributeMask, level, std::make_index_sequence<sizeof...(Attributes)>{});
+}
+
+template <typename... Attributes>
+template <typename... SourceAttribs, size_t... I>
+void RenderBuffer<Attributes...>::writeImpl(GridBuffer<SourceAttribs...>& source, uint32_t attributeMask, const RenderLevel& level, std::index_sequence<I...>)
+{
+    int t[] = {0, ((void)( (attributeMask & (1u << I)) ? Attributes::write( static_cast<SourceAttribs&>(source), level ) : void() ),1)...};
     (void)t[0];
 }
 
@@ -397,10 +508,19 @@ public:
 
     virtual void bindRenderBuffer(GLuint binding, GLenum target)=0; //!< bind the renderbuffer to target starting with binding id binding
     virtual void addRenderBufferToVao(mpu::gph::VertexArray& vao, int binding)=0; //!< adds the renderbuffer buffers onto the vao starting with binding id binding
+    virtual void setRenderedBuffers(const std::vector<int>& bufferIds)=0; //!< only copy these render buffers (by storage position) when new data is rendered
+    virtual void setRenderLevel(const CoordinateSystem& cs, int level)=0; //!< render a coarser level of the grid, the level is written to the start of the render buffers, call from the render thread
 
     virtual void cacheOnHost()=0; //!< cache the current buffers data on the host
     virtual void pushCachToDevice()=0; //!< write changes from the local cache back to the device
     virtual void cacheOverwrite()=0; //!< activate the cache without doenloading the data first (for initialization)
+
+    virtual std::vector<AT> getAttributeTypes() const =0; //!< list of the attributes stored in this grid in storage order
+    virtual size_t getTimeLevelBytes() const =0; //!< number of bytes needed to store all attributes of one time level
+    virtual void downloadTimeLevel(int timeLevel, char* dst)=0; //!< copy all attributes at t (timeLevel 0) or t-1 (timeLevel -1) to host memory
+    virtual void uploadTimeLevel(int timeLevel, const char* src)=0; //!< overwrite all attributes at t (timeLevel 0) or t-1 (timeLevel -1) with data from host memory
+    virtual void initializeRange(AT attribute, int firstCell, int numCells, const void* src, cudaStream_t stream=cudaStreamPerThread)=0; //!< asynchronously write numCells values of attribute from (pinned) host memory to all used buffers, like initialize() but directly on the device
+    virtual const void* getDeviceData(int timeLevel, AT attribute) const =0; //!< device pointer to attribute at t (timeLevel 0) or t-1 (timeLevel -1), only valid until the next buffer swap, nullptr if the attribute is not part of the grid
 };
 
 //-------------------------------------------------------------------
@@ -425,7 +545,7 @@ public:
     using RenderBufferType = RenderBuffer<typename GridAttribs::RenderType ...>;
     using ReferenceType = GridReference<typename GridAttribs::ReferenceType...>;
 
-    explicit Grid(int numCells=1);
+    explicit Grid(int numCells=1, bool renderable=true); //!< a grid that is not renderable does not create any openGL objects and can be used without a context
 
     // copy and move constructor (copy swap idom)
     Grid(const Grid& other);
@@ -442,11 +562,20 @@ public:
 
     void bindRenderBuffer(GLuint binding, GLenum target) override; //!< bind the renderbuffer to target starting with binding id binding
     void addRenderBufferToVao(mpu::gph::VertexArray& vao, int binding) override; //!< adds the renderbuffer buffers onto the vao starting with binding id binding
+    void setRenderedBuffers(const std::vector<int>& bufferIds) override; //!< only copy these render buffers (by storage position) when new data is rendered
+    void setRenderLevel(const CoordinateSystem& cs, int level) override; //!< render a coarser level of the grid, the level is written to the start of the render buffers, call from the render thread
 
     void cacheOnHost() override; //!< cache the current buffers data on the host
     void cacheOverwrite() override; //!< activate the cache without doenloading the data first (for initialization)
     void pushCachToDevice() override; //!< write changes from the local cache back to the device
 
+    std::vector<AT> getAttributeTypes() const override {return {GridAttribs::type...};} //!< list of the attributes stored in this grid in storage order
+    size_t getTimeLevelBytes() const override {return m_buffers[0].bytes();} //!< number of bytes needed to store all attributes of one time level
+    void downloadTimeLevel(int timeLevel, char* dst) override; //!< copy all attributes at t (timeLevel 0) or t-1 (timeLevel -1) to host memory
+    void uploadTimeLevel(int timeLevel, const char* src) override; //!< overwrite all attributes at t (timeLevel 0) or t-1 (timeLevel -1) with data from host memory
+    void initializeRange(AT attribute, int firstCell, int numCells, const void* src, cudaStream_t stream=cudaStreamPerThread) override; //!< asynchronously write numCells values of attribute from (pinned) host memory to all used buffers, like initialize() but directly on the device
+    const void* getDeviceData(int timeLevel, AT attribute) const override; //!< device pointer to attribute at t (timeLevel 0) or t-1 (timeLevel -1), only valid until the next buffer swap, nullptr if the attribute is not part of the grid
+
     template <AT Param>
     auto read(int cellId); //!< read data from grid cell cellId parameter Param at time t
     template <AT Param>
@@ -463,8 +592,10 @@ public:
     void initialize(int cellId, T&& data); //!< write data to grid cell cellId parameter Param in all used buffers (t-1, t, t+1, renderAwait). Beware of possible race conditions when also reading from the time t or t-1 buffer!
 
     int size() const; //!< returns the number of available grid cells
+    bool isWriteBufferRecycled() const {return m_writeBufferRecycled;} //!< the t+1 buffer was the unused buffer before the last swap and holds values older than t-1, cells that are not written keep these values
 
     ReferenceType getGridReference(); //!< get a grid reference object for use in device code
+    std::vector<ReferenceType> getGridReferencesAndSwap(int numSteps); //!< references for numSteps consecutive steps, buffers are swapped as if every step was simulated, for kernels that simulate multiple steps at once
 
     // for copy swap idom
     friend void swap(Grid& first, Grid& second) //!< swap two instances of buffer
@@ -484,6 +615,7 @@ public:
         swap(first.m_previousBuffer , second.m_previousBuffer );
         swap(first.m_renderAwaitBuffer , second.m_renderAwaitBuffer );
         swap(first.m_unusedBuffer , second.m_unusedBuffer );
+        swap(first.m_writeBufferRecycled , second.m_writeBufferRecycled );
 
         bool b = first.m_renderbufferNotRendered;
         first.m_renderbufferNotRendered = second.m_renderbufferNotRendered.load();
@@ -491,6 +623,10 @@ public:
         b = first.m_newRenderdataWaiting;
         first.m_newRenderdataWaiting = second.m_newRenderdataWaiting.load();
         second.m_newRenderdataWaiting = b;
+        uint32_t m = first.m_renderedAttributes;
+        first.m_renderedAttributes = second.m_renderedAttributes.load();
+        second.m_renderedAttributes = m;
+        swap(first.m_renderLevel, second.m_renderLevel);
     }
 
     friend class GridReference<typename GridAttribs::ReferenceType...>; //!< reference type needs to be friends
@@ -504,20 +640,24 @@ private:
 
     int m_renderAwaitBuffer; //!< data that will be copied to the openGL buffer on the rendering GPU
     int m_unusedBuffer; //!< when render await buffer == previous buffer one buffer is unused
+    bool m_writeBufferRecycled{false}; //!< the write buffer was taken from m_unusedBuffer in the last swap
 
     BufferType m_buffers[4]; //!< buffers for cuda grid data
     HostBufferType m_cachedBuffers[4]; //!< data is stored here when cached on the host
-    RenderBufferType m_renderBuffer; //!< openGL buffer to render from
+    std::unique_ptr<RenderBufferType> m_renderBuffer; //!< openGL buffer to render from, nullptr if grid is not renderable
 
     bool m_cached{false}; //!< is data currently cached on the host
 
     std::atomic_bool m_renderbufferNotRendered{false}; //!< indicates that renderbuffer contains data that have not been rendered yet
     std::atomic_bool m_newRenderdataWaiting{false}; //!< indicate new renderdata are ready to be written to the renderbuffer
+    std::atomic<uint32_t> m_renderedAttributes{~0u}; //!< bit i is set if the attribute at storage position i is rendered
+    RenderLevel m_renderLevel; //!< level of the multi resolution pyramid that is copied to the render buffer
 
     std::mutex m_rbuMtx; //!< renderbuffer mutex
     std::mutex m_rabuMtx; //!< renderAwaitBuffer mutex
 
     void prepareForRendering(); //!< copies data from renderAwaitBuffer to renderBuffer
+    int timeLevelToBuffer(int timeLevel) const; //!< get buffer id for time level 0 (t) or -1 (t-1)
 };
 
 // include forward defined classes
@@ -605,12 +745,12 @@ void Grid<GridAttribs...>::initialize(int cellId, T&& data)
 }
 
 template <typename ...GridAttribs>
-Grid<GridAttribs...>::Grid(int numCells)
+Grid<GridAttribs...>::Grid(int numCells, bool renderable)
     : m_buffers{ Grid<GridAttribs...>::BufferType(numCells), Grid<GridAttribs...>::BufferType(numCells),
                  Grid<GridAttribs...>::BufferType(numCells), Grid<GridAttribs...>::BufferType(numCells)},
       m_cachedBuffers{ Grid<GridAttribs...>::HostBufferType(numCells), Grid<GridAttribs...>::HostBufferType(numCells),
                  Grid<GridAttribs...>::HostBufferType(numCells), Grid<GridAttribs...>::HostBufferType(numCells)},
-    m_numCells(numCells), m_renderBuffer(numCells)
+    m_numCells(numCells), m_renderBuffer(renderable ? std::make_unique<RenderBufferType>(numCells) : nullptr)
 {
     assert_critical(numCells>0,"Grid","Number of cells must be at least one");
     m_writeBuffer = 3;
@@ -631,9 +771,12 @@ Grid<GridAttribs...>::Grid(const Grid& other)
       m_previousBuffer(other.m_previousBuffer),
       m_renderAwaitBuffer(other.m_renderAwaitBuffer),
       m_unusedBuffer(other.m_unusedBuffer),
-      m_renderBuffer(other.m_renderBuffer),
+      m_writeBufferRecycled(other.m_writeBufferRecycled),
+      m_renderBuffer(other.m_renderBuffer ? std::make_unique<RenderBufferType>(*other.m_renderBuffer) : nullptr),
       m_renderbufferNotRendered(other.m_renderbufferNotRendered.load()),
       m_newRenderdataWaiting(other.m_newRenderdataWaiting.load()),
+      m_renderedAttributes(other.m_renderedAttributes.load()),
+      m_renderLevel(other.m_renderLevel),
       m_rbuMtx(),
       m_rabuMtx(),
       m_numCells(other.m_numCells)
@@ -660,7 +803,8 @@ void Grid<GridAttribs...>::swapBuffer()
     int tmp = m_writeBuffer;
 
     // make sure not to overwrite the render await buffer
-    if(m_previousBuffer == m_renderAwaitBuffer)
+    m_writeBufferRecycled = (m_previousBuffer == m_renderAwaitBuffer);
+    if(m_writeBufferRecycled)
     {
         m_writeBuffer = m_unusedBuffer;
         m_unusedBuffer = -1;
@@ -679,7 +823,8 @@ void Grid<GridAttribs...>::swapAndRender()
 
     int tmp = m_writeBuffer;
     // make sure not to overwrite the render await buffer
-    if(m_previousBuffer == m_renderAwaitBuffer)
+    m_writeBufferRecycled = (m_previousBuffer == m_renderAwaitBuffer);
+    if(m_writeBufferRecycled)
         m_writeBuffer = m_unusedBuffer;
     else
         m_writeBuffer = m_previousBuffer;
@@ -702,15 +847,8 @@ void Grid<GridAttribs...>::swapAndRender()
 
     */
 
-    lck.unlock();
-
-    if(m_rbuMtx.try_lock())
-    {
-        lck.lock();
-        prepareForRendering();
-        lck.unlock();
-        m_rbuMtx.unlock();
-    } else
+    // the copy to the render buffer is deferred to startRendering(), so data that is never drawn is never copied
+    if(m_renderBuffer)
         m_newRenderdataWaiting = true;
 }
 
@@ -723,7 +861,8 @@ void Grid<GridAttribs...>::swapAndRenderWait()
 
     int tmp = m_writeBuffer;
     // make sure not to overwrite the render await buffer
-    if(m_previousBuffer == m_renderAwaitBuffer)
+    m_writeBufferRecycled = (m_previousBuffer == m_renderAwaitBuffer);
+    if(m_writeBufferRecycled)
         m_writeBuffer = m_unusedBuffer;
     else
         m_writeBuffer = m_previousBuffer;
@@ -736,29 +875,13 @@ void Grid<GridAttribs...>::swapAndRenderWait()
     m_renderAwaitBuffer = tmp;
     m_readBuffer = tmp;
 
-    lck.unlock();
-
-    while(m_renderbufferNotRendered) mpu::yield(); // don't copy to renderbuffer bevore is is rendered
-
-    if(m_rbuMtx.try_lock())
-    {
-        lck.lock();
-        prepareForRendering();
-        lck.lock();
-        m_rbuMtx.unlock();
-    } else
+    if(m_renderBuffer)
         m_newRenderdataWaiting = true;
 }
 
 template <typename ...GridAttribs>
 void Grid<GridAttribs...>::renderDone()
 {
-    if(m_newRenderdataWaiting)
-    {
-        std::lock_guard<std::mutex> lck(m_rabuMtx);
-        prepareForRendering();
-    }
-
     m_renderbufferNotRendered = false;
     m_rbuMtx.unlock();
 }
@@ -767,6 +890,11 @@ template <typename ...GridAttribs>
 void Grid<GridAttribs...>::startRendering()
 {
     m_rbuMtx.lock();
+    if(m_newRenderdataWaiting)
+    {
+        std::lock_guard<std::mutex> lck(m_rabuMtx);
+        prepareForRendering();
+    }
 }
 
 template <typename ...GridAttribs>
@@ -778,7 +906,9 @@ bool Grid<GridAttribs...>::newRenderDataReady()
 template <typename ...GridAttribs>
 void Grid<GridAttribs...>::prepareForRendering()
 {
-    m_renderBuffer.write( m_buffers[m_renderAwaitBuffer]);
+    PROFILE_SCOPE("render handoff");
+    if(m_renderBuffer)
+        m_renderBuffer->write( m_buffers[m_renderAwaitBuffer], m_renderedAttributes, m_renderLevel);
 
     m_newRenderdataWaiting = false;
     m_renderbufferNotRendered = true;
@@ -787,13 +917,42 @@ void Grid<GridAttribs...>::prepareForRendering()
 template <typename ...GridAttribs>
 void Grid<GridAttribs...>::bindRenderBuffer(GLuint binding, GLenum target)
 {
-    m_renderBuffer.bind(binding,target);
+    if(m_renderBuffer)
+        m_renderBuffer->bind(binding,target);
 }
 
 template <typename ...GridAttribs>
 void Grid<GridAttribs...>::addRenderBufferToVao(mpu::gph::VertexArray& vao, int binding)
 {
-    m_renderBuffer.addToVao(vao,binding);
+    if(m_renderBuffer)
+        m_renderBuffer->addToVao(vao,binding);
+}
+
+template <typename ...GridAttribs>
+void Grid<GridAttribs...>::setRenderedBuffers(const std::vector<int>& bufferIds)
+{
+    uint32_t mask = 0;
+    for(int id : bufferIds)
+        if(id >= 0 && id < static_cast<int>(sizeof...(GridAttribs)))
+            mask |= 1u << id;
+
+    // newly shown attributes need to be copied from the render await buffer, which still holds the last rendered time level
+    const uint32_t previous = m_renderedAttributes.exchange(mask);
+    if(m_renderBuffer && (mask & ~previous) != 0)
+        m_newRenderdataWaiting = true;
+}
+
+template <typename ...GridAttribs>
+void Grid<GridAttribs...>::setRenderLevel(const CoordinateSystem& cs, int level)
+{
+    RenderLevel renderLevel{std::max(level, 0), make_int2(cs.getNumGridCells3d()), cs.hasBoundary().x == 0};
+    if(renderLevel.level == m_renderLevel.level)
+        return;
+
+    // the render buffer needs to be filled with the new level, even if the simulation is paused
+    m_renderLevel = renderLevel;
+    if(m_renderBuffer)
+        m_newRenderdataWaiting = true;
 }
 
 template <typename ...GridAttribs>
@@ -829,12 +988,62 @@ void Grid<GridAttribs...>::pushCachToDevice()
 }
 
 
+template <typename... GridAttribs>
+int Grid<GridAttribs...>::timeLevelToBuffer(int timeLevel) const
+{
+    assert_critical(timeLevel == 0 || timeLevel == -1, "Grid", "Only time levels t (0) and t-1 (-1) can be accessed.");
+    return (timeLevel == 0) ? m_readBuffer : m_previousBuffer;
+}
+
+template <typename... GridAttribs>
+void Grid<GridAttribs...>::downloadTimeLevel(int timeLevel, char* dst)
+{
+    assert_critical(!m_cached, "Grid", "Can not download time level while data is cached on the host.");
+    m_buffers[timeLevelToBuffer(timeLevel)].download(dst);
+}
+
+template <typename... GridAttribs>
+void Grid<GridAttribs...>::uploadTimeLevel(int timeLevel, const char* src)
+{
+    assert_critical(!m_cached, "Grid", "Can not upload time level while data is cached on the host.");
+    m_buffers[timeLevelToBuffer(timeLevel)].upload(src);
+}
+
+template <typename... GridAttribs>
+void Grid<GridAttribs...>::initializeRange(AT attribute, int firstCell, int numCells, const void* src, cudaStream_t stream)
+{
+    assert_critical(!m_cached, "Grid", "Can not initialize on the device while data is cached on the host.");
+    assert_critical(firstCell >= 0 && firstCell + numCells <= m_numCells, "Grid", "Cell range out of bounds.");
+    for(auto& buffer : m_buffers)
+        buffer.uploadRange(attribute, firstCell, numCells, src, stream);
+}
+
+template <typename... GridAttribs>
+const void* Grid<GridAttribs...>::getDeviceData(int timeLevel, AT attribute) const
+{
+    assert_critical(!m_cached, "Grid", "Can not access device data while data is cached on the host.");
+    return m_buffers[timeLevelToBuffer(timeLevel)].data(attribute);
+}
+
 template <typename... GridAttribs>
 Grid<GridAttribs...>::ReferenceType Grid<GridAttribs...>::getGridReference()
 {
     return Grid::ReferenceType(*this);
 }
 
+template <typename... GridAttribs>
+std::vector<typename Grid<GridAttribs...>::ReferenceType> Grid<GridAttribs...>::getGridReferencesAndSwap(int numSteps)
+{
+    std::vector<ReferenceType> references;
+    references.reserve(numSteps);
+    for(int i = 0; i < numSteps; i++)
+    {
+        references.push_back(getGridReference());
+        swapBuffer();
+    }
+    return references;
+}
+
 // template function definitions of the Grid class
 //-------------------------------------------------------------------
 
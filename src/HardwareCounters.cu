@@ -0,0 +1,148 @@
+/*
+ * CIRCULATION
+ * HardwareCounters.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the HardwareCounters class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "HardwareCounters.h"
+#include <cstring>
+#include <cerrno>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+//--------------------
+
+// variables
+//--------------------
+constexpr double HardwareCounters::cacheLineBytes;
+//--------------------
+
+namespace {
+    //!< open one hardware counter of the calling thread, part of group if group is not -1
+    int openCounter(uint64_t config, int group)
+    {
+        perf_event_attr attr{};
+        attr.size = sizeof(perf_event_attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = (group == -1) ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group, 0));
+    }
+}
+
+// function definitions of the HardwareCounters class
+//-------------------------------------------------------------------
+
+HardwareCounters& HardwareCounters::instance()
+{
+    static HardwareCounters counters;
+    return counters;
+}
+
+HardwareCounters::~HardwareCounters()
+{
+    disable();
+}
+
+bool HardwareCounters::enable()
+{
+    disable();
+
+    m_fd[0] = openCounter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if(m_fd[0] >= 0)
+    {
+        m_fd[1] = openCounter(PERF_COUNT_HW_INSTRUCTIONS, m_fd[0]);
+        m_fd[2] = openCounter(PERF_COUNT_HW_CACHE_MISSES, m_fd[0]);
+    }
+
+    if(m_fd[0] < 0 || m_fd[1] < 0 || m_fd[2] < 0)
+    {
+        logWARNING("HardwareCounters") << "Hardware counters are not available: " << strerror(errno)
+                                       << ". Check /proc/sys/kernel/perf_event_paranoid.";
+        disable();
+        return false;
+    }
+
+    ioctl(m_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(m_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    m_thread = std::this_thread::get_id();
+    m_enabled = true;
+    logINFO("HardwareCounters") << "Counting cycles, instructions and last level cache misses.";
+    return true;
+}
+
+void HardwareCounters::disable()
+{
+    m_enabled = false;
+    for(int& fd : m_fd)
+    {
+        if(fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+}
+
+bool HardwareCounters::isCountingThisThread() const
+{
+    return m_enabled && m_thread == std::this_thread::get_id();
+}
+
+CounterValues HardwareCounters::read() const
+{
+    // with PERF_FORMAT_GROUP the leader returns the number of counters followed by all values
+    uint64_t data[4] = {0,0,0,0};
+    if(!m_enabled || ::read(m_fd[0], data, sizeof(data)) < static_cast<ssize_t>(sizeof(data)))
+        return {};
+    return {data[1], data[2], data[3]};
+}
+
+void HardwareCounters::addPhase(const char* name, const CounterValues& counters, double seconds, int64_t cells)
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    PhaseCounters& p = m_phases[name];
+    p.counters += counters;
+    p.seconds += seconds;
+    p.cells += cells;
+    p.count++;
+}
+
+std::map<std::string, HardwareCounters::PhaseCounters> HardwareCounters::getPhases()
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    return m_phases;
+}
+
+void HardwareCounters::resetPhases()
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_phases.clear();
+}
+
+void HardwareCounters::writeReport(std::ostream& os)
+{
+    auto phases = getPhases();
+    os << std::left << std::setw(24) << "phase" << std::right << std::setw(10) << "calls" << std::setw(10) << "IPC"
+       << std::setw(16) << "LLC miss/call" << std::setw(14) << "est. GB/s" << "\n";
+    for(const auto& phase : phases)
+    {
+        const PhaseCounters& p = phase.second;
+        os << std::left << std::setw(24) << phase.first << std::right << std::setw(10) << p.count
+           << std::setw(10) << std::setprecision(3) << p.instructionsPerCycle()
+           << std::setw(16) << std::setprecision(3) << double(p.counters.llcMisses) / double(p.count)
+           << std::setw(14) << std::setprecision(3) << p.gigabytesPerSecond() << "\n";
+    }
+}
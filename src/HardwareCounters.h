@@ -0,0 +1,152 @@
+/*
+ * CIRCULATION
+ * HardwareCounters.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the HardwareCounters and ScopedCounters classes
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_HARDWARECOUNTERS_H
+#define CIRCULATION_HARDWARECOUNTERS_H
+
+// includes
+//--------------------
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+
+#include <mpUtils/mpUtils.h>
+
+#include "Profiler.h"
+//--------------------
+
+// counter scopes, compiled to nothing when CIRCULATION_ENABLE_PROFILING is not defined
+#if defined(CIRCULATION_ENABLE_PROFILING)
+    #define PROFILE_COUNTERS(name, cells) ScopedCounters CIRCULATION_PROFILER_CONCAT(counterScope,__LINE__)(name, cells) //!< count cpu events of the enclosing scope
+#else
+    #define PROFILE_COUNTERS(name, cells)
+#endif
+
+//-------------------------------------------------------------------
+/**
+ * @brief values of the cpu performance counters
+ */
+struct CounterValues
+{
+    uint64_t cycles{0}; //!< cpu cycles
+    uint64_t instructions{0}; //!< retired instructions
+    uint64_t llcMisses{0}; //!< last level cache misses
+
+    CounterValues operator-(const CounterValues& other) const
+    {
+        return {cycles - other.cycles, instructions - other.instructions, llcMisses - other.llcMisses};
+    }
+    CounterValues& operator+=(const CounterValues& other)
+    {
+        cycles += other.cycles; instructions += other.instructions; llcMisses += other.llcMisses;
+        return *this;
+    }
+};
+
+//-------------------------------------------------------------------
+/**
+ * class HardwareCounters
+ *
+ * Counts cpu cycles, instructions and last level cache misses of one thread using the linux perf_event_open interface.
+ *
+ * usage:
+ * Call enable() on the thread you want to measure, it returns false if the counters are not available
+ * (eg. because of /proc/sys/kernel/perf_event_paranoid or inside of a virtual machine). Then use read() to get the current
+ * values or the PROFILE_COUNTERS() macro to accumulate the counts of a scope into a named phase. Scopes on other threads
+ * are ignored. Memory traffic is estimated as one cache line per last level cache miss, which ignores prefetching and writebacks.
+ *
+ */
+class HardwareCounters
+{
+public:
+    struct PhaseCounters
+    {
+        CounterValues counters; //!< sum of all counted scopes
+        double seconds{0.0}; //!< sum of the wall time of all counted scopes
+        int64_t cells{0}; //!< sum of the cells processed
+        int64_t count{0}; //!< number of counted scopes
+
+        double instructionsPerCycle() const {return (counters.cycles > 0) ? double(counters.instructions) / double(counters.cycles) : 0.0;}
+        double gigabytesPerSecond() const {return (seconds > 0.0) ? double(counters.llcMisses) * cacheLineBytes / seconds * 1.0e-9 : 0.0;} //!< estimated memory bandwidth
+    };
+
+    static constexpr double cacheLineBytes = 64.0; //!< bytes transferred per cache miss
+
+    static HardwareCounters& instance(); //!< the global counters
+    ~HardwareCounters();
+
+    bool enable(); //!< start counting on the calling thread, returns false if counters are unavailable
+    void disable(); //!< stop counting
+    bool isCountingThisThread() const; //!< check if the counters are enabled and measure the calling thread
+    CounterValues read() const; //!< current values of the counters
+
+    void addPhase(const char* name, const CounterValues& counters, double seconds, int64_t cells); //!< accumulate counts of a phase
+    std::map<std::string, PhaseCounters> getPhases(); //!< copy of the counts of all phases
+    void resetPhases(); //!< clear counts of all phases
+    void writeReport(std::ostream& os); //!< write a table of all phases
+
+private:
+    HardwareCounters() = default;
+
+    int m_fd[3]{-1,-1,-1}; //!< perf event file descriptors, first one is the group leader
+    std::atomic<bool> m_enabled{false};
+    std::thread::id m_thread; //!< thread that is measured
+    std::mutex m_mtx; //!< protects phases
+    std::map<std::string, PhaseCounters> m_phases; //!< counts of all phases
+};
+
+//-------------------------------------------------------------------
+/**
+ * @brief counts cpu events of the scope it lives in, use the PROFILE_COUNTERS macro instead of using this directly
+ */
+class ScopedCounters
+{
+public:
+    ScopedCounters(const char* name, int64_t cells) : m_name(name), m_cells(cells)
+    {
+        HardwareCounters& hc = HardwareCounters::instance();
+        m_active = hc.isCountingThisThread();
+        if(m_active)
+        {
+            m_startTime = std::chrono::steady_clock::now();
+            m_start = hc.read();
+        }
+    }
+
+    ~ScopedCounters()
+    {
+        if(!m_active)
+            return;
+        HardwareCounters& hc = HardwareCounters::instance();
+        const CounterValues end = hc.read();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_startTime).count();
+        hc.addPhase(m_name, end - m_start, seconds, m_cells);
+    }
+
+    ScopedCounters(const ScopedCounters& other) = delete;
+    ScopedCounters& operator=(const ScopedCounters& other) = delete;
+
+private:
+    const char* m_name;
+    int64_t m_cells;
+    bool m_active;
+    CounterValues m_start;
+    std::chrono::steady_clock::time_point m_startTime;
+};
+
+#endif //CIRCULATION_HARDWARECOUNTERS_H
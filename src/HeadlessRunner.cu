@@ -0,0 +1,511 @@
+/*
+ * CIRCULATION
+ * HeadlessRunner.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the HeadlessRunner class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "HeadlessRunner.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+#include "coordinateSystems/CartesianCoordinates2D.h"
+#include "coordinateSystems/GeographicalCoordinates2D.h"
+#include "simulationModels/RenderDemoSimulation.h"
+#include "simulationModels/TestSimulation.h"
+#include "simulationModels/ShallowWaterModel.h"
+#include "simulationModels/ShallowWaterEnsemble.h"
+#include "Checkpoint.h"
+#include "OutputWriter.h"
+#include "ImageSequenceWriter.h"
+#include "ProbeSet.h"
+#include "Profiler.h"
+#include "HardwareCounters.h"
+#include "Roofline.h"
+//--------------------
+
+// function definitions of the HeadlessRunner class
+//-------------------------------------------------------------------
+
+bool HeadlessRunner::isHeadless(int argc, char* argv[])
+{
+    for(int i = 1; i < argc; i++)
+        if(strcmp(argv[i], "--headless") == 0)
+            return true;
+    return false;
+}
+
+HeadlessRunner::HeadlessRunner(int argc, char* argv[])
+    : m_checkpointFile(checkpointFilename)
+{
+    float initScale = 1.0f;
+    float initOffset = 0.0f;
+
+    auto nextArg = [&](int& i) -> std::string
+    {
+        if(i+1 >= argc)
+        {
+            logERROR("HeadlessRunner") << "Missing value for argument " << argv[i];
+            throw std::invalid_argument("missing command line value");
+        }
+        return argv[++i];
+    };
+
+    auto parseAttributeList = [](const std::string& list)
+    {
+        std::vector<AT> attributes;
+        size_t start = 0;
+        while(start <= list.size())
+        {
+            size_t end = std::min(list.find(',', start), list.size());
+            std::string name = list.substr(start, end - start);
+            bool found = false;
+            for(int a = 0; a <= static_cast<int>(AT::potentialVort); a++)
+                if(name == getAttributeName(static_cast<AT>(a)))
+                {
+                    attributes.push_back(static_cast<AT>(a));
+                    found = true;
+                }
+            if(!found)
+                logWARNING("HeadlessRunner") << "Unknown attribute " << name;
+            start = end + 1;
+        }
+        return attributes;
+    };
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--headless")
+            continue;
+        else if(arg == "--model")
+        {
+            std::string model = nextArg(i);
+            if(model == "demo")
+                m_model = SimModel::renderDemo;
+            else if(model == "test")
+                m_model = SimModel::testSimulation;
+            else if(model == "shallow")
+                m_model = SimModel::shallowWaterModel;
+            else if(model == "ensemble")
+                m_model = SimModel::shallowWaterEnsemble;
+            else
+                logWARNING("HeadlessRunner") << "Unknown model " << model << ", using shallow water model.";
+        }
+        else if(arg == "--cs")
+        {
+            std::string cs = nextArg(i);
+            if(cs == "cartesian")
+                m_csType = CSType::cartesian2d;
+            else if(cs == "geographical")
+                m_csType = CSType::geographical2d;
+            else
+                logWARNING("HeadlessRunner") << "Unknown coordinate system " << cs << ", using geographical coordinates.";
+        }
+        else if(arg == "--cells")
+        {
+            m_numGridCells.x = std::stoi(nextArg(i));
+            m_numGridCells.y = std::stoi(nextArg(i));
+        }
+        else if(arg == "--members")
+            m_numMembers = std::stoi(nextArg(i));
+        else if(arg == "--steps")
+            m_numSteps = std::stoi(nextArg(i));
+        else if(arg == "--diagnostics-interval")
+            m_diagnosticsInterval = std::stoi(nextArg(i));
+        else if(arg == "--diagnostics-file")
+            m_diagnosticsFile = nextArg(i);
+        else if(arg == "--restart")
+            m_restartFile = nextArg(i);
+        else if(arg == "--checkpoint-file")
+            m_checkpointFile = nextArg(i);
+        else if(arg == "--checkpoint-interval")
+            m_checkpointInterval = std::stoi(nextArg(i));
+        else if(arg == "--output-dir")
+            m_outputDirectory = nextArg(i);
+        else if(arg == "--output-interval")
+            m_outputInterval = std::stoi(nextArg(i));
+        else if(arg == "--output-stride")
+            m_outputStride = std::stoi(nextArg(i));
+        else if(arg == "--output-compress")
+            m_outputCompress = true;
+        else if(arg == "--image-dir")
+            m_imageDirectory = nextArg(i);
+        else if(arg == "--image-interval")
+            m_imageInterval = std::stoi(nextArg(i));
+        else if(arg == "--image-size")
+        {
+            m_imageSize.x = std::stoi(nextArg(i));
+            m_imageSize.y = std::stoi(nextArg(i));
+        }
+        else if(arg == "--image-projection")
+        {
+            std::string projection = nextArg(i);
+            if(projection == "cartesian")
+                m_imageProjection = ImageProjection::cartesian;
+            else if(projection == "equirectangular")
+                m_imageProjection = ImageProjection::equirectangular;
+            else if(projection == "orthographic")
+                m_imageProjection = ImageProjection::orthographic;
+            else if(projection == "auto")
+                m_imageProjection = ImageProjection::automatic;
+            else
+                logWARNING("HeadlessRunner") << "Unknown projection " << projection << ", choosing automatically.";
+        }
+        else if(arg == "--image-range")
+        {
+            m_imageRange.x = std::stof(nextArg(i));
+            m_imageRange.y = std::stof(nextArg(i));
+            m_imageHasRange = true;
+        }
+        else if(arg == "--probes")
+            m_probeFile = nextArg(i);
+        else if(arg == "--probe-interval")
+            m_probeInterval = std::stoi(nextArg(i));
+        else if(arg == "--probe-output")
+            m_probeOutputFile = nextArg(i);
+        else if(arg == "--init-type")
+        {
+            std::string type = nextArg(i);
+            if(type == "f64")
+                m_initialConditionLayout.setInputType(InputType::float64);
+            else if(type == "i16")
+                m_initialConditionLayout.setInputType(InputType::int16);
+            else
+                m_initialConditionLayout.setInputType(InputType::float32);
+        }
+        else if(arg == "--init-scale")
+            initScale = std::stof(nextArg(i));
+        else if(arg == "--init-offset")
+            initOffset = std::stof(nextArg(i));
+        else if(arg == "--init-header")
+            m_initialConditionLayout.setHeaderBytes(std::stoull(nextArg(i)));
+        else if(arg == "--init-record")
+            m_initialConditionLayout.setRecord(std::stoi(nextArg(i)));
+        else if(arg == "--init-flip-y")
+            m_initialConditionLayout.setFlipY(true);
+        else if(arg == "--init-shift-x")
+            m_initialConditionLayout.setShiftX(std::stoi(nextArg(i)));
+        else if(arg == "--step-batching")
+        {
+            std::string batching = nextArg(i);
+            if(batching == "off")
+                m_stepBatching = StepBatching::off;
+            else if(batching == "barrier")
+                m_stepBatching = StepBatching::gridBarrier;
+            else if(batching == "wavefront")
+                m_stepBatching = StepBatching::wavefront;
+            else
+                logWARNING("HeadlessRunner") << "Unknown step batching " << batching << ", using one kernel per step.";
+        }
+        else if(arg == "--skip-quiet-tiles")
+            m_tileTolerance = std::stof(nextArg(i));
+        else if(arg == "--trace")
+            m_traceFile = nextArg(i);
+        else if(arg == "--roofline")
+            m_roofline = true;
+        else if(arg == "--counters")
+            m_counters = true;
+        else if(arg.compare(0, 7, "--init-") == 0)
+        {
+            std::string name = arg.substr(7);
+            bool found = false;
+            for(int a = 0; a <= static_cast<int>(AT::potentialVort); a++)
+                if(name == getAttributeName(static_cast<AT>(a)))
+                {
+                    FieldSource source{static_cast<AT>(a)};
+                    source.filename = nextArg(i);
+                    source.scale = initScale;
+                    source.offset = initOffset;
+                    m_initialConditionFiles.push_back(source);
+                    found = true;
+                }
+            if(!found)
+                logWARNING("HeadlessRunner") << "Ignoring unknown argument " << arg;
+        }
+        else if(arg == "--output-attributes")
+            m_outputAttributes = parseAttributeList(nextArg(i));
+        else if(arg == "--image-attributes")
+            m_imageAttributes = parseAttributeList(nextArg(i));
+        else if(arg == "--probe-attributes")
+            m_probeAttributes = parseAttributeList(nextArg(i));
+        else
+            logWARNING("HeadlessRunner") << "Ignoring unknown argument " << arg;
+    }
+}
+
+std::shared_ptr<CoordinateSystem> HeadlessRunner::createCoordinateSystem() const
+{
+    switch(m_csType)
+    {
+        case CSType::cartesian2d:
+            return std::make_shared<CartesianCoordinates2D>(float3{-1,-1,0}, float3{1,1,0}, int3{m_numGridCells.x,m_numGridCells.y,0});
+        case CSType::geographical2d:
+        default:
+            return std::make_shared<GeographicalCoordinates2D>(-1.55f, 1.55f, m_numGridCells, 1.0f);
+    }
+}
+
+std::unique_ptr<Simulation> HeadlessRunner::createSimulation() const
+{
+    switch(m_model)
+    {
+        case SimModel::renderDemo:
+            return std::make_unique<RenderDemoSimulation>();
+        case SimModel::testSimulation:
+            return std::make_unique<TestSimulation>();
+        case SimModel::shallowWaterEnsemble:
+        {
+            auto simulation = std::make_unique<ShallowWaterEnsemble>();
+            simulation->setNumMembers(m_numMembers);
+            return std::move(simulation);
+        }
+        case SimModel::shallowWaterModel:
+        default:
+        {
+            auto simulation = std::make_unique<ShallowWaterModel>();
+            if(!m_initialConditionFiles.empty())
+            {
+                InitialConditionLoader& loader = simulation->initialConditions();
+                loader = m_initialConditionLayout;
+                loader.setSource(FieldSource{AT::geopotential, "", 1.0f});
+                for(const auto& source : m_initialConditionFiles)
+                    loader.setSource(source);
+                simulation->setUseInitialConditionFiles(true);
+            }
+            simulation->setStepBatching(m_stepBatching);
+            if(m_tileTolerance > 0.0f)
+                simulation->setParameters({{"skip quiet tiles", 1.0f}, {"tile tolerance", m_tileTolerance}});
+            return std::move(simulation);
+        }
+    }
+}
+
+int HeadlessRunner::run()
+{
+    logINFO("HeadlessRunner") << "Running headless simulation with sim model " << int(m_model) << " coordinate system "
+                              << int(m_csType) << " grid cell count " << m_numGridCells << " for " << m_numSteps << " steps";
+
+    std::shared_ptr<CoordinateSystem> cs;
+    std::unique_ptr<Simulation> simulation;
+    std::shared_ptr<GridBase> grid;
+    if(m_restartFile.empty())
+    {
+        cs = createCoordinateSystem();
+        simulation = createSimulation();
+        simulation->setHeadless(true);
+        grid = simulation->recreate(cs);
+    }
+    else
+    {
+        try
+        {
+            CheckpointFile checkpoint(m_restartFile);
+            m_model = checkpoint.getModelType();
+            cs = checkpoint.createCoordinateSystem();
+            simulation = createSimulation();
+            simulation->setHeadless(true);
+            grid = simulation->recreate(cs);
+            checkpoint.restore(*simulation, *grid);
+        }
+        catch (const std::exception& e)
+        {
+            logERROR("HeadlessRunner") << "Restart from " << m_restartFile << " failed.";
+            return 1;
+        }
+    }
+
+    CheckpointWriter checkpointWriter;
+    CheckpointWriter::installSignalHandler();
+
+    OutputWriter outputWriter;
+    if(!m_outputDirectory.empty())
+    {
+        outputWriter.setDirectory(m_outputDirectory);
+        outputWriter.setInterval(m_outputInterval);
+        outputWriter.setCompression(m_outputCompress);
+        for(AT a : m_outputAttributes)
+            outputWriter.addAttribute({a, m_outputStride, m_outputStride});
+        outputWriter.start(*grid, *cs);
+    }
+
+    ImageSequenceWriter imageWriter;
+    if(!m_imageDirectory.empty())
+    {
+        imageWriter.setDirectory(m_imageDirectory);
+        imageWriter.setInterval(m_imageInterval);
+        imageWriter.setSize(m_imageSize.x, m_imageSize.y);
+        imageWriter.setProjection(m_imageProjection);
+        if(m_imageHasRange)
+            imageWriter.setRange(m_imageRange.x, m_imageRange.y);
+        for(AT a : m_imageAttributes)
+            imageWriter.addAttribute(a);
+        imageWriter.start(*grid, *cs);
+    }
+
+    ProbeSet probes;
+    if(!m_probeFile.empty() && probes.loadProbes(m_probeFile, cs->getType() == CSType::geographical2d))
+    {
+        probes.setInterval(m_probeInterval);
+        for(AT a : m_probeAttributes)
+            probes.addAttribute(a);
+        probes.start(*grid, *cs);
+    }
+
+    if(outputWriter.isRunning() || imageWriter.isRunning() || probes.isRunning())
+        simulation->setStepCallback([&outputWriter, &imageWriter, &probes](GridBase& g, const SimulationState& state)
+        {
+            outputWriter.onStep(g, state);
+            imageWriter.onStep(g, state);
+            probes.onStep(g, state);
+        });
+    simulation->setDiagnosticFieldsFilter([&outputWriter, &imageWriter, &probes](int step)
+    {
+        return outputWriter.isDue(step) || imageWriter.isDue(step) || probes.isDue(step);
+    });
+
+    // diagnostics are streamed to the file, only the latest records are kept in memory
+    ConservationDiagnostics* diagnostics = simulation->getDiagnostics();
+    std::ofstream diagnosticsFile;
+    if(diagnostics)
+    {
+        diagnostics->setInterval(m_diagnosticsInterval);
+        if(!m_diagnosticsFile.empty())
+        {
+            diagnosticsFile.open(m_diagnosticsFile);
+            if(!diagnosticsFile.is_open())
+            {
+                logERROR("HeadlessRunner") << "Could not open diagnostics file " << m_diagnosticsFile;
+                return 1;
+            }
+            diagnostics->setOutput(&diagnosticsFile);
+        }
+    }
+
+    const bool profile = !m_traceFile.empty() || m_roofline;
+    if(profile && !Profiler::enabled())
+        logWARNING("HeadlessRunner") << "Profiling was disabled at compile time, no phases will be recorded.";
+    if(m_counters)
+        HardwareCounters::instance().enable();
+
+    // run in chunks so we can report progress
+    // the profiler only keeps the latest events, so statistics need to be collected every few hundred steps
+    int chunk = std::max(1, m_numSteps / 10);
+    if(profile)
+        chunk = std::min(chunk, ProfileRingBuffer::capacity / 32);
+    mpu::HRStopwatch sw;
+    int stepsDone = 0;
+    simulation->resume();
+    while(stepsDone < m_numSteps)
+    {
+        int steps = std::min(chunk, m_numSteps - stepsDone);
+        if(m_checkpointInterval > 0)
+            steps = std::min(steps, m_checkpointInterval - stepsDone % m_checkpointInterval);
+        simulation->setIterations(steps);
+        simulation->run();
+        stepsDone += steps;
+        if(profile)
+            Profiler::instance().updateStatistics();
+        logINFO("HeadlessRunner") << "Simulated " << stepsDone << " / " << m_numSteps << " steps.";
+
+        if(CheckpointWriter::signalReceived())
+        {
+            logINFO("HeadlessRunner") << "Received SIGTERM, writing checkpoint and stopping.";
+            checkpointWriter.wait();
+            checkpointWriter.write(m_checkpointFile, *simulation, *grid, *cs);
+            checkpointWriter.wait();
+            return 1;
+        }
+
+        if(m_checkpointInterval > 0 && stepsDone % m_checkpointInterval == 0)
+            checkpointWriter.write(m_checkpointFile, *simulation, *grid, *cs);
+    }
+    checkpointWriter.wait();
+    outputWriter.stop();
+    imageWriter.stop();
+    assert_cuda(cudaDeviceSynchronize());
+    sw.pause();
+    logINFO("HeadlessRunner") << "Finished after " << sw.getSeconds() << "s (" << sw.getSeconds() * 1000.0 / m_numSteps << "ms per step)";
+    if(m_model == SimModel::shallowWaterEnsemble)
+        logINFO("HeadlessRunner") << "Ensemble throughput: " << m_numMembers * m_numSteps / sw.getSeconds() << " member-steps/s ("
+                                  << static_cast<ShallowWaterEnsemble&>(*simulation).getMemberStepsPerSecond() << " member-steps/s measured on the device)";
+
+    // profiling results
+    if(profile)
+    {
+        Profiler& profiler = Profiler::instance();
+        profiler.flushDevice();
+        profiler.updateStatistics();
+        const auto phases = profiler.getStatistics();
+        for(const auto& phase : phases)
+            logINFO("HeadlessRunner") << "Phase " << phase.first << (phase.second.device ? " (device)" : " (host)") << ": "
+                                      << phase.second.count << " calls, " << phase.second.totalSeconds << "s total";
+
+        if(m_roofline)
+        {
+            // achieved throughput of every kernel with a known cost, using the total time measured on the device
+            const MachinePeak peak = MachinePeak::currentDevice();
+            std::vector<RooflinePoint> points;
+            for(const auto& phase : phases)
+            {
+                const KernelCost* cost = findKernelCost(phase.first);
+                if(cost && phase.second.totalSeconds > 0.0)
+                    points.push_back(evaluateRoofline(phase.first, cost->bytesPerCell, cost->flopsPerCell,
+                                                      double(phase.second.totalCells) / phase.second.totalSeconds, peak));
+            }
+            writeRooflineReport(std::cout, points, peak);
+        }
+
+        if(!m_traceFile.empty())
+            profiler.writeChromeTrace(m_traceFile);
+    }
+
+    if(m_counters && HardwareCounters::instance().isCountingThisThread())
+        HardwareCounters::instance().writeReport(std::cout);
+
+    // probe time series
+    if(probes.isRunning())
+    {
+        if(m_probeOutputFile.empty())
+            probes.writeCsv(std::cout);
+        else
+        {
+            std::ofstream file(m_probeOutputFile);
+            if(!file.is_open())
+            {
+                logERROR("HeadlessRunner") << "Could not open probe output file " << m_probeOutputFile;
+                return 1;
+            }
+            probes.writeCsv(file);
+            logINFO("HeadlessRunner") << "Probe time series written to " << m_probeOutputFile;
+        }
+    }
+
+    // output diagnostics
+    if(!diagnostics)
+    {
+        logINFO("HeadlessRunner") << "Simulation model does not support conservation diagnostics.";
+        return 0;
+    }
+
+    for(int q = 0; q < ConservationDiagnostics::numQuantities; q++)
+        logINFO("HeadlessRunner") << "Relative drift of " << ConservationDiagnostics::getQuantityName(q) << ": " << diagnostics->getRelativeDrift(q);
+
+    if(m_diagnosticsFile.empty())
+        diagnostics->writeCsv(std::cout);
+    else
+    {
+        diagnostics->setOutput(nullptr);
+        logINFO("HeadlessRunner") << "Diagnostics written to " << m_diagnosticsFile;
+    }
+    return 0;
+}
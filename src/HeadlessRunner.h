@@ -0,0 +1,130 @@
+/*
+ * CIRCULATION
+ * HeadlessRunner.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the HeadlessRunner class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_HEADLESSRUNNER_H
+#define CIRCULATION_HEADLESSRUNNER_H
+
+// includes
+//--------------------
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+
+#include "coordinateSystems/CoordinateSystem.h"
+#include "simulationModels/Simulation.h"
+#include "enums.h"
+#include "globalSettings.h"
+#include "InitialConditionLoader.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * class HeadlessRunner
+ *
+ * Runs a simulation without window, openGL context or user interface, e.g. on a compute node.
+ *
+ * usage:
+ * Check isHeadless() on the command line arguments. If it returns true construct a HeadlessRunner from the arguments and call run().
+ * Supported arguments:
+ *  --headless                   run without window
+ *  --model <demo|test|shallow|ensemble> simulation model to use (default shallow)
+ *  --members <n>                number of members of the ensemble model (default 64)
+ *  --cs <cartesian|geographical> coordinate system to use (default geographical)
+ *  --cells <nx> <ny>            number of grid cells (default 512 256)
+ *  --steps <n>                  number of timesteps to simulate (default 1000)
+ *  --diagnostics-interval <n>   collect conservation diagnostics every n steps (default 10)
+ *  --diagnostics-file <file>    stream the diagnostics time series to file as csv instead of printing the latest records
+ *  --restart <file>             continue the simulation stored in a checkpoint, model and coordinate system arguments are ignored
+ *  --checkpoint-file <file>     file to write checkpoints to (default from globalSettings.h)
+ *  --checkpoint-interval <n>    write a checkpoint every n steps, 0 to disable (default 0)
+ *  --output-dir <dir>           enable file output of attributes to dir, see OutputWriter
+ *  --output-attributes <a,b,..> comma separated names of attributes to write (default geopotential)
+ *  --output-interval <n>        write output every n steps (default 100)
+ *  --output-stride <n>          only write every n-th cell in each direction (default 1)
+ *  --output-compress            enable lossless compression of the output
+ *  --image-dir <dir>            enable drawing attributes to ppm images in dir, see ImageSequenceWriter
+ *  --image-attributes <a,b,..>  comma separated names of attributes to draw (default geopotential)
+ *  --image-interval <n>         draw images every n steps (default 100)
+ *  --image-size <w> <h>         size of the images in pixel (default 1024 512)
+ *  --image-projection <auto|cartesian|equirectangular|orthographic> view of the grid (default auto)
+ *  --image-range <min> <max>    values mapped to the min / max color (default range of the first image)
+ *  --probes <file>              sample attributes at the locations in a csv file with lines "name,x,y" (degrees on geographical grids), see ProbeSet
+ *  --probe-attributes <a,b,..>  comma separated names of attributes to sample (default geopotential)
+ *  --probe-interval <n>         sample probes every n steps (default 1)
+ *  --probe-output <file>        write the probe time series to file as csv instead of printing it
+ *  --init-<attribute> <file>    load initial values of an attribute from a raw file (shallow water model only), eg --init-geopotential
+ *  --init-type <f32|f64|i16>    data type of initial condition files (default f32)
+ *  --init-scale <s> --init-offset <o> unpack values of the following --init-<attribute> files (value = raw * s + o)
+ *  --init-header <bytes>        bytes to skip at the start of initial condition files
+ *  --init-record <n>            record to load from multi record files
+ *  --init-flip-y                rows are stored in reverse order
+ *  --init-shift-x <n>           rotate rows by n cells
+ *  --step-batching <off|barrier|wavefront> run steps that are not written in persistent kernels (shallow water model only, default off)
+ *  --skip-quiet-tiles <tol>     do not compute tiles that changed less than tol, approximation (shallow water model only, default off)
+ *  --trace <file>               write the latest profiled phases as chrome trace event json (needs CIRCULATION_ENABLE_PROFILING)
+ *  --roofline                   report achieved vs attainable bandwidth and flops of the model kernels (needs CIRCULATION_ENABLE_PROFILING)
+ *  --counters                   count cpu cycles, instructions and cache misses of the step phases using perf_event_open
+ * A checkpoint is also written when SIGTERM is received.
+ *
+ */
+class HeadlessRunner
+{
+public:
+    static bool isHeadless(int argc, char* argv[]); //!< checks if --headless was passed on the command line
+    HeadlessRunner(int argc, char* argv[]); //!< parse settings from the command line
+    int run(); //!< run the simulation, returns exit code
+
+private:
+    SimModel m_model{SimModel::shallowWaterModel}; //!< simulation model to use
+    CSType m_csType{CSType::geographical2d}; //!< type of coordinate system
+    int3 m_numGridCells{512,256,1}; //!< number of grid cells
+    int m_numMembers{64}; //!< number of members of the ensemble model
+    int m_numSteps{1000}; //!< number of timesteps to simulate
+    int m_diagnosticsInterval{10}; //!< collect diagnostics every n steps
+    std::string m_diagnosticsFile; //!< if not empty, diagnostics are written to this file
+    std::string m_restartFile; //!< if not empty, the simulation is restored from this checkpoint
+    std::string m_checkpointFile; //!< checkpoints are written to this file
+    int m_checkpointInterval{0}; //!< write checkpoints every n steps
+    std::string m_outputDirectory; //!< if not empty, output is written to this directory
+    std::vector<AT> m_outputAttributes{AT::geopotential}; //!< attributes to write
+    int m_outputInterval{100}; //!< write output every n steps
+    int m_outputStride{1}; //!< only write every n-th cell
+    bool m_outputCompress{false}; //!< compress output
+    std::string m_imageDirectory; //!< if not empty, images are written to this directory
+    std::vector<AT> m_imageAttributes{AT::geopotential}; //!< attributes to draw
+    int m_imageInterval{100}; //!< draw images every n steps
+    int2 m_imageSize{1024,512}; //!< size of the images
+    ImageProjection m_imageProjection{ImageProjection::automatic}; //!< view of the grid
+    bool m_imageHasRange{false}; //!< a value range was given
+    float2 m_imageRange{0.0f,1.0f}; //!< values mapped to min and max color
+    std::string m_probeFile; //!< if not empty, probes are loaded from this file
+    std::vector<AT> m_probeAttributes{AT::geopotential}; //!< attributes to sample at the probes
+    int m_probeInterval{1}; //!< sample probes every n steps
+    std::string m_probeOutputFile; //!< if not empty, the probe time series is written to this file
+    std::vector<FieldSource> m_initialConditionFiles; //!< files to load initial conditions from
+    InitialConditionLoader m_initialConditionLayout; //!< layout of initial condition files
+    std::string m_traceFile; //!< if not empty, profiled phases are written to this file
+    bool m_roofline{false}; //!< print a roofline report of the model kernels
+    bool m_counters{false}; //!< use hardware counters
+    StepBatching m_stepBatching{StepBatching::off}; //!< how steps that are not written are simulated
+    float m_tileTolerance{0.0f}; //!< skip tiles that changed less than this, 0 computes all tiles
+
+    std::shared_ptr<CoordinateSystem> createCoordinateSystem() const; //!< create the coordinate system from the settings
+    std::unique_ptr<Simulation> createSimulation() const; //!< create the simulation model from the settings
+};
+
+
+#endif //CIRCULATION_HEADLESSRUNNER_H
@@ -0,0 +1,239 @@
+/*
+ * CIRCULATION
+ * ImageSequenceWriter.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ImageSequenceWriter class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "ImageSequenceWriter.h"
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <limits>
+#include <experimental/filesystem>
+
+#include "Profiler.h"
+//--------------------
+
+// namespace aliases
+//--------------------
+namespace fs = std::experimental::filesystem;
+//--------------------
+
+// function definitions of the ImageSequenceWriter class
+//-------------------------------------------------------------------
+
+ImageSequenceWriter::~ImageSequenceWriter()
+{
+    stop();
+}
+
+void ImageSequenceWriter::setRange(float minValue, float maxValue)
+{
+    m_colorMap.minValue = minValue;
+    m_colorMap.maxValue = maxValue;
+    m_hasRange = true;
+}
+
+bool ImageSequenceWriter::start(const GridBase& grid, const CoordinateSystem& cs)
+{
+    stop();
+
+    if(m_attributes.empty())
+    {
+        logWARNING("ImageSequenceWriter") << "No attributes selected for images.";
+        return false;
+    }
+
+    std::vector<AT> gridAttributes = grid.getAttributeTypes();
+    m_numCells = size_t(cs.getNumGridCells());
+    assert_critical(grid.getTimeLevelBytes() == gridAttributes.size() * m_numCells * sizeof(float),
+                    "ImageSequenceWriter", "Images only support grids where all attributes are float.");
+
+    m_images.clear();
+    for(AT a : m_attributes)
+    {
+        auto it = std::find(gridAttributes.begin(), gridAttributes.end(), a);
+        if(it == gridAttributes.end())
+        {
+            logWARNING("ImageSequenceWriter") << "Attribute " << getAttributeName(a) << " is not part of the grid, it will not be drawn.";
+            continue;
+        }
+        m_images.push_back({a, m_colorMap, m_hasRange});
+    }
+    if(m_images.empty())
+        return false;
+
+    std::error_code ec;
+    fs::create_directories(m_directory, ec);
+    m_rasterizer.prepare(cs);
+
+    // reset state
+    m_framesWritten = 0;
+    m_framesDropped = 0;
+    m_drawSeconds = 0.0;
+    m_lastStep = -1;
+
+    // allocate frame buffers
+    allocateFrames();
+    m_freeFrames.clear();
+    m_queuedFrames.clear();
+    for(auto& frame : m_frames)
+        m_freeFrames.push_back(&frame);
+
+    m_shouldStop = false;
+    m_writerThread = std::thread(&ImageSequenceWriter::writerLoop, this);
+    m_running = true;
+
+    logINFO("ImageSequenceWriter") << "Drawing " << m_images.size() << " attributes every " << m_interval << " steps to "
+                                   << m_directory << " (" << m_rasterizer.getWidth() << "x" << m_rasterizer.getHeight() << ")";
+    return true;
+}
+
+void ImageSequenceWriter::stop()
+{
+    if(!m_running)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        m_shouldStop = true;
+    }
+    m_cv.notify_all();
+    m_writerThread.join();
+    releaseFrames();
+    m_running = false;
+
+    logINFO("ImageSequenceWriter") << "Images finished, " << m_framesWritten << " frames written, " << m_framesDropped << " dropped, "
+                                   << ((m_framesWritten > 0) ? m_drawSeconds * 1000.0 / m_framesWritten : 0.0) << "ms per frame";
+}
+
+void ImageSequenceWriter::onStep(GridBase& grid, const SimulationState& state)
+{
+    if(!isDue(state.step))
+        return;
+
+    Frame* frame;
+    {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        if(m_freeFrames.empty())
+        {
+            m_framesDropped++;
+            return;
+        }
+        frame = m_freeFrames.front();
+        m_freeFrames.pop_front();
+    }
+
+    frame->step = state.step;
+    m_lastStep = state.step;
+    {
+        // the copies are ordered before any later kernel that could overwrite time level t
+        PROFILE_SCOPE("image download");
+        for(size_t i = 0; i < m_images.size(); i++)
+            assert_cuda(cudaMemcpyAsync(frame->data + i * m_numCells, grid.getDeviceData(0, m_images[i].attribute),
+                                        m_numCells * sizeof(float), cudaMemcpyDeviceToHost, cudaStreamPerThread));
+        assert_cuda(cudaEventRecord(frame->downloaded, cudaStreamPerThread));
+    }
+
+    {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        m_queuedFrames.push_back(frame);
+    }
+    m_cv.notify_all();
+}
+
+void ImageSequenceWriter::writerLoop()
+{
+    std::unique_lock<std::mutex> lck(m_mtx);
+    while(true)
+    {
+        m_cv.wait(lck, [this](){ return !m_queuedFrames.empty() || m_shouldStop; });
+        if(m_queuedFrames.empty())
+            return;
+
+        Frame* frame = m_queuedFrames.front();
+        m_queuedFrames.pop_front();
+        lck.unlock();
+
+        assert_cuda(cudaEventSynchronize(frame->downloaded));
+        writeFrame(*frame);
+
+        lck.lock();
+        m_freeFrames.push_back(frame);
+    }
+}
+
+void ImageSequenceWriter::writeFrame(const Frame& frame)
+{
+    PROFILE_SCOPE("image write");
+    mpu::HRStopwatch sw;
+    const size_t numCells = m_numCells;
+    for(size_t i = 0; i < m_images.size(); i++)
+    {
+        ImageAttribute& image = m_images[i];
+        const float* field = frame.data + i * numCells;
+
+        // the range of the first frame is kept for the whole sequence, so colors are comparable between images
+        if(!image.hasRange)
+        {
+            float minValue = std::numeric_limits<float>::max();
+            float maxValue = std::numeric_limits<float>::lowest();
+            for(size_t i = 0; i < numCells; i++)
+                if(std::isfinite(field[i]))
+                {
+                    minValue = std::min(minValue, field[i]);
+                    maxValue = std::max(maxValue, field[i]);
+                }
+            if(minValue <= maxValue)
+            {
+                image.colorMap.minValue = minValue;
+                image.colorMap.maxValue = maxValue;
+            }
+            image.hasRange = true;
+            logINFO("ImageSequenceWriter") << "Value range of " << getAttributeName(image.attribute) << ": "
+                                           << image.colorMap.minValue << " to " << image.colorMap.maxValue;
+        }
+
+        m_rasterizer.render(field, image.colorMap, m_rgb);
+
+        char step[16];
+        snprintf(step, sizeof(step), "%08d", frame.step);
+        SoftwareRasterizer::writePpm(m_directory + "/" + getAttributeName(image.attribute) + "_" + step + ".ppm",
+                                     m_rasterizer.getWidth(), m_rasterizer.getHeight(), m_rgb);
+    }
+
+    sw.pause();
+    m_drawSeconds += sw.getSeconds();
+    m_framesWritten++;
+}
+
+void ImageSequenceWriter::allocateFrames()
+{
+    releaseFrames();
+    const size_t bytes = m_images.size() * m_numCells * sizeof(float);
+    for(auto& frame : m_frames)
+    {
+        assert_cuda(cudaMallocHost(&frame.data, bytes));
+        assert_cuda(cudaEventCreateWithFlags(&frame.downloaded, cudaEventDisableTiming));
+    }
+}
+
+void ImageSequenceWriter::releaseFrames()
+{
+    for(auto& frame : m_frames)
+    {
+        if(frame.downloaded) cudaEventDestroy(frame.downloaded);
+        if(frame.data) cudaFreeHost(frame.data);
+        frame.downloaded = nullptr;
+        frame.data = nullptr;
+    }
+}
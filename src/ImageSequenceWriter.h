@@ -0,0 +1,135 @@
+/*
+ * CIRCULATION
+ * ImageSequenceWriter.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ImageSequenceWriter class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_IMAGESEQUENCEWRITER_H
+#define CIRCULATION_IMAGESEQUENCEWRITER_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include <mpUtils/mpUtils.h>
+
+#include "Grid.h"
+#include "SoftwareRasterizer.h"
+#include "coordinateSystems/CoordinateSystem.h"
+#include "simulationModels/Simulation.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * class ImageSequenceWriter
+ *
+ * Draws scalar attributes of the grid to images every n steps, without window or openGL, eg to make animations of headless runs.
+ *
+ * usage:
+ * Select attributes and settings, then call start() with the grid and coordinate system and pass onStep() to
+ * Simulation::setStepCallback(). Call stop() to finish all remaining images.
+ * Every image is written to "<directory>/<attributeName>_<step>.ppm" with the step padded to 8 digits, so the sequence
+ * can be passed to ffmpeg directly. If no value range is set, the range of the first frame is used for all frames.
+ *
+ * onStep() only issues asynchronous downloads of the drawn attributes into one of two pinned frame buffers, drawing and
+ * encoding happens on the writer thread after the download finished. If both frame buffers are in use the frame is dropped
+ * and counted. A step is never drawn twice, even if the model does not advance SimulationState::step.
+ *
+ */
+class ImageSequenceWriter
+{
+public:
+    ImageSequenceWriter() = default;
+    ~ImageSequenceWriter(); //!< calls stop()
+    ImageSequenceWriter(const ImageSequenceWriter& other) = delete;
+    ImageSequenceWriter& operator=(const ImageSequenceWriter& other) = delete;
+
+    // settings, changes take effect on the next call to start()
+    void setDirectory(std::string directory) {m_directory = std::move(directory);} //!< directory to write images to
+    void setInterval(int interval) {m_interval = std::max(interval, 1);} //!< write images every interval steps
+    void setSize(int width, int height) {m_rasterizer.setSize(width, height);} //!< size of the images
+    void setProjection(ImageProjection projection) {m_rasterizer.setProjection(projection);} //!< map projection of geographical grids
+    void setColorMap(const ColorMap& colorMap) {m_colorMap = colorMap;} //!< colors used for all attributes
+    void setRange(float minValue, float maxValue); //!< fixed value range of the color map
+    void addAttribute(AT attribute) {m_attributes.push_back(attribute);} //!< add attribute to draw
+    void clearAttributes() {m_attributes.clear();} //!< remove all attributes
+
+    // running
+    bool start(const GridBase& grid, const CoordinateSystem& cs); //!< prepare the rasterizer and start the writer thread, returns false on error
+    void stop(); //!< write remaining images and stop the writer thread
+    void onStep(GridBase& grid, const SimulationState& state); //!< takes a snapshot if images are due at this step
+    bool isRunning() const {return m_running;} //!< are images currently written
+    bool isDue(int step) const {return m_running && step % m_interval == 0 && step != m_lastStep;} //!< images are taken at step
+
+    // statistics
+    size_t getFramesWritten() const {return m_framesWritten;} //!< number of frames written since start()
+    size_t getFramesDropped() const {return m_framesDropped;} //!< number of frames dropped because the writer could not keep up
+
+private:
+    //!< snapshot of one time level
+    struct Frame
+    {
+        int step; //!< simulation step
+        float* data{nullptr}; //!< pinned host memory, the drawn attributes at time level t one after the other
+        cudaEvent_t downloaded{nullptr}; //!< recorded after the download into data was issued
+    };
+
+    //!< one attribute that is drawn
+    struct ImageAttribute
+    {
+        AT attribute; //!< the attribute
+        ColorMap colorMap; //!< colors and range used for the attribute
+        bool hasRange; //!< is the range known, otherwise it is taken from the first frame
+    };
+
+    void writerLoop(); //!< runs in the writer thread
+    void writeFrame(const Frame& frame); //!< draws and writes images of one frame
+    void allocateFrames(); //!< allocate pinned memory for the drawn attributes in both frame buffers
+    void releaseFrames(); //!< free the memory of both frame buffers
+
+    // settings
+    std::string m_directory{"images"}; //!< directory to write images to
+    int m_interval{100}; //!< write images every m_interval steps
+    ColorMap m_colorMap; //!< colors of all attributes
+    bool m_hasRange{false}; //!< the range of the color map was set
+    std::vector<AT> m_attributes; //!< attributes to draw
+
+    // state
+    std::atomic_bool m_running{false}; //!< is the writer running
+    SoftwareRasterizer m_rasterizer; //!< draws the images
+    size_t m_numCells{0}; //!< number of cells of the grid
+    int m_lastStep{-1}; //!< step of the last frame taken
+    std::vector<ImageAttribute> m_images; //!< attributes that are drawn
+    std::vector<uint8_t> m_rgb; //!< image buffer of the writer thread
+
+    // double buffering
+    std::thread m_writerThread; //!< draws and writes images
+    std::mutex m_mtx; //!< protects queues
+    std::condition_variable m_cv; //!< signals new frames / stop
+    bool m_shouldStop{false}; //!< writer should finish remaining frames and exit
+    Frame m_frames[2]; //!< frame buffers
+    std::deque<Frame*> m_freeFrames; //!< frames that can be filled
+    std::deque<Frame*> m_queuedFrames; //!< frames waiting to be drawn
+
+    // statistics
+    std::atomic<size_t> m_framesWritten{0}; //!< frames written since start
+    std::atomic<size_t> m_framesDropped{0}; //!< frames dropped since start
+    double m_drawSeconds{0.0}; //!< time spent drawing and writing
+};
+
+
+#endif //CIRCULATION_IMAGESEQUENCEWRITER_H
@@ -0,0 +1,218 @@
+/*
+ * CIRCULATION
+ * InitialConditionLoader.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the InitialConditionLoader class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "InitialConditionLoader.h"
+#include <memory>
+#include <mpUtils/mpGraphics.h>
+#include "MappedFile.h"
+#include "HardwareCounters.h"
+//--------------------
+
+namespace {
+    //!< converts count values of type T at src to float, applies scale and offset and stores them in dst
+    template <typename T>
+    void convertValues(const char* src, int count, float scale, float offset, float* dst)
+    {
+        for(int i = 0; i < count; i++)
+        {
+            T v;
+            memcpy(&v, src + size_t(i) * sizeof(T), sizeof(T));
+            dst[i] = static_cast<float>(v) * scale + offset;
+        }
+    }
+
+    //!< converts one row of nx values of type T, column x of dstRow is read from column (x + shift) mod nx of srcRow
+    template <typename T>
+    void convertRow(const char* srcRow, int nx, int shift, float scale, float offset, float* dstRow)
+    {
+        // the shifted row consists of two contiguous ranges of the source row, split where it wraps around
+        const int first = (shift % nx + nx) % nx;
+        convertValues<T>(srcRow + size_t(first) * sizeof(T), nx - first, scale, offset, dstRow);
+        convertValues<T>(srcRow, first, scale, offset, dstRow + (nx - first));
+    }
+
+    using RowConverter = void (*)(const char*, int, int, float, float, float*);
+}
+
+// function definitions of the InitialConditionLoader class
+//-------------------------------------------------------------------
+
+void InitialConditionLoader::setSource(FieldSource source)
+{
+    removeSource(source.attribute);
+    m_sources.push_back(std::move(source));
+}
+
+void InitialConditionLoader::removeSource(AT attribute)
+{
+    m_sources.erase(std::remove_if(m_sources.begin(), m_sources.end(), [attribute](const FieldSource& s){ return s.attribute == attribute; }),
+                    m_sources.end());
+}
+
+bool InitialConditionLoader::hasFileSources() const
+{
+    return std::any_of(m_sources.begin(), m_sources.end(), [](const FieldSource& s){ return !s.filename.empty(); });
+}
+
+void InitialConditionLoader::load(GridBase& grid, const CoordinateSystem& cs) const
+{
+    PROFILE_SCOPE_CELLS("initial conditions", cs.getNumGridCells());
+    PROFILE_COUNTERS("initial conditions", cs.getNumGridCells());
+    const int nx = cs.getNumGridCells3d().x;
+    const int ny = cs.getNumGridCells3d().y;
+    assert_critical(cs.getCellId(int3{0,1,0}) == nx, "InitialConditionLoader", "Loader requires row major cell ordering.");
+
+    size_t valueBytes;
+    RowConverter rowConverter;
+    switch(m_inputType)
+    {
+        case InputType::float32: valueBytes = 4; rowConverter = &convertRow<float>; break;
+        case InputType::float64: valueBytes = 8; rowConverter = &convertRow<double>; break;
+        case InputType::int16: valueBytes = 2; rowConverter = &convertRow<int16_t>; break;
+        default:
+            logERROR("InitialConditionLoader") << "Unknown input type " << static_cast<int>(m_inputType);
+            throw std::runtime_error("Unknown initial condition input type.");
+    }
+    const size_t recordBytes = size_t(nx) * ny * valueBytes;
+
+    // two pinned staging buffers, one is filled while the other one is uploaded
+    const int rowsPerChunk = std::max(1, chunkBytes / int(nx * sizeof(float)));
+    const size_t chunkCells = size_t(rowsPerChunk) * nx;
+    struct Staging
+    {
+        float* data{nullptr};
+        cudaEvent_t uploaded{nullptr};
+        ~Staging()
+        {
+            if(uploaded) cudaEventDestroy(uploaded);
+            if(data) cudaFreeHost(data);
+        }
+    } staging[2];
+    for(auto& s : staging)
+    {
+        assert_cuda(cudaMallocHost(&s.data, chunkCells * sizeof(float)));
+        assert_cuda(cudaEventCreateWithFlags(&s.uploaded, cudaEventDisableTiming));
+        assert_cuda(cudaEventRecord(s.uploaded, cudaStreamPerThread));
+    }
+
+    mpu::HRStopwatch sw;
+    uint64_t bytesRead = 0;
+    for(AT attribute : grid.getAttributeTypes())
+    {
+        auto source = std::find_if(m_sources.begin(), m_sources.end(), [attribute](const FieldSource& s){ return s.attribute == attribute; });
+        const bool fromFile = source != m_sources.end() && !source->filename.empty();
+        const float constant = (source != m_sources.end()) ? source->constant : 0.0f;
+        const float scale = fromFile ? source->scale : 1.0f;
+        const float offset = fromFile ? source->offset : 0.0f;
+
+        std::unique_ptr<MappedFile> file;
+        const char* record = nullptr;
+        if(fromFile)
+        {
+            file = std::make_unique<MappedFile>(source->filename);
+            const uint64_t recordStart = m_headerBytes + uint64_t(m_record) * recordBytes;
+            if(recordStart + recordBytes > file->size())
+            {
+                logERROR("InitialConditionLoader") << "File " << source->filename << " is too small for record " << m_record
+                                                   << " of " << nx << "x" << ny << " values.";
+                throw std::runtime_error("Initial condition file too small.");
+            }
+            record = file->data() + recordStart;
+            bytesRead += recordBytes;
+            logINFO("InitialConditionLoader") << "Loading " << getAttributeName(attribute) << " from " << source->filename;
+        }
+
+        int buffer = 0;
+        for(int firstRow = 0; firstRow < ny; firstRow += rowsPerChunk, buffer ^= 1)
+        {
+            const int numRows = std::min(rowsPerChunk, ny - firstRow);
+            float* dst = staging[buffer].data;
+
+            // wait until the previous upload from this buffer is done
+            assert_cuda(cudaEventSynchronize(staging[buffer].uploaded));
+
+            #pragma omp parallel for schedule(static)
+            for(int r = 0; r < numRows; r++)
+            {
+                float* dstRow = dst + size_t(r) * nx;
+                if(!record)
+                {
+                    std::fill(dstRow, dstRow + nx, constant);
+                    continue;
+                }
+
+                const int y = firstRow + r;
+                const int fileRow = m_flipY ? (ny - 1 - y) : y;
+                const char* srcRow = record + size_t(fileRow) * nx * valueBytes;
+                rowConverter(srcRow, nx, m_shiftX, scale, offset, dstRow);
+            }
+
+            grid.initializeRange(attribute, firstRow * nx, numRows * nx, dst, cudaStreamPerThread);
+            assert_cuda(cudaEventRecord(staging[buffer].uploaded, cudaStreamPerThread));
+        }
+    }
+    assert_cuda(cudaStreamSynchronize(cudaStreamPerThread));
+    sw.pause();
+
+    if(bytesRead > 0)
+    {
+        const double gigabytes = double(bytesRead) / (1024.0*1024.0*1024.0);
+        logINFO("InitialConditionLoader") << "Loaded " << gigabytes << " GB of initial conditions in " << sw.getSeconds() << "s ("
+                                          << gigabytes / sw.getSeconds() << " GB/s)";
+    }
+}
+
+void InitialConditionLoader::showGui(const std::vector<AT>& attributes)
+{
+    ImGui::PushID("InitialConditionLoader");
+    int type = static_cast<int>(m_inputType);
+    if(ImGui::Combo("Data type", &type, "float32\0float64\0int16\0\0"))
+        m_inputType = static_cast<InputType>(type);
+    int headerBytes = static_cast<int>(m_headerBytes);
+    if(ImGui::DragInt("Header bytes", &headerBytes, 1.0f, 0, 1<<30))
+        m_headerBytes = static_cast<uint64_t>(headerBytes);
+    ImGui::DragInt("Record", &m_record, 0.1f, 0, 1<<20);
+    ImGui::Checkbox("Flip rows", &m_flipY);
+    ImGui::DragInt("Shift columns", &m_shiftX, 0.1f);
+
+    for(AT a : attributes)
+    {
+        ImGui::PushID(static_cast<int>(a));
+        auto it = std::find_if(m_sources.begin(), m_sources.end(), [a](const FieldSource& s){ return s.attribute == a; });
+        FieldSource source = (it != m_sources.end()) ? *it : FieldSource{a};
+
+        char filename[256];
+        strncpy(filename, source.filename.c_str(), sizeof(filename));
+        filename[sizeof(filename)-1] = '\0';
+
+        ImGui::Text("%s", getAttributeName(a));
+        bool changed = ImGui::InputText("File", filename, sizeof(filename));
+        if(source.filename.empty())
+            changed |= ImGui::DragFloat("Constant", &source.constant, 0.01f);
+        else
+        {
+            changed |= ImGui::DragFloat("Scale", &source.scale, 0.01f);
+            changed |= ImGui::DragFloat("Offset", &source.offset, 0.01f);
+        }
+
+        if(changed)
+        {
+            source.filename = filename;
+            setSource(source);
+        }
+        ImGui::PopID();
+    }
+    ImGui::PopID();
+}
@@ -0,0 +1,99 @@
+/*
+ * CIRCULATION
+ * InitialConditionLoader.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the InitialConditionLoader class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_INITIALCONDITIONLOADER_H
+#define CIRCULATION_INITIALCONDITIONLOADER_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+
+#include "Grid.h"
+#include "coordinateSystems/CoordinateSystem.h"
+//--------------------
+
+/**
+ * @brief data types supported in initial condition files
+ */
+enum class InputType : int
+{
+    float32 = 0,
+    float64 = 1,
+    int16 = 2 //!< packed data, use scale and offset to unpack
+};
+
+//-------------------------------------------------------------------
+/**
+ * @brief where the initial values of one attribute come from
+ */
+struct FieldSource
+{
+    AT attribute; //!< attribute to initialize
+    std::string filename; //!< raw file to load, if empty the constant value is used
+    float constant{0.0f}; //!< value used when no file is given
+    float scale{1.0f}; //!< value = raw * scale + offset
+    float offset{0.0f}; //!< value = raw * scale + offset
+};
+
+//-------------------------------------------------------------------
+/**
+ * class InitialConditionLoader
+ *
+ * Loads initial conditions from raw binary files into all time levels of a grid.
+ *
+ * usage:
+ * Set a file or constant for the attributes of the grid and configure the file layout, then call load() with a grid
+ * that is not cached on the host. Attributes without source are set to zero.
+ * Files are expected to contain one or more records of nx*ny values, row major with x (longitude) varying fastest,
+ * starting after headerBytes bytes. The number of values per row and rows per record must match the grid.
+ * Rows can be flipped (eg north to south ordered reanalysis data) and rows can be rotated by shiftX cells (eg to
+ * convert longitudes from -180..180 to 0..360).
+ * Files are memory mapped and converted in chunks of rows in parallel into two pinned staging buffers, while one is
+ * converted the other is uploaded to the device. No full copy of a field is ever held in host memory.
+ * Throws std::runtime_error if a file can not be read.
+ *
+ */
+class InitialConditionLoader
+{
+public:
+    void setSource(FieldSource source); //!< set source of an attribute, replaces previous source of the same attribute
+    void removeSource(AT attribute); //!< remove source of an attribute, it will be set to zero
+    bool hasFileSources() const; //!< is at least one attribute loaded from a file
+
+    void setInputType(InputType type) {m_inputType = type;} //!< data type of the values in all files
+    void setHeaderBytes(uint64_t bytes) {m_headerBytes = bytes;} //!< bytes to skip at the start of all files
+    void setRecord(int record) {m_record = record;} //!< index of the record (eg time step) to load from multi record files
+    void setFlipY(bool flip) {m_flipY = flip;} //!< files store rows in reverse order
+    void setShiftX(int shift) {m_shiftX = shift;} //!< cell x of the grid is read from column (x + shift) mod nx of the file
+
+    void load(GridBase& grid, const CoordinateSystem& cs) const; //!< load all attributes of the grid into all time levels
+    void showGui(const std::vector<AT>& attributes); //!< draws settings for the given attributes
+
+private:
+    std::vector<FieldSource> m_sources; //!< sources of all attributes
+    InputType m_inputType{InputType::float32}; //!< data type in files
+    uint64_t m_headerBytes{0}; //!< bytes to skip at the start of every file
+    int m_record{0}; //!< record to load
+    bool m_flipY{false}; //!< rows are stored in reverse order
+    int m_shiftX{0}; //!< rotation of rows
+
+    static constexpr int chunkBytes = 8*1024*1024; //!< size of one staging buffer
+};
+
+
+#endif //CIRCULATION_INITIALCONDITIONLOADER_H
@@ -0,0 +1,187 @@
+/*
+ * CIRCULATION
+ * LaunchTuner.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the LaunchTuner class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "LaunchTuner.h"
+#include <sstream>
+#include <algorithm>
+#include <limits>
+
+#include <mpUtils/mpGraphics.h>
+
+#include "globalSettings.h"
+//--------------------
+
+// variables
+//--------------------
+constexpr int LaunchTuner::repetitions;
+//--------------------
+
+// function definitions of the LaunchTuner class
+//-------------------------------------------------------------------
+
+LaunchTuner& LaunchTuner::instance()
+{
+    static LaunchTuner tuner;
+    return tuner;
+}
+
+std::vector<dim3> LaunchTuner::candidates2d()
+{
+    return {{16,16,1}, {32,8,1}, {32,4,1}, {64,4,1}, {128,2,1}, {32,16,1}, {64,8,1}, {8,8,1}};
+}
+
+bool LaunchTuner::openFile()
+{
+    if(m_fileOpened)
+        return m_fileAvailable;
+    m_fileOpened = true;
+
+    int device;
+    cudaDeviceProp prop;
+    assert_cuda(cudaGetDevice(&device));
+    assert_cuda(cudaGetDeviceProperties(&prop, device));
+    m_device = prop.name;
+    std::replace_if(m_device.begin(), m_device.end(), [](char c){return !isalnum(c);}, '_');
+
+    try {
+        m_file.open(tuningFilename);
+        m_fileAvailable = true;
+    }
+    catch (const std::exception& e)
+    {
+        try {
+            m_file.createAndOpen(tuningFilename);
+            m_fileAvailable = true;
+        }
+        catch (const std::exception& e)
+        {
+            logWARNING("LaunchTuner") << "Could not create tuning file, results will not be stored.";
+        }
+    }
+    return m_fileAvailable;
+}
+
+dim3 LaunchTuner::benchmark(const std::vector<dim3>& candidates, const std::function<void(dim3)>& launch)
+{
+    cudaEvent_t start;
+    cudaEvent_t stop;
+    assert_cuda(cudaEventCreate(&start));
+    assert_cuda(cudaEventCreate(&stop));
+
+    dim3 best = candidates.front();
+    float bestMs = std::numeric_limits<float>::max();
+    for(const dim3& blocksize : candidates)
+    {
+        // warm up, also skips block sizes the kernel can not be launched with
+        launch(blocksize);
+        if(cudaGetLastError() != cudaSuccess)
+            continue;
+
+        assert_cuda(cudaEventRecord(start, cudaStreamPerThread));
+        for(int i = 0; i < repetitions; i++)
+            launch(blocksize);
+        assert_cuda(cudaEventRecord(stop, cudaStreamPerThread));
+        assert_cuda(cudaEventSynchronize(stop));
+        if(cudaGetLastError() != cudaSuccess)
+            continue;
+
+        float ms;
+        assert_cuda(cudaEventElapsedTime(&ms, start, stop));
+        if(ms < bestMs)
+        {
+            bestMs = ms;
+            best = blocksize;
+        }
+    }
+
+    assert_cuda(cudaEventDestroy(start));
+    assert_cuda(cudaEventDestroy(stop));
+    return best;
+}
+
+dim3 LaunchTuner::blockSize(const std::string& kernel, int3 numGridCells, const std::vector<dim3>& candidates,
+                            const std::function<void(dim3)>& launch)
+{
+    assert_critical(!candidates.empty(), "LaunchTuner", "No candidate block sizes given for " + kernel);
+    if(!m_enabled)
+        return candidates.front();
+
+    // held across the trial launches, models running concurrently (eg in a sweep) tune one after the other
+    std::lock_guard<std::mutex> lck(m_mtx);
+    const std::string key = kernel + "_" + std::to_string(numGridCells.x) + "x" + std::to_string(numGridCells.y)
+                            + "x" + std::to_string(numGridCells.z);
+    auto it = m_results.find(key);
+    if(it != m_results.end())
+        return it->second;
+
+    // results of earlier runs
+    const bool fileAvailable = openFile();
+    if(fileAvailable && !m_skipFile)
+    {
+        try {
+            std::istringstream stored(m_file.getValue<std::string>(m_device, key));
+            dim3 blocksize;
+            if(stored >> blocksize.x >> blocksize.y >> blocksize.z)
+            {
+                m_results[key] = blocksize;
+                return blocksize;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            // not tuned yet
+        }
+    }
+
+    mpu::HRStopwatch sw;
+    const dim3 best = benchmark(candidates, launch);
+    m_results[key] = best;
+    sw.pause();
+    logINFO("LaunchTuner") << "Tuned " << key << " in " << sw.getSeconds() * 1000.0 << "ms, using block size "
+                           << best.x << "x" << best.y << "x" << best.z;
+
+    if(fileAvailable)
+    {
+        try {
+            m_file.setValue<std::string>(m_device, key, std::to_string(best.x) + " " + std::to_string(best.y) + " " + std::to_string(best.z));
+        }
+        catch (const std::exception& e)
+        {
+            logWARNING("LaunchTuner") << "Could not store tuning result of " << key;
+        }
+    }
+    return best;
+}
+
+void LaunchTuner::forget()
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_results.clear();
+    m_skipFile = true;
+}
+
+void LaunchTuner::showGui()
+{
+    bool enabled = m_enabled;
+    if(ImGui::Checkbox("Tune kernel launches", &enabled))
+        m_enabled = enabled;
+    ImGui::SameLine();
+    if(ImGui::Button("Tune again"))
+        forget();
+
+    std::lock_guard<std::mutex> lck(m_mtx);
+    for(const auto& result : m_results)
+        ImGui::Text("%s: %ux%ux%u", result.first.c_str(), result.second.x, result.second.y, result.second.z);
+}
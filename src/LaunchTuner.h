@@ -0,0 +1,78 @@
+/*
+ * CIRCULATION
+ * LaunchTuner.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the LaunchTuner class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_LAUNCHTUNER_H
+#define CIRCULATION_LAUNCHTUNER_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * class LaunchTuner
+ *
+ * Finds the fastest block size of a kernel for the current device and grid shape.
+ *
+ * usage:
+ * Call blockSize() with a name for the kernel, the shape of the grid, a list of candidate block sizes and a function
+ * that launches the kernel with a given block size (and computes the number of blocks itself).
+ * The first time a kernel is used with a grid shape on a device, every candidate is launched a few times and the fastest
+ * one is returned. Results are stored in the tuning file (see globalSettings.h) and reused on later runs.
+ * The launch function is called multiple times in a row, so the kernel needs to give the same result every time it
+ * is run on the same input, eg write to a different buffer than it reads from.
+ * When tuning is disabled the first candidate is used.
+ * All functions are thread safe. Tuning is serialised, so trial launches of different threads do not disturb each others timings.
+ *
+ */
+class LaunchTuner
+{
+public:
+    static LaunchTuner& instance(); //!< the global launch tuner
+
+    dim3 blockSize(const std::string& kernel, int3 numGridCells, const std::vector<dim3>& candidates,
+                   const std::function<void(dim3)>& launch); //!< fastest of the candidates for kernel on a grid of numGridCells
+    void setEnabled(bool enabled) {m_enabled = enabled;} //!< enable or disable tuning
+    bool isEnabled() const {return m_enabled;} //!< is tuning enabled
+    void forget(); //!< forget all results of the current session, kernels are tuned again on the next use
+    void showGui(); //!< draws settings and results into the current window
+
+    static std::vector<dim3> candidates2d(); //!< candidate block sizes for kernels that cover a 2d grid
+
+private:
+    LaunchTuner() = default;
+    bool openFile(); //!< open or create the tuning file, returns false if it is not available
+    dim3 benchmark(const std::vector<dim3>& candidates, const std::function<void(dim3)>& launch); //!< time all candidates
+
+    static constexpr int repetitions = 5; //!< timed launches per candidate
+
+    std::mutex m_mtx; //!< guards everything below, held while a kernel is tuned
+    std::atomic<bool> m_enabled{true}; //!< tune kernels, otherwise the first candidate is used
+    bool m_fileOpened{false}; //!< opening the file was attempted
+    bool m_fileAvailable{false}; //!< the file is open
+    mpu::CfgFile m_file; //!< stores the results
+    std::string m_device; //!< name of the device, used as section in the file
+    std::unordered_map<std::string, dim3> m_results; //!< block size of every kernel and grid shape used in this session
+    bool m_skipFile{false}; //!< ignore stored results after forget()
+};
+
+#endif //CIRCULATION_LAUNCHTUNER_H
@@ -0,0 +1,95 @@
+/*
+ * CIRCULATION
+ * MappedFile.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the MappedFile class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_MAPPEDFILE_H
+#define CIRCULATION_MAPPEDFILE_H
+
+// includes
+//--------------------
+#include <string>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <mpUtils/mpUtils.h>
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * class MappedFile
+ *
+ * Maps a file read only into memory.
+ *
+ * usage:
+ * Construct with a filename, throws std::runtime_error if the file can not be mapped.
+ * Access the content using data() and size(). The mapping is released when the object is destroyed.
+ *
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& filename)
+    {
+        m_fd = open(filename.c_str(), O_RDONLY);
+        if(m_fd < 0)
+        {
+            logERROR("MappedFile") << "Could not open " << filename << ": " << strerror(errno);
+            throw std::runtime_error("Could not open file " + filename);
+        }
+
+        struct stat st{};
+        if(fstat(m_fd, &st) != 0 || st.st_size == 0)
+        {
+            close(m_fd);
+            logERROR("MappedFile") << "File " << filename << " is empty or can not be accessed.";
+            throw std::runtime_error("Could not map file " + filename);
+        }
+        m_size = static_cast<size_t>(st.st_size);
+
+        m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if(m_data == MAP_FAILED)
+        {
+            close(m_fd);
+            logERROR("MappedFile") << "Could not map " << filename << ": " << strerror(errno);
+            throw std::runtime_error("Could not map file " + filename);
+        }
+
+        // we usually read front to back
+        madvise(m_data, m_size, MADV_SEQUENTIAL);
+        madvise(m_data, m_size, MADV_WILLNEED);
+    }
+
+    ~MappedFile()
+    {
+        munmap(m_data, m_size);
+        close(m_fd);
+    }
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    const char* data() const {return static_cast<const char*>(m_data);} //!< start of the mapped file
+    size_t size() const {return m_size;} //!< size of the mapped file in bytes
+
+private:
+    int m_fd{-1}; //!< file descriptor
+    size_t m_size{0}; //!< size of the mapped file
+    void* m_data{nullptr}; //!< start of the mapping
+};
+
+
+#endif //CIRCULATION_MAPPEDFILE_H
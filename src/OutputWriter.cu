@@ -0,0 +1,405 @@
+/*
+ * CIRCULATION
+ * OutputWriter.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the OutputWriter class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "OutputWriter.h"
+#include <fstream>
+#include <cstring>
+#include <experimental/filesystem>
+
+#include "Profiler.h"
+//--------------------
+
+// namespace aliases
+//--------------------
+namespace fs = std::experimental::filesystem;
+//--------------------
+
+// function definitions of the OutputWriter class
+//-------------------------------------------------------------------
+
+OutputWriter::~OutputWriter()
+{
+    stop();
+}
+
+bool OutputWriter::start(const GridBase& grid, const CoordinateSystem& cs)
+{
+    stop();
+
+    if(m_attributes.empty())
+    {
+        logWARNING("OutputWriter") << "No attributes selected for output.";
+        return false;
+    }
+
+    std::vector<AT> gridAttributes = grid.getAttributeTypes();
+    m_numGridCells = make_int2(cs.getNumGridCells3d());
+    assert_critical(grid.getTimeLevelBytes() == gridAttributes.size() * size_t(m_numGridCells.x) * m_numGridCells.y * sizeof(float),
+                    "OutputWriter", "Output only supports grids where all attributes are float.");
+
+    std::error_code ec;
+    fs::create_directories(m_directory, ec);
+
+    // open one file per attribute
+    m_files.clear();
+    for(const auto& a : m_attributes)
+    {
+        auto it = std::find(gridAttributes.begin(), gridAttributes.end(), a.attribute);
+        if(it == gridAttributes.end())
+        {
+            logWARNING("OutputWriter") << "Attribute " << getAttributeName(a.attribute) << " is not part of the grid, it will not be written.";
+            continue;
+        }
+
+        AttributeFile f;
+        f.settings = a;
+        f.settings.strideX = std::max(a.strideX, 1);
+        f.settings.strideY = std::max(a.strideY, 1);
+        f.outputSize = make_int2( (m_numGridCells.x + f.settings.strideX - 1) / f.settings.strideX,
+                                  (m_numGridCells.y + f.settings.strideY - 1) / f.settings.strideY);
+        std::string filename = m_directory + "/" + getAttributeName(a.attribute) + ".raw";
+        f.file = fopen(filename.c_str(), "wb");
+        if(!f.file)
+        {
+            logERROR("OutputWriter") << "Could not open output file " << filename << ": " << strerror(errno);
+            for(auto& other : m_files)
+                fclose(other.file);
+            m_files.clear();
+            return false;
+        }
+        m_files.push_back(std::move(f));
+    }
+    if(m_files.empty())
+        return false;
+
+    // reset state, the writer thread is not running
+    m_steps.clear();
+    m_times.clear();
+    m_lastStep = -1;
+    m_framesWritten = 0;
+    m_framesDropped = 0;
+    m_writeSeconds = 0.0;
+    m_bytesWritten = 0;
+    m_bytesUncompressed = 0;
+
+    // allocate frame buffers
+    allocateFrames();
+    m_freeFrames.clear();
+    m_queuedFrames.clear();
+    for(auto& frame : m_frames)
+        m_freeFrames.push_back(&frame);
+
+    m_shouldStop = false;
+    m_writerThread = std::thread(&OutputWriter::writerLoop, this);
+    m_running = true;
+
+    logINFO("OutputWriter") << "Writing " << m_files.size() << " attributes every " << m_interval << " steps to " << m_directory;
+    return true;
+}
+
+void OutputWriter::stop()
+{
+    if(!m_running)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        m_shouldStop = true;
+    }
+    m_cv.notify_all();
+    m_writerThread.join();
+
+    writeSidecars();
+    for(auto& f : m_files)
+        fclose(f.file);
+    m_files.clear();
+    releaseFrames();
+    m_running = false;
+
+    logINFO("OutputWriter") << "Output finished, " << m_framesWritten << " frames written, " << m_framesDropped << " dropped, "
+                            << m_bytesWritten / (1024.0*1024.0) << " MB at " << getWriteRate() << " MB/s, compression ratio "
+                            << getCompressionRatio();
+}
+
+double OutputWriter::getWriteRate() const
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    return (m_writeSeconds > 0.0) ? (m_bytesWritten / (1024.0*1024.0)) / m_writeSeconds : 0.0;
+}
+
+size_t OutputWriter::getFramesWritten() const
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    return m_framesWritten;
+}
+
+size_t OutputWriter::getFramesDropped() const
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    return m_framesDropped;
+}
+
+double OutputWriter::getCompressionRatio() const
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    return (m_bytesWritten > 0) ? double(m_bytesUncompressed) / double(m_bytesWritten) : 1.0;
+}
+
+void OutputWriter::onStep(GridBase& grid, const SimulationState& state)
+{
+    if(!isDue(state.step))
+        return;
+
+    Frame* frame;
+    {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        if(m_freeFrames.empty())
+        {
+            m_framesDropped++;
+            return;
+        }
+        frame = m_freeFrames.front();
+        m_freeFrames.pop_front();
+    }
+
+    frame->step = state.step;
+    frame->time = state.totalSimulatedTime;
+    m_lastStep = state.step;
+    {
+        // the copies are ordered before any later kernel that could overwrite time level t
+        PROFILE_SCOPE("output download");
+        const size_t cells = size_t(m_numGridCells.x) * m_numGridCells.y;
+        for(size_t i = 0; i < m_files.size(); i++)
+            assert_cuda(cudaMemcpyAsync(frame->data + i * cells, grid.getDeviceData(0, m_files[i].settings.attribute),
+                                        cells * sizeof(float), cudaMemcpyDeviceToHost, cudaStreamPerThread));
+        assert_cuda(cudaEventRecord(frame->downloaded, cudaStreamPerThread));
+    }
+
+    {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        m_queuedFrames.push_back(frame);
+    }
+    m_cv.notify_all();
+}
+
+void OutputWriter::writerLoop()
+{
+    std::unique_lock<std::mutex> lck(m_mtx);
+    while(true)
+    {
+        m_cv.wait(lck, [this](){ return !m_queuedFrames.empty() || m_shouldStop; });
+        if(m_queuedFrames.empty())
+            return;
+
+        Frame* frame = m_queuedFrames.front();
+        m_queuedFrames.pop_front();
+        lck.unlock();
+
+        assert_cuda(cudaEventSynchronize(frame->downloaded));
+        writeFrame(*frame);
+
+        lck.lock();
+        m_freeFrames.push_back(frame);
+    }
+}
+
+void OutputWriter::writeFrame(const Frame& frame)
+{
+    PROFILE_SCOPE("output write");
+    mpu::HRStopwatch sw;
+    std::vector<float> subset;
+    uint64_t bytesWritten = 0;
+    uint64_t bytesUncompressed = 0;
+    for(size_t i = 0; i < m_files.size(); i++)
+    {
+        // gather strided subset
+        AttributeFile& f = m_files[i];
+        const float* source = frame.data + i * size_t(m_numGridCells.x) * m_numGridCells.y;
+        subset.resize(size_t(f.outputSize.x) * f.outputSize.y);
+        for(int y = 0; y < f.outputSize.y; y++)
+            for(int x = 0; x < f.outputSize.x; x++)
+                subset[size_t(y) * f.outputSize.x + x] = source[size_t(y * f.settings.strideY) * m_numGridCells.x + x * f.settings.strideX];
+
+        const void* chunk = subset.data();
+        size_t chunkBytes = subset.size() * sizeof(float);
+        std::vector<uint8_t> compressed;
+        if(m_compress)
+        {
+            compressed = compress(subset.data(), subset.size());
+            chunk = compressed.data();
+            chunkBytes = compressed.size();
+        }
+
+        if(fwrite(chunk, 1, chunkBytes, f.file) != chunkBytes)
+            logERROR("OutputWriter") << "Error writing output of " << getAttributeName(f.settings.attribute) << ": " << strerror(errno);
+
+        f.chunkOffsets.push_back(f.offset);
+        f.chunkBytes.push_back(chunkBytes);
+        f.offset += chunkBytes;
+        bytesWritten += chunkBytes;
+        bytesUncompressed += subset.size() * sizeof(float);
+    }
+    m_steps.push_back(frame.step);
+    m_times.push_back(frame.time);
+
+    // keep the description up to date in case the program is killed
+    if(m_steps.size() % 16 == 0)
+        writeSidecars();
+
+    sw.pause();
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_writeSeconds += sw.getSeconds();
+    m_bytesWritten += bytesWritten;
+    m_bytesUncompressed += bytesUncompressed;
+    m_framesWritten++;
+}
+
+void OutputWriter::allocateFrames()
+{
+    releaseFrames();
+    const size_t bytes = m_files.size() * size_t(m_numGridCells.x) * m_numGridCells.y * sizeof(float);
+    for(auto& frame : m_frames)
+    {
+        assert_cuda(cudaMallocHost(&frame.data, bytes));
+        assert_cuda(cudaEventCreateWithFlags(&frame.downloaded, cudaEventDisableTiming));
+    }
+}
+
+void OutputWriter::releaseFrames()
+{
+    for(auto& frame : m_frames)
+    {
+        if(frame.downloaded) cudaEventDestroy(frame.downloaded);
+        if(frame.data) cudaFreeHost(frame.data);
+        frame.downloaded = nullptr;
+        frame.data = nullptr;
+    }
+}
+
+void OutputWriter::writeSidecars()
+{
+    auto writeList = [](std::ostream& stream, const auto& list)
+    {
+        stream << "[";
+        for(size_t i = 0; i < list.size(); i++)
+            stream << (i > 0 ? ", " : "") << list[i];
+        stream << "]";
+    };
+
+    for(auto& f : m_files)
+    {
+        fflush(f.file);
+
+        std::ofstream json(m_directory + "/" + getAttributeName(f.settings.attribute) + ".json");
+        json.precision(17);
+        json << "{\n";
+        json << "  \"attribute\": \"" << getAttributeName(f.settings.attribute) << "\",\n";
+        json << "  \"file\": \"" << getAttributeName(f.settings.attribute) << ".raw\",\n";
+        json << "  \"dtype\": \"<f4\",\n";
+        json << "  \"order\": \"C\",\n";
+        json << "  \"shape\": [" << m_steps.size() << ", " << f.outputSize.y << ", " << f.outputSize.x << "],\n";
+        json << "  \"grid_cells\": [" << m_numGridCells.y << ", " << m_numGridCells.x << "],\n";
+        json << "  \"stride\": [" << f.settings.strideY << ", " << f.settings.strideX << "],\n";
+        json << "  \"compression\": \"" << (m_compress ? "xor-delta+shuffle4+packbits" : "none") << "\",\n";
+        json << "  \"steps\": "; writeList(json, m_steps); json << ",\n";
+        json << "  \"times\": "; writeList(json, m_times); json << ",\n";
+        json << "  \"chunk_offsets\": "; writeList(json, f.chunkOffsets); json << ",\n";
+        json << "  \"chunk_bytes\": "; writeList(json, f.chunkBytes); json << "\n";
+        json << "}\n";
+    }
+}
+
+std::vector<uint8_t> OutputWriter::compress(const float* data, size_t count)
+{
+    // xor with previous value and shuffle bytes into planes
+    std::vector<uint8_t> shuffled(count * 4);
+    uint32_t previous = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        uint32_t bits;
+        memcpy(&bits, &data[i], 4);
+        const uint32_t delta = bits ^ previous;
+        previous = bits;
+        for(int b = 0; b < 4; b++)
+            shuffled[b * count + i] = static_cast<uint8_t>(delta >> (8*b));
+    }
+
+    // packbits: n in [0,127] -> n+1 literal bytes follow, n in [-127,-1] -> next byte is repeated 1-n times
+    std::vector<uint8_t> result;
+    result.reserve(shuffled.size() / 2);
+    size_t i = 0;
+    while(i < shuffled.size())
+    {
+        size_t run = 1;
+        while(i + run < shuffled.size() && run < 128 && shuffled[i + run] == shuffled[i])
+            run++;
+
+        if(run >= 3)
+        {
+            result.push_back(static_cast<uint8_t>(static_cast<int8_t>(1 - static_cast<int>(run))));
+            result.push_back(shuffled[i]);
+            i += run;
+        }
+        else
+        {
+            // collect literals until a run of at least 3 starts
+            size_t start = i;
+            size_t length = 0;
+            while(i < shuffled.size() && length < 128)
+            {
+                if(i + 2 < shuffled.size() && shuffled[i] == shuffled[i+1] && shuffled[i] == shuffled[i+2])
+                    break;
+                i++;
+                length++;
+            }
+            result.push_back(static_cast<uint8_t>(length - 1));
+            result.insert(result.end(), shuffled.begin() + start, shuffled.begin() + start + length);
+        }
+    }
+    return result;
+}
+
+std::vector<float> OutputWriter::decompress(const uint8_t* data, size_t bytes, size_t count)
+{
+    // undo packbits
+    std::vector<uint8_t> shuffled;
+    shuffled.reserve(count * 4);
+    size_t i = 0;
+    while(i < bytes)
+    {
+        const int n = static_cast<int8_t>(data[i++]);
+        if(n >= 0)
+        {
+            shuffled.insert(shuffled.end(), data + i, data + i + n + 1);
+            i += n + 1;
+        }
+        else if(n != -128)
+            shuffled.insert(shuffled.end(), size_t(1 - n), data[i++]);
+    }
+    assert_critical(shuffled.size() == count * 4, "OutputWriter", "Compressed data does not match the expected size.");
+
+    // unshuffle and undo xor
+    std::vector<float> result(count);
+    uint32_t previous = 0;
+    for(size_t k = 0; k < count; k++)
+    {
+        uint32_t delta = 0;
+        for(int b = 0; b < 4; b++)
+            delta |= uint32_t(shuffled[b * count + k]) << (8*b);
+        previous ^= delta;
+        memcpy(&result[k], &previous, 4);
+    }
+    return result;
+}
@@ -0,0 +1,164 @@
+/*
+ * CIRCULATION
+ * OutputWriter.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the OutputWriter class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_OUTPUTWRITER_H
+#define CIRCULATION_OUTPUTWRITER_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#include <mpUtils/mpUtils.h>
+
+#include "Grid.h"
+#include "coordinateSystems/CoordinateSystem.h"
+#include "simulationModels/Simulation.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * @brief output settings for one attribute
+ */
+struct OutputAttribute
+{
+    AT attribute; //!< the attribute to write
+    int strideX{1}; //!< only every strideX-th cell along x is written
+    int strideY{1}; //!< only every strideY-th cell along y is written
+};
+
+//-------------------------------------------------------------------
+/**
+ * class OutputWriter
+ *
+ * Writes selected attributes of the grid every n steps for offline analysis.
+ *
+ * usage:
+ * Select attributes and settings, then call start() with the grid and coordinate system and pass onStep() to
+ * Simulation::setStepCallback(). Call stop() to write all remaining frames and close the files.
+ * Each attribute is written to "<directory>/<attributeName>.raw", frames are appended one after the other as C ordered
+ * float32 arrays of shape (ny/strideY, nx/strideX). "<attributeName>.json" describes the layout, including step and
+ * time of every frame. Without compression the raw file can be memory mapped by numpy directly.
+ * With compression every frame is a separate chunk: the float bits are xor-ed with the previous value, the bytes are
+ * shuffled into 4 planes (all least significant bytes, then all second bytes, ...) and the result is packbits run length
+ * encoded (control byte n in [0,127]: n+1 literal bytes follow, n in [-127,-1]: the next byte is repeated 1-n times).
+ * Chunk offsets and sizes are listed in the json file. scripts/readOutput.py reads both variants into numpy arrays.
+ *
+ * onStep() never waits for disk io or the device: only the selected attributes are downloaded asynchronously into one of
+ * two pinned frame buffers, which are queued for the writer thread. The writer thread waits for the download to finish.
+ * If both frame buffers are in use the frame is dropped and counted. A step is never written twice, even if the model
+ * does not advance SimulationState::step.
+ *
+ */
+class OutputWriter
+{
+public:
+    OutputWriter() = default;
+    ~OutputWriter(); //!< calls stop()
+    OutputWriter(const OutputWriter& other) = delete;
+    OutputWriter& operator=(const OutputWriter& other) = delete;
+
+    // settings, changes take effect on the next call to start()
+    void setDirectory(std::string directory) {m_directory = std::move(directory);} //!< directory to write output files to
+    void setInterval(int interval) {m_interval = std::max(interval, 1);} //!< write output every interval steps
+    void setCompression(bool compress) {m_compress = compress;} //!< enable lossless compression
+    void addAttribute(OutputAttribute attribute) {m_attributes.push_back(attribute);} //!< add attribute to the output
+    void clearAttributes() {m_attributes.clear();} //!< remove all attributes from the output
+    const std::string& getDirectory() const {return m_directory;} //!< directory to write output files to
+    int getInterval() const {return m_interval;} //!< write output every interval steps
+    bool getCompression() const {return m_compress;} //!< is compression enabled
+    std::vector<OutputAttribute>& attributes() {return m_attributes;} //!< access selected attributes
+
+    // running
+    bool start(const GridBase& grid, const CoordinateSystem& cs); //!< open output files and start the writer thread, returns false on error
+    void stop(); //!< write remaining frames, close all files and stop the writer thread
+    void onStep(GridBase& grid, const SimulationState& state); //!< takes a snapshot if output is due at this step
+    bool isRunning() const {return m_running;} //!< is output currently written
+    bool isDue(int step) const {return m_running && step % m_interval == 0 && step != m_lastStep;} //!< output is taken at step
+
+    // statistics
+    double getWriteRate() const; //!< sustained write rate in MB/s (bytes written / time spend writing)
+    size_t getFramesWritten() const; //!< number of frames written since start()
+    size_t getFramesDropped() const; //!< number of frames dropped because the writer could not keep up
+    double getCompressionRatio() const; //!< uncompressed / compressed size
+
+    static std::vector<uint8_t> compress(const float* data, size_t count); //!< compress count floats using the scheme described above
+    static std::vector<float> decompress(const uint8_t* data, size_t bytes, size_t count); //!< decompress count floats
+
+private:
+    //!< snapshot of one time level
+    struct Frame
+    {
+        int step; //!< simulation step
+        double time; //!< simulated time
+        float* data{nullptr}; //!< pinned host memory, the attributes of all files at time level t one after the other
+        cudaEvent_t downloaded{nullptr}; //!< recorded after the download into data was issued
+    };
+
+    //!< open output file of one attribute
+    struct AttributeFile
+    {
+        OutputAttribute settings; //!< settings of the attribute
+        int2 outputSize; //!< number of cells written in each dimension
+        FILE* file{nullptr}; //!< the raw file
+        uint64_t offset{0}; //!< current size of the raw file
+        std::vector<uint64_t> chunkOffsets; //!< start of each frame in the raw file
+        std::vector<uint64_t> chunkBytes; //!< size of each frame in the raw file
+    };
+
+    void writerLoop(); //!< runs in the writer thread
+    void writeFrame(const Frame& frame); //!< writes one frame to all attribute files
+    void writeSidecars(); //!< writes the json files describing all attribute files
+    void allocateFrames(); //!< allocate pinned memory for the selected attributes in both frame buffers
+    void releaseFrames(); //!< free the memory of both frame buffers
+
+    // settings
+    std::string m_directory{"output"}; //!< directory to write output files to
+    int m_interval{100}; //!< write output every m_interval steps
+    bool m_compress{false}; //!< enable lossless compression
+    std::vector<OutputAttribute> m_attributes; //!< attributes to write
+
+    // state
+    std::atomic_bool m_running{false}; //!< is the writer running
+    int2 m_numGridCells; //!< number of cells of the grid
+    int m_lastStep{-1}; //!< step of the last frame taken
+    std::vector<AttributeFile> m_files; //!< one file per attribute
+    std::vector<int> m_steps; //!< step of every written frame
+    std::vector<double> m_times; //!< time of every written frame
+
+    // double buffering
+    std::thread m_writerThread; //!< writes frames to disk
+    mutable std::mutex m_mtx; //!< protects queues and statistics
+    std::condition_variable m_cv; //!< signals new frames / stop
+    bool m_shouldStop{false}; //!< writer should finish remaining frames and exit
+    Frame m_frames[2]; //!< frame buffers
+    std::deque<Frame*> m_freeFrames; //!< frames that can be filled
+    std::deque<Frame*> m_queuedFrames; //!< frames waiting to be written
+
+    // statistics, updated by the writer thread and read by the ui, guarded by m_mtx
+    size_t m_framesWritten{0}; //!< frames written since start
+    size_t m_framesDropped{0}; //!< frames dropped since start
+    double m_writeSeconds{0.0}; //!< time spent writing
+    uint64_t m_bytesWritten{0}; //!< bytes written to the raw files
+    uint64_t m_bytesUncompressed{0}; //!< bytes before compression
+};
+
+
+#endif //CIRCULATION_OUTPUTWRITER_H
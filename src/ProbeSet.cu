@@ -0,0 +1,353 @@
+/*
+ * CIRCULATION
+ * ProbeSet.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ProbeSet class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "ProbeSet.h"
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "interpolation.h"
+#include "Profiler.h"
+//--------------------
+
+// variables
+//--------------------
+constexpr int ProbeSet::maxAttributes;
+constexpr int ProbeSet::numStaggerClasses;
+//--------------------
+
+namespace {
+    //!< device pointers of the sampled attributes, passed by value since they change with every buffer swap
+    struct ProbeFields
+    {
+        const float* field[ProbeSet::maxAttributes];
+        int staggerClass[ProbeSet::maxAttributes]; //!< selects the stencils used for each attribute
+    };
+
+    //!< interpolates every attribute at every probe, samples stores all probes of one attribute after the other
+    __global__ void gatherProbes(ProbeFields fields, int numAttributes, const ProbeStencil* stencils, int numProbes, float* samples)
+    {
+        for(int i : mpu::gridStrideRange(numProbes * numAttributes))
+        {
+            const int attribute = i / numProbes;
+            const ProbeStencil s = stencils[fields.staggerClass[attribute] * numProbes + i - attribute * numProbes];
+            if(s.cell[0] < 0)
+            {
+                samples[i] = nanf("");
+                continue;
+            }
+
+            const float* f = fields.field[attribute];
+            samples[i] = s.weight[0] * f[s.cell[0]] + s.weight[1] * f[s.cell[1]]
+                         + s.weight[2] * f[s.cell[2]] + s.weight[3] * f[s.cell[3]];
+        }
+    }
+}
+
+// function definitions of the ProbeSet class
+//-------------------------------------------------------------------
+
+void ProbeSet::addProbe(std::string name, float2 coordinate)
+{
+    m_names.push_back(std::move(name));
+    m_coordinates.push_back(coordinate);
+    m_stencilsValid = false;
+}
+
+bool ProbeSet::loadProbes(const std::string& filename, bool degrees)
+{
+    std::ifstream file(filename);
+    if(!file.is_open())
+    {
+        logERROR("ProbeSet") << "Could not open probe file " << filename;
+        return false;
+    }
+
+    const float scale = degrees ? M_PIf32 / 180.0f : 1.0f;
+    int loaded = 0;
+    std::string line;
+    while(std::getline(file, line))
+    {
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream ls(line);
+        std::string name, x, y;
+        if(!std::getline(ls, name, ',') || !std::getline(ls, x, ',') || !std::getline(ls, y, ','))
+        {
+            logWARNING("ProbeSet") << "Ignoring invalid line in probe file: " << line;
+            continue;
+        }
+
+        try
+        {
+            addProbe(name, make_float2(std::stof(x) * scale, std::stof(y) * scale));
+            loaded++;
+        }
+        catch(const std::exception& e)
+        {
+            // most likely the header line
+            logWARNING("ProbeSet") << "Ignoring invalid line in probe file: " << line;
+        }
+    }
+
+    logINFO("ProbeSet") << "Loaded " << loaded << " probes from " << filename;
+    return true;
+}
+
+void ProbeSet::clearProbes()
+{
+    m_names.clear();
+    m_coordinates.clear();
+    m_stencilsValid = false;
+}
+
+int ProbeSet::getStaggerClass(AT attribute)
+{
+    switch(attribute)
+    {
+        case AT::velocityX:
+            return 1;
+        case AT::velocityY:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+float2 ProbeSet::getStaggerOffset(int staggerClass)
+{
+    switch(staggerClass)
+    {
+        case 1:
+            return make_float2(0.5f,0.0f);
+        case 2:
+            return make_float2(0.0f,0.5f);
+        default:
+            return make_float2(0.0f,0.0f);
+    }
+}
+
+ProbeStencil ProbeSet::computeStencil(const CoordinateSystem& cs, float2 coordinate, float2 offset)
+{
+    ProbeStencil stencil{{-1,-1,-1,-1},{0.0f,0.0f,0.0f,0.0f}};
+
+    const int3 numCells = cs.getNumGridCells3d();
+    const bool periodicX = cs.hasBoundary().x == 0;
+    const float2 minCoord = make_float2(cs.getMinCoord());
+    const float2 cellSize = make_float2(cs.getCellSize());
+
+    // position in units of cells, cell centers are at integer positions
+    float2 pos = (coordinate - minCoord) / cellSize;
+
+    // up to half a cell outside of the outermost cell centers the border value is used
+    if((!periodicX && (pos.x < -0.5f || pos.x > float(numCells.x) - 0.5f)) || pos.y < -0.5f || pos.y > float(numCells.y) - 0.5f
+       || !std::isfinite(pos.x) || !std::isfinite(pos.y))
+        return stencil;
+
+    // staggered values of cell i are stored at i + offset, like sampleGrid() in semiLagrangian.h
+    pos = pos - offset;
+    if(periodicX)
+    {
+        pos.x = fmodf(pos.x, float(numCells.x));
+        if(pos.x < 0.0f)
+            pos.x += float(numCells.x);
+    }
+    if(!periodicX)
+        pos.x = fminf(fmaxf(pos.x, 0.0f), float(numCells.x - 1));
+    pos.y = fminf(fmaxf(pos.y, 0.0f), float(numCells.y - 1));
+
+    int x0 = static_cast<int>(floorf(pos.x));
+    int y0 = std::min(static_cast<int>(floorf(pos.y)), std::max(numCells.y - 2, 0));
+    int x1;
+    if(periodicX)
+    {
+        x0 = x0 % numCells.x;
+        x1 = (x0 + 1) % numCells.x;
+    }
+    else
+    {
+        x0 = std::min(x0, std::max(numCells.x - 2, 0));
+        x1 = std::min(x0 + 1, numCells.x - 1);
+    }
+    const int y1 = std::min(y0 + 1, numCells.y - 1);
+
+    // interpolating the unit vectors gives the weight of each corner
+    const float4 w = bilinearInterpolate(make_float2(pos.x - float(x0), pos.y - float(y0)), 0.0f, 1.0f, 0.0f, 1.0f,
+                                         make_float4(1,0,0,0), make_float4(0,1,0,0), make_float4(0,0,1,0), make_float4(0,0,0,1));
+
+    stencil.cell[0] = cs.getCellId(make_int3(x0, y0, 0));
+    stencil.cell[1] = cs.getCellId(make_int3(x1, y0, 0));
+    stencil.cell[2] = cs.getCellId(make_int3(x0, y1, 0));
+    stencil.cell[3] = cs.getCellId(make_int3(x1, y1, 0));
+    stencil.weight[0] = w.x;
+    stencil.weight[1] = w.y;
+    stencil.weight[2] = w.z;
+    stencil.weight[3] = w.w;
+    return stencil;
+}
+
+void ProbeSet::prepare(const CoordinateSystem& cs)
+{
+    const int3 numCells = cs.getNumGridCells3d();
+    if(m_stencilsValid && m_preparedCs == &cs && m_preparedCells.x == numCells.x && m_preparedCells.y == numCells.y)
+        return;
+
+    mpu::HRStopwatch sw;
+    const int numProbes = static_cast<int>(m_coordinates.size());
+    std::vector<ProbeStencil> stencils(size_t(numProbes) * numStaggerClasses);
+    int invalid = 0;
+    #pragma omp parallel for schedule(static) reduction(+:invalid)
+    for(int i = 0; i < numProbes; i++)
+    {
+        for(int c = 0; c < numStaggerClasses; c++)
+            stencils[c * numProbes + i] = computeStencil(cs, m_coordinates[i], getStaggerOffset(c));
+        if(stencils[i].cell[0] < 0)
+            invalid++;
+    }
+    m_stencils.assign(stencils);
+
+    m_preparedCs = &cs;
+    m_preparedCells = numCells;
+    m_stencilsValid = true;
+
+    sw.pause();
+    if(invalid > 0)
+        logWARNING("ProbeSet") << invalid << " probes are outside of the grid, they will record NaN.";
+    logINFO("ProbeSet") << "Computed interpolation weights of " << numProbes << " probes in " << sw.getSeconds() * 1000.0 << "ms";
+}
+
+bool ProbeSet::start(const GridBase& grid, const CoordinateSystem& cs)
+{
+    m_running = false;
+
+    if(m_names.empty())
+    {
+        logWARNING("ProbeSet") << "No probes defined.";
+        return false;
+    }
+
+    std::vector<AT> gridAttributes = grid.getAttributeTypes();
+    m_sampledAttributes.clear();
+    for(AT a : m_attributes)
+    {
+        if(std::find(gridAttributes.begin(), gridAttributes.end(), a) == gridAttributes.end())
+        {
+            logWARNING("ProbeSet") << "Attribute " << getAttributeName(a) << " is not part of the grid, it will not be sampled.";
+            continue;
+        }
+        if(m_sampledAttributes.size() == maxAttributes)
+        {
+            logWARNING("ProbeSet") << "Only " << maxAttributes << " attributes can be sampled, ignoring " << getAttributeName(a);
+            continue;
+        }
+        m_sampledAttributes.push_back(a);
+    }
+    if(m_sampledAttributes.empty())
+    {
+        logWARNING("ProbeSet") << "No attributes selected for probes.";
+        return false;
+    }
+    assert_critical(grid.getTimeLevelBytes() == gridAttributes.size() * size_t(cs.getNumGridCells()) * sizeof(float),
+                    "ProbeSet", "Probes only support grids where all attributes are float.");
+
+    prepare(cs);
+
+    // reset state
+    m_deviceSamples = mpu::DeviceVector<float>(size_t(m_chunkSize) * m_sampledAttributes.size() * m_names.size());
+    m_pendingSteps.clear();
+    m_pendingTimes.clear();
+    m_steps.clear();
+    m_times.clear();
+    m_values.clear();
+    m_running = true;
+
+    logINFO("ProbeSet") << "Sampling " << m_sampledAttributes.size() << " attributes at " << m_names.size() << " probes every "
+                        << m_interval << " steps";
+    return true;
+}
+
+void ProbeSet::onStep(GridBase& grid, const SimulationState& state)
+{
+    if(!isDue(state.step))
+        return;
+
+    if(static_cast<int>(m_pendingSteps.size()) == m_chunkSize)
+        flush();
+
+    const int numProbes = getNumProbes();
+    const int numAttributes = static_cast<int>(m_sampledAttributes.size());
+    ProbeFields fields{};
+    for(int a = 0; a < numAttributes; a++)
+    {
+        fields.field[a] = static_cast<const float*>(grid.getDeviceData(0, m_sampledAttributes[a]));
+        fields.staggerClass[a] = getStaggerClass(m_sampledAttributes[a]);
+    }
+
+    {
+        PROFILE_GPU_SCOPE("probe gather", numProbes * numAttributes);
+        const int blocksize = 256;
+        float* samples = m_deviceSamples.data() + m_pendingSteps.size() * numProbes * numAttributes;
+        gatherProbes<<< mpu::numBlocks(numProbes * numAttributes, blocksize), blocksize>>>(fields, numAttributes,
+                m_stencils.data(), numProbes, samples);
+    }
+
+    m_pendingSteps.push_back(state.step);
+    m_pendingTimes.push_back(state.totalSimulatedTime);
+}
+
+void ProbeSet::flush()
+{
+    if(m_pendingSteps.empty())
+        return;
+
+    PROFILE_SCOPE("probe download");
+    const size_t sampleSize = m_sampledAttributes.size() * m_names.size();
+    const size_t offset = m_values.size();
+    m_values.resize(offset + m_pendingSteps.size() * sampleSize);
+    assert_cuda(cudaMemcpy(m_values.data() + offset, m_deviceSamples.data(), m_pendingSteps.size() * sampleSize * sizeof(float),
+                           cudaMemcpyDeviceToHost));
+
+    m_steps.insert(m_steps.end(), m_pendingSteps.begin(), m_pendingSteps.end());
+    m_times.insert(m_times.end(), m_pendingTimes.begin(), m_pendingTimes.end());
+    m_pendingSteps.clear();
+    m_pendingTimes.clear();
+}
+
+float ProbeSet::getValue(int sample, int attribute, int probe) const
+{
+    return m_values[(size_t(sample) * m_sampledAttributes.size() + attribute) * m_names.size() + probe];
+}
+
+void ProbeSet::writeCsv(std::ostream& stream)
+{
+    flush();
+
+    stream << "step,time,probe";
+    for(AT a : m_sampledAttributes)
+        stream << "," << getAttributeName(a);
+    stream << "\n";
+
+    stream.precision(9);
+    for(int s = 0; s < getNumSamples(); s++)
+        for(int p = 0; p < getNumProbes(); p++)
+        {
+            stream << m_steps[s] << "," << m_times[s] << "," << m_names[p];
+            for(int a = 0; a < static_cast<int>(m_sampledAttributes.size()); a++)
+                stream << "," << getValue(s, a, p);
+            stream << "\n";
+        }
+}
@@ -0,0 +1,123 @@
+/*
+ * CIRCULATION
+ * ProbeSet.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ProbeSet class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_PROBESET_H
+#define CIRCULATION_PROBESET_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+
+#include "Grid.h"
+#include "coordinateSystems/CoordinateSystem.h"
+#include "simulationModels/Simulation.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * @brief the four cells around a probe and their bilinear weights, invalid probes have cell[0] == -1
+ */
+struct ProbeStencil
+{
+    int cell[4]; //!< cell ids in the order (x0,y0) (x1,y0) (x0,y1) (x1,y1)
+    float weight[4]; //!< weight of each cell, they sum up to one
+};
+
+//-------------------------------------------------------------------
+/**
+ * class ProbeSet
+ *
+ * Samples attributes of the grid at a set of fixed locations (eg weather stations) and records a time series.
+ *
+ * usage:
+ * Add probes and attributes, then call start() with the grid and coordinate system and pass onStep() to
+ * Simulation::setStepCallback(). Call writeCsv() at the end to get the time series.
+ * The four surrounding cells and bilinear weights of every probe are computed once when the coordinate system changes,
+ * including the wrap around of periodic dimensions. Probes outside of the grid record NaN.
+ * Attributes need to be stored as float. velocityX and velocityY are sampled on the right and forward faces of the cells
+ * (as in the staggered shallow water grid), all other attributes at the cell centers. One stencil is computed per
+ * probe and stagger class.
+ *
+ * Every sample gathers all probes and attributes in a single kernel launch into a buffer on the device. The buffer
+ * holds chunkSize samples and is only downloaded when it is full, so sampling does not synchronize with the device.
+ *
+ */
+class ProbeSet
+{
+public:
+    static constexpr int maxAttributes = 8; //!< maximum number of attributes sampled at the same time
+    static constexpr int numStaggerClasses = 3; //!< cell centers, right faces and forward faces
+
+    // probes, changes take effect on the next call to start()
+    void addProbe(std::string name, float2 coordinate); //!< add a probe at coordinate (in coordinates of the coordinate system)
+    bool loadProbes(const std::string& filename, bool degrees); //!< add probes from a csv file with lines "name,x,y", if degrees is set x and y are converted to radians
+    void clearProbes(); //!< remove all probes
+    int getNumProbes() const {return static_cast<int>(m_names.size());} //!< number of probes
+
+    // settings, changes take effect on the next call to start()
+    void setInterval(int interval) {m_interval = std::max(interval, 1);} //!< sample every interval steps
+    void setChunkSize(int samples) {m_chunkSize = std::max(samples, 1);} //!< number of samples stored on the device before downloading
+    void addAttribute(AT attribute) {m_attributes.push_back(attribute);} //!< add attribute to sample
+    void clearAttributes() {m_attributes.clear();} //!< remove all attributes
+
+    // running
+    bool start(const GridBase& grid, const CoordinateSystem& cs); //!< compute stencils if needed and clear the time series, returns false on error
+    void onStep(GridBase& grid, const SimulationState& state); //!< gathers all probes if a sample is due at this step
+    bool isRunning() const {return m_running;} //!< are probes currently sampled
+    bool isDue(int step) const {return m_running && step % m_interval == 0;} //!< a sample is taken at step
+
+    // results
+    void flush(); //!< download samples that are still on the device
+    int getNumSamples() const {return static_cast<int>(m_steps.size());} //!< number of downloaded samples
+    float getValue(int sample, int attribute, int probe) const; //!< value of probe for attribute (index into the attribute list) in a downloaded sample
+    void writeCsv(std::ostream& stream); //!< flush and write the time series as csv to stream, one line per sample and probe
+
+    static ProbeStencil computeStencil(const CoordinateSystem& cs, float2 coordinate, float2 offset = {0.0f,0.0f}); //!< cells and weights to interpolate at coordinate, values are stored offset cells away from the cell center
+    static int getStaggerClass(AT attribute); //!< 0 for cell centered attributes, 1 for attributes on the right face, 2 on the forward face
+    static float2 getStaggerOffset(int staggerClass); //!< position in units of cells of the values of staggerClass relative to the cell center
+
+private:
+    void prepare(const CoordinateSystem& cs); //!< compute the stencils of all probes
+
+    // probes
+    std::vector<std::string> m_names; //!< name of every probe
+    std::vector<float2> m_coordinates; //!< location of every probe
+    bool m_stencilsValid{false}; //!< the stencils belong to the current probes and m_preparedCs
+    const CoordinateSystem* m_preparedCs{nullptr}; //!< coordinate system the stencils where computed for
+    int3 m_preparedCells{0,0,0}; //!< number of cells of the coordinate system the stencils where computed for
+    mpu::DeviceVector<ProbeStencil> m_stencils; //!< stencil of every probe for every stagger class, all probes of one class after the other
+
+    // settings
+    int m_interval{1}; //!< sample every m_interval steps
+    int m_chunkSize{256}; //!< samples kept on the device
+    std::vector<AT> m_attributes; //!< attributes to sample
+
+    // state
+    bool m_running{false}; //!< probes are sampled
+    std::vector<AT> m_sampledAttributes; //!< attributes that are part of the grid and are sampled
+    mpu::DeviceVector<float> m_deviceSamples; //!< samples that are not yet downloaded
+    std::vector<int> m_pendingSteps; //!< steps of the samples on the device
+    std::vector<double> m_pendingTimes; //!< simulated time of the samples on the device
+
+    // time series
+    std::vector<int> m_steps; //!< step of every sample
+    std::vector<double> m_times; //!< simulated time of every sample
+    std::vector<float> m_values; //!< samples one after the other, each sample stores all probes of one attribute after the other
+};
+
+#endif //CIRCULATION_PROBESET_H
@@ -0,0 +1,283 @@
+/*
+ * CIRCULATION
+ * Profiler.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the Profiler, ScopedTimer and ScopedGpuTimer classes
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "Profiler.h"
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <mpUtils/mpGraphics.h>
+//--------------------
+
+//!< per thread data of the profiler
+struct Profiler::ThreadData
+{
+    struct PendingDevice
+    {
+        const char* name;
+        int64_t cells;
+        cudaEvent_t start;
+        cudaEvent_t end;
+    };
+
+    int id{0}; //!< id of the thread
+    ProfileRingBuffer events; //!< recorded events
+    std::deque<PendingDevice> pending; //!< device events not yet passed by the device
+    std::vector<cudaEvent_t> eventPool; //!< unused events
+    cudaEvent_t reference{nullptr}; //!< event to relate device and host time
+    int64_t referenceNs{0}; //!< host time of the reference event
+};
+
+// function definitions of the Profiler class
+//-------------------------------------------------------------------
+
+Profiler& Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler() : m_start(std::chrono::steady_clock::now())
+{
+}
+
+int64_t Profiler::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+Profiler::ThreadData& Profiler::threadData()
+{
+    thread_local std::shared_ptr<ThreadData> td;
+    if(!td)
+    {
+        // data is owned by the profiler as well, so events of finished threads can still be exported
+        td = std::make_shared<ThreadData>();
+        std::lock_guard<std::mutex> lck(m_mtx);
+        td->id = static_cast<int>(m_threads.size());
+        m_threads.push_back(td);
+        m_statisticsPosition.push_back(0);
+    }
+    return *td;
+}
+
+int Profiler::threadId()
+{
+    return threadData().id;
+}
+
+void Profiler::record(const ProfileEvent& e)
+{
+    threadData().events.push(e);
+}
+
+cudaEvent_t Profiler::acquireEvent()
+{
+    ThreadData& td = threadData();
+    if(!td.reference)
+    {
+        // synchronize once per thread to relate device timestamps to host time
+        assert_cuda(cudaEventCreate(&td.reference));
+        assert_cuda(cudaEventRecord(td.reference, cudaStreamPerThread));
+        assert_cuda(cudaEventSynchronize(td.reference));
+        td.referenceNs = now();
+    }
+
+    if(td.eventPool.empty())
+    {
+        cudaEvent_t e;
+        assert_cuda(cudaEventCreate(&e));
+        return e;
+    }
+    cudaEvent_t e = td.eventPool.back();
+    td.eventPool.pop_back();
+    return e;
+}
+
+void Profiler::recordDevice(const char* name, int64_t cells, cudaEvent_t start, cudaEvent_t end)
+{
+    ThreadData& td = threadData();
+    td.pending.push_back({name, cells, start, end});
+    resolveDevice(td, false);
+}
+
+void Profiler::flushDevice()
+{
+    resolveDevice(threadData(), true);
+}
+
+void Profiler::resolveDevice(ThreadData& td, bool wait)
+{
+    // events are recorded in order on the same stream, so we can stop at the first one the device did not pass
+    while(!td.pending.empty())
+    {
+        ThreadData::PendingDevice& p = td.pending.front();
+        if(wait)
+            assert_cuda(cudaEventSynchronize(p.end));
+        else if(cudaEventQuery(p.end) != cudaSuccess)
+            break;
+
+        float startMs = 0.0f;
+        float durationMs = 0.0f;
+        assert_cuda(cudaEventElapsedTime(&startMs, td.reference, p.start));
+        assert_cuda(cudaEventElapsedTime(&durationMs, p.start, p.end));
+        td.events.push({p.name, td.referenceNs + static_cast<int64_t>(double(startMs) * 1.0e6),
+                        static_cast<int64_t>(double(durationMs) * 1.0e6), p.cells, td.id, true});
+
+        td.eventPool.push_back(p.start);
+        td.eventPool.push_back(p.end);
+        td.pending.pop_front();
+    }
+}
+
+void Profiler::updateStatistics()
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    std::vector<ProfileEvent> events;
+    for(size_t i = 0; i < m_threads.size(); i++)
+        m_statisticsPosition[i] = m_threads[i]->events.read(m_statisticsPosition[i], events);
+
+    constexpr double smoothing = 0.05; // weight of a new value in the moving averages
+    for(const ProfileEvent& e : events)
+    {
+        PhaseStatistics& s = m_statistics[e.name];
+        const double ms = double(e.durationNs) * 1.0e-6;
+        const double cellsPerSecond = (e.durationNs > 0) ? double(e.cells) * 1.0e9 / double(e.durationNs) : 0.0;
+        s.averageMs = (s.count == 0) ? ms : (1.0-smoothing) * s.averageMs + smoothing * ms;
+        s.cellsPerSecond = (s.count == 0) ? cellsPerSecond : (1.0-smoothing) * s.cellsPerSecond + smoothing * cellsPerSecond;
+        s.totalSeconds += ms * 1.0e-3;
+        s.totalCells += e.cells;
+        s.device = e.device;
+        s.count++;
+    }
+}
+
+void Profiler::resetStatistics()
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_statistics.clear();
+}
+
+std::map<std::string, Profiler::PhaseStatistics> Profiler::getStatistics()
+{
+    std::lock_guard<std::mutex> lck(m_mtx);
+    return m_statistics;
+}
+
+void Profiler::showGui()
+{
+    if(!enabled())
+    {
+        ImGui::Text("Profiling was disabled at compile time.");
+        ImGui::Text("Configure with CIRCULATION_ENABLE_PROFILING=ON to see a phase breakdown.");
+        return;
+    }
+
+    auto statistics = getStatistics();
+    double totalHost = 0.0;
+    double totalDevice = 0.0;
+    for(const auto& s : statistics)
+        (s.second.device ? totalDevice : totalHost) += s.second.totalSeconds;
+
+    ImGui::Columns(6, "phases");
+    ImGui::Separator();
+    ImGui::Text("phase"); ImGui::NextColumn();
+    ImGui::Text("where"); ImGui::NextColumn();
+    ImGui::Text("calls"); ImGui::NextColumn();
+    ImGui::Text("avg ms"); ImGui::NextColumn();
+    ImGui::Text("share"); ImGui::NextColumn();
+    ImGui::Text("Mcells/s"); ImGui::NextColumn();
+    ImGui::Separator();
+    for(const auto& s : statistics)
+    {
+        const PhaseStatistics& p = s.second;
+        const double total = p.device ? totalDevice : totalHost;
+        ImGui::Text("%s", s.first.c_str()); ImGui::NextColumn();
+        ImGui::Text("%s", p.device ? "device" : "host"); ImGui::NextColumn();
+        ImGui::Text("%lld", static_cast<long long>(p.count)); ImGui::NextColumn();
+        ImGui::Text("%.3f", p.averageMs); ImGui::NextColumn();
+        ImGui::Text("%.1f%%", (total > 0.0) ? 100.0 * p.totalSeconds / total : 0.0); ImGui::NextColumn();
+        if(p.cellsPerSecond > 0.0)
+            ImGui::Text("%.1f", p.cellsPerSecond * 1.0e-6);
+        else
+            ImGui::Text("-");
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::Separator();
+
+    if(ImGui::Button("Reset"))
+        resetStatistics();
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename)
+{
+    std::ofstream file(filename);
+    if(!file.is_open())
+    {
+        logERROR("Profiler") << "Could not open trace file " << filename;
+        return false;
+    }
+
+    std::vector<ProfileEvent> events;
+    int numThreads = 0;
+    {
+        std::lock_guard<std::mutex> lck(m_mtx);
+        numThreads = static_cast<int>(m_threads.size());
+        for(const auto& td : m_threads)
+            td->events.read(0, events);
+    }
+
+    // device events of a thread are shown on their own track
+    auto tid = [&](const ProfileEvent& e){ return e.device ? numThreads + e.thread : e.thread; };
+    std::set<int> deviceThreads;
+
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for(const ProfileEvent& e : events)
+    {
+        if(e.device)
+            deviceThreads.insert(e.thread);
+        file << "{\"name\":\"" << e.name << "\",\"cat\":\"" << (e.device ? "device" : "host") << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid(e)
+             << ",\"ts\":" << double(e.startNs) * 1.0e-3 << ",\"dur\":" << double(e.durationNs) * 1.0e-3
+             << ",\"args\":{\"cells\":" << e.cells << "}},\n";
+    }
+    for(int i = 0; i < numThreads; i++)
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"host thread " << i << "\"}},\n";
+    for(int i : deviceThreads)
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << numThreads + i << ",\"args\":{\"name\":\"device (thread " << i << ")\"}},\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CIRCULATION\"}}\n";
+    file << "]}\n";
+
+    logINFO("Profiler") << "Wrote " << events.size() << " events to " << filename;
+    return true;
+}
+
+// function definitions of the ScopedGpuTimer class
+//-------------------------------------------------------------------
+
+ScopedGpuTimer::ScopedGpuTimer(const char* name, int64_t cells) : m_name(name), m_cells(cells)
+{
+    Profiler& p = Profiler::instance();
+    m_startEvent = p.acquireEvent();
+    m_endEvent = p.acquireEvent();
+    assert_cuda(cudaEventRecord(m_startEvent, cudaStreamPerThread));
+}
+
+ScopedGpuTimer::~ScopedGpuTimer()
+{
+    assert_cuda(cudaEventRecord(m_endEvent, cudaStreamPerThread));
+    Profiler::instance().recordDevice(m_name, m_cells, m_startEvent, m_endEvent);
+}
@@ -0,0 +1,219 @@
+/*
+ * CIRCULATION
+ * Profiler.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the Profiler, ScopedTimer and ScopedGpuTimer classes
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_PROFILER_H
+#define CIRCULATION_PROFILER_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+//--------------------
+
+// instrumentation macros, compiled to nothing when CIRCULATION_ENABLE_PROFILING is not defined
+#define CIRCULATION_PROFILER_CONCAT_IMPL(a,b) a##b
+#define CIRCULATION_PROFILER_CONCAT(a,b) CIRCULATION_PROFILER_CONCAT_IMPL(a,b)
+#if defined(CIRCULATION_ENABLE_PROFILING)
+    #define PROFILE_SCOPE(name) ScopedTimer CIRCULATION_PROFILER_CONCAT(profileScope,__LINE__)(name) //!< time the enclosing scope on the host
+    #define PROFILE_SCOPE_CELLS(name, cells) ScopedTimer CIRCULATION_PROFILER_CONCAT(profileScope,__LINE__)(name, cells) //!< time the enclosing scope on the host, cells processed for throughput
+    #define PROFILE_GPU_SCOPE(name, cells) ScopedGpuTimer CIRCULATION_PROFILER_CONCAT(profileScope,__LINE__)(name, cells) //!< time device work issued in the enclosing scope to cudaStreamPerThread
+#else
+    #define PROFILE_SCOPE(name)
+    #define PROFILE_SCOPE_CELLS(name, cells)
+    #define PROFILE_GPU_SCOPE(name, cells)
+#endif
+
+//-------------------------------------------------------------------
+/**
+ * @brief one timed interval
+ */
+struct ProfileEvent
+{
+    const char* name; //!< name of the phase, must be a string literal
+    int64_t startNs; //!< start time in ns since the profiler was created
+    int64_t durationNs; //!< duration in ns
+    int64_t cells; //!< number of cells processed, 0 if unknown
+    int thread; //!< id of the recording thread
+    bool device; //!< interval was measured on the device
+};
+
+//-------------------------------------------------------------------
+/**
+ * class ProfileRingBuffer
+ *
+ * Fixed size buffer of the latest events of one thread. Only the owning thread writes, other threads may read.
+ * Every slot is published with the index of the event it holds (release / acquire), readers skip slots that are
+ * overwritten while they read them. Readers that fall behind more than the capacity lose the oldest events.
+ *
+ */
+class ProfileRingBuffer
+{
+public:
+    static constexpr int capacity = 1<<14; //!< number of events stored
+
+    void push(const ProfileEvent& e) //!< add an event, only call from the owning thread
+    {
+        const uint64_t pos = m_written.load(std::memory_order_relaxed);
+        Slot& slot = m_slots[pos % capacity];
+        slot.sequence.store(0, std::memory_order_relaxed); // readers discard what they copy from now on
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.event = e;
+        slot.sequence.store(pos+1, std::memory_order_release);
+        m_written.store(pos+1, std::memory_order_release);
+    }
+
+    uint64_t read(uint64_t from, std::vector<ProfileEvent>& out) const //!< append events starting at index from, returns index of the next event
+    {
+        const uint64_t written = m_written.load(std::memory_order_acquire);
+        const uint64_t first = std::max(from, (written > capacity) ? written - capacity : 0);
+        for(uint64_t i = first; i < written; i++)
+        {
+            const Slot& slot = m_slots[i % capacity];
+            if(slot.sequence.load(std::memory_order_acquire) != i+1)
+                continue; // already overwritten
+            const ProfileEvent e = slot.event;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot.sequence.load(std::memory_order_relaxed) == i+1)
+                out.push_back(e);
+        }
+        return written;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence{0}; //!< index of the stored event + 1, 0 while it is written
+        ProfileEvent event; //!< the event
+    };
+
+    Slot m_slots[capacity]; //!< events, event i is stored in slot i % capacity
+    std::atomic<uint64_t> m_written{0}; //!< total number of events pushed
+};
+
+//-------------------------------------------------------------------
+/**
+ * class Profiler
+ *
+ * Collects timings of hot path phases from all threads.
+ *
+ * usage:
+ * Use the PROFILE_SCOPE(), PROFILE_SCOPE_CELLS() and PROFILE_GPU_SCOPE() macros to time phases, they compile to
+ * nothing unless CIRCULATION_ENABLE_PROFILING is defined (cmake option of the same name). Every thread records into
+ * its own ring buffer, so recording does not lock. Device timings use cuda events and are added to the ring buffer
+ * of the recording thread once the device has passed them, which is checked whenever that thread records the next
+ * device scope or calls flushDevice().
+ * Call updateStatistics() and showGui() regularly to show a breakdown of all phases, or writeChromeTrace() to export
+ * the latest events of all threads for chrome://tracing or perfetto.
+ *
+ */
+class Profiler
+{
+public:
+    struct PhaseStatistics
+    {
+        int64_t count{0}; //!< number of recorded intervals
+        double totalSeconds{0.0}; //!< sum of all intervals
+        int64_t totalCells{0}; //!< sum of the cells processed in all intervals
+        double averageMs{0.0}; //!< moving average of the duration
+        double cellsPerSecond{0.0}; //!< moving average of the throughput
+        bool device{false}; //!< phase was measured on the device
+    };
+
+    static Profiler& instance(); //!< the global profiler
+    static constexpr bool enabled() //!< was profiling enabled at compile time
+    {
+    #if defined(CIRCULATION_ENABLE_PROFILING)
+        return true;
+    #else
+        return false;
+    #endif
+    }
+
+    int64_t now() const; //!< time in ns since the profiler was created
+    void record(const ProfileEvent& e); //!< add an event to the ring buffer of the calling thread
+    int threadId(); //!< id of the calling thread
+
+    void updateStatistics(); //!< add new events of all threads to the phase statistics
+    void resetStatistics(); //!< clear phase statistics
+    std::map<std::string, PhaseStatistics> getStatistics(); //!< copy of the phase statistics
+    void showGui(); //!< draws the phase breakdown into the current window
+    bool writeChromeTrace(const std::string& filename); //!< write the latest events of all threads as chrome trace event json
+
+    cudaEvent_t acquireEvent(); //!< get an unused cuda event of the calling thread for device timing
+    void recordDevice(const char* name, int64_t cells, cudaEvent_t start, cudaEvent_t end); //!< add a pair of recorded events of the calling thread, resolved later
+    void flushDevice(); //!< wait for all device events of the calling thread and record them
+
+private:
+    Profiler();
+    struct ThreadData;
+    ThreadData& threadData(); //!< data of the calling thread, created on first use
+    void resolveDevice(ThreadData& td, bool wait); //!< record finished device events
+
+    const std::chrono::steady_clock::time_point m_start; //!< time of creation
+    std::mutex m_mtx; //!< protects thread list and statistics
+    std::vector<std::shared_ptr<ThreadData>> m_threads; //!< data of all threads that recorded events
+    std::vector<uint64_t> m_statisticsPosition; //!< position of the last read event in each ring buffer
+    std::map<std::string, PhaseStatistics> m_statistics; //!< statistics per phase
+};
+
+//-------------------------------------------------------------------
+/**
+ * @brief times the scope it lives in on the host, use the PROFILE_SCOPE macros instead of using this directly
+ */
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const char* name, int64_t cells=0) : m_name(name), m_cells(cells), m_start(Profiler::instance().now()) {}
+    ~ScopedTimer()
+    {
+        Profiler& p = Profiler::instance();
+        p.record({m_name, m_start, p.now() - m_start, m_cells, p.threadId(), false});
+    }
+    ScopedTimer(const ScopedTimer& other) = delete;
+    ScopedTimer& operator=(const ScopedTimer& other) = delete;
+
+private:
+    const char* m_name;
+    int64_t m_cells;
+    int64_t m_start;
+};
+
+/**
+ * @brief times device work issued to cudaStreamPerThread inside of the scope, use the PROFILE_GPU_SCOPE macro instead of using this directly
+ */
+class ScopedGpuTimer
+{
+public:
+    ScopedGpuTimer(const char* name, int64_t cells);
+    ~ScopedGpuTimer();
+    ScopedGpuTimer(const ScopedGpuTimer& other) = delete;
+    ScopedGpuTimer& operator=(const ScopedGpuTimer& other) = delete;
+
+private:
+    const char* m_name;
+    int64_t m_cells;
+    cudaEvent_t m_startEvent;
+    cudaEvent_t m_endEvent;
+};
+
+#endif //CIRCULATION_PROFILER_H
@@ -14,6 +14,7 @@
 // includes
 //--------------------
 #include "Renderer.h"
+#include "mipmap.h"
 //--------------------
 
 // function definitions of the Renderer class
@@ -43,13 +44,24 @@ Renderer::Renderer(int w, int h)
     m_vectorShader.setShaderModule({PROJECT_SHADER_PATH"gridRenderer.frag"});
 
     m_streamlineShader.setShaderModule({PROJECT_SHADER_PATH"streamline.vert"});
-    m_streamlineShader.setShaderModule({PROJECT_SHADER_PATH"streamline.geom"});
     m_streamlineShader.setShaderModule({PROJECT_SHADER_PATH"gridRenderer.frag"});
 
+    // streamline vertices are traced on the cpu, xyz is the position and w the length of the vector
+    glCreateBuffers(1, &m_streamlineVbo);
+    glCreateVertexArrays(1, &m_streamlineVao);
+    glVertexArrayVertexBuffer(m_streamlineVao, 0, m_streamlineVbo, 0, sizeof(glm::vec4));
+    glVertexArrayAttribFormat(m_streamlineVao, 0, 4, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(m_streamlineVao, 0, 0);
+    glEnableVertexArrayAttrib(m_streamlineVao, 0);
+    m_streamlineTracer.setSeparation(m_streamlineSeparation);
+    m_streamlineTracer.setStepSize(m_streamlineDx);
+    m_streamlineTracer.setMaxSteps(m_streamlineSteps);
+
     // try compiling shaders
     compileShader();
 
     m_aspect = float(w)/float(h);
+    m_viewportHeight = h;
     setViewMat(glm::mat4(1.0f));
     rebuildProjectionMat();
 
@@ -58,6 +70,12 @@ Renderer::Renderer(int w, int h)
     glClearColor( m_backgroundColor.x, m_backgroundColor.y, m_backgroundColor.z, 1.0f);
 }
 
+Renderer::~Renderer()
+{
+    glDeleteVertexArrays(1, &m_streamlineVao);
+    glDeleteBuffers(1, &m_streamlineVbo);
+}
+
 void Renderer::showGui(bool* show)
 {
     ImGui::SetNextWindowSize({0,0},ImGuiCond_FirstUseEver);
@@ -82,6 +100,18 @@ void Renderer::showGui(bool* show)
             if(ImGui::Checkbox("Hide back-faces",&m_backfaceCulling))
                 setBackfaceCulling(m_backfaceCulling);
 
+            ImGui::Checkbox("Automatic level of detail",&m_autoRenderLevel);
+            if(m_autoRenderLevel)
+                ImGui::DragFloat("Pixel per cell",&m_pixelPerCell,0.05f,0.1f,64.0f);
+            else
+            {
+                int level = m_renderLevel;
+                if(ImGui::SliderInt("Level of detail",&level,0,m_maxRenderLevel))
+                    setRenderLevel(level);
+            }
+            if(m_renderCs)
+                ImGui::Text("Drawing level %d: %d x %d cells", m_renderLevel, m_renderCs->getNumGridCells3d().x, m_renderCs->getNumGridCells3d().y);
+
             if(ImGui::Button("Rebuild Shader"))
                 compileShader();
         }
@@ -200,34 +230,33 @@ void Renderer::showGui(bool* show)
             if(ImGui::DragFloat("line width", &m_lineWidth, 0.1))
                 glLineWidth(m_lineWidth);
 
-            if(ImGui::DragFloat("line length", &m_streamlineLength, 0.01))
-                m_streamlineShader.uniform1f("slLength",m_streamlineLength);
+            if(ImGui::DragFloat("line distance (cells)", &m_streamlineSeparation, 0.1f, 1.0f, 1000.0f))
+                m_streamlineTracer.setSeparation(m_streamlineSeparation);
 
-            if(ImGui::DragFloat("dx", &m_streamlineDx, 0.001))
-                m_streamlineShader.uniform1f("dx",m_streamlineDx);
+            if(ImGui::DragFloat("step size (cells)", &m_streamlineDx, 0.01f, 0.01f, 10.0f))
+                m_streamlineTracer.setStepSize(m_streamlineDx);
 
-            ImGui::DragInt("Number of Streamlines",&m_numStreamlines);
+            if(ImGui::DragInt("max steps", &m_streamlineSteps, 1.0f, 1, 100000))
+                m_streamlineTracer.setMaxSteps(m_streamlineSteps);
 
-            if( ImGui::BeginCombo("Attribute##streamlineselection", (m_currentVecField<0) ? "none" : m_vectorFields[m_currentVecField].first.c_str()))
+            ImGui::DragInt("trace every n updates", &m_streamlineRefreshInterval, 0.1f, 1, 1000);
+
+            if( ImGui::BeginCombo("Attribute##streamlineselection", (m_currentStreamlineVecField<0) ? "none" : m_vectorFields[m_currentStreamlineVecField].first.c_str()))
             {
                 for(int i = 0; i < m_vectorFields.size(); i++)
                 {
                     bool selected = (m_currentStreamlineVecField == i);
-                    if(ImGui::Selectable((m_vectorFields[i].first+"##vectorfieldselection").c_str(), &selected))
+                    if(ImGui::Selectable((m_vectorFields[i].first+"##streamlineselection").c_str(), &selected))
                     {
                         m_currentStreamlineVecField = i;
-
-                        unsigned int blockIndex = 0;
-                        blockIndex = glGetProgramResourceIndex(static_cast<GLuint>(m_streamlineShader), GL_SHADER_STORAGE_BLOCK, "vectorFieldX");
-                        glShaderStorageBlockBinding(static_cast<GLuint>(m_streamlineShader), blockIndex, m_vectorFields[i].second.first);
-
-                        blockIndex = glGetProgramResourceIndex(static_cast<GLuint>(m_streamlineShader), GL_SHADER_STORAGE_BLOCK, "vectorFieldY");
-                        glShaderStorageBlockBinding(static_cast<GLuint>(m_streamlineShader), blockIndex, m_vectorFields[i].second.second);
+                        m_streamlineFieldStale = true;
                     }
                 }
                 ImGui::EndCombo();
             }
 
+            ImGui::Text("%zu lines, traced in %.2f ms", m_streamlineTracer.getCount().size(), m_streamlineTracer.getTraceTime());
+
             ImGui::Checkbox("color by length##vectorfieldselection",&m_colorstreamlinesByLength);
             m_streamlineShader.uniform1b("scalarColor",m_colorstreamlinesByLength);
 
@@ -235,8 +264,8 @@ void Renderer::showGui(bool* show)
             {
                 if(ImGui::ColorEdit3("Min Color##slmincolor", glm::value_ptr(m_minSlColor)))
                     m_streamlineShader.uniform3f("minScalarColor", m_minSlColor);
-                if(ImGui::ColorEdit3("Max Color##slmaxcolor", glm::value_ptr(m_maxVecColor)))
-                    m_streamlineShader.uniform3f("maxScalarColor", m_maxVecColor);
+                if(ImGui::ColorEdit3("Max Color##slmaxcolor", glm::value_ptr(m_maxSlColor)))
+                    m_streamlineShader.uniform3f("maxScalarColor", m_maxSlColor);
                 if(ImGui::DragFloat("Min Length##slminveclength",&m_minSlVecLength,0.01))
                     m_streamlineShader.uniform1f("minScalar",m_minSlVecLength);
                 if(ImGui::DragFloat("Max Length##slmaxveclength",&m_maxSlVecLength,0.01))
@@ -269,6 +298,19 @@ void Renderer::showGui(bool* show)
 void Renderer::setCS(std::shared_ptr<CoordinateSystem> cs)
 {
     m_cs = cs;
+    m_renderCs = cs;
+    m_renderLevel = 0;
+    m_streamlineTracer.setCS(cs);
+    m_streamlineFieldStale = true;
+
+    // keep at least a few cells in each dimension
+    int2 coarseCells = coarsenedGridSize(make_int2(m_cs->getNumGridCells3d()), 1);
+    m_maxRenderLevel = 0;
+    while(coarseCells.x >= 8 && coarseCells.y >= 8)
+    {
+        m_maxRenderLevel++;
+        coarseCells = coarsenedGridSize(coarseCells, 1);
+    }
 
     // set near / far
     glm::vec3 aabbMin{m_cs->getAABBMin().x,m_cs->getAABBMin().y, m_cs->getAABBMin().z};
@@ -285,6 +327,7 @@ void Renderer::setCS(std::shared_ptr<CoordinateSystem> cs)
         setBackfaceCulling(false);
 
     compileShader();
+    updateRenderLevel();
 }
 
 void Renderer::compileShader()
@@ -299,7 +342,7 @@ void Renderer::compileShader()
             m_gridlineShader.addDefinition(glsp::definition(m_cs->getShaderDefine()) );
         m_gridlineShader.rebuild();
         if(m_cs)
-            m_cs->setShaderUniforms(m_gridlineShader);
+            m_renderCs->setShaderUniforms(m_gridlineShader);
         m_gridlineShader.uniform3f("constantColor", m_gridlineColor);
         m_gridlineShader.uniformMat4("viewMat", m_view);
         m_gridlineShader.uniformMat4("projectionMat", m_projection);
@@ -312,7 +355,7 @@ void Renderer::compileShader()
             m_gridCenterShader.addDefinition(glsp::definition(m_cs->getShaderDefine()) );
         m_gridCenterShader.rebuild();
         if(m_cs)
-            m_cs->setShaderUniforms(m_gridCenterShader);
+            m_renderCs->setShaderUniforms(m_gridCenterShader);
         m_gridCenterShader.uniform3f("constantColor", m_gridpointColor);
         m_gridCenterShader.uniformMat4("viewMat", m_view);
         m_gridCenterShader.uniformMat4("projectionMat", m_projection);
@@ -325,7 +368,7 @@ void Renderer::compileShader()
             m_scalarShader.addDefinition(glsp::definition(m_cs->getShaderDefine()) );
         m_scalarShader.rebuild();
         if(m_cs)
-            m_cs->setShaderUniforms(m_scalarShader);
+            m_renderCs->setShaderUniforms(m_scalarShader);
         m_scalarShader.uniform3f("constantColor", m_scalarConstColor);
         m_scalarShader.uniformMat4("viewMat", m_view);
         m_scalarShader.uniformMat4("projectionMat", m_projection);
@@ -349,7 +392,7 @@ void Renderer::compileShader()
             m_vectorShader.addDefinition(glsp::definition(m_cs->getShaderDefine()) );
         m_vectorShader.rebuild();
         if(m_cs)
-            m_cs->setShaderUniforms(m_vectorShader);
+            m_renderCs->setShaderUniforms(m_vectorShader);
         m_vectorShader.uniformMat4("viewMat", m_view);
         m_vectorShader.uniformMat4("projectionMat", m_projection);
         m_vectorShader.uniformMat4("modelMat", m_model);
@@ -373,34 +416,17 @@ void Renderer::compileShader()
             glShaderStorageBlockBinding(static_cast<GLuint>(m_vectorShader), blockIndex,m_vectorFields[m_currentVecField].second.second);
         }
 
-        // compile streamline shader
-        m_streamlineShader.clearDefinitions();
-        if(m_cs)
-            m_streamlineShader.addDefinition(glsp::definition(m_cs->getShaderDefine()) );
+        // compile streamline shader, lines are traced on the cpu so it does not need the coordinate system
         m_streamlineShader.rebuild();
-        if(m_cs)
-            m_cs->setShaderUniforms(m_streamlineShader);
         m_streamlineShader.uniformMat4("viewMat", m_view);
         m_streamlineShader.uniformMat4("projectionMat", m_projection);
         m_streamlineShader.uniformMat4("modelMat", m_model);
-        m_streamlineShader.uniform1f("slLength",m_streamlineLength);
-        m_streamlineShader.uniform1f("dx",m_streamlineDx);
-        m_streamlineShader.uniform1b("scalarColor",m_colorVectorsByLength);
-        m_streamlineShader.uniform3f("minScalarColor", m_minVecColor);
-        m_streamlineShader.uniform3f("maxScalarColor", m_maxVecColor);
-        m_streamlineShader.uniform1f("minScalar",m_minVecLength);
-        m_streamlineShader.uniform1f("maxScalar",m_maxVecLength);
-        m_streamlineShader.uniform3f("constantColor", m_VectorConstColor);
-
-        if(m_currentStreamlineVecField >= 0)
-        {
-            unsigned int blockIndex = 0;
-            blockIndex = glGetProgramResourceIndex(static_cast<GLuint>(m_streamlineShader), GL_SHADER_STORAGE_BLOCK,"vectorFieldX");
-            glShaderStorageBlockBinding(static_cast<GLuint>(m_streamlineShader), blockIndex,m_vectorFields[m_currentStreamlineVecField].second.first);
-
-            blockIndex = glGetProgramResourceIndex(static_cast<GLuint>(m_streamlineShader), GL_SHADER_STORAGE_BLOCK,"vectorFieldY");
-            glShaderStorageBlockBinding(static_cast<GLuint>(m_streamlineShader), blockIndex,m_vectorFields[m_currentStreamlineVecField].second.second);
-        }
+        m_streamlineShader.uniform1b("scalarColor",m_colorstreamlinesByLength);
+        m_streamlineShader.uniform3f("minScalarColor", m_minSlColor);
+        m_streamlineShader.uniform3f("maxScalarColor", m_maxSlColor);
+        m_streamlineShader.uniform1f("minScalar",m_minSlVecLength);
+        m_streamlineShader.uniform1f("maxScalar",m_maxSlVecLength);
+        m_streamlineShader.uniform3f("constantColor", m_streamlineConstColor);
 
         updateMVP();
 
@@ -420,6 +446,7 @@ void Renderer::compileShader()
 void Renderer::setSize(int w, int h)
 {
     m_aspect = float(w) / float(h);
+    m_viewportHeight = h;
     rebuildProjectionMat();
 }
 
@@ -447,38 +474,91 @@ void Renderer::draw()
     if(m_renderScalarField)
     {
         m_scalarShader.use();
-        glDrawArrays(GL_POINTS, 0, m_cs->getNumGridCells());
+        glDrawArrays(GL_POINTS, 0, m_renderCs->getNumGridCells());
     }
 
     // visualize grid outlines
     if(m_renderGridlines)
     {
         m_gridlineShader.use();
-        glDrawArrays(GL_POINTS, 0, m_cs->getNumGridCells());
+        glDrawArrays(GL_POINTS, 0, m_renderCs->getNumGridCells());
     }
 
     // visualize grid centerpoints
     if(m_renderGridpoints)
     {
         m_gridCenterShader.use();
-        glDrawArrays(GL_POINTS, 0, m_cs->getNumGridCells());
+        glDrawArrays(GL_POINTS, 0, m_renderCs->getNumGridCells());
     }
 
     // visualize vectors
     if(m_renderVectorField && m_currentVecField >= 0)
     {
         m_vectorShader.use();
-        glDrawArrays(GL_POINTS, 0, m_cs->getNumGridCells());
+        glDrawArrays(GL_POINTS, 0, m_renderCs->getNumGridCells());
     }
 
     // draw streamlines
-    if(m_renderStreamlines)// && m_currentVecField >= 0)
+    if(m_renderStreamlines && m_currentStreamlineVecField >= 0)
     {
+        updateStreamlines();
         m_streamlineShader.use();
-        glDrawArrays(GL_POINTS,0,m_numStreamlines);
+        glBindVertexArray(m_streamlineVao);
+        glMultiDrawArrays(GL_LINE_STRIP, m_streamlineTracer.getFirst().data(), m_streamlineTracer.getCount().data(),
+                          static_cast<GLsizei>(m_streamlineTracer.getCount().size()));
     }
 }
 
+void Renderer::notifyNewData()
+{
+    m_fieldVersion++;
+}
+
+void Renderer::readRenderBuffer(int bufferId, std::vector<float>& data)
+{
+    GLint buffer = 0;
+    glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, bufferId, &buffer);
+    data.resize(m_renderCs->getNumGridCells());
+    glGetNamedBufferSubData(static_cast<GLuint>(buffer), 0, data.size() * sizeof(float), data.data());
+}
+
+void Renderer::updateStreamlines()
+{
+    // reading back the field stalls the pipeline, so it is only done when the field changed
+    if(m_streamlineFieldStale || m_fieldVersion - m_streamlineFieldVersion >= static_cast<uint64_t>(m_streamlineRefreshInterval))
+    {
+        readRenderBuffer(m_vectorFields[m_currentStreamlineVecField].second.first, m_streamlineFieldX);
+        readRenderBuffer(m_vectorFields[m_currentStreamlineVecField].second.second, m_streamlineFieldY);
+        m_streamlineFieldVersion = m_fieldVersion;
+        m_streamlineFieldStale = false;
+        m_streamlineTracer.invalidate();
+    }
+
+    if(m_streamlineTracer.update(m_streamlineFieldX, m_streamlineFieldY, m_streamlineFieldVersion))
+    {
+        const std::vector<glm::vec4>& vertices = m_streamlineTracer.getVertices();
+        glNamedBufferData(m_streamlineVbo, vertices.size() * sizeof(glm::vec4), vertices.data(), GL_DYNAMIC_DRAW);
+    }
+}
+
+std::vector<int> Renderer::getDisplayedBuffers() const
+{
+    std::vector<int> ids;
+    if(m_renderScalarField && m_currentScalarField >= 0)
+        ids.push_back(m_scalarFields[m_currentScalarField].second);
+    if(m_renderVectorField && m_currentVecField >= 0)
+    {
+        ids.push_back(m_vectorFields[m_currentVecField].second.first);
+        ids.push_back(m_vectorFields[m_currentVecField].second.second);
+    }
+    if(m_renderStreamlines && m_currentStreamlineVecField >= 0)
+    {
+        ids.push_back(m_vectorFields[m_currentStreamlineVecField].second.first);
+        ids.push_back(m_vectorFields[m_currentStreamlineVecField].second.second);
+    }
+    return ids;
+}
+
 void Renderer::setViewMat(const glm::mat4& view)
 {
     m_view = view;
@@ -488,6 +568,48 @@ void Renderer::setViewMat(const glm::mat4& view)
     m_vectorShader.uniformMat4("viewMat", m_view);
     m_streamlineShader.uniformMat4("viewMat", m_view);
     updateMVP();
+    updateRenderLevel();
+}
+
+void Renderer::updateRenderLevel()
+{
+    if(!m_cs || !m_autoRenderLevel)
+        return;
+
+    // size of a full resolution cell near the center of the grid
+    const int3 numGridCells = m_cs->getNumGridCells3d();
+    const int center = m_cs->getCellId(int3{numGridCells.x/2, numGridCells.y/2, 0});
+    const float3 a = m_cs->getCartesian(m_cs->getCellCoordinate(center));
+    const float3 b = m_cs->getCartesian(m_cs->getCellCoordinate(m_cs->getRightNeighbor(center)));
+    const float cellSize = length(b - a) * m_scale;
+
+    // seen from the camera at the closest point of the bounding box
+    const glm::vec3 camera = glm::vec3(glm::inverse(m_view)[3]);
+    const glm::vec3 aabbMin = m_scale * glm::vec3(m_cs->getAABBMin().x, m_cs->getAABBMin().y, m_cs->getAABBMin().z);
+    const glm::vec3 aabbMax = m_scale * glm::vec3(m_cs->getAABBMax().x, m_cs->getAABBMax().y, m_cs->getAABBMax().z);
+    const float distance = std::max(glm::length(camera - glm::clamp(camera, aabbMin, aabbMax)), m_near);
+    const float pixelPerCell = cellSize / (2.0f * distance * std::tan(glm::radians(m_fovy) * 0.5f)) * float(m_viewportHeight);
+
+    int level = 0;
+    while(level < m_maxRenderLevel && pixelPerCell * float(1<<level) < m_pixelPerCell)
+        level++;
+    setRenderLevel(level);
+}
+
+void Renderer::setRenderLevel(int level)
+{
+    level = std::min(std::max(level, 0), m_maxRenderLevel);
+    if(!m_cs || level == m_renderLevel)
+        return;
+
+    m_renderLevel = level;
+    m_renderCs = (level > 0) ? m_cs->createCoarsened(level) : m_cs;
+    m_renderCs->setShaderUniforms(m_gridlineShader);
+    m_renderCs->setShaderUniforms(m_gridCenterShader);
+    m_renderCs->setShaderUniforms(m_scalarShader);
+    m_renderCs->setShaderUniforms(m_vectorShader);
+    m_streamlineTracer.setCS(m_renderCs);
+    m_streamlineFieldStale = true;
 }
 
 void Renderer::rebuildProjectionMat()
@@ -554,12 +676,7 @@ void Renderer::setVecFields(std::vector<std::pair<std::string, std::pair<int, in
     glShaderStorageBlockBinding(static_cast<GLuint>(m_vectorShader), blockIndex, m_vectorFields[m_currentVecField].second.first);
     blockIndex = glGetProgramResourceIndex(static_cast<GLuint>(m_vectorShader), GL_SHADER_STORAGE_BLOCK, "vectorFieldY");
     glShaderStorageBlockBinding(static_cast<GLuint>(m_vectorShader), blockIndex, m_vectorFields[m_currentVecField].second.second);
-
-    blockIndex = glGetProgramResourceIndex(static_cast<GLuint>(m_streamlineShader), GL_SHADER_STORAGE_BLOCK,"vectorFieldX");
-    glShaderStorageBlockBinding(static_cast<GLuint>(m_streamlineShader), blockIndex,m_vectorFields[m_currentStreamlineVecField].second.first);
-    blockIndex = glGetProgramResourceIndex(static_cast<GLuint>(m_streamlineShader), GL_SHADER_STORAGE_BLOCK,"vectorFieldY");
-    glShaderStorageBlockBinding(static_cast<GLuint>(m_streamlineShader), blockIndex,m_vectorFields[m_currentStreamlineVecField].second.second);
-
+    m_streamlineFieldStale = true;
 
 }
 
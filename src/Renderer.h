@@ -19,6 +19,7 @@
 #include <mpUtils/mpUtils.h>
 #include <mpUtils/mpGraphics.h>
 #include "coordinateSystems/CoordinateSystem.h"
+#include "StreamlineTracer.h"
 //--------------------
 
 //-------------------------------------------------------------------
@@ -32,6 +33,10 @@
  * Bin the grids buffers to the vao using getVAO() also bind them to the same positions of SSBO binding point.
  * Declare the grid using declareGrid().
  * Set view and projection matrix, then call draw(). Call Size() in your framebuffer resize callback.
+ * Pass getDisplayedBuffers() to the grid before rendering, so only the buffers that are drawn are updated.
+ * Call notifyNewData() after startRendering() when the grid has new render data, so cached streamlines are traced again.
+ * Large grids are drawn at a coarser level of the grid pyramid, chosen from screen resolution and zoom. Pass getRenderLevel()
+ * to the grid before rendering, so the render buffers contain that level.
  * To change setting show the renderer ui with showUi().
  *
  */
@@ -40,6 +45,9 @@ class Renderer
 public:
 
     Renderer(int w, int h); //!< create renderer with width and height of window
+    ~Renderer();
+    Renderer(const Renderer& other) = delete;
+    Renderer& operator=(const Renderer& other) = delete;
 
     void setCS(std::shared_ptr<CoordinateSystem> cs); //!< sets the coordinate system
     mpu::gph::VertexArray& getVAO(); //!< get a reference to the vao so buffers can be bound to it
@@ -51,6 +59,9 @@ public:
 
     void showGui(bool* show); //!< show user interface for rendering settings
     void draw(); //!< draw the grid
+    void notifyNewData(); //!< the render buffers of the grid contain new data
+    std::vector<int> getDisplayedBuffers() const; //!< ids of the buffers read by the current visualization settings
+    int getRenderLevel() const {return m_renderLevel;} //!< level of the grid pyramid that is drawn
 
 private:
 
@@ -59,6 +70,8 @@ private:
     float m_scale{1.0}; //!< global scale factor
     bool m_backfaceCulling{false}; //!< is backface culling on / off?
     bool m_colorCodeCellID{false}; //!< is backface culling on / off?
+    bool m_autoRenderLevel{true}; //!< choose the level of detail from screen resolution and zoom
+    float m_pixelPerCell{2.0f}; //!< smallest on screen size of a cell in pixel when choosing the level automatically
 
     bool m_renderGridlines{false};   //!< should grid lines be rendered
     glm::vec3 m_gridlineColor{1.0,1.0,1.0}; //!< gridline color
@@ -87,9 +100,10 @@ private:
 
     bool m_renderStreamlines{false}; //!< should streamlines be rendered
     float m_lineWidth{1.0}; //!< width of lines
-    int m_numStreamlines{200}; //!< number of streamlines
-    float m_streamlineLength{1.0}; //!< length of streamlines
-    float m_streamlineDx{0.01}; //!< streamline integration steps
+    float m_streamlineSeparation{8.0}; //!< distance between streamlines in grid cells
+    float m_streamlineDx{0.5}; //!< streamline integration step in grid cells
+    int m_streamlineSteps{200}; //!< maximum integration steps in each direction of a seed
+    int m_streamlineRefreshInterval{1}; //!< trace streamlines again after this many updates of the vector field
     glm::vec3 m_streamlineConstColor{0.0,0.8,1.0}; //!< streamline color
     bool m_colorstreamlinesByLength{false}; //!< should streamlines be colored by length, or constant?
     glm::vec3 m_minSlColor{0.0,0.0,0.0}; //!< color of smallest value
@@ -103,6 +117,7 @@ private:
     float m_unscaledFar{50}; //!< far plane without scaling
     float m_fovy{60}; //!< field of view in degrees
     float m_aspect; //!< aspect ratio of the current window
+    int m_viewportHeight; //!< height of the window in pixel
 
     glm::mat4 m_projection{1.0}; //!< projection matrix used when rendering
     glm::mat4 m_view{1.0}; //!< view matrix used when rendering
@@ -110,9 +125,20 @@ private:
 
     // stuff to render
     std::shared_ptr<CoordinateSystem> m_cs{nullptr}; //!< coordinate system to use for rendering
+    std::shared_ptr<CoordinateSystem> m_renderCs{nullptr}; //!< coordinate system of the rendered level of the grid pyramid
+    int m_renderLevel{0}; //!< rendered level of the grid pyramid
+    int m_maxRenderLevel{0}; //!< coarsest level that can be rendered
     std::vector<std::pair<std::string,int>> m_scalarFields; //!< scalar fields used for visualization, name and buffer id
     std::vector<std::pair<std::string,std::pair<int,int>>> m_vectorFields; //!< scalar fields used for visualization, name and buffer id
 
+    // streamlines
+    StreamlineTracer m_streamlineTracer; //!< traces streamlines on the cpu
+    uint64_t m_fieldVersion{1}; //!< incremented whenever the grid has new render data
+    uint64_t m_streamlineFieldVersion{0}; //!< field version of the vector field copy used for tracing
+    bool m_streamlineFieldStale{true}; //!< the vector field copy needs to be read back before tracing
+    std::vector<float> m_streamlineFieldX; //!< host copy of the x component of the streamline vector field
+    std::vector<float> m_streamlineFieldY; //!< host copy of the y component of the streamline vector field
+
     // opengl objects
     mpu::gph::ShaderProgram m_streamlineShader; //!< shader to draw streamlines
     mpu::gph::ShaderProgram m_vectorShader; //!< shader used for rendering
@@ -120,6 +146,8 @@ private:
     mpu::gph::ShaderProgram m_gridlineShader; //!< shader used for rendering
     mpu::gph::ShaderProgram m_gridCenterShader; //!< shader used for rendering
     mpu::gph::VertexArray m_vao; //!< vertex array to use for rendering
+    GLuint m_streamlineVao{0}; //!< vertex array for the streamline vertices
+    GLuint m_streamlineVbo{0}; //!< buffer of the streamline vertices
 
     // internal helper functions
     void compileShader(); //!< comile / recompile all visualization shader
@@ -127,6 +155,10 @@ private:
     void rebuildProjectionMat(); //!< set the projection matrix using a aspect ratio
     void updateMVP(); //!< update model  view projection on all shaders
     void setBackfaceCulling(bool enable); //!< enable / disable backface culling
+    void readRenderBuffer(int bufferId, std::vector<float>& data); //!< read back the float render buffer bound to SSBO binding bufferId
+    void updateStreamlines(); //!< read back the vector field and trace streamlines if necessary
+    void updateRenderLevel(); //!< choose the level of the grid pyramid from screen resolution and zoom
+    void setRenderLevel(int level); //!< change the level of the grid pyramid that is rendered
 };
 
 
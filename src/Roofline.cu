@@ -0,0 +1,112 @@
+/*
+ * CIRCULATION
+ * Roofline.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * analytic cost of the model kernels and a roofline model of the device
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "Roofline.h"
+#include <algorithm>
+#include <iomanip>
+//--------------------
+
+namespace {
+    //!< single precision cores per multiprocessor of a compute capability
+    int coresPerMultiprocessor(int major, int minor)
+    {
+        switch(major)
+        {
+            case 3: return 192;
+            case 5: return 128;
+            case 6: return (minor == 0) ? 64 : 128;
+            case 7: return 64;
+            case 8: return (minor == 0) ? 64 : 128;
+            default: return 128;
+        }
+    }
+}
+
+const std::vector<KernelCost>& getKernelCosts()
+{
+    // shallow water A: reads phi, velX, velY, phi(t-1), writes phi(t+1), phi+K, vorticity and potential vorticity
+    // shallow water B: reads phi+K, vorticity, velX, velY and both velocities at t-1, writes both velocities
+    // test simulation A: reads density, velX, velY, temperature, writes 2 gradients, divergence, laplace and curl
+    // test simulation B: reads curl, temperature and its gradient, writes temperature and curl
+    // gather member: reads and writes all four attributes of one member
+    static const std::vector<KernelCost> costs = {
+            {"shallow water A", 32.0, 53.0},
+            {"shallow water B", 32.0, 22.0},
+            {"ensemble A", 32.0, 53.0},
+            {"ensemble B", 32.0, 22.0},
+            {"test simulation A", 44.0, 54.0},
+            {"test simulation B", 28.0, 20.0},
+            {"gather member", 32.0, 0.0},
+    };
+    return costs;
+}
+
+const KernelCost* findKernelCost(const std::string& phase)
+{
+    for(const KernelCost& c : getKernelCosts())
+        if(phase == c.phase)
+            return &c;
+    return nullptr;
+}
+
+MachinePeak MachinePeak::currentDevice()
+{
+    int device = 0;
+    cudaDeviceProp prop{};
+    assert_cuda(cudaGetDevice(&device));
+    assert_cuda(cudaGetDeviceProperties(&prop, device));
+
+    // clock rates are given in kHz, memory is double data rate, fused multiply add counts as two flops
+    MachinePeak peak;
+    peak.name = prop.name;
+    peak.gigabytesPerSecond = 2.0 * double(prop.memoryClockRate) * 1.0e3 * double(prop.memoryBusWidth / 8) * 1.0e-9;
+    peak.gigaflopsPerSecond = 2.0 * double(prop.multiProcessorCount) * coresPerMultiprocessor(prop.major, prop.minor)
+                              * double(prop.clockRate) * 1.0e3 * 1.0e-9;
+    return peak;
+}
+
+double MachinePeak::attainableGigaflops(double intensity) const
+{
+    return std::min(gigaflopsPerSecond, intensity * gigabytesPerSecond);
+}
+
+RooflinePoint evaluateRoofline(const std::string& name, double bytesPerCell, double flopsPerCell, double cellsPerSecond, const MachinePeak& peak)
+{
+    RooflinePoint p;
+    p.name = name;
+    p.intensity = (bytesPerCell > 0.0) ? flopsPerCell / bytesPerCell : 0.0;
+    p.achievedGigabytes = bytesPerCell * cellsPerSecond * 1.0e-9;
+    p.achievedGigaflops = flopsPerCell * cellsPerSecond * 1.0e-9;
+    p.attainableGigaflops = peak.attainableGigaflops(p.intensity);
+    p.memoryBound = p.intensity * peak.gigabytesPerSecond < peak.gigaflopsPerSecond;
+    if(p.memoryBound)
+        p.efficiency = (peak.gigabytesPerSecond > 0.0) ? p.achievedGigabytes / peak.gigabytesPerSecond : 0.0;
+    else
+        p.efficiency = (p.attainableGigaflops > 0.0) ? p.achievedGigaflops / p.attainableGigaflops : 0.0;
+    return p;
+}
+
+void writeRooflineReport(std::ostream& os, const std::vector<RooflinePoint>& points, const MachinePeak& peak)
+{
+    os << "Roofline of " << peak.name << ": " << std::setprecision(4) << peak.gigabytesPerSecond << " GB/s, "
+       << peak.gigaflopsPerSecond << " GFLOP/s, ridge point at " << peak.gigaflopsPerSecond / peak.gigabytesPerSecond << " flop/byte\n";
+    os << std::left << std::setw(48) << "kernel" << std::right << std::setw(10) << "flop/B" << std::setw(12) << "GB/s"
+       << std::setw(12) << "GFLOP/s" << std::setw(14) << "attainable" << std::setw(10) << "bound" << std::setw(12) << "efficiency" << "\n";
+    for(const RooflinePoint& p : points)
+        os << std::left << std::setw(48) << p.name << std::right << std::setprecision(3)
+           << std::setw(10) << p.intensity << std::setw(12) << p.achievedGigabytes << std::setw(12) << p.achievedGigaflops
+           << std::setw(14) << p.attainableGigaflops << std::setw(10) << (p.memoryBound ? "memory" : "compute")
+           << std::setw(11) << p.efficiency * 100.0 << "%\n";
+}
@@ -0,0 +1,77 @@
+/*
+ * CIRCULATION
+ * Roofline.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * analytic cost of the model kernels and a roofline model of the device
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_ROOFLINE_H
+#define CIRCULATION_ROOFLINE_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * @brief analytically counted cost of a kernel per grid cell
+ *  Bytes count every value once, assuming neighbour accesses hit the cache. Flops count additions, multiplications
+ *  and divisions in geographical coordinates, special functions count as one flop.
+ */
+struct KernelCost
+{
+    const char* phase; //!< name of the profiler phase of the kernel
+    double bytesPerCell; //!< compulsory memory traffic per cell
+    double flopsPerCell; //!< floating point operations per cell
+
+    double intensity() const {return flopsPerCell / bytesPerCell;} //!< arithmetic intensity in flop/byte
+};
+
+const std::vector<KernelCost>& getKernelCosts(); //!< cost of all model kernels
+const KernelCost* findKernelCost(const std::string& phase); //!< cost of the kernel timed in phase, nullptr if unknown
+
+//-------------------------------------------------------------------
+/**
+ * @brief peak performance of a device
+ */
+struct MachinePeak
+{
+    std::string name; //!< name of the device
+    double gigabytesPerSecond{0.0}; //!< theoretical memory bandwidth
+    double gigaflopsPerSecond{0.0}; //!< theoretical single precision throughput
+
+    static MachinePeak currentDevice(); //!< compute peaks of the current cuda device from its properties
+    double attainableGigaflops(double intensity) const; //!< roofline: min(compute peak, intensity * bandwidth)
+};
+
+//-------------------------------------------------------------------
+/**
+ * @brief position of one kernel in the roofline model
+ */
+struct RooflinePoint
+{
+    std::string name; //!< name of the kernel or benchmark
+    double intensity{0.0}; //!< flop per byte
+    double achievedGigabytes{0.0}; //!< achieved GB/s
+    double achievedGigaflops{0.0}; //!< achieved GFLOP/s
+    double attainableGigaflops{0.0}; //!< roofline limit at this intensity
+    bool memoryBound{true}; //!< the roofline limit at this intensity is the bandwidth
+    double efficiency{0.0}; //!< fraction of the attainable performance (of the bandwidth for memory bound kernels)
+};
+
+RooflinePoint evaluateRoofline(const std::string& name, double bytesPerCell, double flopsPerCell, double cellsPerSecond, const MachinePeak& peak); //!< place a kernel in the roofline model
+void writeRooflineReport(std::ostream& os, const std::vector<RooflinePoint>& points, const MachinePeak& peak); //!< write a table of all points
+
+#endif //CIRCULATION_ROOFLINE_H
@@ -0,0 +1,166 @@
+/*
+ * CIRCULATION
+ * SoftwareRasterizer.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the SoftwareRasterizer class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "SoftwareRasterizer.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+//--------------------
+
+// variables
+//--------------------
+constexpr int SoftwareRasterizer::tileSize;
+//--------------------
+
+namespace {
+    //!< convert a color channel from 0-1 to a byte
+    uint8_t toByte(float c)
+    {
+        return static_cast<uint8_t>(fminf(fmaxf(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+// function definitions of the SoftwareRasterizer class
+//-------------------------------------------------------------------
+
+void SoftwareRasterizer::setSize(int width, int height)
+{
+    m_width = std::max(width, 1);
+    m_height = std::max(height, 1);
+}
+
+void SoftwareRasterizer::prepare(const CoordinateSystem& cs)
+{
+    ImageProjection projection = m_projection;
+    if(projection == ImageProjection::automatic)
+        projection = (cs.getType() == CSType::geographical2d) ? ImageProjection::equirectangular : ImageProjection::cartesian;
+    if(projection != ImageProjection::cartesian && cs.getType() != CSType::geographical2d)
+    {
+        logWARNING("SoftwareRasterizer") << "Map projections need geographical coordinates, using cartesian view.";
+        projection = ImageProjection::cartesian;
+    }
+
+    const int3 numCells = cs.getNumGridCells3d();
+    const bool periodicX = cs.hasBoundary().x == 0;
+    const float2 minCoord = make_float2(cs.getMinCoord());
+    const float2 maxCoord = make_float2(cs.getMaxCoord());
+    const float2 cellSize = make_float2(cs.getCellSize());
+
+    // the cartesian view includes the outer half of the border cells
+    const float2 viewMin = minCoord - 0.5f * cellSize;
+    const float2 viewMax = maxCoord + 0.5f * cellSize;
+    const float discRadius = 0.5f * float(std::min(m_width, m_height));
+
+    // the equirectangular view covers the region of regional grids, latitude is limited to the poles
+    const float2 mapMin = make_float2( periodicX ? minCoord.x : viewMin.x, fmaxf(viewMin.y, -M_PI_2f32));
+    const float2 mapMax = make_float2( periodicX ? maxCoord.x : viewMax.x, fminf(viewMax.y, M_PI_2f32));
+
+    m_pixelCell.assign(size_t(m_width) * m_height, -1);
+    #pragma omp parallel for schedule(static)
+    for(int py = 0; py < m_height; py++)
+        for(int px = 0; px < m_width; px++)
+        {
+            const float u = (float(px) + 0.5f) / float(m_width);
+            const float v = (float(py) + 0.5f) / float(m_height);
+
+            float2 coord;
+            if(projection == ImageProjection::cartesian)
+                coord = make_float2( viewMin.x + u * (viewMax.x - viewMin.x), viewMax.y - v * (viewMax.y - viewMin.y));
+            else if(projection == ImageProjection::equirectangular)
+                coord = make_float2( mapMin.x + u * (mapMax.x - mapMin.x), mapMax.y - v * (mapMax.y - mapMin.y));
+            else
+            {
+                // point on the visible hemisphere, seen from far away above the equator
+                const float x = (float(px) + 0.5f - 0.5f * float(m_width)) / discRadius;
+                const float y = (0.5f * float(m_height) - float(py) - 0.5f) / discRadius;
+                const float d = x*x + y*y;
+                if(d > 1.0f)
+                    continue;
+                coord = make_float2( m_centerLongitude + atan2f(x, sqrtf(1.0f - d)), asinf(y));
+            }
+
+            if(periodicX)
+            {
+                coord.x = minCoord.x + fmodf(coord.x - minCoord.x, maxCoord.x - minCoord.x);
+                if(coord.x < minCoord.x)
+                    coord.x += maxCoord.x - minCoord.x;
+            }
+
+            int3 cell = cs.getCellId3d(make_float3(coord.x, coord.y, 0.0f));
+            if(periodicX)
+                cell.x = (cell.x % numCells.x + numCells.x) % numCells.x;
+            if(cell.x < 0 || cell.x >= numCells.x || cell.y < 0 || cell.y >= numCells.y)
+                continue;
+            m_pixelCell[size_t(py) * m_width + px] = cs.getCellId(cell);
+        }
+}
+
+void SoftwareRasterizer::render(const float* field, const ColorMap& colorMap, std::vector<uint8_t>& rgb) const
+{
+    assert_critical(m_pixelCell.size() == size_t(m_width) * m_height, "SoftwareRasterizer", "Call prepare() before render().");
+
+    rgb.resize(size_t(m_width) * m_height * 3);
+    const float range = colorMap.maxValue - colorMap.minValue;
+    const float scale = (range != 0.0f) ? 1.0f / range : 0.0f;
+    const uint8_t background[3] = {toByte(m_background.x), toByte(m_background.y), toByte(m_background.z)};
+
+    const int tilesX = (m_width + tileSize - 1) / tileSize;
+    const int tilesY = (m_height + tileSize - 1) / tileSize;
+    #pragma omp parallel for schedule(dynamic)
+    for(int tile = 0; tile < tilesX * tilesY; tile++)
+    {
+        const int x0 = (tile % tilesX) * tileSize;
+        const int y0 = (tile / tilesX) * tileSize;
+        const int x1 = std::min(x0 + tileSize, m_width);
+        const int y1 = std::min(y0 + tileSize, m_height);
+        for(int py = y0; py < y1; py++)
+            for(int px = x0; px < x1; px++)
+            {
+                const size_t pixel = size_t(py) * m_width + px;
+                uint8_t* out = &rgb[pixel * 3];
+                const int cell = m_pixelCell[pixel];
+                if(cell < 0)
+                {
+                    out[0] = background[0];
+                    out[1] = background[1];
+                    out[2] = background[2];
+                    continue;
+                }
+
+                const float f = fminf(fmaxf((field[cell] - colorMap.minValue) * scale, 0.0f), 1.0f);
+                out[0] = toByte(colorMap.minColor.x + f * (colorMap.maxColor.x - colorMap.minColor.x));
+                out[1] = toByte(colorMap.minColor.y + f * (colorMap.maxColor.y - colorMap.minColor.y));
+                out[2] = toByte(colorMap.minColor.z + f * (colorMap.maxColor.z - colorMap.minColor.z));
+            }
+    }
+}
+
+bool SoftwareRasterizer::writePpm(const std::string& filename, int width, int height, const std::vector<uint8_t>& rgb)
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if(!file)
+    {
+        logERROR("SoftwareRasterizer") << "Could not open image file " << filename << ": " << strerror(errno);
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    const bool ok = fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+    fclose(file);
+    if(!ok)
+        logERROR("SoftwareRasterizer") << "Error writing image file " << filename;
+    return ok;
+}
@@ -0,0 +1,83 @@
+/*
+ * CIRCULATION
+ * SoftwareRasterizer.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the SoftwareRasterizer class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_SOFTWARERASTERIZER_H
+#define CIRCULATION_SOFTWARERASTERIZER_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+
+#include "coordinateSystems/CoordinateSystem.h"
+#include "enums.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * @brief maps scalar values linearly to colors, defaults match the scalar field settings of the Renderer
+ */
+struct ColorMap
+{
+    float3 minColor{0.0f,0.0f,0.0f}; //!< color of smallest value
+    float3 maxColor{1.0f,0.0f,0.0f}; //!< color of biggest value
+    float minValue{0.0f}; //!< smallest value
+    float maxValue{1.0f}; //!< biggest value
+};
+
+//-------------------------------------------------------------------
+/**
+ * class SoftwareRasterizer
+ *
+ * Draws a scalar field of the grid into an rgb image on the cpu, without openGL.
+ *
+ * usage:
+ * Set image size and projection, then call prepare() with the coordinate system. This computes which grid cell is
+ * visible in each pixel, so it only needs to be called again when settings or grid change. Then call render() with the
+ * scalar field (one float per cell) for every image. Tiles of the image are colored in parallel.
+ * Pixels that do not show the grid get the background color. Use writePpm() to store the image as binary ppm.
+ *
+ */
+class SoftwareRasterizer
+{
+public:
+    void setSize(int width, int height); //!< size of the image in pixel
+    void setProjection(ImageProjection projection) {m_projection = projection;} //!< projection to use
+    void setCenterLongitude(float longitude) {m_centerLongitude = longitude;} //!< longitude in the center of the orthographic projection
+    void setBackground(float3 color) {m_background = color;} //!< color of pixels outside of the grid
+
+    int getWidth() const {return m_width;} //!< width of the image
+    int getHeight() const {return m_height;} //!< height of the image
+
+    void prepare(const CoordinateSystem& cs); //!< compute the grid cell of every pixel
+    void render(const float* field, const ColorMap& colorMap, std::vector<uint8_t>& rgb) const; //!< draw field into rgb (3 bytes per pixel, rows top to bottom)
+
+    static bool writePpm(const std::string& filename, int width, int height, const std::vector<uint8_t>& rgb); //!< write an rgb image as binary ppm
+
+private:
+    static constexpr int tileSize = 64; //!< images are processed in tiles of tileSize x tileSize pixel
+
+    int m_width{1024}; //!< image width
+    int m_height{512}; //!< image height
+    ImageProjection m_projection{ImageProjection::automatic}; //!< projection
+    float m_centerLongitude{0.0f}; //!< center of the orthographic projection
+    float3 m_background{0.2f,0.2f,0.2f}; //!< color of pixels outside of the grid, same as the renderer background
+
+    std::vector<int> m_pixelCell; //!< cell visible in each pixel, -1 for background
+};
+
+#endif //CIRCULATION_SOFTWARERASTERIZER_H
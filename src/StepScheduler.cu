@@ -0,0 +1,150 @@
+/*
+ * CIRCULATION
+ * StepScheduler.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the StepScheduler class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "StepScheduler.h"
+#include <algorithm>
+#include <cmath>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpGraphics.h>
+#include <mpUtils/mpCuda.h>
+//--------------------
+
+// variables
+//--------------------
+constexpr int StepScheduler::maxSteps;
+constexpr double StepScheduler::smoothing;
+//--------------------
+
+// function definitions of the StepScheduler class
+//-------------------------------------------------------------------
+
+int StepScheduler::stepsForFrame(int fixedSteps)
+{
+    const Clock::time_point now = Clock::now();
+    if(m_started)
+    {
+        // frames that took very long (eg because the simulation was paused) are no useful measurement
+        const double frameSeconds = std::chrono::duration<double>(now - m_frameStart).count();
+        const double otherSeconds = std::max(frameSeconds - m_lastSimulateSeconds, 0.0);
+        if(frameSeconds < 2.0)
+            m_otherSeconds = (m_otherSeconds > 0.0) ? (1.0-smoothing) * m_otherSeconds + smoothing * otherSeconds : otherSeconds;
+    }
+    m_frameStart = now;
+    m_started = true;
+
+    if(m_mode == StepScheduling::fixed || m_stepSeconds <= 0.0)
+    {
+        m_steps = std::max(fixedSteps, 1);
+        return m_steps;
+    }
+
+    double steps;
+    switch(m_mode)
+    {
+        case StepScheduling::frameTime:
+        case StepScheduling::fastForward:
+            steps = (m_targetFrameMs * 0.001 - m_otherSeconds) / m_stepSeconds;
+            break;
+        case StepScheduling::simulationRate:
+        {
+            // frame period is other + steps * stepSeconds and should advance by targetRate times the frame period
+            const double maxStepsInFrame = (m_maxFrameMs * 0.001 - m_otherSeconds) / m_stepSeconds;
+            const double denominator = m_simulatedPerStep - m_targetRate * m_stepSeconds;
+            steps = (m_simulatedPerStep > 0.0 && denominator > 0.0) ? std::min(m_targetRate * m_otherSeconds / denominator, maxStepsInFrame)
+                                                                   : maxStepsInFrame;
+            break;
+        }
+        default:
+            steps = fixedSteps;
+    }
+
+    // change at most by a factor of two per frame, so single slow frames do not cause oscillations
+    steps = std::min(steps, 2.0 * m_steps);
+    m_steps = static_cast<int>(std::min(std::max(std::round(steps), 1.0), double(maxSteps)));
+    return m_steps;
+}
+
+bool StepScheduler::publishDue()
+{
+    const Clock::time_point now = Clock::now();
+    if(m_mode == StepScheduling::fastForward && m_published
+       && std::chrono::duration<double,std::milli>(now - m_lastPublish).count() < m_fastForwardMs)
+        return false;
+
+    m_lastPublish = now;
+    m_published = true;
+    return true;
+}
+
+void StepScheduler::frameSimulated(int steps, double totalSimulatedTime)
+{
+    if(m_mode != StepScheduling::fixed)
+        assert_cuda(cudaStreamSynchronize(cudaStreamPerThread));
+
+    m_lastSimulateSeconds = std::chrono::duration<double>(Clock::now() - m_frameStart).count();
+    if(steps > 0 && m_mode != StepScheduling::fixed)
+    {
+        const double stepSeconds = m_lastSimulateSeconds / steps;
+        m_stepSeconds = (m_stepSeconds > 0.0) ? (1.0-smoothing) * m_stepSeconds + smoothing * stepSeconds : stepSeconds;
+
+        const double simulatedPerStep = (totalSimulatedTime - m_lastSimulatedTime) / steps;
+        if(simulatedPerStep > 0.0)
+            m_simulatedPerStep = simulatedPerStep;
+    }
+    m_lastSimulatedTime = totalSimulatedTime;
+}
+
+void StepScheduler::reset()
+{
+    m_started = false;
+    m_published = false;
+    m_lastSimulateSeconds = 0.0;
+    m_lastSimulatedTime = 0.0;
+    m_stepSeconds = 0.0;
+    m_otherSeconds = 0.0;
+    m_simulatedPerStep = 0.0;
+    m_steps = 1;
+}
+
+void StepScheduler::showGui(int& fixedSteps)
+{
+    int mode = static_cast<int>(m_mode);
+    if(ImGui::Combo("Steps per frame", &mode, "Fixed\0Target frame time\0Target simulation rate\0Fast forward\0\0"))
+    {
+        m_mode = static_cast<StepScheduling>(mode);
+        m_stepSeconds = 0.0; // fixed mode does not wait for the device, so old measurements are not comparable
+    }
+
+    switch(m_mode)
+    {
+        case StepScheduling::fixed:
+            ImGui::DragInt("Timesteps per Rendering",&fixedSteps,0.1);
+            return;
+        case StepScheduling::frameTime:
+            ImGui::DragFloat("Target frame time (ms)", &m_targetFrameMs, 0.1f, 1.0f, 1000.0f);
+            break;
+        case StepScheduling::simulationRate:
+            ImGui::DragFloat("Simulated time per second", &m_targetRate, 0.0001f, 0.0f, 1000.0f, "%.5f");
+            ImGui::DragFloat("Max frame time (ms)", &m_maxFrameMs, 0.1f, 1.0f, 1000.0f);
+            break;
+        case StepScheduling::fastForward:
+            ImGui::DragFloat("Target frame time (ms)", &m_targetFrameMs, 0.1f, 1.0f, 1000.0f);
+            ImGui::DragFloat("Publish interval (ms)", &m_fastForwardMs, 1.0f, 1.0f, 60000.0f);
+            break;
+    }
+
+    ImGui::Text("Steps per frame: %i (%.3f ms per step, %.2f ms other)", m_steps, getStepMs(), getOtherMs());
+}
@@ -0,0 +1,86 @@
+/*
+ * CIRCULATION
+ * StepScheduler.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the StepScheduler class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_STEPSCHEDULER_H
+#define CIRCULATION_STEPSCHEDULER_H
+
+// includes
+//--------------------
+#include <chrono>
+#include "enums.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * class StepScheduler
+ *
+ * Picks the number of timesteps simulated per rendered frame.
+ *
+ * usage:
+ * Call stepsForFrame() before simulating a frame, publishDue() before the last step of the frame and frameSimulated()
+ * afterwards. The last step is only rendered if publishDue() returns true. In fixed mode the number of steps
+ * set by the user is used. All other modes measure the cost of a step and the cost of everything else in a frame
+ * (rendering, ui) and choose the number of steps for the next frame so that:
+ *  - frameTime: the whole frame takes the target frame time
+ *  - simulationRate: the simulation advances by the target amount of simulated time per second of wall clock time,
+ *                    frames never take longer than the maximum frame time
+ *  - fastForward: like frameTime, but the results are only published once per fast forward interval, so the ui stays
+ *                 responsive while the copies for rendering are skipped
+ * To measure the step cost frameSimulated() waits for the device in all modes but fixed. The frame needs
+ * the results for rendering anyway, so this costs little.
+ *
+ */
+class StepScheduler
+{
+public:
+    int stepsForFrame(int fixedSteps); //!< number of steps to simulate in the next frame, fixedSteps is used in fixed mode
+    bool publishDue(); //!< should the last step of the current frame be rendered, always true except in fastForward mode
+    void frameSimulated(int steps, double totalSimulatedTime); //!< call after steps were simulated, totalSimulatedTime is the simulated time after the last step
+    void reset(); //!< forget all measurements, eg after the simulation changed
+    void showGui(int& fixedSteps); //!< draws settings into the current window
+
+    void setMode(StepScheduling mode) {m_mode = mode;} //!< change scheduling mode
+    StepScheduling getMode() const {return m_mode;} //!< current scheduling mode
+    void setTargetFrameTime(float ms) {m_targetFrameMs = ms;} //!< frame time in frameTime mode
+    void setTargetRate(float simulatedPerSecond) {m_targetRate = simulatedPerSecond;} //!< simulated time per wall clock second in simulationRate mode
+    void setMaxFrameTime(float ms) {m_maxFrameMs = ms;} //!< upper bound of the frame time in simulationRate mode
+    void setFastForwardInterval(float ms) {m_fastForwardMs = ms;} //!< time between published frames in fastForward mode
+    double getStepMs() const {return m_stepSeconds * 1000.0;} //!< measured wall clock time of one step
+    double getOtherMs() const {return m_otherSeconds * 1000.0;} //!< measured wall clock time per frame spent outside of the simulation
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int maxSteps = 100000; //!< upper bound of steps per frame
+    static constexpr double smoothing = 0.2; //!< weight of a new measurement in the moving averages
+
+    // settings
+    StepScheduling m_mode{StepScheduling::fixed};
+    float m_targetFrameMs{16.0f}; //!< frame time in frameTime mode
+    float m_targetRate{1.0f}; //!< simulated time per wall clock second in simulationRate mode
+    float m_maxFrameMs{50.0f}; //!< upper bound of the frame time in simulationRate mode
+    float m_fastForwardMs{1000.0f}; //!< time between published frames in fastForward mode
+
+    // measurements
+    bool m_started{false}; //!< the last frame started at m_frameStart
+    Clock::time_point m_frameStart; //!< start of the last call to stepsForFrame()
+    bool m_published{false}; //!< a frame was published at m_lastPublish
+    Clock::time_point m_lastPublish; //!< time the last frame was published
+    double m_lastSimulateSeconds{0.0}; //!< wall clock time of simulating the last frame
+    double m_lastSimulatedTime{0.0}; //!< total simulated time after the last frame
+    double m_stepSeconds{0.0}; //!< moving average of the time per step, 0 if unknown
+    double m_otherSeconds{0.0}; //!< moving average of the time per frame spent outside of the simulation
+    double m_simulatedPerStep{0.0}; //!< simulated time per step, 0 if unknown
+    int m_steps{1}; //!< steps of the current frame
+};
+
+#endif //CIRCULATION_STEPSCHEDULER_H
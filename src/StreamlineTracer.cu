@@ -0,0 +1,320 @@
+/*
+ * CIRCULATION
+ * StreamlineTracer.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the StreamlineTracer class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "StreamlineTracer.h"
+#include <algorithm>
+#include <cmath>
+//--------------------
+
+namespace {
+
+    //!< one vertex of a line during tracing
+    struct LineVertex
+    {
+        float2 position; //!< position in grid index space (cell centers are at integer positions)
+        float speed; //!< length of the vector at the position
+    };
+
+    //!< one traced line, backward part is stored in reverse order before the seed
+    struct TracedLine
+    {
+        std::vector<LineVertex> vertices;
+        int seed{0}; //!< index of the seed vertex
+    };
+
+    /**
+     * @brief bilinear sampling of the staggered vector field in grid index space
+     *  by convention a cell stores the x component on its right face and the y component on its forward face
+     */
+    struct FieldSampler
+    {
+        const float* vecX;
+        const float* vecY;
+        int2 numCells;
+        bool periodicX;
+
+        int wrapX(int i) const
+        {
+            if(periodicX)
+            {
+                i %= numCells.x;
+                return (i < 0) ? i + numCells.x : i;
+            }
+            return std::min(std::max(i, 0), numCells.x - 1);
+        }
+
+        int clampY(int j) const
+        {
+            return std::min(std::max(j, 0), numCells.y - 1);
+        }
+
+        float sample(const float* field, float x, float y) const
+        {
+            const float fx0 = std::floor(x);
+            const float fy0 = std::floor(y);
+            const float fx = x - fx0;
+            const float fy = y - fy0;
+            const int i0 = wrapX(static_cast<int>(fx0));
+            const int i1 = wrapX(static_cast<int>(fx0) + 1);
+            const int j0 = clampY(static_cast<int>(fy0));
+            const int j1 = clampY(static_cast<int>(fy0) + 1);
+            const float a = (1.0f - fx) * field[j0 * numCells.x + i0] + fx * field[j0 * numCells.x + i1];
+            const float b = (1.0f - fx) * field[j1 * numCells.x + i0] + fx * field[j1 * numCells.x + i1];
+            return (1.0f - fy) * a + fy * b;
+        }
+
+        float2 operator()(const float2& p) const
+        {
+            return make_float2(sample(vecX, p.x - 0.5f, p.y), sample(vecY, p.x, p.y - 0.5f));
+        }
+
+        bool inside(float2& p) const //!< check if p is inside the grid, wraps periodic dimensions
+        {
+            if(periodicX)
+            {
+                p.x = std::fmod(p.x, float(numCells.x));
+                if(p.x < 0.0f)
+                    p.x += float(numCells.x);
+            }
+            else if(p.x < 0.0f || p.x > float(numCells.x - 1))
+                return false;
+            return p.y >= 0.0f && p.y <= float(numCells.y - 1);
+        }
+    };
+
+    /**
+     * @brief convert a vector of the field into the rate of change in grid index space
+     */
+    template <typename csT>
+    float2 indexRate(const float2& position, const float2& vec, const csT& cs)
+    {
+        static_assert(csT::isCartesian, "This overload only works for cartesian coordinates.");
+        return vec / make_float2(cs.getCellSize());
+    }
+
+    template <>
+    float2 indexRate<GeographicalCoordinates2D>(const float2& position, const float2& vec, const GeographicalCoordinates2D& cs)
+    {
+        const float latitude = cs.getMinCoord().y + position.y * cs.getCellSize().y;
+        const float rinv = 1.0f / cs.getMinCoord().z;
+        return make_float2( rinv / cos(latitude) * vec.x / cs.getCellSize().x, rinv * vec.y / cs.getCellSize().y);
+    }
+
+    /**
+     * @brief normalized direction of the field in grid index space, false at a critical point
+     */
+    template <typename csT>
+    bool direction(float2 position, const FieldSampler& field, const csT& cs, float2& dir, float& speed)
+    {
+        const float2 vec = field(position);
+        speed = length(vec);
+        const float2 rate = indexRate(position, vec, cs);
+        const float l = length(rate);
+        if(!(l > 1.0e-12f) || !std::isfinite(l))
+            return false;
+        dir = rate / l;
+        return true;
+    }
+
+    /**
+     * @brief integrate the normalized field with RK4, starting at (but not including) the seed, step can be negative
+     */
+    template <typename csT>
+    void traceDirection(float2 position, float step, int maxSteps, const FieldSampler& field, const csT& cs, std::vector<LineVertex>& line)
+    {
+        float2 prev;
+        float speed;
+        if(!direction(position, field, cs, prev, speed))
+            return;
+
+        for(int i = 0; i < maxSteps; i++)
+        {
+            float2 k1, k2, k3, k4;
+            float2 p = position;
+            float s;
+            if(!direction(p, field, cs, k1, s))
+                break;
+            p = position + 0.5f * step * k1;
+            if(!field.inside(p) || !direction(p, field, cs, k2, s))
+                break;
+            p = position + 0.5f * step * k2;
+            if(!field.inside(p) || !direction(p, field, cs, k3, s))
+                break;
+            p = position + step * k3;
+            if(!field.inside(p) || !direction(p, field, cs, k4, s))
+                break;
+
+            // stop when the line turns around, the field changes direction inside of one step
+            const float2 delta = (k1 + 2.0f * k2 + 2.0f * k3 + k4) * (1.0f/6.0f);
+            if(dot(delta, prev) <= 0.0f)
+                break;
+            prev = delta;
+
+            position = position + step * delta;
+            if(!field.inside(position) || !direction(position, field, cs, k1, speed))
+                break;
+            line.push_back({position, speed});
+        }
+    }
+}
+
+// function definitions of the StreamlineTracer class
+//-------------------------------------------------------------------
+
+void StreamlineTracer::setCS(std::shared_ptr<CoordinateSystem> cs)
+{
+    m_cs = std::move(cs);
+    m_vertices.clear();
+    m_first.clear();
+    m_count.clear();
+    invalidate();
+}
+
+void StreamlineTracer::setSeparation(float cells)
+{
+    cells = std::max(cells, 1.0f);
+    if(cells != m_separation)
+        invalidate();
+    m_separation = cells;
+}
+
+void StreamlineTracer::setStepSize(float cells)
+{
+    cells = std::max(cells, 0.01f);
+    if(cells != m_stepSize)
+        invalidate();
+    m_stepSize = cells;
+}
+
+void StreamlineTracer::setMaxSteps(int steps)
+{
+    steps = std::max(steps, 1);
+    if(steps != m_maxSteps)
+        invalidate();
+    m_maxSteps = steps;
+}
+
+void StreamlineTracer::invalidate()
+{
+    m_valid = false;
+}
+
+bool StreamlineTracer::update(const std::vector<float>& vecX, const std::vector<float>& vecY, uint64_t fieldVersion)
+{
+    if(!m_cs || (m_valid && fieldVersion == m_fieldVersion))
+        return false;
+
+    const size_t numCells = static_cast<size_t>(m_cs->getNumGridCells());
+    if(vecX.size() < numCells || vecY.size() < numCells)
+    {
+        logWARNING("StreamlineTracer") << "Vector field does not match the coordinate system, streamlines are not traced.";
+        return false;
+    }
+
+    mpu::HRStopwatch sw;
+    switch(m_cs->getType())
+    {
+        case CSType::cartesian2d:
+            traceImpl(static_cast<CartesianCoordinates2D&>(*m_cs), vecX.data(), vecY.data());
+            break;
+        case CSType::geographical2d:
+            traceImpl(static_cast<GeographicalCoordinates2D&>(*m_cs), vecX.data(), vecY.data());
+            break;
+    }
+    sw.pause();
+    m_traceTime = sw.getSeconds() * 1000.0;
+
+    m_fieldVersion = fieldVersion;
+    m_valid = true;
+    return true;
+}
+
+template <typename csT>
+void StreamlineTracer::traceImpl(const csT& cs, const float* vecX, const float* vecY)
+{
+    const int2 numCells = make_int2(cs.getNumGridCells3d());
+    const FieldSampler field{vecX, vecY, numCells, cs.hasBoundary().x == 0};
+
+    // one seed at the center of every separation sized block of cells
+    std::vector<float2> seeds;
+    const float xEnd = field.periodicX ? float(numCells.x) : float(numCells.x - 1);
+    for(float y = 0.5f * m_separation; y <= float(numCells.y - 1); y += m_separation)
+        for(float x = 0.5f * m_separation; x < xEnd; x += m_separation)
+            seeds.push_back(make_float2(x,y));
+
+    // trace all seeds in parallel
+    std::vector<TracedLine> lines(seeds.size());
+    #pragma omp parallel for schedule(dynamic, 4)
+    for(int i = 0; i < static_cast<int>(seeds.size()); i++)
+    {
+        TracedLine& line = lines[i];
+        float2 dir;
+        float speed;
+        if(!direction(seeds[i], field, cs, dir, speed))
+            continue;
+
+        traceDirection(seeds[i], -m_stepSize, m_maxSteps, field, cs, line.vertices);
+        std::reverse(line.vertices.begin(), line.vertices.end());
+        line.seed = static_cast<int>(line.vertices.size());
+        line.vertices.push_back({seeds[i], speed});
+        traceDirection(seeds[i], m_stepSize, m_maxSteps, field, cs, line.vertices);
+    }
+
+    // keep lines apart, every line is cut where it enters a block already occupied by an earlier line
+    const float blockSize = std::max(0.5f * m_separation, 1.0f);
+    const int2 numBlocks = make_int2( static_cast<int>(std::ceil(float(numCells.x) / blockSize)) + 1,
+                                      static_cast<int>(std::ceil(float(numCells.y) / blockSize)) + 1);
+    std::vector<int> owner(numBlocks.x * numBlocks.y, -1);
+    auto block = [&](const float2& p)
+    {
+        const int bx = std::min(static_cast<int>(p.x / blockSize), numBlocks.x - 1);
+        const int by = std::min(static_cast<int>(p.y / blockSize), numBlocks.y - 1);
+        return by * numBlocks.x + bx;
+    };
+    auto isFree = [&](const float2& p, int lineId)
+    {
+        const int o = owner[block(p)];
+        return o == -1 || o == lineId;
+    };
+
+    m_vertices.clear();
+    m_first.clear();
+    m_count.clear();
+    for(int l = 0; l < static_cast<int>(lines.size()); l++)
+    {
+        const std::vector<LineVertex>& v = lines[l].vertices;
+        if(v.empty() || !isFree(v[lines[l].seed].position, l))
+            continue;
+
+        int last = lines[l].seed;
+        while(last + 1 < static_cast<int>(v.size()) && isFree(v[last+1].position, l))
+            last++;
+        int first = lines[l].seed;
+        while(first > 0 && isFree(v[first-1].position, l))
+            first--;
+        if(last - first < 2)
+            continue;
+
+        m_first.push_back(static_cast<GLint>(m_vertices.size()));
+        m_count.push_back(static_cast<GLsizei>(last - first + 1));
+        for(int i = first; i <= last; i++)
+        {
+            owner[block(v[i].position)] = l;
+            const float2 coord = make_float2(cs.getMinCoord()) + v[i].position * make_float2(cs.getCellSize());
+            const float3 cartesian = cs.getCartesian(make_float3(coord.x, coord.y, 0.0f));
+            m_vertices.emplace_back(cartesian.x, cartesian.y, cartesian.z, v[i].speed);
+        }
+    }
+}
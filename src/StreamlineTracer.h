@@ -0,0 +1,82 @@
+/*
+ * CIRCULATION
+ * StreamlineTracer.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the StreamlineTracer class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_STREAMLINETRACER_H
+#define CIRCULATION_STREAMLINETRACER_H
+
+// includes
+//--------------------
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpGraphics.h>
+#include "coordinateSystems/CoordinateSystem.h"
+#include "coordinateSystems/CartesianCoordinates2D.h"
+#include "coordinateSystems/GeographicalCoordinates2D.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * class StreamlineTracer
+ *
+ * Traces streamlines of a vector field stored on the staggered grid on the cpu.
+ *
+ * usage:
+ * Set the coordinate system with setCS() and change settings using the setters. Call update() with the x and y
+ * components of the vector field and a version number that changes whenever the field changes. Lines are only traced again
+ * when the version or a setting changed. Seeds are placed one per "separation" cells and every line is cut off where it comes
+ * closer than half the separation to an earlier line, so the result is evenly spaced. Lines are integrated with RK4 along the
+ * normalized field in both directions of the seed, seeds are traced in parallel.
+ * getVertices() returns positions in cartesian coordinates with the length of the vector in w. Draw line i as a line strip
+ * starting at getFirst()[i] with getCount()[i] vertices (eg using glMultiDrawArrays()).
+ *
+ */
+class StreamlineTracer
+{
+public:
+    void setCS(std::shared_ptr<CoordinateSystem> cs); //!< set the coordinate system, drops all lines
+    void setSeparation(float cells); //!< distance between seeds in grid cells, lines keep at least half of it as distance
+    void setStepSize(float cells); //!< integration step size in grid cells
+    void setMaxSteps(int steps); //!< maximum number of steps in each direction of the seed
+
+    bool update(const std::vector<float>& vecX, const std::vector<float>& vecY, uint64_t fieldVersion); //!< trace lines again if field or settings changed, returns true if lines changed
+    void invalidate(); //!< lines are traced again on the next update
+
+    const std::vector<glm::vec4>& getVertices() const {return m_vertices;} //!< cartesian position and length of the vector of all line vertices
+    const std::vector<GLint>& getFirst() const {return m_first;} //!< first vertex of each line
+    const std::vector<GLsizei>& getCount() const {return m_count;} //!< number of vertices of each line
+    double getTraceTime() const {return m_traceTime;} //!< time in ms it took to trace the current lines
+
+private:
+    // settings
+    float m_separation{8.0f}; //!< distance between seeds in grid cells
+    float m_stepSize{0.5f}; //!< integration step in grid cells
+    int m_maxSteps{200}; //!< maximum steps in each direction
+
+    // state
+    std::shared_ptr<CoordinateSystem> m_cs{nullptr}; //!< coordinate system of the grid
+    bool m_valid{false}; //!< lines match the settings and field version
+    uint64_t m_fieldVersion{0}; //!< version of the field lines where traced from
+    double m_traceTime{0.0}; //!< time spent tracing the current lines
+
+    // results
+    std::vector<glm::vec4> m_vertices; //!< all line vertices
+    std::vector<GLint> m_first; //!< first vertex of each line
+    std::vector<GLsizei> m_count; //!< number of vertices of each line
+
+    template <typename csT>
+    void traceImpl(const csT& cs, const float* vecX, const float* vecY); //!< trace and prune all lines
+};
+
+#endif //CIRCULATION_STREAMLINETRACER_H
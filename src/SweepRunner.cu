@@ -0,0 +1,319 @@
+/*
+ * CIRCULATION
+ * SweepRunner.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the SweepRunner class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "SweepRunner.h"
+#include <thread>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+#include "coordinateSystems/CartesianCoordinates2D.h"
+#include "coordinateSystems/GeographicalCoordinates2D.h"
+#include "simulationModels/ShallowWaterModel.h"
+#include "Checkpoint.h"
+//--------------------
+
+// variables
+//--------------------
+constexpr double SweepRunner::cellsPerCore;
+//--------------------
+
+namespace {
+    //!< splits a comma separated list and converts each value using f
+    template <typename T, typename F>
+    std::vector<T> parseList(const std::string& list, F f)
+    {
+        std::vector<T> values;
+        std::stringstream ss(list);
+        std::string item;
+        while(std::getline(ss, item, ','))
+            if(!item.empty())
+                values.push_back(f(item));
+        return values;
+    }
+}
+
+// function definitions of the SweepRunner class
+//-------------------------------------------------------------------
+
+bool SweepRunner::isSweep(int argc, char* argv[])
+{
+    for(int i = 1; i < argc; i++)
+        if(strcmp(argv[i], "--sweep") == 0)
+            return true;
+    return false;
+}
+
+SweepRunner::SweepRunner(int argc, char* argv[])
+    : m_numThreads(std::max(1u, std::thread::hardware_concurrency()))
+{
+    auto nextArg = [&](int& i) -> std::string
+    {
+        if(i+1 >= argc)
+        {
+            logERROR("SweepRunner") << "Missing value for argument " << argv[i];
+            throw std::invalid_argument("missing command line value");
+        }
+        return argv[++i];
+    };
+    auto toFloat = [](const std::string& s){ return std::stof(s); };
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--sweep")
+            continue;
+        else if(arg == "--sweep-file")
+            m_sweepFile = nextArg(i);
+        else if(arg == "--sweep-cells")
+            m_cells = parseList<int2>(nextArg(i), [](const std::string& s)
+            {
+                size_t x = s.find('x');
+                return int2{std::stoi(s.substr(0,x)), (x == std::string::npos) ? std::stoi(s) : std::stoi(s.substr(x+1))};
+            });
+        else if(arg == "--sweep-diffusion")
+            m_diffusion = parseList<float>(nextArg(i), toFloat);
+        else if(arg == "--sweep-angular-velocity")
+            m_angularVelocity = parseList<float>(nextArg(i), toFloat);
+        else if(arg == "--sweep-multiplier")
+            m_multiplier = parseList<float>(nextArg(i), toFloat);
+        else if(arg == "--sweep-stddev")
+            m_stdDev = parseList<float>(nextArg(i), toFloat);
+        else if(arg == "--cs")
+        {
+            std::string cs = nextArg(i);
+            if(cs == "cartesian")
+                m_csType = CSType::cartesian2d;
+            else if(cs == "geographical")
+                m_csType = CSType::geographical2d;
+            else
+                logWARNING("SweepRunner") << "Unknown coordinate system " << cs << ", using geographical coordinates.";
+        }
+        else if(arg == "--steps")
+            m_numSteps = std::stoi(nextArg(i));
+        else if(arg == "--timestep")
+            m_timestep = std::stof(nextArg(i));
+        else if(arg == "--diagnostics-interval")
+            m_diagnosticsInterval = std::stoi(nextArg(i));
+        else if(arg == "--threads")
+            m_numThreads = std::max(1, std::stoi(nextArg(i)));
+        else
+            logWARNING("SweepRunner") << "Ignoring unknown argument " << arg;
+    }
+}
+
+void SweepRunner::readProgress()
+{
+    std::ifstream file(m_sweepFile);
+    if(!file.is_open())
+        return;
+
+    std::string line;
+    std::getline(file, line); // header
+    while(std::getline(file, line))
+        if(!line.empty())
+            m_finished.insert(std::stoi(line.substr(0, line.find(','))));
+}
+
+void SweepRunner::createRuns()
+{
+    // every combination of the parameter lists, the id encodes the position in the parameter grid
+    std::vector<SweepRun> runs;
+    int id = 0;
+    for(const int2& cells : m_cells)
+        for(float diffusion : m_diffusion)
+            for(float angularVelocity : m_angularVelocity)
+                for(float multiplier : m_multiplier)
+                    for(float stdDev : m_stdDev)
+                    {
+                        SweepRun run{id++, cells, diffusion, angularVelocity, multiplier, stdDev};
+                        run.cores = static_cast<int>(std::min(double(m_numThreads), std::max(1.0, std::round(run.cost() / cellsPerCore))));
+                        if(m_finished.count(run.id) == 0)
+                            runs.push_back(run);
+                    }
+
+    // most expensive runs first, dealt round robin so every queue gets a share of the large runs
+    std::stable_sort(runs.begin(), runs.end(), [](const SweepRun& a, const SweepRun& b){ return a.cost() > b.cost(); });
+    m_queues.assign(m_numThreads, {});
+    for(size_t i = 0; i < runs.size(); i++)
+        m_queues[i % m_numThreads].push_back(runs[i]);
+
+    m_runsTotal = static_cast<int>(runs.size());
+    logINFO("SweepRunner") << "Sweep has " << id << " runs, " << m_finished.size() << " already finished, " << m_runsTotal << " to do.";
+}
+
+bool SweepRunner::takeRun(int threadId, SweepRun& run)
+{
+    std::unique_lock<std::mutex> lck(m_mtx);
+    while(true)
+    {
+        if(CheckpointWriter::signalReceived())
+            return false;
+
+        // own queue first, otherwise steal from the queue with the most remaining work
+        std::deque<SweepRun>* queue = &m_queues[threadId];
+        if(queue->empty())
+        {
+            double maxWork = 0.0;
+            for(auto& q : m_queues)
+            {
+                double work = 0.0;
+                for(const auto& r : q)
+                    work += r.cost();
+                if(work > maxWork)
+                {
+                    maxWork = work;
+                    queue = &q;
+                }
+            }
+            if(queue->empty())
+                return false;
+        }
+
+        // first run of the queue that fits on the free cores, a large run at the front does not block smaller ones
+        auto fits = std::find_if(queue->begin(), queue->end(), [this](const SweepRun& r){ return r.cores <= m_freeCores; });
+        if(fits != queue->end())
+        {
+            run = *fits;
+            queue->erase(fits);
+            m_freeCores -= run.cores;
+            return true;
+        }
+
+        // wait for cores to be freed, wake up regularly to check for signals
+        m_cv.wait_for(lck, std::chrono::seconds(1));
+    }
+}
+
+void SweepRunner::worker(int threadId)
+{
+    SweepRun run;
+    while(takeRun(threadId, run))
+    {
+        mpu::HRStopwatch sw;
+        try
+        {
+            executeRun(run);
+        }
+        catch (const std::exception& e)
+        {
+            logERROR("SweepRunner") << "Run " << run.id << " failed: " << e.what();
+        }
+        sw.pause();
+
+        std::lock_guard<std::mutex> lck(m_mtx);
+        m_freeCores += run.cores;
+        m_coreSeconds += sw.getSeconds() * run.cores;
+        m_runsDone++;
+        logINFO("SweepRunner") << "Finished run " << run.id << " (" << m_runsDone << " / " << m_runsTotal << ") in " << sw.getSeconds() << "s";
+        m_cv.notify_all();
+    }
+}
+
+void SweepRunner::executeRun(const SweepRun& run)
+{
+    // host side parallel work of this run uses its share of the cores
+    #ifdef _OPENMP
+    omp_set_num_threads(run.cores);
+    #endif
+
+    std::shared_ptr<CoordinateSystem> cs;
+    ShallowWaterModel simulation;
+    simulation.setHeadless(true);
+    simulation.setTimestep(m_timestep);
+    simulation.setDiffusion(run.diffusion);
+    simulation.setDisturbance(float2{0,0}, run.stdDev, run.multiplier);
+    if(m_csType == CSType::cartesian2d)
+    {
+        cs = std::make_shared<CartesianCoordinates2D>(float3{-1,-1,0}, float3{1,1,0}, int3{run.numGridCells.x,run.numGridCells.y,0});
+        simulation.setCoriolisParameter(run.angularVelocity);
+    }
+    else
+    {
+        cs = std::make_shared<GeographicalCoordinates2D>(-1.55f, 1.55f, int3{run.numGridCells.x,run.numGridCells.y,1}, 1.0f);
+        simulation.setAngularVelocity(run.angularVelocity);
+    }
+
+    simulation.getDiagnostics()->setInterval(m_diagnosticsInterval);
+    std::shared_ptr<GridBase> grid = simulation.recreate(cs);
+
+    // kernels of this thread go to its own default stream, so runs of different threads overlap on the device
+    mpu::HRStopwatch sw;
+    simulation.setIterations(m_numSteps);
+    simulation.resume();
+    simulation.run();
+    assert_cuda(cudaStreamSynchronize(cudaStreamPerThread));
+    sw.pause();
+
+    // store results
+    const ConservationDiagnostics& diagnostics = *simulation.getDiagnostics();
+    std::lock_guard<std::mutex> lck(m_fileMtx);
+    m_file << run.id << "," << run.numGridCells.x << "," << run.numGridCells.y << "," << run.diffusion << "," << run.angularVelocity
+           << "," << run.multiplier << "," << run.stdDev << "," << run.cores << "," << sw.getSeconds();
+    for(int q = 0; q < ConservationDiagnostics::numQuantities; q++)
+        m_file << "," << diagnostics.getRelativeDrift(q);
+    m_file << std::endl;
+}
+
+int SweepRunner::run()
+{
+    readProgress();
+    createRuns();
+
+    const bool newFile = m_finished.empty();
+    m_file.open(m_sweepFile, newFile ? std::ios::out : std::ios::app);
+    if(!m_file.is_open())
+    {
+        logERROR("SweepRunner") << "Could not open sweep file " << m_sweepFile;
+        return 1;
+    }
+    if(newFile)
+    {
+        m_file << "run,cells_x,cells_y,diffusion,angular_velocity,multiplier,stddev,cores,seconds";
+        for(int q = 0; q < ConservationDiagnostics::numQuantities; q++)
+        {
+            std::string name = ConservationDiagnostics::getQuantityName(q);
+            std::replace(name.begin(), name.end(), ' ', '_');
+            m_file << ",drift_" << name;
+        }
+        m_file << std::endl;
+    }
+
+    CheckpointWriter::installSignalHandler();
+    logINFO("SweepRunner") << "Running sweep with " << m_numThreads << " threads, results are written to " << m_sweepFile;
+
+    mpu::HRStopwatch sw;
+    m_freeCores = m_numThreads;
+    std::vector<std::thread> threads;
+    for(int i = 0; i < m_numThreads; i++)
+        threads.emplace_back(&SweepRunner::worker, this, i);
+    for(auto& t : threads)
+        t.join();
+    sw.pause();
+
+    logINFO("SweepRunner") << "Finished " << m_runsDone << " runs in " << sw.getSeconds() << "s, core utilization "
+                           << 100.0 * m_coreSeconds / (sw.getSeconds() * m_numThreads) << "%";
+
+    if(CheckpointWriter::signalReceived())
+    {
+        logINFO("SweepRunner") << "Received SIGTERM, sweep stopped. Run again with the same arguments to continue.";
+        return 1;
+    }
+    return 0;
+}
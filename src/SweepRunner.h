@@ -0,0 +1,126 @@
+/*
+ * CIRCULATION
+ * SweepRunner.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the SweepRunner class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_SWEEPRUNNER_H
+#define CIRCULATION_SWEEPRUNNER_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+
+#include "enums.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * @brief one simulation of a parameter sweep
+ */
+struct SweepRun
+{
+    int id; //!< position in the parameter grid, stable as long as the parameter lists do not change
+    int2 numGridCells; //!< resolution
+    float diffusion; //!< geopotential diffusion
+    float angularVelocity; //!< angular velocity (geographical) or coriolis parameter (cartesian)
+    float multiplier; //!< amplitude of the initial disturbance
+    float stdDev; //!< width of the initial disturbance
+    int cores{1}; //!< number of cores the run may use
+
+    double cost() const {return double(numGridCells.x) * numGridCells.y;} //!< estimated cost per step
+};
+
+//-------------------------------------------------------------------
+/**
+ * class SweepRunner
+ *
+ * Runs a parameter sweep of the shallow water model without window, scheduled over a work stealing thread pool.
+ *
+ * usage:
+ * Check isSweep() on the command line arguments. If it returns true construct a SweepRunner from the arguments and call run().
+ * One run is created for every combination of the parameter lists. Runs are sorted by cost and dealt to the
+ * per thread queues, every thread works on the most expensive run in its own queue that fits on the free cores and steals
+ * from the fullest other queue when its own queue is empty, so the largest runs are started first and there is little idle time at the end.
+ * Every run gets a number of cores proportional to its grid size (at least one), used for host side work like initialization.
+ * Small runs share the machine, a thread only starts a run when enough cores are free.
+ * Each thread launches kernels in its own stream, so runs also overlap on the GPU.
+ * Results including the relative drift of the conserved quantities are appended to the sweep file after every run.
+ * When the sweep file already exists, runs listed in it are skipped, so an interrupted sweep can be continued.
+ * Supported arguments:
+ *  --sweep                          run a parameter sweep
+ *  --sweep-file <file>              result / progress file (default circulation_sweep.csv)
+ *  --sweep-cells <nx>x<ny>,...      resolutions (default 256x128)
+ *  --sweep-diffusion <v>,...        geopotential diffusion values (default 0)
+ *  --sweep-angular-velocity <v>,... angular velocity or coriolis parameter values (default 7.2921e-5)
+ *  --sweep-multiplier <v>,...       amplitudes of the initial disturbance (default 0.1)
+ *  --sweep-stddev <v>,...           widths of the initial disturbance (default 0.1)
+ *  --cs <cartesian|geographical>    coordinate system (default geographical)
+ *  --steps <n>                      timesteps of every run (default 1000)
+ *  --timestep <dt>                  simulation timestep (default 0.0001)
+ *  --diagnostics-interval <n>       collect conservation diagnostics every n steps (default 10)
+ *  --threads <n>                    worker threads and cores to use (default number of hardware threads)
+ * On SIGTERM no new runs are started, runs in progress are finished.
+ *
+ */
+class SweepRunner
+{
+public:
+    static bool isSweep(int argc, char* argv[]); //!< checks if --sweep was passed on the command line
+    SweepRunner(int argc, char* argv[]); //!< parse settings from the command line
+    int run(); //!< run the sweep, returns exit code
+
+private:
+    void createRuns(); //!< build the list of runs from the parameter lists, skipping finished runs
+    void readProgress(); //!< read ids of finished runs from the sweep file
+    void worker(int threadId); //!< main function of the worker threads
+    bool takeRun(int threadId, SweepRun& run); //!< get the next run for a thread, blocks until enough cores are free, false if no runs are left
+    void executeRun(const SweepRun& run); //!< simulate one run and store the results
+
+    // settings
+    std::string m_sweepFile{"circulation_sweep.csv"}; //!< results and progress
+    std::vector<int2> m_cells{int2{256,128}}; //!< resolutions
+    std::vector<float> m_diffusion{0.0f}; //!< diffusion values
+    std::vector<float> m_angularVelocity{7.2921e-5f}; //!< angular velocity values
+    std::vector<float> m_multiplier{0.1f}; //!< disturbance amplitudes
+    std::vector<float> m_stdDev{0.1f}; //!< disturbance widths
+    CSType m_csType{CSType::geographical2d}; //!< type of coordinate system
+    int m_numSteps{1000}; //!< timesteps per run
+    float m_timestep{0.0001f}; //!< simulation timestep
+    int m_diagnosticsInterval{10}; //!< collect diagnostics every n steps
+    int m_numThreads{1}; //!< worker threads and available cores
+
+    // scheduling
+    std::vector<std::deque<SweepRun>> m_queues; //!< runs of each thread, most expensive first
+    std::set<int> m_finished; //!< ids of runs found in the sweep file
+    std::mutex m_mtx; //!< protects queues and free cores
+    std::condition_variable m_cv; //!< signals freed cores
+    int m_freeCores{0}; //!< cores not used by a running run
+    int m_runsTotal{0}; //!< number of runs in this session
+    int m_runsDone{0}; //!< number of runs finished in this session
+    double m_coreSeconds{0.0}; //!< sum of runtime * cores of all finished runs, used to compute utilization
+    static constexpr double cellsPerCore = 256.0*256.0; //!< runs get one core per this many grid cells
+
+    // results
+    std::mutex m_fileMtx; //!< protects the sweep file
+    std::ofstream m_file; //!< sweep file opened for appending
+};
+
+
+#endif //CIRCULATION_SWEEPRUNNER_H
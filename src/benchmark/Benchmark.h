@@ -0,0 +1,205 @@
+/*
+ * CIRCULATION
+ * Benchmark.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the BenchmarkSuite class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_BENCHMARK_H
+#define CIRCULATION_BENCHMARK_H
+
+// includes
+//--------------------
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdint>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+
+#include "../HardwareCounters.h"
+#include "../Roofline.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * @brief result of one benchmark
+ */
+struct BenchmarkResult
+{
+    std::string name; //!< name of the benchmark
+    int64_t iterations; //!< number of operations timed
+    double nsPerOp; //!< time per operation in nanoseconds
+    double cellsPerSecond; //!< grid cells processed per second, 0 if not applicable
+    double gigabytesPerSecond; //!< nominal memory traffic per second, 0 if not applicable
+    double gigaflopsPerSecond; //!< nominal floating point operations per second, 0 if not applicable
+    RooflinePoint roofline; //!< position in the roofline model of the device
+    double instructionsPerCycle; //!< of the host thread, 0 if hardware counters are disabled
+    double llcMissesPerOp; //!< of the host thread, 0 if hardware counters are disabled
+};
+
+//-------------------------------------------------------------------
+/**
+ * class BenchmarkSuite
+ *
+ * Runs micro benchmarks and reports the results.
+ *
+ * usage:
+ * Construct from the command line arguments, then call run() for every benchmark and finish() at the end.
+ * The function passed to run() needs to perform the given number of operations and wait for the device to finish.
+ * The number of operations is doubled until the runtime exceeds the minimum time, the last batch is reported.
+ * Cells, bytes and flops per operation are used to compute throughput, pass 0 if they do not apply.
+ * Supported arguments:
+ *  --filter <text>   only run benchmarks whose name contains text
+ *  --json <file>     write results as json to file
+ *  --min-time <s>    minimum runtime of each benchmark in seconds (default 0.25)
+ *  --roofline        print achieved vs attainable bandwidth and flops of every benchmark
+ *  --counters        count cycles, instructions and cache misses of the host thread using perf_event_open
+ *
+ */
+class BenchmarkSuite
+{
+public:
+    BenchmarkSuite(int argc, char* argv[])
+    {
+        for(int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if(arg == "--filter" && i+1 < argc)
+                m_filter = argv[++i];
+            else if(arg == "--json" && i+1 < argc)
+                m_jsonFile = argv[++i];
+            else if(arg == "--min-time" && i+1 < argc)
+                m_minTime = std::stod(argv[++i]);
+            else if(arg == "--roofline")
+                m_roofline = true;
+            else if(arg == "--counters")
+                m_counters = HardwareCounters::instance().enable();
+            else
+                logWARNING("Benchmark") << "Ignoring unknown argument " << arg;
+        }
+        m_peak = MachinePeak::currentDevice();
+    }
+
+    bool isSelected(const std::string& name) const {return m_filter.empty() || name.find(m_filter) != std::string::npos;} //!< does the name pass the filter
+
+    const BenchmarkResult* findResult(const std::string& name) const //!< result of the benchmark with name, nullptr if it was not run
+    {
+        for(const BenchmarkResult& r : m_results)
+            if(r.name == name)
+                return &r;
+        return nullptr;
+    }
+
+    template <typename F>
+    void run(const std::string& name, int64_t cellsPerOp, int64_t bytesPerOp, int64_t flopsPerOp, F&& f) //!< time f(iterations)
+    {
+        if(!isSelected(name))
+            return;
+
+        f(1); // warm up
+        int64_t iterations = 1;
+        double seconds = 0.0;
+        CounterValues counters;
+        while(true)
+        {
+            mpu::HRStopwatch sw;
+            const CounterValues start = HardwareCounters::instance().read();
+            f(iterations);
+            counters = HardwareCounters::instance().read() - start;
+            sw.pause();
+            seconds = sw.getSeconds();
+            if(seconds >= m_minTime || iterations >= (int64_t(1) << 40))
+                break;
+            iterations *= 2;
+        }
+
+        BenchmarkResult r;
+        r.name = name;
+        r.iterations = iterations;
+        r.nsPerOp = seconds * 1.0e9 / double(iterations);
+        r.cellsPerSecond = double(cellsPerOp) * double(iterations) / seconds;
+        r.gigabytesPerSecond = double(bytesPerOp) * double(iterations) / seconds / 1.0e9;
+        r.gigaflopsPerSecond = double(flopsPerOp) * double(iterations) / seconds / 1.0e9;
+        r.roofline = evaluateRoofline(name, double(bytesPerOp), double(flopsPerOp), double(iterations) / seconds, m_peak);
+        r.instructionsPerCycle = (counters.cycles > 0) ? double(counters.instructions) / double(counters.cycles) : 0.0;
+        r.llcMissesPerOp = double(counters.llcMisses) / double(iterations);
+        m_results.push_back(r);
+
+        std::cout << std::left << std::setw(56) << r.name << std::right
+                  << std::setw(14) << std::setprecision(4) << r.nsPerOp << " ns/op"
+                  << std::setw(12) << std::setprecision(4) << r.cellsPerSecond * 1.0e-6 << " Mcells/s"
+                  << std::setw(10) << std::setprecision(4) << r.gigabytesPerSecond << " GB/s"
+                  << std::setw(10) << std::setprecision(4) << r.gigaflopsPerSecond << " GFLOP/s";
+        if(m_counters)
+            std::cout << std::setw(8) << std::setprecision(3) << r.instructionsPerCycle << " IPC";
+        std::cout << std::endl;
+    }
+
+    int finish() //!< writes roofline report and json output, returns exit code
+    {
+        if(m_roofline)
+        {
+            std::vector<RooflinePoint> points;
+            for(const BenchmarkResult& r : m_results)
+                if(r.roofline.achievedGigabytes > 0.0)
+                    points.push_back(r.roofline);
+            writeRooflineReport(std::cout, points, m_peak);
+        }
+
+        if(m_jsonFile.empty())
+            return 0;
+
+        std::ofstream file(m_jsonFile);
+        if(!file.is_open())
+        {
+            logERROR("Benchmark") << "Could not open " << m_jsonFile;
+            return 1;
+        }
+
+        file << std::setprecision(10);
+        file << "{\n";
+        file << "  \"version\": \"" << CIRCULATION_VERSION << "\",\n";
+        file << "  \"commit\": \"" << CIRCULATION_VERSION_SHA << "\",\n";
+        file << "  \"device\": \"" << m_peak.name << "\",\n";
+        file << "  \"peak_gb_per_second\": " << m_peak.gigabytesPerSecond << ",\n";
+        file << "  \"peak_gflop_per_second\": " << m_peak.gigaflopsPerSecond << ",\n";
+        file << "  \"benchmarks\": [\n";
+        for(size_t i = 0; i < m_results.size(); i++)
+        {
+            const BenchmarkResult& r = m_results[i];
+            file << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations << ", \"ns_per_op\": " << r.nsPerOp
+                 << ", \"cells_per_second\": " << r.cellsPerSecond << ", \"gb_per_second\": " << r.gigabytesPerSecond
+                 << ", \"gflop_per_second\": " << r.gigaflopsPerSecond << ", \"attainable_gflop_per_second\": " << r.roofline.attainableGigaflops
+                 << ", \"roofline_efficiency\": " << r.roofline.efficiency;
+            if(m_counters)
+                file << ", \"host_ipc\": " << r.instructionsPerCycle << ", \"host_llc_misses_per_op\": " << r.llcMissesPerOp;
+            file << "}"
+                 << ((i+1 < m_results.size()) ? ",\n" : "\n");
+        }
+        file << "  ]\n}\n";
+        logINFO("Benchmark") << "Results written to " << m_jsonFile;
+        return 0;
+    }
+
+private:
+    std::string m_filter; //!< only run benchmarks containing this
+    std::string m_jsonFile; //!< json output file
+    double m_minTime{0.25}; //!< minimum runtime per benchmark
+    bool m_roofline{false}; //!< print roofline report
+    bool m_counters{false}; //!< hardware counters are available and enabled
+    MachinePeak m_peak; //!< peak performance of the device
+    std::vector<BenchmarkResult> m_results; //!< all results
+};
+
+#endif //CIRCULATION_BENCHMARK_H
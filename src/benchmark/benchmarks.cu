@@ -0,0 +1,332 @@
+/*
+ * CIRCULATION
+ * benchmarks.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * micro benchmarks of finite differences, coordinate systems, grid and simulation models
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "Benchmark.h"
+
+#include "../Grid.h"
+#include "../GridReference.h"
+#include "../finiteDifferences.h"
+#include "../coordinateSystems/CartesianCoordinates2D.h"
+#include "../coordinateSystems/GeographicalCoordinates2D.h"
+#include "../simulationModels/TestSimulation.h"
+#include "../simulationModels/ShallowWaterModel.h"
+#include "../simulationModels/ShallowWaterEnsemble.h"
+//--------------------
+
+namespace {
+
+// finite difference operators
+//--------------------
+struct GradientOp
+{
+    static constexpr const char* name = "gradient2d";
+    static constexpr int flops = 8; //!< per cell in geographical coordinates
+    template <typename csT>
+    CUDAHOSTDEV float operator()(float l, float r, float b, float f, float c, const float2& pos, const csT& cs) const
+    {
+        float2 g = gradient2d(l,r,b,f,pos,cs);
+        return g.x + g.y;
+    }
+};
+
+struct DivergenceOp
+{
+    static constexpr const char* name = "divergence2d";
+    static constexpr int flops = 12; //!< per cell in geographical coordinates
+    template <typename csT>
+    CUDAHOSTDEV float operator()(float l, float r, float b, float f, float c, const float2& pos, const csT& cs) const
+    {
+        return divergence2d(l,r,b,f,pos,cs);
+    }
+};
+
+struct CurlOp
+{
+    static constexpr const char* name = "curl2d";
+    static constexpr int flops = 12; //!< per cell in geographical coordinates
+    template <typename csT>
+    CUDAHOSTDEV float operator()(float l, float r, float b, float f, float c, const float2& pos, const csT& cs) const
+    {
+        return curl2d(l,r,b,f,pos,cs);
+    }
+};
+
+struct LaplaceOp
+{
+    static constexpr const char* name = "laplace2d";
+    static constexpr int flops = 14; //!< per cell in geographical coordinates
+    template <typename csT>
+    CUDAHOSTDEV float operator()(float l, float r, float b, float f, float c, const float2& pos, const csT& cs) const
+    {
+        return laplace2d(l,r,b,f,c,pos,cs);
+    }
+};
+
+// coordinate system functions
+//--------------------
+struct CellIdOp
+{
+    static constexpr const char* name = "getCellId";
+    static constexpr int flops = 0;
+    template <typename csT>
+    CUDAHOSTDEV float operator()(int i, const csT& cs) const {return float(cs.getCellId(cs.getCellId3d(i)));}
+};
+
+struct NeighborOp
+{
+    static constexpr const char* name = "getNeighbors";
+    static constexpr int flops = 0;
+    template <typename csT>
+    CUDAHOSTDEV float operator()(int i, const csT& cs) const
+    {
+        return float(cs.getLeftNeighbor(i) + cs.getRightNeighbor(i) + cs.getForwardNeighbor(i) + cs.getBackwardNeighbor(i));
+    }
+};
+
+struct CellCoordinateOp
+{
+    static constexpr const char* name = "getCellCoordinate";
+    static constexpr int flops = 0;
+    template <typename csT>
+    CUDAHOSTDEV float operator()(int i, const csT& cs) const
+    {
+        float3 c = cs.getCellCoordinate(i);
+        return c.x + c.y;
+    }
+};
+
+struct ConversionOp
+{
+    static constexpr const char* name = "getCartesian+getCoord";
+    static constexpr int flops = 0;
+    template <typename csT>
+    CUDAHOSTDEV float operator()(int i, const csT& cs) const
+    {
+        float3 c = cs.getCoord(cs.getCartesian(cs.getCellCoordinate(i)));
+        return c.x + c.y;
+    }
+};
+
+// kernels
+//--------------------
+template <typename csT, typename opT>
+__global__ void finiteDifferenceBench(csT coordinateSystem, mpu::VectorReference<const float> in, mpu::VectorReference<float> out, opT op)
+{
+    csT cs = coordinateSystem;
+    for(int x : mpu::gridStrideRange( cs.hasBoundary().x, cs.getNumGridCells3d().x-cs.hasBoundary().x ))
+        for(int y : mpu::gridStrideRangeY( cs.hasBoundary().y, cs.getNumGridCells3d().y-cs.hasBoundary().y ))
+        {
+            int3 cell{x,y,0};
+            int cellId = cs.getCellId(cell);
+            float2 pos = make_float2(cs.getCellCoordinate3d(cell));
+            out[cellId] = op(in[cs.getLeftNeighbor(cellId)], in[cs.getRightNeighbor(cellId)], in[cs.getBackwardNeighbor(cellId)],
+                             in[cs.getForwardNeighbor(cellId)], in[cellId], pos, cs);
+        }
+}
+
+template <typename csT, typename opT>
+__global__ void coordinateSystemBench(csT coordinateSystem, mpu::VectorReference<float> out, opT op)
+{
+    csT cs = coordinateSystem;
+    for(int i : mpu::gridStrideRange(cs.getNumGridCells()))
+        out[i] = op(i, cs);
+}
+
+// benchmark groups
+//--------------------
+std::string sizeName(const int3& n)
+{
+    return std::to_string(n.x) + "x" + std::to_string(n.y);
+}
+
+template <typename csT, typename opT>
+void benchFiniteDifference(BenchmarkSuite& suite, const csT& cs, const std::string& csName)
+{
+    const int numCells = cs.getNumGridCells();
+    const std::string name = std::string(opT::name) + "/" + csName + "/" + sizeName(cs.getNumGridCells3d());
+    if(!suite.isSelected(name))
+        return;
+
+    mpu::DeviceVector<float> in(std::vector<float>(numCells, 1.0f));
+    mpu::DeviceVector<float> out(numCells);
+
+    dim3 blocksize{16,16,1};
+    dim3 numBlocks{ static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().x ,blocksize.x)),
+                    static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().y ,blocksize.y)), 1};
+
+    // every value is read once and one result written, neighbours are expected to come from cache
+    suite.run(name, numCells, 2 * int64_t(numCells) * sizeof(float), int64_t(numCells) * opT::flops, [&](int64_t iterations)
+    {
+        for(int64_t i = 0; i < iterations; i++)
+            finiteDifferenceBench<<<numBlocks, blocksize>>>(cs, in.getVectorReference(), out.getVectorReference(), opT());
+        assert_cuda(cudaDeviceSynchronize());
+    });
+}
+
+template <typename csT, typename opT>
+void benchCoordinateSystem(BenchmarkSuite& suite, const csT& cs, const std::string& csName)
+{
+    const int numCells = cs.getNumGridCells();
+    const std::string name = std::string(opT::name) + "/" + csName + "/" + sizeName(cs.getNumGridCells3d());
+    if(!suite.isSelected(name))
+        return;
+
+    mpu::DeviceVector<float> out(numCells);
+    suite.run(name, numCells, int64_t(numCells) * sizeof(float), int64_t(numCells) * opT::flops, [&](int64_t iterations)
+    {
+        for(int64_t i = 0; i < iterations; i++)
+            coordinateSystemBench<<<mpu::numBlocks(numCells,256), 256>>>(cs, out.getVectorReference(), opT());
+        assert_cuda(cudaDeviceSynchronize());
+    });
+}
+
+template <typename csT>
+void benchCoordinates(BenchmarkSuite& suite, const csT& cs, const std::string& csName)
+{
+    benchFiniteDifference<csT,GradientOp>(suite, cs, csName);
+    benchFiniteDifference<csT,DivergenceOp>(suite, cs, csName);
+    benchFiniteDifference<csT,CurlOp>(suite, cs, csName);
+    benchFiniteDifference<csT,LaplaceOp>(suite, cs, csName);
+
+    benchCoordinateSystem<csT,CellIdOp>(suite, cs, csName);
+    benchCoordinateSystem<csT,NeighborOp>(suite, cs, csName);
+    benchCoordinateSystem<csT,CellCoordinateOp>(suite, cs, csName);
+    benchCoordinateSystem<csT,ConversionOp>(suite, cs, csName);
+}
+
+void benchGrid(BenchmarkSuite& suite, int numCells, const std::string& size)
+{
+    ShallowWaterGrid grid(numCells, false);
+    const int64_t bufferBytes = grid.getTimeLevelBytes();
+
+    suite.run("Grid::swapBuffer/" + size, 0, 0, 0, [&](int64_t iterations)
+    {
+        for(int64_t i = 0; i < iterations; i++)
+            grid.swapBuffer();
+    });
+
+    suite.run("Grid::swapAndRender/" + size, 0, 0, 0, [&](int64_t iterations)
+    {
+        for(int64_t i = 0; i < iterations; i++)
+            grid.swapAndRender();
+    });
+
+    // one operation initializes one attribute of all cells in all four buffers of the host cache
+    grid.cacheOverwrite();
+    suite.run("Grid::initialize/" + size, numCells, 4 * int64_t(numCells) * sizeof(float), 0, [&](int64_t iterations)
+    {
+        for(int64_t i = 0; i < iterations; i++)
+            for(int c = 0; c < numCells; c++)
+                grid.initialize<AT::geopotential>(c, 1.0f);
+    });
+    grid.pushCachToDevice();
+
+    suite.run("Grid::cacheOnHost/" + size, numCells, 4 * bufferBytes, 0, [&](int64_t iterations)
+    {
+        for(int64_t i = 0; i < iterations; i++)
+            grid.cacheOnHost();
+    });
+    grid.pushCachToDevice();
+}
+
+void benchModel(BenchmarkSuite& suite, Simulation& simulation, const std::string& name, std::shared_ptr<CoordinateSystem> cs,
+                const std::vector<std::string>& kernels, int members=1)
+{
+    if(!suite.isSelected(name))
+        return;
+
+    simulation.setHeadless(true);
+    std::shared_ptr<GridBase> grid = simulation.recreate(cs);
+    simulation.resume();
+
+    // analytic traffic and flops of the model kernels, boundaries are neglected
+    double bytesPerCell = 0.0;
+    double flopsPerCell = 0.0;
+    for(const std::string& k : kernels)
+    {
+        const KernelCost* cost = findKernelCost(k);
+        assert_critical(cost, "Benchmark", "Model benchmark uses a kernel without known cost.");
+        bytesPerCell += cost->bytesPerCell;
+        flopsPerCell += cost->flopsPerCell;
+    }
+
+    const int64_t cells = int64_t(cs->getNumGridCells()) * members;
+    suite.run(name, cells, static_cast<int64_t>(bytesPerCell * cells), static_cast<int64_t>(flopsPerCell * cells), [&](int64_t iterations)
+    {
+        simulation.setIterations(static_cast<int>(iterations));
+        simulation.run();
+        assert_cuda(cudaDeviceSynchronize());
+    });
+}
+
+void reportOverhead(const BenchmarkSuite& suite, const std::string& name, const std::string& baseline)
+{
+    const BenchmarkResult* r = suite.findResult(name);
+    const BenchmarkResult* b = suite.findResult(baseline);
+    if(!r || !b)
+        return;
+
+    std::cout << std::left << std::setw(56) << ("  overhead vs " + baseline) << std::right
+              << std::setw(14) << std::setprecision(3) << 100.0 * (r->nsPerOp / b->nsPerOp - 1.0) << " %" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    mpu::Log myLog( mpu::LogLvl::ALL, mpu::ConsoleSink());
+    BenchmarkSuite suite(argc, argv);
+
+    const int3 sizes[] = {{256,128,1}, {1024,512,1}, {2048,1024,1}};
+    for(const int3& n : sizes)
+    {
+        CartesianCoordinates2D cartesian(float3{-1,-1,0}, float3{1,1,0}, int3{n.x,n.y,0});
+        GeographicalCoordinates2D geographical(-1.55f, 1.55f, n, 1.0f);
+        benchCoordinates(suite, cartesian, "cartesian");
+        benchCoordinates(suite, geographical, "geographical");
+    }
+
+    for(const int3& n : sizes)
+        benchGrid(suite, n.x*n.y, sizeName(n));
+
+    for(const int3& n : sizes)
+    {
+        auto cs = std::make_shared<GeographicalCoordinates2D>(-1.55f, 1.55f, n, 1.0f);
+
+        TestSimulation test;
+        benchModel(suite, test, "TestSimulation::step/" + sizeName(n), cs, {"test simulation A", "test simulation B"});
+
+        ShallowWaterModel shallowWater;
+        benchModel(suite, shallowWater, "ShallowWaterModel::step/" + sizeName(n), cs, {"shallow water A", "shallow water B"});
+
+        // conservation diagnostics every step vs. never, the overhead should stay below 5%
+        // both use one kernel per step, otherwise only the model without diagnostics would batch steps
+        ShallowWaterModel noDiagnostics;
+        noDiagnostics.setStepBatching(StepBatching::off);
+        noDiagnostics.getDiagnostics()->setEnabled(false);
+        benchModel(suite, noDiagnostics, "ShallowWaterModel::step/noDiagnostics/" + sizeName(n), cs, {"shallow water A", "shallow water B"});
+        ShallowWaterModel diagnostics;
+        diagnostics.setStepBatching(StepBatching::off);
+        diagnostics.getDiagnostics()->setInterval(1);
+        benchModel(suite, diagnostics, "ShallowWaterModel::step/diagnostics/" + sizeName(n), cs, {"shallow water A", "shallow water B"});
+        reportOverhead(suite, "ShallowWaterModel::step/diagnostics/" + sizeName(n), "ShallowWaterModel::step/noDiagnostics/" + sizeName(n));
+
+        ShallowWaterEnsemble ensemble;
+        ensemble.setNumMembers(16);
+        benchModel(suite, ensemble, "ShallowWaterEnsemble::step/16members/" + sizeName(n), cs, {"ensemble A", "ensemble B"}, 16);
+    }
+
+    return suite.finish();
+}
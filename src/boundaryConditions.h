@@ -18,87 +18,393 @@
 //--------------------
 
 /**
- * @brief initializes the boundaries on the grid to fixed scalar values
+ * @brief the four faces of a 2d grid, used to index boundary settings
  */
-template < AT attributeType, typename T, typename csT, typename gridT>
-void initializeFixedValueBoundaries(bool boundX, bool boundY, const T& valueX, const T& valueY, const csT& cs, gridT& grid)
+enum class BoundaryFace : int
 {
-    if(boundY)
+    left = 0, //!< face at the lower end of the x axis
+    right = 1, //!< face at the upper end of the x axis
+    backward = 2, //!< face at the lower end of the y axis
+    forward = 3 //!< face at the upper end of the y axis
+};
+
+/**
+ * @brief boundary settings for one face of the grid
+ */
+struct FaceBoundary
+{
+    BoundaryType type{BoundaryType::zeroGradient}; //!< type of the boundary condition
+    float value{0.0f}; //!< value used by fixedValue and sponge boundaries
+    int spongeWidth{8}; //!< number of cells in the sponge layer
+    float spongeStrength{0.1f}; //!< relaxation factor per timestep next to the boundary, decays quadratically towards the interior
+};
+
+/**
+ * @brief boundary settings for all faces of one attribute
+ */
+struct AttributeBoundary
+{
+    FaceBoundary face[4]; //!< settings for each face, indexed using BoundaryFace
+    bool staggeredX{false}; //!< attribute is stored on the right face of a cell, so its upper x wall is one cell further inside
+    bool staggeredY{false}; //!< attribute is stored on the forward face of a cell, so its upper y wall is one cell further inside
+
+    FaceBoundary& operator[](BoundaryFace f) {return face[static_cast<int>(f)];}
+    CUDAHOSTDEV const FaceBoundary& operator[](BoundaryFace f) const {return face[static_cast<int>(f)];}
+
+    void setAxis(int axis, const FaceBoundary& fb) //!< set both faces of axis 0 (x) or 1 (y) to the same settings
+    {
+        face[2*axis] = fb;
+        face[2*axis+1] = fb;
+    }
+};
+
+//!< finds the position of an attribute type in a list of attribute types
+template <AT Param, AT First, AT ...Rest>
+struct AttributeIndexImpl
+{
+    static constexpr int value = (First == Param) ? 0 : 1 + AttributeIndexImpl<Param,Rest...>::value;
+};
+
+template <AT Param, AT First>
+struct AttributeIndexImpl<Param,First>
+{
+    static_assert(First == Param, "Attribute is not part of the list.");
+    static constexpr int value = 0;
+};
+
+//-------------------------------------------------------------------
+/**
+ * @brief accesses the t+1 buffer of a grid reference, used to apply boundaries after a timestep on the device
+ */
+template <typename gridRefT>
+struct NextBufferAccess
+{
+    gridRefT grid;
+
+    template <AT Param>
+    CUDAHOSTDEV auto read(int cellId) {return grid.template readNext<Param>(cellId);}
+    template <AT Param, typename T>
+    CUDAHOSTDEV void write(int cellId, T&& data) {grid.template write<Param>(cellId, std::forward<T>(data));}
+};
+
+/**
+ * @brief accesses all time levels of a grid on the host, used to initialize boundaries on a cached grid
+ */
+template <typename gridT>
+struct InitializeAccess
+{
+    gridT& grid;
+
+    template <AT Param>
+    auto read(int cellId) {return grid.template read<Param>(cellId);}
+    template <AT Param, typename T>
+    void write(int cellId, T&& data) {grid.template initialize<Param>(cellId, std::forward<T>(data));}
+};
+
+/**
+ * @brief accesses one member of an ensemble grid, where the values of all members of a cell are stored next to each other
+ */
+template <typename accessT>
+struct EnsembleMemberAccess
+{
+    accessT access;
+    int member; //!< the member to access
+    int numMembers; //!< number of members in the grid
+
+    template <AT Param>
+    CUDAHOSTDEV auto read(int cellId) {return access.template read<Param>(cellId*numMembers + member);}
+    template <AT Param, typename T>
+    CUDAHOSTDEV void write(int cellId, T&& data) {access.template write<Param>(cellId*numMembers + member, std::forward<T>(data));}
+};
+
+//-------------------------------------------------------------------
+/**
+ * @brief applies the boundary of one attribute to one cell
+ *          Cells on a face get the value defined by the face type, cells inside a sponge layer are relaxed towards the sponge value.
+ *          Corners belong to the y faces. Values are only read from cells that are not changed by any rule,
+ *          so cells can be processed in parallel and in any order.
+ */
+template <AT attributeType, typename csT, typename accessT>
+CUDAHOSTDEV void applyAttributeBoundary(const int3& cell, const AttributeBoundary& ab, const csT& cs, accessT& access)
+{
+    const int3 n = cs.getNumGridCells3d();
+    const int3 hb = cs.hasBoundary();
+
+    // last cell in each direction, the upper wall of staggered attributes is one cell further in
+    const int lastX = n.x-1 - (ab.staggeredX ? 1 : 0);
+    const int lastY = n.y-1 - (ab.staggeredY ? 1 : 0);
+    const int dist[4] = {cell.x, lastX - cell.x, cell.y, lastY - cell.y};
+
+    // closest interior cell in x direction for cells on a y face
+    const int sourceX = hb.x ? min(max(cell.x,1),lastX-1) : cell.x;
+
+    // cells on a face
+    int face = -1;
+    if(hb.y && dist[2] <= 0)
+        face = 2;
+    else if(hb.y && dist[3] <= 0)
+        face = 3;
+    else if(hb.x && dist[0] <= 0)
+        face = 0;
+    else if(hb.x && dist[1] <= 0)
+        face = 1;
+
+    if(face >= 0)
     {
-        int numBoundCellsY = 2 * cs.hasBoundary().y * cs.getNumGridCells3d().x;
-        for(int i : mpu::Range<int>(numBoundCellsY))
+        const FaceBoundary& fb = ab.face[face];
+        if(fb.type == BoundaryType::fixedValue || fb.type == BoundaryType::sponge)
         {
-            // transform boundary cell id into actual cell id
-            int3 cellId3d{i % cs.getNumGridCells3d().x, 0, 0};
-            if(i >= cs.getNumGridCells3d().x)
-                cellId3d.y = cs.getNumGridCells3d().y - 1;
-            int cellId = cs.getCellId(cellId3d);
+            access.template write<attributeType>(cs.getCellId(cell), fb.value);
+            return;
+        }
 
-            grid.template initialize<attributeType>(cellId, valueX);
+        // all other types copy from an interior cell
+        int3 source;
+        bool periodic = (fb.type == BoundaryType::periodic);
+        switch(face)
+        {
+            case 0: source = int3{periodic ? lastX-1 : 1, cell.y, 0}; break;
+            case 1: source = int3{periodic ? 1 : lastX-1, cell.y, 0}; break;
+            case 2: source = int3{sourceX, periodic ? lastY-1 : 1, 0}; break;
+            default: source = int3{sourceX, periodic ? 1 : lastY-1, 0}; break;
         }
+
+        auto value = access.template read<attributeType>(cs.getCellId(source));
+        if(fb.type == BoundaryType::mirror)
+            value = -value;
+        access.template write<attributeType>(cs.getCellId(cell), value);
+        return;
     }
 
-    if(boundX)
+    // interior cells inside a sponge layer, cells used as source by another face are left untouched
+    // so the result does not depend on the order in which cells are processed
+    for(int f = 0; f < 4; f++)
     {
-        int numBoundCellsX = 2 * cs.hasBoundary().x * cs.getNumGridCells3d().y - 4;
-        for(int i : mpu::Range<int>(numBoundCellsX))
-        {
-            // transform boundary cell id into actual cell id
-            int3 cellId3d{(i % 2) * (cs.getNumGridCells3d().x - 1), 1 + i / 2, 0};
-            int cellId = cs.getCellId(cellId3d);
+        const bool axisHasBoundary = (f < 2) ? hb.x : hb.y;
+        const BoundaryType opposite = ab.face[f^1].type;
+        const BoundaryType own = ab.face[f].type;
+        if(axisHasBoundary && dist[f] == 1 && (own == BoundaryType::zeroGradient || own == BoundaryType::mirror
+                                               || opposite == BoundaryType::periodic))
+            return;
+    }
 
-            grid.template initialize<attributeType>(cellId, valueY);
+    bool relaxed = false;
+    auto value = access.template read<attributeType>(cs.getCellId(cell));
+    for(int f = 0; f < 4; f++)
+    {
+        const FaceBoundary& fb = ab.face[f];
+        const bool axisHasBoundary = (f < 2) ? hb.x : hb.y;
+        if(axisHasBoundary && fb.type == BoundaryType::sponge && dist[f] < fb.spongeWidth)
+        {
+            const float decay = 1.0f - float(dist[f]) / float(fb.spongeWidth);
+            value += fb.spongeStrength * decay * decay * (fb.value - value);
+            relaxed = true;
         }
     }
+    if(relaxed)
+        access.template write<attributeType>(cs.getCellId(cell), value);
 }
 
-template < AT attributeType, typename csT, typename gridRefT>
-__global__ void mirrorBoundariesGPU(int numBoundCellsY, int  numBoundCellsX, csT coordinateSystem, gridRefT grid, bool isOffset)
+//-------------------------------------------------------------------
+/**
+ * @brief cells close to the faces of the grid that might be touched by a boundary condition
+ *          Y faces own complete rows, x faces the remaining part of their columns.
+ */
+struct BoundaryBand
 {
-    csT cs = coordinateSystem;
-    int offset = isOffset ? 2 : 1;
+    int3 numGridCells{0,0,0}; //!< number of grid cells in each direction
+    int rowsLow{0}; //!< rows at the backward face
+    int rowsHigh{0}; //!< rows at the forward face
+    int colsLow{0}; //!< columns at the left face
+    int colsHigh{0}; //!< columns at the right face
+    int numRowCells{0}; //!< number of cells in all rows
+    int numCells{0}; //!< total number of cells in the band
 
-    for(int i : mpu::gridStrideRange(numBoundCellsY))
+    CUDAHOSTDEV int3 getCell(int i) const //!< get the 3d cell id of the i-th cell in the band
     {
-        // transform boundary cell id into actual cell id
-        int3 cellId3d{i % cs.getNumGridCells3d().x, 0, 0};
-        if(i >= cs.getNumGridCells3d().x)
-            cellId3d.y = cs.getNumGridCells3d().y - offset;
-        int cellId = cs.getCellId(cellId3d);
+        if(i < numRowCells)
+        {
+            int r = i / numGridCells.x;
+            return int3{ i % numGridCells.x, (r < rowsLow) ? r : numGridCells.y - rowsHigh + (r - rowsLow), 0};
+        }
 
-        int neighbourId = (cellId3d.y == 0) ? cs.getForwardNeighbor(cellId) : cs.getBackwardNeighbor(cellId);
+        int j = i - numRowCells;
+        int cols = colsLow + colsHigh;
+        int c = j % cols;
+        return int3{ (c < colsLow) ? c : numGridCells.x - colsHigh + (c - colsLow), rowsLow + j / cols, 0};
+    }
 
-        auto value = grid.template read<attributeType>(neighbourId);
-        grid.template write<attributeType>(cellId,value);
+    CUDAHOSTDEV int numCellsInRow(int y) const //!< number of cells of the band in row y
+    {
+        return (y < rowsLow || y >= numGridCells.y - rowsHigh) ? numGridCells.x : colsLow + colsHigh;
     }
 
-    for(int i : mpu::gridStrideRange(numBoundCellsX))
+    CUDAHOSTDEV int3 getCellInRow(int y, int i) const //!< get the 3d cell id of the i-th cell of the band in row y
     {
-        // transform boundary cell id into actual cell id
-        int3 cellId3d{(i % 2) * (cs.getNumGridCells3d().x - offset), 1 + i / 2, 0};
-        int cellId = cs.getCellId(cellId3d);
+        if(y < rowsLow || y >= numGridCells.y - rowsHigh)
+            return int3{i, y, 0};
+        return int3{ (i < colsLow) ? i : numGridCells.x - colsHigh + (i - colsLow), y, 0};
+    }
+};
+
+//-------------------------------------------------------------------
+/**
+ * class BoundaryConditions
+ *
+ * usage:
+ * Stores boundary settings for a list of grid attributes. Set per face types using get<AT>().
+ * Call apply() after all interior cells of the t+1 buffer have been computed, it handles
+ * all attributes in one kernel launch. Call applyOnHost() on a cached grid to initialize all time levels.
+ * For ensemble grids that store numMembers values per cell (member index varying fastest) use applyEnsemble()
+ * and applyEnsembleOnHost(), the same settings are applied to all members.
+ * Periodic boundaries of staggered attributes are not supported.
+ *
+ */
+template <AT ...attributeTypes>
+class BoundaryConditions
+{
+public:
+    template <AT Param>
+    AttributeBoundary& get() {return m_bounds[AttributeIndexImpl<Param,attributeTypes...>::value];} //!< access settings of one attribute
+    template <AT Param>
+    const AttributeBoundary& get() const {return m_bounds[AttributeIndexImpl<Param,attributeTypes...>::value];} //!< access settings of one attribute
 
-        int neighbourId = (cellId3d.x == 0) ? cs.getRightNeighbor(cellId) : cs.getLeftNeighbor(cellId);
+    template <typename csT>
+    BoundaryBand getBand(const csT& cs) const; //!< computes the cells that need to be visited for the current settings
 
-        auto value = grid.template read<attributeType>(neighbourId);
-        grid.template write<attributeType>(cellId, value);
+    template <typename csT, typename accessT>
+    CUDAHOSTDEV void applyToCell(const int3& cell, const csT& cs, accessT& access) const; //!< apply boundaries of all attributes to one cell
+
+    template <typename csT, typename gridT>
+    void apply(const csT& cs, gridT& grid) const; //!< apply to the t+1 buffer on the device in a single kernel
+    template <typename csT, typename gridT>
+    void applyOnHost(const csT& cs, gridT& grid) const; //!< apply to all time levels of a grid cached on the host
+    template <typename csT, typename gridT>
+    void applyEnsemble(const csT& cs, gridT& grid, int numMembers) const; //!< apply to the t+1 buffer of all members of an ensemble grid on the device
+    template <typename csT, typename gridT>
+    void applyEnsembleOnHost(const csT& cs, gridT& grid, int numMembers) const; //!< apply to all members and time levels of an ensemble grid cached on the host
+
+private:
+    AttributeBoundary m_bounds[sizeof...(attributeTypes)];
+};
+
+template <AT ...attributeTypes, typename csT, typename accessT>
+__global__ void applyBoundariesGPU(BoundaryConditions<attributeTypes...> bc, BoundaryBand band, csT coordinateSystem, accessT access)
+{
+    csT cs = coordinateSystem;
+    for(int i : mpu::gridStrideRange(band.numCells))
+        bc.applyToCell(band.getCell(i), cs, access);
+}
+
+template <AT ...attributeTypes, typename csT, typename accessT>
+__global__ void applyEnsembleBoundariesGPU(BoundaryConditions<attributeTypes...> bc, BoundaryBand band, csT coordinateSystem, accessT access, int numMembers)
+{
+    // neighbouring threads handle different members of the same cell
+    csT cs = coordinateSystem;
+    for(int i : mpu::gridStrideRange(band.numCells * numMembers))
+    {
+        EnsembleMemberAccess<accessT> memberAccess{access, i % numMembers, numMembers};
+        bc.applyToCell(band.getCell(i / numMembers), cs, memberAccess);
     }
 }
 
-/**
- * @brief update the boundaries on the grid to mirror the closest valid value
- */
-template < AT attributeType, typename csT, typename gridT>
-void handleMirroredBoundaries(bool boundX, bool boundY, csT& cs, gridT& grid, bool isOffset = false)
+// template function definitions of the BoundaryConditions class
+//-------------------------------------------------------------------
+template <AT... attributeTypes>
+template <typename csT>
+BoundaryBand BoundaryConditions<attributeTypes...>::getBand(const csT& cs) const
 {
-    int numBoundCellsY = boundY ? 2 * cs.hasBoundary().y * cs.getNumGridCells3d().x : 0;
-    int numBoundCellsX = boundX ? 2 * cs.hasBoundary().x * cs.getNumGridCells3d().y - 4 : 0;
+    // the band needs to include the widest sponge layer plus the extra cell of staggered attributes
+    int widthX = 1;
+    int widthY = 1;
+    for(const auto& ab : m_bounds)
+        for(int f = 0; f < 4; f++)
+            if(ab.face[f].type == BoundaryType::sponge)
+            {
+                if(f < 2)
+                    widthX = std::max(widthX, ab.face[f].spongeWidth);
+                else
+                    widthY = std::max(widthY, ab.face[f].spongeWidth);
+            }
 
+    BoundaryBand band;
+    band.numGridCells = cs.getNumGridCells3d();
+    band.rowsLow = cs.hasBoundary().y ? std::min(widthY, band.numGridCells.y) : 0;
+    band.rowsHigh = cs.hasBoundary().y ? std::min(widthY+1, band.numGridCells.y - band.rowsLow) : 0;
+    band.colsLow = cs.hasBoundary().x ? std::min(widthX, band.numGridCells.x) : 0;
+    band.colsHigh = cs.hasBoundary().x ? std::min(widthX+1, band.numGridCells.x - band.colsLow) : 0;
+
+    int innerRows = std::max(0, band.numGridCells.y - band.rowsLow - band.rowsHigh);
+    band.numRowCells = (band.rowsLow + band.rowsHigh) * band.numGridCells.x;
+    band.numCells = band.numRowCells + (band.colsLow + band.colsHigh) * innerRows;
+    return band;
+}
+
+template <AT... attributeTypes>
+template <typename csT, typename accessT>
+CUDAHOSTDEV void BoundaryConditions<attributeTypes...>::applyToCell(const int3& cell, const csT& cs, accessT& access) const
+{
+    int t[] = {0, ((void)applyAttributeBoundary<attributeTypes>(cell, m_bounds[AttributeIndexImpl<attributeTypes,attributeTypes...>::value], cs, access),1)...};
+    (void)t[0]; // silence compiler warning abut t being unused
+}
+
+template <AT... attributeTypes>
+template <typename csT, typename gridT>
+void BoundaryConditions<attributeTypes...>::apply(const csT& cs, gridT& grid) const
+{
+    BoundaryBand band = getBand(cs);
+    if(band.numCells == 0)
+        return;
+
+    // not tuned by the LaunchTuner, sponge layers relax t+1 in place so repeated launches would change the result
+    dim3 blocksize{128,1,1};
+    dim3 numBlocks{ static_cast<unsigned int>(mpu::numBlocks( band.numCells ,blocksize.x)), 1, 1};
+
+    NextBufferAccess<typename gridT::ReferenceType> access{grid.getGridReference()};
+    applyBoundariesGPU<<<numBlocks, blocksize>>>(*this, band, cs, access);
+}
+
+template <AT... attributeTypes>
+template <typename csT, typename gridT>
+void BoundaryConditions<attributeTypes...>::applyOnHost(const csT& cs, gridT& grid) const
+{
+    BoundaryBand band = getBand(cs);
+    InitializeAccess<gridT> access{grid};
+
+    #pragma omp parallel for
+    for(int i = 0; i < band.numCells; i++)
+        applyToCell(band.getCell(i), cs, access);
+}
+
+template <AT... attributeTypes>
+template <typename csT, typename gridT>
+void BoundaryConditions<attributeTypes...>::applyEnsemble(const csT& cs, gridT& grid, int numMembers) const
+{
+    BoundaryBand band = getBand(cs);
+    if(band.numCells == 0)
+        return;
+
+    // not tuned, see apply()
     dim3 blocksize{128,1,1};
-    dim3 numBlocks{ static_cast<unsigned int>(mpu::numBlocks( min(numBoundCellsX,numBoundCellsY) ,blocksize.x)),
-                    1, 1};
+    dim3 numBlocks{ static_cast<unsigned int>(mpu::numBlocks( band.numCells * numMembers ,blocksize.x)), 1, 1};
 
-    mirrorBoundariesGPU<attributeType><<<numBlocks, blocksize>>>(numBoundCellsY,numBoundCellsX,cs,grid.getGridReference(), isOffset);
+    NextBufferAccess<typename gridT::ReferenceType> access{grid.getGridReference()};
+    applyEnsembleBoundariesGPU<<<numBlocks, blocksize>>>(*this, band, cs, access, numMembers);
+}
+
+template <AT... attributeTypes>
+template <typename csT, typename gridT>
+void BoundaryConditions<attributeTypes...>::applyEnsembleOnHost(const csT& cs, gridT& grid, int numMembers) const
+{
+    BoundaryBand band = getBand(cs);
+    InitializeAccess<gridT> access{grid};
+
+    #pragma omp parallel for
+    for(int i = 0; i < band.numCells * numMembers; i++)
+    {
+        EnsembleMemberAccess<InitializeAccess<gridT>> memberAccess{access, i % numMembers, numMembers};
+        applyToCell(band.getCell(i / numMembers), cs, memberAccess);
+    }
 }
 
 #endif //CIRCULATION_BOUNDARYCONDITIONS_H
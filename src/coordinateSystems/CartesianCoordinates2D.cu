@@ -14,6 +14,7 @@
 // includes
 //--------------------
 #include "CartesianCoordinates2D.h"
+#include "../mipmap.h"
 //--------------------
 
 // function definitions of the CartesianCoordinates2D class
@@ -136,6 +137,11 @@ float3 CartesianCoordinates2D::getCellSize() const
     return make_float3(m_cellSize);
 }
 
+float CartesianCoordinates2D::getCellArea(int cellId) const
+{
+    return m_cellSize.x * m_cellSize.y;
+}
+
 float3 CartesianCoordinates2D::getMinCoord() const
 {
     return float3{m_min.x, m_min.y, 0};
@@ -166,6 +172,12 @@ float3 CartesianCoordinates2D::getAABBMax() const
     return float3{m_max.x,m_max.y,0};
 }
 
+std::shared_ptr<CoordinateSystem> CartesianCoordinates2D::createCoarsened(int level) const
+{
+    int2 coarseCells = coarsenedGridSize(m_numGridCells, level);
+    return std::make_shared<CartesianCoordinates2D>(make_float3(m_min,0), make_float3(m_max,0), make_int3(coarseCells,1));
+}
+
 std::string CartesianCoordinates2D::getShaderDefine() const
 {
     return "CARTESIAN_COORDINATES_2D";
@@ -67,6 +67,7 @@ public:
 
     // dimensions
     CUDAHOSTDEV float3 getCellSize() const override; //! get the size of the cell in target coordinates (uniform grid)
+    CUDAHOSTDEV float getCellArea(int cellId) const override; //!< get the area (2d) of a cell in cartesian units, used to integrate quantities over the grid
     CUDAHOSTDEV int getDimension() const override; //!< get the number of dimensions
     CUDAHOSTDEV int getCartesianDimension() const override; //!< get the number of dimensions in cartesian coordinates (eg surface of sphere dim=2 cartesian_dim = 3)
 
@@ -78,6 +79,9 @@ public:
     std::string getShaderDefine() const override ; //!< returns name of a file to be included in a shader which defines above functions in glsl
     void setShaderUniforms(mpu::gph::ShaderProgram& shader) const override; //!< sets the necessary uniforms to a shader that included th shader file from "getShaderFileName()" function
 
+    // multi resolution
+    std::shared_ptr<CoordinateSystem> createCoarsened(int level) const override; //!< coordinate system of level "level" of the grid pyramid (see mipmap.h), covering the same area
+
     // downcasting and template things
     CUDAHOSTDEV CSType getType() const override; //!< identify the type of coordinate system using CSType from enums.h for downcasting
     static constexpr bool isCartesian{true}; //!< is the coordinate system a cartesian coordinate system
@@ -76,6 +76,7 @@ public:
 
     // dimensions
     CUDAHOSTDEV virtual float3 getCellSize() const =0; //! get the size of the cell in target coordinates (uniform grid)
+    CUDAHOSTDEV virtual float getCellArea(int cellId) const =0; //!< get the area (2d) of a cell in cartesian units, used to integrate quantities over the grid
     CUDAHOSTDEV virtual int getDimension() const =0; //!< get the number of dimensions 1-3
     CUDAHOSTDEV virtual int getCartesianDimension() const =0; //!< get the number of dimensions in cartesian coordinates 1-3 (eg surface of sphere dim=2 cartesian_dim = 3)
 
@@ -87,6 +88,9 @@ public:
     virtual std::string getShaderDefine() const =0; //!< returns name of a file to be included in a shader which defines above functions in glsl
     virtual void setShaderUniforms(mpu::gph::ShaderProgram& shader) const =0; //!< sets the necessary uniforms to a shader that included th shader file from "getShaderFileName()" function
 
+    // multi resolution
+    virtual std::shared_ptr<CoordinateSystem> createCoarsened(int level) const =0; //!< coordinate system of level "level" of the grid pyramid (see mipmap.h), covering the same area
+
     // type for downcasting
     CUDAHOSTDEV virtual CSType getType() const=0; //!< identify the type of coordinate system using CSType from enums.h for downcasting
 };
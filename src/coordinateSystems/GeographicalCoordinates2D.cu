@@ -14,17 +14,24 @@
 // includes
 //--------------------
 #include "GeographicalCoordinates2D.h"
+#include "../mipmap.h"
 //--------------------
 
 // function definitions of the GeographicalCoordinates2D class
 //-------------------------------------------------------------------
 
 GeographicalCoordinates2D::GeographicalCoordinates2D(float minLat, float maxLat, int3 numGridCells, float radius)
+    : GeographicalCoordinates2D(0, 2* M_PIf32, minLat, maxLat, numGridCells, radius)
+{
+}
+
+GeographicalCoordinates2D::GeographicalCoordinates2D(float minLon, float maxLon, float minLat, float maxLat, int3 numGridCells, float radius)
     : m_radius(radius), m_numGridCells(make_int2(numGridCells)),
-        m_min(make_float2(0,minLat)), m_max(make_float2(2* M_PIf32, maxLat)),
-        m_totalNumGridCells(numGridCells.x*numGridCells.y), m_size(m_max - m_min),
-        m_cellSize( m_size / make_float2( m_numGridCells.x, (m_numGridCells.y<2) ? 1 : m_numGridCells.y-1) )
-        // pretend there was one cel less to fix overlap
+        m_min(make_float2(minLon,minLat)), m_max(make_float2(maxLon, maxLat)),
+        m_totalNumGridCells(numGridCells.x*numGridCells.y), m_periodic(maxLon - minLon >= 2* M_PIf32 - 1.0e-4f), m_size(m_max - m_min),
+        m_cellSize( m_size / make_float2( (m_periodic || m_numGridCells.x<2) ? m_numGridCells.x : m_numGridCells.x-1,
+                                          (m_numGridCells.y<2) ? 1 : m_numGridCells.y-1) )
+        // pretend there was one cel less to fix overlap, periodic grids do not overlap in x direction
 {
 }
 
@@ -97,14 +104,14 @@ int3 GeographicalCoordinates2D::getCellId3d(const float3& coord) const
 int GeographicalCoordinates2D::getRightNeighbor(int cellId) const
 {
     cellId += 1;
-    if(cellId % m_numGridCells.x == 0)
+    if(m_periodic && cellId % m_numGridCells.x == 0)
         cellId -= m_numGridCells.x;
     return cellId;
 }
 
 int GeographicalCoordinates2D::getLeftNeighbor(int cellId) const
 {
-    if(cellId % m_numGridCells.x == 0)
+    if(m_periodic && cellId % m_numGridCells.x == 0)
         cellId += m_numGridCells.x;
     return cellId-1;
 }
@@ -151,7 +158,7 @@ int3 GeographicalCoordinates2D::getNumGridCells3d() const
 
 int3 GeographicalCoordinates2D::hasBoundary() const
 {
-    return make_int3(0,1,0);
+    return make_int3(m_periodic ? 0 : 1,1,0);
 }
 
 float3 GeographicalCoordinates2D::getCellSize() const
@@ -159,6 +166,17 @@ float3 GeographicalCoordinates2D::getCellSize() const
     return make_float3(m_cellSize);
 }
 
+float GeographicalCoordinates2D::getCellArea(int cellId) const
+{
+    // area of the spherical rectangle between the cell faces, first and last row end at the min / max latitude
+    // first and last column of regional grids end at the min / max longitude
+    float2 coord = make_float2(getCellCoordinate(cellId));
+    float latBackward = fmax(coord.y - 0.5f*m_cellSize.y, m_min.y);
+    float latForward = fmin(coord.y + 0.5f*m_cellSize.y, m_max.y);
+    float width = m_periodic ? m_cellSize.x : fmin(coord.x + 0.5f*m_cellSize.x, m_max.x) - fmax(coord.x - 0.5f*m_cellSize.x, m_min.x);
+    return m_radius * m_radius * width * (sin(latForward) - sin(latBackward));
+}
+
 int GeographicalCoordinates2D::getDimension() const
 {
     return 2;
@@ -179,6 +197,12 @@ float3 GeographicalCoordinates2D::getAABBMax() const
     return make_float3(m_radius);
 }
 
+std::shared_ptr<CoordinateSystem> GeographicalCoordinates2D::createCoarsened(int level) const
+{
+    int2 coarseCells = coarsenedGridSize(m_numGridCells, level);
+    return std::make_shared<GeographicalCoordinates2D>(m_min.x, m_max.x, m_min.y, m_max.y, make_int3(coarseCells,1), m_radius);
+}
+
 std::string GeographicalCoordinates2D::getShaderDefine() const
 {
     return "GEOGRAPHICAL_COORDINATES_2D";
@@ -24,6 +24,8 @@
  * class GeographicalCoordinates2D
  *
  * 2D geographical coordinates (one layer). First component is longitude 0<long<2pi, second is latitude. Grid cell access is row major.
+ * Grids that cover all longitudes are periodic in x direction. Regional grids cover a range of longitudes, cell centers
+ * are placed on both ends of the range (like for latitude) and they have a boundary in x direction.
  * No bounds checking is done!
  *
  * notation and formulas from http://mathworld.wolfram.com/SphericalCoordinates.html
@@ -33,6 +35,7 @@ class GeographicalCoordinates2D : public CoordinateSystem
 {
 public:
     CUDAHOSTDEV GeographicalCoordinates2D(float minLat, float maxLat, int3 numGridCells, float radius); //!< smallest and biggest allowed latitude values (0<lat<pi), number of grid cells and radius (only used for conversion to cartesian coordinates)
+    CUDAHOSTDEV GeographicalCoordinates2D(float minLon, float maxLon, float minLat, float maxLat, int3 numGridCells, float radius); //!< regional grid between the longitudes minLon and maxLon, periodic if the range is 2pi
     CUDAHOSTDEV ~GeographicalCoordinates2D() final = default;
 
     // convert
@@ -69,6 +72,7 @@ public:
 
     // dimensions
     CUDAHOSTDEV float3 getCellSize() const final; //! get the size of the cell in target coordinates (uniform grid)
+    CUDAHOSTDEV float getCellArea(int cellId) const final; //!< get the area (2d) of a cell in cartesian units, used to integrate quantities over the grid
     CUDAHOSTDEV int getDimension() const final; //!< get the number of dimensions
     CUDAHOSTDEV int getCartesianDimension() const final; //!< get the number of dimensions in cartesian coordinates (eg surface of sphere dim=2 cartesian_dim = 3)
 
@@ -80,6 +84,9 @@ public:
     std::string getShaderDefine() const final; //!< returns name of a file to be included in a shader which defines above functions in glsl
     void setShaderUniforms(mpu::gph::ShaderProgram& shader) const final; //!< sets the necessary uniforms to a shader that included th shader file from "getShaderFileName()" function
 
+    // multi resolution
+    std::shared_ptr<CoordinateSystem> createCoarsened(int level) const final; //!< coordinate system of level "level" of the grid pyramid (see mipmap.h), covering the same area
+
     // downcasting
     CUDAHOSTDEV CSType getType() const final; //!< identify the type of coordinate system using CSType from enums.h for downcasting
     static constexpr bool isCartesian{false}; //!< is the coordinate system a cartesian coordinate system
@@ -88,6 +95,7 @@ private:
     const float m_radius; //!< radius of the sphere shell
     const int2 m_numGridCells; //!< number of cells in each dimension
     const int m_totalNumGridCells; //!< total number of cells
+    const bool m_periodic; //!< the grid covers all longitudes and wraps around in x direction
     const float2 m_min; //!< smallest possible coordinate in both directions i.e. lower left corner of the grid
     const float2 m_max; //!< biggest possible coordinate in both directions i.e. upper right corner of the grid
     const float2 m_size; //!< size of the grid in both coordinate directions (m_max - m_min)
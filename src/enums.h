@@ -18,7 +18,8 @@ enum class SimModel : int
 {
     renderDemo = 0,
     testSimulation = 1,
-    shallowWaterModel = 2
+    shallowWaterModel = 2,
+    shallowWaterEnsemble = 3
 };
 
 /**
@@ -30,5 +31,66 @@ enum class CSType : int
     geographical2d = 1
 };
 
+/**
+ * Types of boundary conditions available for each face of the grid
+ */
+enum class BoundaryType : int
+{
+    periodic = 0, //!< values wrap around to the opposite face
+    mirror = 1, //!< closest interior value with opposite sign, use for velocities to get zero at the wall
+    fixedValue = 2, //!< constant value
+    zeroGradient = 3, //!< closest interior value
+    sponge = 4 //!< constant value, cells near the face are relaxed towards it
+};
+
+
+/**
+ * Map projections used to draw a grid into an image
+ */
+enum class ImageProjection : int
+{
+    automatic = 0, //!< cartesian view for cartesian grids, equirectangular for geographical grids
+    cartesian = 1, //!< grid coordinates mapped linearly to the image
+    equirectangular = 2, //!< longitude and latitude of the grid region mapped linearly to the whole image
+    orthographic = 3 //!< globe seen from far away, centered at the equator
+};
+/**
+ * Interpolation used to sample fields at the departure points of semi-lagrangian advection
+ */
+enum class AdvectionInterpolation : int
+{
+    bilinear = 0, //!< first order, smooths the field
+    monotoneCubic = 1 //!< catmull-rom cubic limited to the range of the surrounding four values, no new extrema
+};
+
+/**
+ * How steps that are not looked at are simulated
+ */
+enum class StepBatching : int
+{
+    off = 0, //!< one launch per kernel and step
+    gridBarrier = 1, //!< one persistent kernel, all phases are separated by grid wide barriers
+    wavefront = 2 //!< one persistent kernel, a band of rows starts a phase as soon as its neighbor bands finished the previous phase
+};
+
+/**
+ * How the number of timesteps per rendered frame is chosen, see StepScheduler
+ */
+enum class StepScheduling : int
+{
+    fixed = 0, //!< number of steps set by the user
+    frameTime = 1, //!< as many steps as fit into a target frame time
+    simulationRate = 2, //!< steps to advance a target amount of simulated time per second
+    fastForward = 3 //!< simulate at the target frame time, but only publish a frame once per fast forward interval
+};
+
+/**
+ * Quantity that decides where the mesh is refined
+ */
+enum class RefinementCriterion : int
+{
+    vorticity = 0, //!< magnitude of the relative vorticity
+    geopotentialGradient = 1 //!< magnitude of the gradient of the geopotential
+};
 
 #endif //CIRCULATION_ENUMS_H
@@ -14,4 +14,10 @@
 //!< filename of persistence file
 constexpr char persistFilename[] = "circulation_persist.cfg";
 
+//!< filename of the file that stores kernel launch sizes found by the LaunchTuner
+constexpr char tuningFilename[] = "circulation_tuning.cfg";
+
+//!< filename used for checkpoints
+constexpr char checkpointFilename[] = "circulation_checkpoint.ckpt";
+
 #endif //CIRCULATION_GLOBALSETTINGS_H
@@ -21,7 +21,7 @@
  * @brief approximate the value at targetPosition using values at position A and B in 1D
  */
 template <typename T>
-__device__ T linearInterpolate(float targetPosition, float positionA, T valueA, float positionB, T valueB)
+CUDAHOSTDEV T linearInterpolate(float targetPosition, float positionA, T valueA, float positionB, T valueB)
 {
     float f = (targetPosition-positionA) / (positionB-positionA);
     return valueA * (1-f) + valueB * f;
@@ -32,14 +32,14 @@ __device__ T linearInterpolate(float targetPosition, float positionA, T valueA,
  * @param valueAA value at (AX,AY)
  * @param valueBA value at (BX,AY)
  * @param valueAB value at (AX,BY)
- * @param valueBB value at (AY,BY)
+ * @param valueBB value at (BX,BY)
  */
 template <typename T>
-__device__ T bilinearInterpolate(float2 targetPosition, float positionAX, float positionBX, float positionAY, float positionBY,
+CUDAHOSTDEV T bilinearInterpolate(float2 targetPosition, float positionAX, float positionBX, float positionAY, float positionBY,
                                                         T valueAA, T valueBA, T valueAB, T valueBB)
 {
     T vxA = linearInterpolate(targetPosition.x, positionAX, valueAA, positionBX, valueBA);
-    T vxB = linearInterpolate(targetPosition.x, positionAX, valueAB, positionAX, valueBB);
+    T vxB = linearInterpolate(targetPosition.x, positionAX, valueAB, positionBX, valueBB);
     return linearInterpolate(targetPosition.y, positionAY, vxA, positionBY, vxB);
 }
 
@@ -11,8 +11,10 @@
 
 #include <mpUtils/mpUtils.h>
 #include "Application.h"
+#include "HeadlessRunner.h"
+#include "SweepRunner.h"
 
-int main()
+int main(int argc, char* argv[])
 {
     // setup logging
     mpu::Log myLog( mpu::LogLvl::ALL, mpu::ConsoleSink());
@@ -22,6 +24,20 @@ int main()
     myLog.printHeader("CIRCULATION", CIRCULATION_VERSION, CIRCULATION_VERSION_SHA, "Debug");
 #endif
 
+    // run a parameter sweep if requested
+    if(SweepRunner::isSweep(argc, argv))
+    {
+        SweepRunner sweep(argc, argv);
+        return sweep.run();
+    }
+
+    // run without window if requested
+    if(HeadlessRunner::isHeadless(argc, argv))
+    {
+        HeadlessRunner runner(argc, argv);
+        return runner.run();
+    }
+
     // create app
     Application myApp(600,600);
 
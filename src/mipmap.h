@@ -0,0 +1,81 @@
+/*
+ * CIRCULATION
+ * mipmap.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+#ifndef CIRCULATION_MIPMAP_H
+#define CIRCULATION_MIPMAP_H
+
+// includes
+//--------------------
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+//--------------------
+
+/**
+ * @brief level of a multi resolution pyramid of a 2d grid, level 0 is the grid itself
+ *  every level halves the number of cells in each dimension, coarse cell i lies on top of fine cell 2*i
+ */
+struct RenderLevel
+{
+    int level{0}; //!< level of the pyramid
+    int2 numGridCells{0,0}; //!< number of cells of the full resolution grid
+    bool periodicX{false}; //!< the first dimension wraps around
+};
+
+/**
+ * @brief number of cells in each dimension of pyramid level "level" of a grid with numGridCells cells
+ */
+CUDAHOSTDEV inline int2 coarsenedGridSize(int2 numGridCells, int level)
+{
+    for(int i = 0; i < level; i++)
+        numGridCells = make_int2( (numGridCells.x+1) / 2, (numGridCells.y+1) / 2);
+    return numGridCells;
+}
+
+/**
+ * @brief computes one cell of the next coarser level using a 3x3 tent filter centered on fine cell (2x,2y)
+ */
+template <typename T>
+__global__ void downsampleGrid(const T* fine, T* coarse, int2 fineCells, int2 coarseCells, bool periodicX)
+{
+    for(int i : mpu::gridStrideRange(coarseCells.x * coarseCells.y))
+    {
+        const int cx = i % coarseCells.x;
+        const int cy = i / coarseCells.x;
+
+        T sum{};
+        float weightSum = 0.0f;
+        for(int dy = -1; dy <= 1; dy++)
+        {
+            const int y = min(max(2*cy + dy, 0), fineCells.y-1);
+            for(int dx = -1; dx <= 1; dx++)
+            {
+                int x = 2*cx + dx;
+                x = periodicX ? (x + fineCells.x) % fineCells.x : min(max(x, 0), fineCells.x-1);
+                const float w = float((2 - abs(dx)) * (2 - abs(dy)));
+                sum += w * fine[y * fineCells.x + x];
+                weightSum += w;
+            }
+        }
+        coarse[i] = sum / weightSum;
+    }
+}
+
+/**
+ * @brief fill the next coarser level of a 2d grid, coarse needs to hold coarsenedGridSize(fineCells,1) cells
+ */
+template <typename T>
+void downsampleGrid(const T* fine, T* coarse, int2 fineCells, bool periodicX)
+{
+    const int2 coarseCells = coarsenedGridSize(fineCells, 1);
+    const int blocksize = 128;
+    downsampleGrid<<< mpu::numBlocks(coarseCells.x * coarseCells.y, blocksize), blocksize>>>(fine, coarse, fineCells, coarseCells, periodicX);
+}
+
+#endif //CIRCULATION_MIPMAP_H
@@ -0,0 +1,138 @@
+/*
+ * CIRCULATION
+ * semiLagrangian.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+#ifndef CIRCULATION_SEMILAGRANGIAN_H
+#define CIRCULATION_SEMILAGRANGIAN_H
+
+// includes
+//--------------------
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+#include "coordinateSystems/GeographicalCoordinates2D.h"
+#include "Grid.h"
+#include "enums.h"
+//--------------------
+
+/*
+ * Semi-lagrangian advection: the value at a cell at t+dt is the value at time t at the point where the fluid came from
+ * (the departure point). Departure points are traced backwards through the velocity field and the field is interpolated
+ * there, so the scheme stays stable for timesteps above the advective CFL limit.
+ * All positions are in index space, the center of cell (i,j) is at (i,j). Velocities are staggered as in the rest of the
+ * models, velocityX at (i+0.5,j) and velocityY at (i,j+0.5).
+ */
+
+/**
+ * @brief rate of change of the index space position when moving with velocity at index space position
+ */
+template <typename csT>
+CUDAHOSTDEV inline float2 velocityToIndexRate(const float2& velocity, const float2& position, const csT& cs)
+{
+    static_assert(csT::isCartesian, "This overload only works for cartesian coordinates.");
+    return velocity / make_float2(cs.getCellSize());
+}
+
+template <>
+CUDAHOSTDEV inline float2 velocityToIndexRate<GeographicalCoordinates2D>(const float2& velocity, const float2& position, const GeographicalCoordinates2D& cs)
+{
+    // cos(latitude) is limited to the distance of the outermost cell center from the pole to avoid the singularity
+    const float latitude = cs.getMinCoord().y + position.y * cs.getCellSize().y;
+    const float cosLat = fmaxf(cos(latitude), 0.5f * cs.getCellSize().y);
+    const float rinv = 1.0f / cs.getMinCoord().z;
+    return make_float2( rinv / cosLat * velocity.x / cs.getCellSize().x, rinv * velocity.y / cs.getCellSize().y );
+}
+
+/**
+ * @brief index of a cell in a dimension with n cells, wraps around in periodic dimensions and is clamped otherwise
+ */
+CUDAHOSTDEV inline int wrapOrClampIndex(int i, int n, bool periodic)
+{
+    return periodic ? ((i % n) + n) % n : min(max(i, 0), n-1);
+}
+
+/**
+ * @brief catmull-rom cubic through four equally spaced values, f is the position between b and c
+ */
+CUDAHOSTDEV inline float cubicInterpolate(float a, float b, float c, float d, float f)
+{
+    return b + 0.5f * f * (c - a + f * (2.0f*a - 5.0f*b + 4.0f*c - d + f * (3.0f*(b - c) + d - a)));
+}
+
+/**
+ * @brief sample attribute Param of the grid at index space position
+ * @param offset index space position of the value stored for cell (0,0), eg (0.5,0) for velocityX
+ * @param previous sample time level t-1 instead of t
+ */
+template <AT Param, typename csT, typename GridRefT>
+__device__ float sampleGrid(GridRefT& grid, float2 position, const float2& offset, const csT& cs,
+                            AdvectionInterpolation interpolation=AdvectionInterpolation::bilinear, bool previous=false)
+{
+    const int3 numCells = cs.getNumGridCells3d();
+    const bool periodicX = cs.hasBoundary().x == 0;
+
+    position = position - offset;
+    if(!periodicX)
+        position.x = fminf(fmaxf(position.x, 0.0f), float(numCells.x-1));
+    position.y = fminf(fmaxf(position.y, 0.0f), float(numCells.y-1));
+
+    const int x0 = static_cast<int>(floorf(position.x));
+    const int y0 = static_cast<int>(floorf(position.y));
+    const float2 f = make_float2(position.x - float(x0), position.y - float(y0));
+
+    auto value = [&](int dx, int dy) -> float
+    {
+        const int cellId = cs.getCellId(make_int3( wrapOrClampIndex(x0+dx, numCells.x, periodicX), wrapOrClampIndex(y0+dy, numCells.y, false), 0));
+        return previous ? grid.template readPrev<Param>(cellId) : grid.template read<Param>(cellId);
+    };
+
+    const float v00 = value(0,0);
+    const float v10 = value(1,0);
+    const float v01 = value(0,1);
+    const float v11 = value(1,1);
+
+    if(interpolation == AdvectionInterpolation::bilinear)
+        return (v00 * (1.0f-f.x) + v10 * f.x) * (1.0f-f.y) + (v01 * (1.0f-f.x) + v11 * f.x) * f.y;
+
+    float rows[4];
+    for(int j = 0; j < 4; j++)
+    {
+        const int dy = j - 1;
+        const float b = (dy == 0) ? v00 : (dy == 1) ? v01 : value(0,dy);
+        const float c = (dy == 0) ? v10 : (dy == 1) ? v11 : value(1,dy);
+        rows[j] = cubicInterpolate(value(-1,dy), b, c, value(2,dy), f.x);
+    }
+    const float result = cubicInterpolate(rows[0], rows[1], rows[2], rows[3], f.y);
+
+    // limiting to the surrounding values keeps the scheme free of new extrema
+    return fminf(fmaxf(result, fminf(fminf(v00, v10), fminf(v01, v11))), fmaxf(fmaxf(v00, v10), fmaxf(v01, v11)));
+}
+
+/**
+ * @brief index space rate of change of the staggered velocity field at index space position
+ */
+template <typename csT, typename GridRefT>
+__device__ float2 sampleIndexRate(GridRefT& grid, const float2& position, const csT& cs)
+{
+    const float2 velocity = make_float2( sampleGrid<AT::velocityX>(grid, position, make_float2(0.5f,0.0f), cs),
+                                         sampleGrid<AT::velocityY>(grid, position, make_float2(0.0f,0.5f), cs) );
+    return velocityToIndexRate(velocity, position, cs);
+}
+
+/**
+ * @brief trace the index space position arrival backwards in time through the velocity field at time t using the midpoint rule
+ * @return index space position of the departure point, timestep earlier
+ */
+template <typename csT, typename GridRefT>
+__device__ float2 departurePoint(GridRefT& grid, const float2& arrival, float timestep, const csT& cs)
+{
+    const float2 midpoint = arrival - 0.5f * timestep * sampleIndexRate(grid, arrival, cs);
+    return arrival - timestep * sampleIndexRate(grid, midpoint, cs);
+}
+
+#endif //CIRCULATION_SEMILAGRANGIAN_H
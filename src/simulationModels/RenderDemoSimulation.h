@@ -39,7 +39,7 @@ public:
     std::shared_ptr<GridBase> recreate(std::shared_ptr<CoordinateSystem> cs) override
     {
         m_cs = cs;
-        m_grid = std::make_shared<RenderDemoGrid>(m_cs->getNumGridCells());
+        m_grid = std::make_shared<RenderDemoGrid>(m_cs->getNumGridCells(), !m_headless);
 
         // call reset() to initialize data
         reset();
@@ -52,13 +52,33 @@ public:
         return std::make_unique<RenderDemoSimulation>(*this);
     }
 
+    SimModel getModelType() const override
+    {
+        return SimModel::renderDemo;
+    }
+
     void showBoundaryOptions(const CoordinateSystem& cs) override
     {
         ImGui::Text("This is a rendering demo, it does not include any special boundary handling.");
     }
 
+    SimulationState getState() const override
+    {
+        SimulationState state;
+        state.step = m_step;
+        return state;
+    }
+
+    void setState(const SimulationState& state) override
+    {
+        m_step = state.step;
+    }
+
     void reset() override
     {
+        m_stepScheduler.reset();
+        m_step = 0;
+
         // generate some data
         std::default_random_engine rng(mpu::getRanndomSeed());
         std::normal_distribution<float> dist(10,4);
@@ -90,7 +110,8 @@ private:
 
     void simulateOnce() override
     {
-        // this is the rendering demo, so we do nothing
+        // this is the rendering demo, so we only count the steps for output
+        m_step++;
     }
 
     GridBase& getGrid() override
@@ -115,6 +136,7 @@ private:
     // sim data
     std::shared_ptr<CoordinateSystem> m_cs;
     std::shared_ptr<RenderDemoGrid> m_grid;
+    int m_step{0}; //!< number of timesteps since the last reset
 
 };
 
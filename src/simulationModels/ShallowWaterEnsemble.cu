@@ -0,0 +1,455 @@
+/*
+ * CIRCULATION
+ * ShallowWaterEnsemble.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ShallowWaterEnsemble class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "ShallowWaterEnsemble.h"
+#include <random>
+#include <climits>
+
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpGraphics.h>
+#include <mpUtils/mpCuda.h>
+
+#include "../GridReference.h"
+#include "../coordinateSystems/CartesianCoordinates2D.h"
+#include "../coordinateSystems/GeographicalCoordinates2D.h"
+#include "../LaunchTuner.h"
+//--------------------
+
+// function definitions of the ShallowWaterEnsemble class
+//-------------------------------------------------------------------
+
+void ShallowWaterEnsemble::showCreationOptions()
+{
+    ImGui::DragInt("Ensemble members", &m_numMembers, 0.1, 1, 1024);
+    int seed = static_cast<int>(m_seed);
+    if(ImGui::InputInt("Random seed", &seed))
+        m_seed = static_cast<unsigned int>(seed);
+    ImGui::DragFloat2("position of disturbance", &m_gaussianPosition.x, 0.001);
+    ImGui::DragFloat("position spread", &m_positionSpread, 0.001f, 0.0f, 1.0f);
+    ImGui::DragFloat("standard deviation", &m_stdDev,0.01f);
+    ImGui::DragFloat("multiplier", &m_multiplier,0.01f);
+    ImGui::DragFloat("multiplier spread", &m_multiplierSpread, 0.001f, 0.0f, 1.0f);
+}
+
+void ShallowWaterEnsemble::showBoundaryOptions(const CoordinateSystem& cs)
+{
+    if(cs.hasBoundary().x)
+    {
+        int type = (m_boundaryTypeX == BoundaryType::mirror) ? 1 : 0;
+        if(ImGui::Combo("X-Axis Boundary", &type, "Free slip wall\0No slip wall\0\0"))
+            m_boundaryTypeX = (type == 1) ? BoundaryType::mirror : BoundaryType::zeroGradient;
+    }
+    if(cs.hasBoundary().y)
+    {
+        int type = (m_boundaryTypeY == BoundaryType::mirror) ? 1 : 0;
+        if(ImGui::Combo("Y-Axis Boundary", &type, "Free slip wall\0No slip wall\0\0"))
+            m_boundaryTypeY = (type == 1) ? BoundaryType::mirror : BoundaryType::zeroGradient;
+    }
+}
+
+void ShallowWaterEnsemble::updateBoundaryConditions()
+{
+    for(int axis : {0,1})
+    {
+        // velocity normal to the wall is zero, tangential velocity is copied (free slip) or mirrored (no slip)
+        FaceBoundary normal;
+        normal.type = BoundaryType::fixedValue;
+        FaceBoundary tangential;
+        tangential.type = (axis == 0) ? m_boundaryTypeX : m_boundaryTypeY;
+        FaceBoundary phi;
+        phi.type = BoundaryType::zeroGradient;
+
+        m_boundaries.get<AT::velocityX>().setAxis(axis, (axis == 0) ? normal : tangential);
+        m_boundaries.get<AT::velocityY>().setAxis(axis, (axis == 1) ? normal : tangential);
+        m_boundaries.get<AT::geopotential>().setAxis(axis, phi);
+    }
+
+    // on the C grid velocities are stored on the right / forward face of the cell
+    m_boundaries.get<AT::velocityX>().staggeredX = true;
+    m_boundaries.get<AT::velocityY>().staggeredY = true;
+}
+
+void ShallowWaterEnsemble::showSimulationOptions()
+{
+    bool changed = false;
+    if(m_cs->getType() != CSType::geographical2d)
+        changed |= ImGui::DragFloat("Coriolis parameter",&m_coriolisParameter,0.0001f,0.000001,5.0f,"%.7f");
+    else
+        changed |= ImGui::DragFloat("Angular Velocity",&m_angularVelocity,0.00001f,0.00001,5.0f,"%.5f");
+    changed |= ImGui::DragFloat("Coriolis spread",&m_coriolisSpread,0.001f,0.0f,1.0f);
+
+    changed |= ImGui::DragFloat("Geopotential diffusion",&m_geopotDiffusion,0.00001f,0.00001,1.0,"%.5f");
+    changed |= ImGui::DragFloat("Diffusion spread",&m_diffusionSpread,0.001f,0.0f,1.0f);
+    ImGui::Checkbox("Use Leapfrog",&m_useLeapfrog);
+    changed |= ImGui::DragFloat("Timestep",&m_timestep,0.000001,0.000001f,1.0,"%.6f");
+    changed |= ImGui::DragFloat("Timestep spread",&m_timestepSpread,0.001f,0.0f,1.0f);
+    m_parametersChanged |= changed;
+
+    ImGui::SliderInt("Displayed member", &m_displayedMember, 0, m_numMembers-1);
+    ImGui::Text("Simulated Time units: %f", m_totalSimulatedTime);
+    ImGui::Text("Throughput: %.3g member-steps/s", m_memberStepsPerSecond);
+
+    if( ImGui::CollapsingHeader("Boundaries"))
+        showBoundaryOptions(*m_cs);
+}
+
+std::shared_ptr<GridBase> ShallowWaterEnsemble::recreate(std::shared_ptr<CoordinateSystem> cs)
+{
+    m_cs = cs;
+    const size_t ensembleCells = size_t(m_cs->getNumGridCells()) * m_numMembers;
+    assert_critical(ensembleCells < INT_MAX, "ShallowWaterEnsemble", "Too many ensemble members for the grid size.");
+
+    m_ensembleGrid = std::make_shared<ShallowWaterGrid>(static_cast<int>(ensembleCells), false);
+    m_displayGrid = std::make_shared<ShallowWaterGrid>(m_cs->getNumGridCells(), !m_headless);
+    m_phiPlusKBuffer.resize(ensembleCells);
+    m_vortPlusCor.resize(ensembleCells);
+    m_displayedMember = std::min(m_displayedMember, m_numMembers-1);
+
+    auto createEvent = []()
+    {
+        auto event = new cudaEvent_t;
+        assert_cuda(cudaEventCreate(event));
+        return std::shared_ptr<cudaEvent_t>(event, [](cudaEvent_t* e){ cudaEventDestroy(*e); delete e; });
+    };
+    m_stepStart = createEvent();
+    m_stepEnd = createEvent();
+
+    // select coordinate system
+    switch(m_cs->getType())
+    {
+        case CSType::cartesian2d:
+            m_simOnceFunc = [this](){ this->simulateOnceImpl( static_cast<CartesianCoordinates2D&>( *(this->m_cs)) ); };
+            break;
+        case CSType::geographical2d:
+            m_simOnceFunc = [this](){ this->simulateOnceImpl( static_cast<GeographicalCoordinates2D&>( *(this->m_cs)) ); };
+            break;
+    }
+
+    reset();
+    return m_displayGrid;
+}
+
+__global__ void gatherEnsembleMember(ShallowWaterGrid::ReferenceType ensemble, ShallowWaterGrid::ReferenceType display,
+                                     int numCells, int numMembers, int member)
+{
+    // copies one member from the t buffer of the ensemble to the t+1 buffer of the display grid
+    for(int cellId : mpu::gridStrideRange(numCells))
+    {
+        const int id = cellId*numMembers + member;
+        display.write<AT::velocityX>(cellId, ensemble.read<AT::velocityX>(id));
+        display.write<AT::velocityY>(cellId, ensemble.read<AT::velocityY>(id));
+        display.write<AT::geopotential>(cellId, ensemble.read<AT::geopotential>(id));
+        display.write<AT::potentialVort>(cellId, ensemble.read<AT::potentialVort>(id));
+    }
+}
+
+void ShallowWaterEnsemble::reset()
+{
+    // reset simulation state
+    m_totalSimulatedTime = 0.0f;
+    m_step = 0;
+    m_firstTimestep = true;
+    m_measurementPending = false;
+    m_parametersChanged = true;
+    m_stepScheduler.reset();
+    updateBoundaryConditions();
+
+    // perturbations of the initial conditions
+    std::vector<float3> disturbance(m_numMembers); // position and multiplier of each members gaussian
+    std::mt19937 rng(m_seed + 1);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for(auto& d : disturbance)
+    {
+        d.x = m_gaussianPosition.x + m_positionSpread * dist(rng);
+        d.y = m_gaussianPosition.y + m_positionSpread * dist(rng);
+        d.z = m_multiplier * (1.0f + m_multiplierSpread * dist(rng));
+    }
+
+    m_ensembleGrid->cacheOverwrite();
+
+    // create initial conditions using gaussian
+    const int numCells = m_cs->getNumGridCells();
+    #pragma omp parallel for
+    for(int i = 0; i < numCells; i++)
+    {
+        float3 c = m_cs->getCellCoordinate(i);
+        for(int m = 0; m < m_numMembers; m++)
+        {
+            const float3& d = disturbance[m];
+            float geopotential = fmax(1, d.z * glm::gauss<float>(c.x,d.x, m_stdDev) * glm::gauss<float>(c.y,d.y, m_stdDev));
+
+            const int id = i*m_numMembers + m;
+            m_ensembleGrid->initialize<AT::geopotential>(id, geopotential);
+            m_ensembleGrid->initialize<AT::velocityX>(id, 0.0f);
+            m_ensembleGrid->initialize<AT::velocityY>(id, 0.0f);
+        }
+    }
+
+    // initialize boundary
+    switch(m_cs->getType())
+    {
+        case CSType::cartesian2d:
+            m_boundaries.applyEnsembleOnHost(static_cast<CartesianCoordinates2D&>(*m_cs), *m_ensembleGrid, m_numMembers);
+            break;
+        case CSType::geographical2d:
+            m_boundaries.applyEnsembleOnHost(static_cast<GeographicalCoordinates2D&>(*m_cs), *m_ensembleGrid, m_numMembers);
+            break;
+    }
+    m_ensembleGrid->pushCachToDevice();
+    m_ensembleGrid->swapBuffer();
+
+    // copy displayed member and ready for rendering
+    gatherEnsembleMember<<<mpu::numBlocks(numCells,256), 256>>>(m_ensembleGrid->getGridReference(), m_displayGrid->getGridReference(),
+                                                                 numCells, m_numMembers, m_displayedMember);
+    m_displayGrid->swapAndRender();
+}
+
+std::unique_ptr<Simulation> ShallowWaterEnsemble::clone() const
+{
+    return std::make_unique<ShallowWaterEnsemble>(*this);
+}
+
+SimulationState ShallowWaterEnsemble::getState() const
+{
+    SimulationState state;
+    state.totalSimulatedTime = m_totalSimulatedTime;
+    state.step = m_step;
+    state.firstTimestep = m_firstTimestep;
+    return state;
+}
+
+void ShallowWaterEnsemble::updateMemberParameters()
+{
+    const float corOrAngvel = (m_cs->getType() == CSType::geographical2d) ? m_angularVelocity : m_coriolisParameter;
+
+    // same seed for every update, so members keep their relative perturbation when base values change
+    std::vector<ShallowWaterParameters> parameters(m_numMembers);
+    std::mt19937 rng(m_seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for(auto& p : parameters)
+    {
+        p.timestep = m_timestep * (1.0f + m_timestepSpread * dist(rng));
+        p.diffusion = m_geopotDiffusion * (1.0f + m_diffusionSpread * dist(rng));
+        p.corOrAngvel = corOrAngvel * (1.0f + m_coriolisSpread * dist(rng));
+    }
+    m_memberParameters.assign(parameters);
+    m_parametersChanged = false;
+}
+
+void ShallowWaterEnsemble::pollThroughput()
+{
+    if(!m_measurementPending)
+        return;
+
+    cudaError_t status = cudaEventQuery(*m_stepEnd);
+    if(status == cudaErrorNotReady)
+        return;
+    assert_cuda(status);
+
+    float milliseconds;
+    assert_cuda(cudaEventElapsedTime(&milliseconds, *m_stepStart, *m_stepEnd));
+    if(milliseconds > 0)
+        m_memberStepsPerSecond = double(m_numMembers) * 1000.0 / milliseconds;
+    m_measurementPending = false;
+}
+
+void ShallowWaterEnsemble::simulateOnce()
+{
+    m_simOnceFunc(); // calls correct template specialization
+}
+
+template <typename csT>
+__global__ void shallowWaterEnsembleA(ShallowWaterGrid::ReferenceType grid, csT coordinateSystem, int numMembers,
+                                      mpu::VectorReference<const ShallowWaterParameters> parameters,
+                                      mpu::VectorReference<float> phiPlusK, mpu::VectorReference<float> vortPlusCor,
+                                      bool useLeapfrog, bool writePotentialVort)
+{
+    csT cs = coordinateSystem;
+    const int3 numCells = cs.getNumGridCells3d();
+    const int3 hasBoundary = cs.hasBoundary();
+    const int innerX = numCells.x - 2*hasBoundary.x;
+    const int innerY = numCells.y - 2*hasBoundary.y;
+
+    // updates geopotential of all members in all non boundary cells
+    // neighbouring threads work on different members of the same cell
+    for(int i : mpu::gridStrideRange( innerX*innerY*numMembers ))
+    {
+        const int m = i % numMembers;
+        const int inner = i / numMembers;
+        int3 cell{hasBoundary.x + inner % innerX, hasBoundary.y + inner / innerX, 0};
+        int cellId = cs.getCellId(cell);
+        float2 cellPos = make_float2( cs.getCellCoordinate3d(cell) );
+
+        const int id = cellId*numMembers + m;
+        const int left = cs.getLeftNeighbor(cellId)*numMembers + m;
+        const int right = cs.getRightNeighbor(cellId)*numMembers + m;
+        const int backward = cs.getBackwardNeighbor(cellId)*numMembers + m;
+        const int forward = cs.getForwardNeighbor(cellId)*numMembers + m;
+
+        // read values of quantities
+        ShallowWaterStencilA s;
+        s.phi = grid.read<AT::geopotential>(id);
+        s.velRightX = grid.read<AT::velocityX>(id);
+        s.velForY = grid.read<AT::velocityY>(id);
+        s.velLeftX = grid.read<AT::velocityX>(left);
+        s.velBackY = grid.read<AT::velocityY>(backward);
+        s.velForX = grid.read<AT::velocityX>(forward);
+        s.velRightY = grid.read<AT::velocityY>(right);
+        s.phiLeft = grid.read<AT::geopotential>(left);
+        s.phiRight = grid.read<AT::geopotential>(right);
+        s.phiFor = grid.read<AT::geopotential>(forward);
+        s.phiBack = grid.read<AT::geopotential>(backward);
+        s.prevPhi = useLeapfrog ? grid.readPrev<AT::geopotential>(id) : 0.0f;
+
+        const ShallowWaterResultA r = shallowWaterStepA(s, cellPos, cs, parameters[m], useLeapfrog);
+        phiPlusK[id] = r.kinEnergy + s.phi;
+        vortPlusCor[id] = r.vortPlusCor;
+        if(writePotentialVort)
+            grid.write<AT::potentialVort>(id, abs(r.vortPlusCor) / s.phi);
+        grid.write<AT::geopotential>(id, r.nextPhi);
+    }
+}
+
+template <typename csT>
+__global__ void shallowWaterEnsembleB(ShallowWaterGrid::ReferenceType grid, csT coordinateSystem, int numMembers,
+                                      mpu::VectorReference<const ShallowWaterParameters> parameters,
+                                      mpu::VectorReference<const float> phiPlusK, mpu::VectorReference<const float> vortPlusCor,
+                                      bool useLeapfrog)
+{
+    csT cs = coordinateSystem;
+    const int3 numCells = cs.getNumGridCells3d();
+    const int3 hasBoundary = cs.hasBoundary();
+    const int innerX = numCells.x - 2*hasBoundary.x;
+    const int innerY = numCells.y - 2*hasBoundary.y;
+
+    // updates all non boundary velocities of all members
+    // velocities normal to a wall are stored one cell further inside, so they are skipped here
+    // and set by the boundary conditions instead
+    for(int i : mpu::gridStrideRange( innerX*innerY*numMembers ))
+    {
+        const int m = i % numMembers;
+        const int inner = i / numMembers;
+        int3 cell{hasBoundary.x + inner % innerX, hasBoundary.y + inner / innerX, 0};
+        int cellId = cs.getCellId(cell);
+        float2 cellPos = make_float2( cs.getCellCoordinate3d(cell) );
+
+        const bool updateX = cell.x < numCells.x-2*hasBoundary.x;
+        const bool updateY = cell.y < numCells.y-2*hasBoundary.y;
+        const int id = cellId*numMembers + m;
+
+        // read values of quantities
+        ShallowWaterStencilB s;
+        s.phiKRight = phiPlusK[cs.getRightNeighbor(cellId)*numMembers + m];
+        s.phiKForward = phiPlusK[cs.getForwardNeighbor(cellId)*numMembers + m];
+        s.phiK = phiPlusK[id];
+        s.vortCorLeft = vortPlusCor[cs.getLeftNeighbor(cellId)*numMembers + m];
+        s.vortCorBack = vortPlusCor[cs.getBackwardNeighbor(cellId)*numMembers + m];
+        s.vortCor = vortPlusCor[id];
+        s.velX = grid.read<AT::velocityX>(id);
+        s.velY = grid.read<AT::velocityY>(id);
+        s.prevVelX = useLeapfrog ? grid.readPrev<AT::velocityX>(id) : 0.0f;
+        s.prevVelY = useLeapfrog ? grid.readPrev<AT::velocityY>(id) : 0.0f;
+
+        const float2 nextVel = shallowWaterStepB(s, cellPos, cs, parameters[m].timestep, useLeapfrog);
+        if(updateX)
+            grid.write<AT::velocityX>(id,nextVel.x);
+        if(updateY)
+            grid.write<AT::velocityY>(id,nextVel.y);
+    }
+}
+
+template <typename csT>
+void ShallowWaterEnsemble::simulateOnceImpl(csT& cs)
+{
+    pollThroughput();
+    if(m_parametersChanged)
+        updateMemberParameters();
+
+    const int3 numCells = cs.getNumGridCells3d();
+    const int numInnerEntries = (numCells.x - 2*cs.hasBoundary().x) * (numCells.y - 2*cs.hasBoundary().y) * m_numMembers;
+
+    const bool useLeapfrog = !m_firstTimestep && m_useLeapfrog;
+    const int64_t cells = int64_t(cs.getNumGridCells()) * m_numMembers;
+
+    // kernels read time levels t and t-1 and write t+1, so they can be launched repeatedly while tuning
+    const bool writePotentialVort = diagnosticFieldsDue();
+    auto launchA = [&](dim3 blocksize)
+    {
+        shallowWaterEnsembleA<<< mpu::numBlocks(numInnerEntries, blocksize.x), blocksize>>>(m_ensembleGrid->getGridReference(), cs, m_numMembers,
+                m_memberParameters.getVectorReference(), m_phiPlusKBuffer.getVectorReference(), m_vortPlusCor.getVectorReference(),
+                useLeapfrog, writePotentialVort);
+    };
+    auto launchB = [&](dim3 blocksize)
+    {
+        shallowWaterEnsembleB<<< mpu::numBlocks(numInnerEntries, blocksize.x), blocksize>>>(m_ensembleGrid->getGridReference(), cs, m_numMembers,
+                m_memberParameters.getVectorReference(), m_phiPlusKBuffer.getVectorReference(), m_vortPlusCor.getVectorReference(),
+                useLeapfrog);
+    };
+    const std::vector<dim3> candidates{{256,1,1}, {128,1,1}, {512,1,1}, {64,1,1}};
+    const int3 tuningShape{numCells.x, numCells.y, m_numMembers};
+    const dim3 blocksizeA = LaunchTuner::instance().blockSize("ensembleA", tuningShape, candidates, launchA);
+    const dim3 blocksizeB = LaunchTuner::instance().blockSize("ensembleB", tuningShape, candidates, launchB);
+
+    // time one step every now and then, evaluated in a later step so we never wait for the device
+    const bool measure = !m_measurementPending;
+    if(measure)
+        assert_cuda(cudaEventRecord(*m_stepStart, cudaStreamPerThread));
+
+    {
+        PROFILE_GPU_SCOPE("ensemble A", cells);
+        launchA(blocksizeA);
+    }
+    {
+        PROFILE_GPU_SCOPE("ensemble B", cells);
+        launchB(blocksizeB);
+    }
+
+    // boundary cells of all attributes and members in one pass
+    {
+        PROFILE_GPU_SCOPE("boundaries", cells);
+        updateBoundaryConditions();
+        m_boundaries.applyEnsemble(cs, *m_ensembleGrid, m_numMembers);
+    }
+
+    if(measure)
+    {
+        assert_cuda(cudaEventRecord(*m_stepEnd, cudaStreamPerThread));
+        m_measurementPending = true;
+    }
+
+    // the display grid is swapped by run(), so the displayed member is written to its t+1 buffer
+    // it is only needed on steps that are rendered or written
+    m_ensembleGrid->swapBuffer();
+    if(diagnosticFieldsDue())
+    {
+        PROFILE_GPU_SCOPE("gather member", cs.getNumGridCells());
+        gatherEnsembleMember<<<mpu::numBlocks(m_cs->getNumGridCells(),256), 256>>>(m_ensembleGrid->getGridReference(),
+                m_displayGrid->getGridReference(), m_cs->getNumGridCells(), m_numMembers, m_displayedMember);
+    }
+
+    m_totalSimulatedTime += m_timestep;
+    m_step++;
+    m_firstTimestep = false;
+}
+
+GridBase& ShallowWaterEnsemble::getGrid()
+{
+    return *m_displayGrid;
+}
+
+std::string ShallowWaterEnsemble::getDisplayName()
+{
+    return "Shallow Water Ensemble";
+}
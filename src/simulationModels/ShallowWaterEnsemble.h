@@ -0,0 +1,116 @@
+/*
+ * CIRCULATION
+ * ShallowWaterEnsemble.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ShallowWaterEnsemble class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_SHALLOWWATERENSEMBLE_H
+#define CIRCULATION_SHALLOWWATERENSEMBLE_H
+
+// includes
+//--------------------
+#include "Simulation.h"
+#include "shallowWaterPhysics.h"
+#include "../boundaryConditions.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * class ShallowWaterEnsemble
+ *
+ * runs an ensemble of perturbed shallow water simulations in a single grid
+ *
+ * usage:
+ * All members are stored in one ShallowWaterGrid with numCells*numMembers entries, the values of all members of one cell
+ * are stored next to each other (index cellId*numMembers + member). Neighbouring threads work on different members
+ * of the same cell, so memory access is coalesced and all members are advanced with one set of kernel launches per step.
+ * Timestep, diffusion and coriolis parameter as well as position and amplitude of the initial gaussian disturbance
+ * are perturbed per member by a random relative spread around the base value.
+ * The grid returned by recreate() only contains the displayed member, it is used for rendering and output.
+ * Checkpoints of ensembles are not supported.
+ *
+ */
+class ShallowWaterEnsemble : public Simulation
+{
+public:
+    void showCreationOptions() override;
+    void showBoundaryOptions(const CoordinateSystem& cs) override;
+
+    std::shared_ptr<GridBase> recreate(std::shared_ptr<CoordinateSystem> cs) override;
+    void reset() override;
+    std::unique_ptr<Simulation> clone() const override;
+
+    SimModel getModelType() const override {return SimModel::shallowWaterEnsemble;}
+    SimulationState getState() const override;
+
+    void setNumMembers(int numMembers) {m_numMembers = numMembers;} //!< number of members, used on the next call to recreate()
+    int getNumMembers() const {return m_numMembers;} //!< number of members
+    double getMemberStepsPerSecond() const {return m_memberStepsPerSecond;} //!< throughput measured over the last steps
+
+private:
+    void showSimulationOptions() override;
+    void simulateOnce() override;
+    GridBase& getGrid() override;
+    std::string getDisplayName() override;
+
+    template <typename csT>
+    void simulateOnceImpl(csT& cs); //!< implementation of simulate once to allow different coordinate systems to be used
+    std::function<void()> m_simOnceFunc; //!< will be set to use the correct template specialisation based on type of coordinate system used
+
+    void updateMemberParameters(); //!< perturb the base parameters and upload them for all members
+    void updateBoundaryConditions(); //!< rebuild m_boundaries from the boundary settings
+    void pollThroughput(); //!< update m_memberStepsPerSecond if the last measured step is finished, does not block
+
+    // creation settings
+    int m_numMembers{64}; //!< number of ensemble members
+    unsigned int m_seed{42}; //!< seed for the perturbations
+    float2 m_gaussianPosition{0,0}; //!< position of the gaussian disturbance
+    float m_stdDev{0.1f}; //!< standard deviation of gaussian disturbance
+    float m_multiplier{0.1f}; //!< value is multiplied with the gaussian
+    float m_positionSpread{0.05f}; //!< members move the disturbance by up to this distance in each direction
+    float m_multiplierSpread{0.1f}; //!< relative perturbation of the multiplier
+
+    // boundary settings
+    BoundaryType m_boundaryTypeX{BoundaryType::zeroGradient}; //!< zeroGradient: free slip wall, mirror: no slip wall
+    BoundaryType m_boundaryTypeY{BoundaryType::zeroGradient}; //!< zeroGradient: free slip wall, mirror: no slip wall
+    BoundaryConditions<AT::velocityX,AT::velocityY,AT::geopotential> m_boundaries; //!< boundary conditions build from the above settings
+
+    // sim settings, the per member values are base * (1 + spread * r) with r uniform in [-1,1]
+    float m_timestep{0.0001}; //!< simulation timestep used
+    bool m_useLeapfrog{true}; //!< should leapfrog be used
+    float m_geopotDiffusion{0.0}; //!< diffusion amount
+    float m_coriolisParameter{0.0}; //!< corrilois parameter for cartesian simulations
+    float m_angularVelocity{7.2921e-5}; //!< angular velocity of earth
+    float m_timestepSpread{0.0f}; //!< relative perturbation of the timestep
+    float m_diffusionSpread{0.0f}; //!< relative perturbation of the diffusion
+    float m_coriolisSpread{0.1f}; //!< relative perturbation of coriolis parameter / angular velocity
+    int m_displayedMember{0}; //!< member copied to the display grid
+    bool m_parametersChanged{true}; //!< member parameters need to be uploaded before the next step
+
+    // sim data
+    std::shared_ptr<CoordinateSystem> m_cs; //!< the coordinate system to be used
+    std::shared_ptr<ShallowWaterGrid> m_ensembleGrid; //!< all members, member index varies fastest
+    std::shared_ptr<ShallowWaterGrid> m_displayGrid; //!< the displayed member
+    mpu::DeviceVector<ShallowWaterParameters> m_memberParameters; //!< parameters of each member
+    mpu::DeviceVector<float> m_phiPlusKBuffer; //!< stores geopotential + kinetic energy of all members
+    mpu::DeviceVector<float> m_vortPlusCor; //!< stores vorticity + corriolis parameter of all members
+    float m_totalSimulatedTime{0.0f}; //!< simulated time using the base timestep
+    int m_step{0}; //!< number of timesteps since the last reset
+    bool m_firstTimestep{true};
+
+    // throughput measurement
+    std::shared_ptr<cudaEvent_t> m_stepStart; //!< recorded before the kernels of a measured step
+    std::shared_ptr<cudaEvent_t> m_stepEnd; //!< recorded after the kernels of a measured step
+    bool m_measurementPending{false}; //!< events of a measured step were recorded but not yet evaluated
+    double m_memberStepsPerSecond{0.0}; //!< result of the last measurement
+};
+
+
+#endif //CIRCULATION_SHALLOWWATERENSEMBLE_H
@@ -18,26 +18,102 @@
 #include <mpUtils/mpUtils.h>
 #include <mpUtils/mpGraphics.h>
 #include <mpUtils/mpCuda.h>
+#include <cooperative_groups.h>
 
 #include "../GridReference.h"
 #include "../coordinateSystems/CartesianCoordinates2D.h"
 #include "../coordinateSystems/GeographicalCoordinates2D.h"
 #include "../finiteDifferences.h"
+#include "shallowWaterPhysics.h"
 #include "../boundaryConditions.h"
+#include "../LaunchTuner.h"
+#include "../tileActivity.h"
 //--------------------
 
 // function definitions of the ShallowWaterModel class
 //-------------------------------------------------------------------
 
+ShallowWaterModel::ShallowWaterModel()
+{
+    // geopotential of the undisturbed fluid, if not loaded from a file
+    FieldSource phi{AT::geopotential};
+    phi.constant = 1.0f;
+    m_initialConditions.setSource(phi);
+}
+
 void ShallowWaterModel::showCreationOptions()
 {
-    ImGui::DragFloat2("position of disturbance", &m_gaussianPosition.x, 0.001);
-    ImGui::DragFloat("standard deviation", &m_stdDev,0.01f);
-    ImGui::DragFloat("multiplier", &m_multiplier,0.01f);
+    int initialConditions = m_useInitialConditionFiles ? 1 : 0;
+    if(ImGui::Combo("Initial conditions", &initialConditions, "Gaussian disturbance\0From files\0\0"))
+        m_useInitialConditionFiles = (initialConditions == 1);
+
+    if(m_useInitialConditionFiles)
+        m_initialConditions.showGui({AT::velocityX, AT::velocityY, AT::geopotential});
+    else
+    {
+        ImGui::DragFloat2("position of disturbance", &m_gaussianPosition.x, 0.001);
+        ImGui::DragFloat("standard deviation", &m_stdDev,0.01f);
+        ImGui::DragFloat("multiplier", &m_multiplier,0.01f);
+    }
 }
 
 void ShallowWaterModel::showBoundaryOptions(const CoordinateSystem& cs)
 {
+    auto boundaryTypeOptions = [](const char* axis, BoundaryType& type)
+    {
+        ImGui::PushID(axis);
+        const BoundaryType types[] = {BoundaryType::zeroGradient, BoundaryType::mirror, BoundaryType::sponge};
+        int selected = static_cast<int>(std::find(std::begin(types), std::end(types), type) - std::begin(types));
+        std::string label = std::string(axis) + "-Axis Boundary";
+        if(ImGui::Combo(label.c_str(), &selected, "Free slip wall\0No slip wall\0Sponge (open)\0\0"))
+            type = types[selected];
+        ImGui::PopID();
+    };
+
+    if(cs.hasBoundary().x)
+        boundaryTypeOptions("X", m_boundaryTypeX);
+    if(cs.hasBoundary().y)
+        boundaryTypeOptions("Y", m_boundaryTypeY);
+
+    if((cs.hasBoundary().x && m_boundaryTypeX == BoundaryType::sponge) || (cs.hasBoundary().y && m_boundaryTypeY == BoundaryType::sponge))
+    {
+        ImGui::DragInt("Sponge width", &m_spongeWidth, 0.1, 1, 256);
+        ImGui::DragFloat("Sponge strength", &m_spongeStrength, 0.001, 0.0f, 1.0f);
+    }
+}
+
+void ShallowWaterModel::updateBoundaryConditions()
+{
+    for(int axis : {0,1})
+    {
+        BoundaryType type = (axis == 0) ? m_boundaryTypeX : m_boundaryTypeY;
+
+        // velocity normal to the wall is zero, tangential velocity is copied (free slip) or mirrored (no slip)
+        FaceBoundary normal;
+        normal.type = BoundaryType::fixedValue;
+        FaceBoundary tangential;
+        tangential.type = type;
+        FaceBoundary phi;
+        phi.type = BoundaryType::zeroGradient;
+
+        if(type == BoundaryType::sponge)
+        {
+            normal.spongeWidth = m_spongeWidth;
+            normal.spongeStrength = m_spongeStrength;
+            normal.type = BoundaryType::sponge;
+            tangential = normal;
+            phi = normal;
+            phi.value = 1.0f; // geopotential of the undisturbed fluid, see reset()
+        }
+
+        m_boundaries.get<AT::velocityX>().setAxis(axis, (axis == 0) ? normal : tangential);
+        m_boundaries.get<AT::velocityY>().setAxis(axis, (axis == 1) ? normal : tangential);
+        m_boundaries.get<AT::geopotential>().setAxis(axis, phi);
+    }
+
+    // on the C grid velocities are stored on the right / forward face of the cell
+    m_boundaries.get<AT::velocityX>().staggeredX = true;
+    m_boundaries.get<AT::velocityY>().staggeredY = true;
 }
 
 void ShallowWaterModel::showSimulationOptions()
@@ -49,25 +125,49 @@ void ShallowWaterModel::showSimulationOptions()
 
     ImGui::DragFloat("Geopotential diffusion",&m_geopotDiffusion,0.00001f,0.00001,1.0,"%.5f");
     ImGui::Checkbox("Use Leapfrog",&m_useLeapfrog);
+    ImGui::Checkbox("Skip quiet tiles",&m_skipQuietTiles);
+    if(m_skipQuietTiles)
+        ImGui::DragFloat("Tile activity tolerance",&m_tileTolerance,0.0000001f,0.0f,1.0f,"%.8f");
+    int batching = static_cast<int>(m_stepBatching);
+    if(ImGui::Combo("Skipped steps", &batching, "Kernel per step\0Persistent, grid barriers\0Persistent, wavefront\0\0"))
+        m_stepBatching = static_cast<StepBatching>(batching);
     ImGui::DragFloat("Timestep",&m_timestep,0.000001,0.000001f,1.0,"%.6f");
     ImGui::Text("Simulated Time units: %f", m_totalSimulatedTime);
+
+    if( ImGui::CollapsingHeader("Boundaries"))
+        showBoundaryOptions(*m_cs);
+
+    if(m_cs->getType() == CSType::cartesian2d && ImGui::CollapsingHeader("Mesh refinement"))
+        m_refinement.showGui();
+
+    if(m_cs->getType() == CSType::geographical2d && ImGui::CollapsingHeader("Nested region"))
+        m_nest.showGui();
+
+    if( ImGui::CollapsingHeader("Conservation diagnostics"))
+        m_diagnostics.showGui();
 }
 
 std::shared_ptr<GridBase> ShallowWaterModel::recreate(std::shared_ptr<CoordinateSystem> cs)
 {
     m_cs = cs;
-    m_grid = std::make_shared<ShallowWaterGrid>(m_cs->getNumGridCells());
+    m_nest.clear();
+    m_grid = std::make_shared<ShallowWaterGrid>(m_cs->getNumGridCells(), !m_headless);
     m_phiPlusKBuffer.resize(m_cs->getNumGridCells());
     m_vortPlusCor.resize(m_cs->getNumGridCells());
+    m_numTiles = numTiles(make_int2(m_cs->getNumGridCells3d()));
+    m_tileQuiet.resize(m_numTiles.x * m_numTiles.y);
+    m_tileChanged.resize(m_numTiles.x * m_numTiles.y);
 
     // select coordinate system
     switch(m_cs->getType())
     {
         case CSType::cartesian2d:
             m_simOnceFunc = [this](){ this->simulateOnceImpl( static_cast<CartesianCoordinates2D&>( *(this->m_cs)) ); };
+            m_batchFunc = [this](int n){ this->simulateBatchImpl( static_cast<CartesianCoordinates2D&>( *(this->m_cs)), n ); };
             break;
         case CSType::geographical2d:
             m_simOnceFunc = [this](){ this->simulateOnceImpl( static_cast<GeographicalCoordinates2D&>( *(this->m_cs)) ); };
+            m_batchFunc = [this](int n){ this->simulateBatchImpl( static_cast<GeographicalCoordinates2D&>( *(this->m_cs)), n ); };
             break;
     }
 
@@ -77,6 +177,32 @@ std::shared_ptr<GridBase> ShallowWaterModel::recreate(std::shared_ptr<Coordinate
 
 void ShallowWaterModel::reset()
 {
+    // reset simulation state
+    m_totalSimulatedTime = 0.0f;
+    m_step = 0;
+    m_firstTimestep = true;
+    m_tileStateValid = false;
+    m_stepScheduler.reset();
+    m_refinement.clear();
+    m_nest.invalidate();
+    m_diagnostics.reset();
+    updateBoundaryConditions();
+
+    if(m_useInitialConditionFiles)
+    {
+        // files are converted and uploaded directly to all time levels, boundaries are applied after the first step
+        try
+        {
+            m_initialConditions.load(*m_grid, *m_cs);
+            m_grid->swapAndRender();
+            return;
+        }
+        catch (const std::exception& e)
+        {
+            logWARNING("ShallowWaterModel") << "Loading initial conditions failed, using gaussian instead.";
+        }
+    }
+
     m_grid->cacheOverwrite();
 
     // create initial conditions using gaussian
@@ -93,14 +219,21 @@ void ShallowWaterModel::reset()
         m_grid->initialize<AT::velocityX>(i, velX);
         m_grid->initialize<AT::velocityY>(i, velY);
     }
+
+    // initialize boundary
+    switch(m_cs->getType())
+    {
+        case CSType::cartesian2d:
+            m_boundaries.applyOnHost(static_cast<CartesianCoordinates2D&>(*m_cs), *m_grid);
+            break;
+        case CSType::geographical2d:
+            m_boundaries.applyOnHost(static_cast<GeographicalCoordinates2D&>(*m_cs), *m_grid);
+            break;
+    }
     m_grid->pushCachToDevice();
 
     // swap buffers and ready for rendering
     m_grid->swapAndRender();
-
-    // reset simulation state
-    m_totalSimulatedTime = 0.0f;
-    m_firstTimestep = true;
 }
 
 std::unique_ptr<Simulation> ShallowWaterModel::clone() const
@@ -108,159 +241,524 @@ std::unique_ptr<Simulation> ShallowWaterModel::clone() const
     return std::make_unique<ShallowWaterModel>(*this);
 }
 
+SimulationState ShallowWaterModel::getState() const
+{
+    SimulationState state;
+    state.totalSimulatedTime = m_totalSimulatedTime;
+    state.step = m_step;
+    state.firstTimestep = m_firstTimestep;
+    return state;
+}
+
+void ShallowWaterModel::setState(const SimulationState& state)
+{
+    m_totalSimulatedTime = static_cast<float>(state.totalSimulatedTime);
+    m_step = state.step;
+    m_firstTimestep = state.firstTimestep;
+    m_tileStateValid = false;
+    m_refinement.clear(); // patches are not part of the state, they are created again on the next regrid
+    m_nest.invalidate();
+}
+
+std::vector<ModelParameter> ShallowWaterModel::getParameters() const
+{
+    return {{"timestep", m_timestep},
+            {"leapfrog", float(m_useLeapfrog)},
+            {"diffusion", m_geopotDiffusion},
+            {"coriolis parameter", m_coriolisParameter},
+            {"angular velocity", m_angularVelocity},
+            {"boundary type x", float(static_cast<int>(m_boundaryTypeX))},
+            {"boundary type y", float(static_cast<int>(m_boundaryTypeY))},
+            {"sponge width", float(m_spongeWidth)},
+            {"sponge strength", m_spongeStrength},
+            {"skip quiet tiles", float(m_skipQuietTiles)},
+            {"tile tolerance", m_tileTolerance}};
+}
+
+void ShallowWaterModel::setParameters(const std::vector<ModelParameter>& parameters)
+{
+    for(const auto& p : parameters)
+    {
+        if(p.name == "timestep") m_timestep = p.value;
+        else if(p.name == "leapfrog") m_useLeapfrog = p.value != 0.0f;
+        else if(p.name == "diffusion") m_geopotDiffusion = p.value;
+        else if(p.name == "coriolis parameter") m_coriolisParameter = p.value;
+        else if(p.name == "angular velocity") m_angularVelocity = p.value;
+        else if(p.name == "boundary type x") m_boundaryTypeX = static_cast<BoundaryType>(static_cast<int>(p.value));
+        else if(p.name == "boundary type y") m_boundaryTypeY = static_cast<BoundaryType>(static_cast<int>(p.value));
+        else if(p.name == "sponge width") m_spongeWidth = static_cast<int>(p.value);
+        else if(p.name == "sponge strength") m_spongeStrength = p.value;
+        else if(p.name == "skip quiet tiles") m_skipQuietTiles = p.value != 0.0f;
+        else if(p.name == "tile tolerance") m_tileTolerance = p.value;
+    }
+    updateBoundaryConditions();
+}
+
 void ShallowWaterModel::simulateOnce()
 {
     m_simOnceFunc(); // calls correct template specialization
 }
 
+int ShallowWaterModel::simulateBatch(int maxSteps)
+{
+    // patches and nested grids are stepped by simulateOnce()
+    if(m_stepBatching == StepBatching::off || m_refinement.isEnabled() || m_nest.isEnabled())
+        return 0;
+
+    static const bool cooperativeLaunch = []()
+    {
+        int device;
+        int supported = 0;
+        assert_cuda(cudaGetDevice(&device));
+        assert_cuda(cudaDeviceGetAttribute(&supported, cudaDevAttrCooperativeLaunch, device));
+        if(!supported)
+            logINFO("ShallowWaterModel") << "Device does not support cooperative launches, persistent kernel is disabled.";
+        return supported != 0;
+    }();
+    if(!cooperativeLaunch)
+        return 0;
+
+    // conservation diagnostics are collected by kernel A, so the batch ends before they are due
+    int numSteps = 0;
+    while(numSteps < maxSteps && !m_diagnostics.isDue(m_step + numSteps))
+        numSteps++;
+    if(numSteps < 2)
+        return 0;
+
+    m_batchFunc(numSteps); // calls correct template specialization
+    return numSteps;
+}
+
+//!< first half of a timestep for one interior cell, updates geopotential and computes phi+K and vorticity for the second half
+//!< returns the change of the geopotential
+template <typename csT>
+__device__ float shallowWaterCellA(int x, int y, ShallowWaterGrid::ReferenceType& grid, const csT& cs,
+                                  mpu::VectorReference<float>& phiPlusK, mpu::VectorReference<float>& vortPlusCor,
+                                  const ShallowWaterParameters& params, bool useLeapfrog, bool writePotentialVort,
+                                  ConservationDiagnostics::AccumulatorType& diagnostics)
+{
+    int3 cell{x,y,0};
+    int cellId = cs.getCellId(cell);
+    float2 cellPos = make_float2( cs.getCellCoordinate3d(cell) );
+
+    // read values of quantities
+    ShallowWaterStencilA s;
+    s.phi = grid.read<AT::geopotential>(cellId);
+    s.velRightX = grid.read<AT::velocityX>(cellId);
+    s.velForY   = grid.read<AT::velocityY>(cellId);
+    s.velLeftX  = grid.read<AT::velocityX>(cs.getLeftNeighbor(cellId));
+    s.velBackY  = grid.read<AT::velocityY>(cs.getBackwardNeighbor(cellId));
+    s.velForX  = grid.read<AT::velocityX>(cs.getForwardNeighbor(cellId)); // used for vorticity
+    s.velRightY  = grid.read<AT::velocityY>(cs.getRightNeighbor(cellId)); // used for vorticity
+
+    s.phiLeft = grid.read<AT::geopotential>(cs.getLeftNeighbor(cellId));
+    s.phiRight = grid.read<AT::geopotential>(cs.getRightNeighbor(cellId));
+    s.phiFor = grid.read<AT::geopotential>(cs.getForwardNeighbor(cellId));
+    s.phiBack = grid.read<AT::geopotential>(cs.getBackwardNeighbor(cellId));
+    s.prevPhi = useLeapfrog ? grid.readPrev<AT::geopotential>(cellId) : 0.0f;
+
+    const ShallowWaterResultA r = shallowWaterStepA(s, cellPos, cs, params, useLeapfrog);
+    phiPlusK[cellId] = r.kinEnergy + s.phi;
+    vortPlusCor[cellId] = r.vortPlusCor;
+
+    // write potential vorticity, only needed on steps that are rendered or written
+    if(writePotentialVort)
+        grid.write<AT::potentialVort>(cellId, abs(r.vortPlusCor) / s.phi);
+
+    // integrate conserved quantities
+    if(diagnostics.enabled())
+    {
+        const double area = cs.getCellArea(cellId);
+        diagnostics.add(ConservationDiagnostics::mass, area * s.phi);
+        diagnostics.add(ConservationDiagnostics::energy, area * (s.phi * r.kinEnergy + 0.5 * s.phi * s.phi));
+        diagnostics.add(ConservationDiagnostics::enstrophy, area * r.vortPlusCor * r.vortPlusCor / (2.0 * s.phi));
+        diagnostics.add(ConservationDiagnostics::absoluteVorticity, area * r.vortPlusCor);
+    }
+
+    grid.write<AT::geopotential>(cellId,r.nextPhi);
+    return abs(r.nextPhi - s.phi);
+}
+
+//!< second half of a timestep for one interior cell, updates the velocities stored at the cell
+//!< returns the largest change of a velocity component
+template <typename csT, typename phiKRefT>
+__device__ float shallowWaterCellB(int x, int y, ShallowWaterGrid::ReferenceType& grid, const csT& cs,
+                                  phiKRefT& phiPlusK, mpu::VectorReference<float>& vortPlusCor,
+                                  float timestep, bool useLeapfrog)
+{
+    // velocities normal to a wall are stored one cell further inside, so they are skipped here
+    // and set by the boundary conditions instead
+    const bool updateX = x < cs.getNumGridCells3d().x-2*cs.hasBoundary().x;
+    const bool updateY = y < cs.getNumGridCells3d().y-2*cs.hasBoundary().y;
+
+    int3 cell{x,y,0};
+    int cellId = cs.getCellId(cell);
+    float2 cellPos = make_float2( cs.getCellCoordinate3d(cell) );
+
+    // read values of quantities
+    ShallowWaterStencilB s;
+    s.phiKRight = phiPlusK[cs.getRightNeighbor(cellId)];
+    s.phiKForward = phiPlusK[cs.getForwardNeighbor(cellId)];
+    s.phiK = phiPlusK[cellId];
+    s.vortCorLeft = vortPlusCor[cs.getLeftNeighbor(cellId)];
+    s.vortCorBack = vortPlusCor[cs.getBackwardNeighbor(cellId)];
+    s.vortCor = vortPlusCor[cellId];
+    s.velX = grid.read<AT::velocityX>(cellId);
+    s.velY = grid.read<AT::velocityY>(cellId);
+    s.prevVelX = useLeapfrog ? grid.readPrev<AT::velocityX>(cellId) : 0.0f;
+    s.prevVelY = useLeapfrog ? grid.readPrev<AT::velocityY>(cellId) : 0.0f;
+
+    const float2 nextVel = shallowWaterStepB(s, cellPos, cs, timestep, useLeapfrog);
+    if(updateX)
+        grid.write<AT::velocityX>(cellId,nextVel.x);
+    if(updateY)
+        grid.write<AT::velocityY>(cellId,nextVel.y);
+    return fmaxf(updateX ? abs(nextVel.x - s.velX) : 0.0f, updateY ? abs(nextVel.y - s.velY) : 0.0f);
+}
+
 template <typename csT>
 __global__ void shallowWaterSimulationA(ShallowWaterGrid::ReferenceType grid, csT coordinateSystem,
                                         mpu::VectorReference<float> phiPlusK, mpu::VectorReference<float> vortPlusCor,
-                                        float timestep, bool useLeapfrog, float diffusion, float corOrAngvel)
+                                        ShallowWaterParameters params, bool useLeapfrog, bool writePotentialVort,
+                                        ConservationDiagnostics::AccumulatorType diagnosticsAccumulator, TileActivity tiles)
 {
     csT cs = coordinateSystem;
+    ConservationDiagnostics::AccumulatorType diagnostics = diagnosticsAccumulator;
 
     // updates geopotential for all non boundary cells
     // also calculates kinetic energy per unit mass
     for(int x : mpu::gridStrideRange( cs.hasBoundary().x, cs.getNumGridCells3d().x-cs.hasBoundary().x ))
         for(int y : mpu::gridStrideRangeY( cs.hasBoundary().y, cs.getNumGridCells3d().y-cs.hasBoundary().y ))
         {
-            int3 cell{x,y,0};
-            int cellId = cs.getCellId(cell);
-            float2 cellPos = make_float2( cs.getCellCoordinate3d(cell) );
-
-            // read values of quantities
-            const float phi = grid.read<AT::geopotential>(cellId);
-            const float velRightX = grid.read<AT::velocityX>(cellId);
-            const float velForY   = grid.read<AT::velocityY>(cellId);
-            const float velLeftX  = grid.read<AT::velocityX>(cs.getLeftNeighbor(cellId));
-            const float velBackY  = grid.read<AT::velocityY>(cs.getBackwardNeighbor(cellId));
-            const float velForX  = grid.read<AT::velocityX>(cs.getForwardNeighbor(cellId)); // used for vorticity
-            const float velRightY  = grid.read<AT::velocityY>(cs.getRightNeighbor(cellId)); // used for vorticity
-
-            const float phiLeft = grid.read<AT::geopotential>(cs.getLeftNeighbor(cellId));
-            const float phiRight = grid.read<AT::geopotential>(cs.getRightNeighbor(cellId));
-            const float phiFor = grid.read<AT::geopotential>(cs.getForwardNeighbor(cellId));
-            const float phiBack = grid.read<AT::geopotential>(cs.getBackwardNeighbor(cellId));
-
-            // compute kinetic energy per unit mass
-            const float velX = (velLeftX + velRightX) * 0.5f;
-            const float velY = (velForY + velBackY) * 0.5f;
-            const float kinEnergy = (velX * velX + velY * velY) * 0.5f;
-            phiPlusK[cellId] = kinEnergy + phi;
-
-            // calculate vorticity and coriolis parameter
-            // if this looks strange consider where values are located on the C grid
-            const float2 vortPos = cellPos + 0.5f * make_float2(cs.getCellSize()); // position where vorticity is computed
-            const float vort = curl2d(velForY, velRightY, velRightX, velForX, vortPos, cs);
-            float cor;
-            if(cs.getType() == CSType::geographical2d)
-                cor = 2*corOrAngvel*sin(vortPos.y);
-            else if(cs.getType() == CSType::cartesian2d)
-                cor = corOrAngvel;
-            else
-                cor = 0.0f;
-            vortPlusCor[cellId] = vort + cor;
-
-            // write potential vorticity
-            grid.write<AT::potentialVort>(cellId, abs(vort+cor) / phi);
-
-            // compute geopotential advection time derivative dPhi/dt
-            float phiHalfLeft = (phi+phiLeft)*0.5;
-            float phiHalfRight = (phi+phiRight)*0.5;
-            float phiHalfBack = (phi+phiBack)*0.5;
-            float phiHalfFor = (phi+phiFor)*0.5;
-            float dphi_dt = -divergence2d( velLeftX*phiHalfLeft, velRightX*phiHalfRight, velBackY*phiHalfBack, velForY*phiHalfFor, cellPos, cs);
-
-            if(diffusion > 0)
+            // quiet tiles carry their values forward, phi+K and vorticity keep the values of the last computed step
+            const uint8_t quiet = tiles.quietSteps(x,y);
+            if(quiet > 0)
             {
-                // compute geopotential diffusion
-                const float lapphi = laplace2d(phiLeft,phiRight,phiBack,phiFor,phi,cellPos,cs);
-                dphi_dt += diffusion * lapphi;
+                if(tiles.needsCopy(quiet))
+                {
+                    const int cellId = cs.getCellId(int3{x,y,0});
+                    grid.copy<AT::geopotential>(cellId);
+                }
+                continue;
             }
 
-            // compute values at t+1
-            float nextPhi;
-            if(useLeapfrog)
-            {
-                const float prevPhi = grid.readPrev<AT::geopotential>(cellId);
-                nextPhi = prevPhi + dphi_dt * 2.0f*timestep;
-            }
-            else
-                nextPhi = phi + dphi_dt * timestep;
-
-            grid.write<AT::geopotential>(cellId,nextPhi);
+            const float change = shallowWaterCellA(x, y, grid, cs, phiPlusK, vortPlusCor, params, useLeapfrog, writePotentialVort, diagnostics);
+            tiles.reportChange(x, y, change);
         }
+
+    diagnostics.storeBlockResult();
 }
 
 template <typename csT>
 __global__ void shallowWaterSimulationB(ShallowWaterGrid::ReferenceType grid, csT coordinateSystem,
                                         mpu::VectorReference<const float> phiPlusK, mpu::VectorReference<float> vortPlusCor,
-                                        float timestep, bool useLeapfrog)
+                                        float timestep, bool useLeapfrog, TileActivity tiles)
 {
     csT cs = coordinateSystem;
 
     // updates all non boundary velocities
-    // TODO: handle velocities parallel to the boundary
-    for(int x : mpu::gridStrideRange( cs.hasBoundary().x, cs.getNumGridCells3d().x-2*cs.hasBoundary().x ))
-        for(int y : mpu::gridStrideRangeY( cs.hasBoundary().y, cs.getNumGridCells3d().y-2*cs.hasBoundary().y ))
+    for(int x : mpu::gridStrideRange( cs.hasBoundary().x, cs.getNumGridCells3d().x-cs.hasBoundary().x ))
+        for(int y : mpu::gridStrideRangeY( cs.hasBoundary().y, cs.getNumGridCells3d().y-cs.hasBoundary().y ))
         {
-            int3 cell{x,y,0};
-            int cellId = cs.getCellId(cell);
-            float2 cellPos = make_float2( cs.getCellCoordinate3d(cell) );
-
-            // read values of quantities
-            const float phiKRight = phiPlusK[cs.getRightNeighbor(cellId)];
-            const float phiKForward = phiPlusK[cs.getForwardNeighbor(cellId)];
-            const float phiK = phiPlusK[cellId];
-            const float vortCorLeft = vortPlusCor[cs.getLeftNeighbor(cellId)];
-            const float vortCorBack = vortPlusCor[cs.getBackwardNeighbor(cellId)];
-            const float vortCor = vortPlusCor[cellId];
-            const float velX = grid.read<AT::velocityX>(cellId);
-            const float velY = grid.read<AT::velocityY>(cellId);
-
-            // compute dvX/dt and dvY/dt
-            const float2 gradPhiK = gradient2d(phiK,phiKRight,phiK,phiKForward,cellPos,cs);
-            const float dvX_dt = (vortCor+vortCorBack)*0.5f*velY -gradPhiK.x;
-            const float dvY_dt = -(vortCor+vortCorLeft)*0.5f*velX -gradPhiK.y;
-
-            // compute values at t+1
-            float nextVelX;
-            float nextVelY;
-            if(useLeapfrog)
+            const uint8_t quiet = tiles.quietSteps(x,y);
+            if(quiet > 0)
             {
-                const float prevVelX = grid.readPrev<AT::velocityX>(cellId);
-                const float prevVelY = grid.readPrev<AT::velocityY>(cellId);
-
-                nextVelX = prevVelX + dvX_dt * 2.0f*timestep;
-                nextVelY = prevVelY + dvY_dt * 2.0f*timestep;
+                if(tiles.needsCopy(quiet))
+                {
+                    const int cellId = cs.getCellId(int3{x,y,0});
+                    grid.copy<AT::velocityX>(cellId);
+                    grid.copy<AT::velocityY>(cellId);
+                }
+                continue;
             }
-            else
+
+            const float change = shallowWaterCellB(x, y, grid, cs, phiPlusK, vortPlusCor, timestep, useLeapfrog);
+            tiles.reportChange(x, y, change);
+        }
+}
+
+//!< tiles where something changed and their neighbors become active, all other tiles count one more quiet step
+__global__ void updateTileActivity(uint8_t* quiet, const int* changed, int2 tiles, bool periodicX)
+{
+    for(int i : mpu::gridStrideRange(tiles.x * tiles.y))
+    {
+        const int tx = i % tiles.x;
+        const int ty = i / tiles.x;
+
+        bool active = false;
+        for(int dy = -1; dy <= 1; dy++)
+            for(int dx = -1; dx <= 1; dx++)
             {
-                nextVelX = velX + dvX_dt * timestep;
-                nextVelY = velY + dvY_dt * timestep;
+                int x = tx + dx;
+                const int y = ty + dy;
+                if(periodicX)
+                    x = (x + tiles.x) % tiles.x;
+                if(x >= 0 && x < tiles.x && y >= 0 && y < tiles.y)
+                    active = active || changed[y * tiles.x + x];
             }
-            grid.write<AT::velocityX>(cellId,nextVelX);
-            grid.write<AT::velocityY>(cellId,nextVelY);
+
+        quiet[i] = active ? 0 : min(quiet[i] + 1, int(TileActivity::settled));
+    }
+}
+
+/**
+ * @brief ends a phase of the persistent kernel, afterwards all data of phase "phase" in the neighborhood of the block is ready
+ *      Without band progress a grid wide barrier is used. Otherwise the block publishes its progress and
+ *      waits only until the bands directly above and below finished the phase.
+ */
+__device__ void finishBandPhase(int phase, int* bandProgress, bool periodicY)
+{
+    if(!bandProgress)
+    {
+        cooperative_groups::this_grid().sync();
+        return;
+    }
+
+    __syncthreads();
+    if(threadIdx.x == 0)
+    {
+        __threadfence();
+        atomicExch(&bandProgress[blockIdx.x], phase);
+
+        const int numBands = gridDim.x;
+        for(int offset : {-1, 1})
+        {
+            int neighbor = blockIdx.x + offset;
+            if(periodicY)
+                neighbor = (neighbor + numBands) % numBands;
+            else if(neighbor < 0 || neighbor >= numBands)
+                continue;
+
+            const volatile int* progress = bandProgress + neighbor;
+            while(*progress < phase);
         }
+        __threadfence();
+    }
+    __syncthreads();
 }
 
+/**
+ * @brief simulates numSteps consecutive steps in one launch, must be launched cooperatively with all blocks resident
+ *      Each block owns a band of rows for all steps, so the data of a block stays in its cache.
+ *      Cells only depend on the rows directly above and below, so phases are either separated by grid wide barriers or,
+ *      if bandProgress is set, by waiting on the neighboring bands only. Then phases of different steps run at the same
+ *      time in a wavefront and there is no global barrier at all.
+ *      Diagnostic fields and conservation diagnostics are not computed.
+ * @param grids grid references of all steps, the buffers are rotated on the host in advance
+ * @param firstLeapfrog use leapfrog in the first step, all following steps use leapfrog if useLeapfrog is set
+ * @param bandProgress one zero initialized counter per block for wavefront mode, nullptr to use grid wide barriers
+ */
+template <typename csT>
+__global__ void shallowWaterPersistent(const ShallowWaterGrid::ReferenceType* grids, int numSteps, csT coordinateSystem,
+                                       mpu::VectorReference<float> phiPlusK, mpu::VectorReference<float> vortPlusCor,
+                                       ShallowWaterParameters params, bool useLeapfrog, bool firstLeapfrog,
+                                       BoundaryConditions<AT::velocityX,AT::velocityY,AT::geopotential> boundaries, BoundaryBand band,
+                                       int* bandProgress)
+{
+    csT cs = coordinateSystem;
+    ConservationDiagnostics::AccumulatorType diagnostics; // disabled
+
+    // rows of this block, every block owns at least one row
+    const int3 numCells = cs.getNumGridCells3d();
+    const int3 hb = cs.hasBoundary();
+    const int firstRow = int(blockIdx.x) * numCells.y / int(gridDim.x);
+    const int endRow = (int(blockIdx.x)+1) * numCells.y / int(gridDim.x);
+
+    // interior cells of this block
+    const int numCols = numCells.x - 2*hb.x;
+    const int firstInteriorRow = max(firstRow, hb.y);
+    const int blockCells = max(min(endRow, numCells.y - hb.y) - firstInteriorRow, 0) * numCols;
+
+    for(int step = 0; step < numSteps; step++)
+    {
+        ShallowWaterGrid::ReferenceType grid = grids[step];
+        const bool leapfrog = (step == 0) ? firstLeapfrog : useLeapfrog;
+
+        for(int i = threadIdx.x; i < blockCells; i += blockDim.x)
+            shallowWaterCellA(hb.x + i % numCols, firstInteriorRow + i / numCols, grid, cs, phiPlusK, vortPlusCor,
+                              params, leapfrog, false, diagnostics);
+        finishBandPhase(3*step+1, bandProgress, !hb.y);
+
+        for(int i = threadIdx.x; i < blockCells; i += blockDim.x)
+            shallowWaterCellB(hb.x + i % numCols, firstInteriorRow + i / numCols, grid, cs, phiPlusK, vortPlusCor,
+                              params.timestep, leapfrog);
+        finishBandPhase(3*step+2, bandProgress, !hb.y);
+
+        // boundary rules only read cells in the same or the adjacent row
+        NextBufferAccess<ShallowWaterGrid::ReferenceType> access{grid};
+        for(int y = firstRow; y < endRow; y++)
+            for(int i = threadIdx.x; i < band.numCellsInRow(y); i += blockDim.x)
+                boundaries.applyToCell(band.getCellInRow(y,i), cs, access);
+        finishBandPhase(3*step+3, bandProgress, !hb.y);
+    }
+}
 
 template <typename csT>
 void ShallowWaterModel::simulateOnceImpl(csT& cs)
 {
-    dim3 blocksize{16,16,1};
-    dim3 numBlocks{ static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().x ,blocksize.x)),
-                    static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().y ,blocksize.y)), 1};
+    auto numBlocksFor = [&cs](dim3 blocksize)
+    {
+        return dim3{ static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().x ,blocksize.x)),
+                     static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().y ,blocksize.y)), 1};
+    };
+
+    ShallowWaterParameters params{m_timestep, m_geopotDiffusion,
+                                  (m_cs->getType() == CSType::geographical2d) ? m_angularVelocity : m_coriolisParameter};
+    const bool useLeapfrog = !m_firstTimestep && m_useLeapfrog;
+    const bool writePotentialVort = diagnosticFieldsDue();
+
+    if(m_refinement.isRegridDue(m_step))
+    {
+        PROFILE_GPU_SCOPE("regrid", cs.getNumGridCells());
+        m_refinement.regrid(*m_grid, cs, m_boundaries.getBand(cs));
+    }
+
+    // kernels read time levels t and t-1 and write t+1, so they can be launched repeatedly while tuning
+    auto launchA = [&](dim3 blocksize, ConservationDiagnostics::AccumulatorType diagnostics, size_t sharedMemory, TileActivity tiles)
+    {
+        shallowWaterSimulationA<<< numBlocksFor(blocksize), blocksize, sharedMemory>>>(m_grid->getGridReference(),cs,m_phiPlusKBuffer.getVectorReference(),
+                m_vortPlusCor.getVectorReference(), params, useLeapfrog, writePotentialVort, diagnostics, tiles);
+    };
+    auto launchB = [&](dim3 blocksize, TileActivity tiles)
+    {
+        shallowWaterSimulationB<<< numBlocksFor(blocksize), blocksize>>>(m_grid->getGridReference(),cs,m_phiPlusKBuffer.getVectorReference(),
+                m_vortPlusCor.getVectorReference(), m_timestep, useLeapfrog, tiles);
+    };
+    const dim3 blocksizeA = LaunchTuner::instance().blockSize("shallowWaterA", cs.getNumGridCells3d(), LaunchTuner::candidates2d(),
+                                                              [&](dim3 b){ launchA(b, {}, 0, {}); });
+    const dim3 blocksizeB = LaunchTuner::instance().blockSize("shallowWaterB", cs.getNumGridCells3d(), LaunchTuner::candidates2d(),
+                                                              [&](dim3 b){ launchB(b, {}); });
+
+    // diagnostics are computed from the values at time t while kernel A runs
+    const bool collectDiagnostics = m_diagnostics.isDue(m_step);
+    ConservationDiagnostics::AccumulatorType diagnostics;
+    size_t sharedMemory = 0;
+    if(collectDiagnostics)
+    {
+        diagnostics = m_diagnostics.prepare(numBlocksFor(blocksizeA));
+        sharedMemory = ConservationDiagnostics::AccumulatorType::sharedMemory(blocksizeA);
+    }
+
+    // all tiles are computed when conservation diagnostics are collected, they integrate over the whole grid,
+    // and when potential vorticity is written, quiet tiles would otherwise keep a stale field
+    TileActivity tiles;
+    if(m_skipQuietTiles)
+    {
+        if(!m_tileStateValid)
+        {
+            assert_cuda(cudaMemsetAsync(m_tileQuiet.data(), 0, m_tileQuiet.size() * sizeof(uint8_t), cudaStreamPerThread));
+            assert_cuda(cudaMemsetAsync(m_tileChanged.data(), 0, m_tileChanged.size() * sizeof(int), cudaStreamPerThread));
+            m_tileStateValid = true;
+        }
+        tiles.quiet = (collectDiagnostics || writePotentialVort) ? nullptr : m_tileQuiet.data();
+        tiles.changed = m_tileChanged.data();
+        tiles.tilesX = m_numTiles.x;
+        tiles.tolerance = m_tileTolerance;
+        tiles.recycledNext = m_grid->isWriteBufferRecycled();
+    }
+    else
+        m_tileStateValid = false;
+
+    const int64_t cells = cs.getNumGridCells();
+    {
+        PROFILE_GPU_SCOPE("shallow water A", cells);
+        launchA(blocksizeA, diagnostics, sharedMemory, tiles);
+    }
+    {
+        PROFILE_GPU_SCOPE("shallow water B", cells);
+        launchB(blocksizeB, tiles);
+    }
+
+    // refined patches overwrite the coarse values at t+1 in their tiles
+    if(m_refinement.isEnabled())
+    {
+        PROFILE_GPU_SCOPE("mesh refinement", int64_t(m_refinement.getNumPatches()) * RefinedPatches::cells * 2);
+        m_refinement.step(*m_grid, cs, params, m_useLeapfrog, useLeapfrog, tiles);
+    }
+
+    // the nested grid follows the parent from t to t+1 and overwrites t+1 where it has results
+    if(m_nest.isEnabled())
+    {
+        PROFILE_GPU_SCOPE("nested grid", m_nest.getNumChildCells());
+        m_nest.step(*this, cs, tiles);
+    }
 
-    shallowWaterSimulationA<<< numBlocks, blocksize>>>(m_grid->getGridReference(),cs,m_phiPlusKBuffer.getVectorReference(),
-            m_vortPlusCor.getVectorReference(), m_timestep, !m_firstTimestep && m_useLeapfrog,
-            m_geopotDiffusion, (m_cs->getType() == CSType::geographical2d) ? m_angularVelocity : m_coriolisParameter);
-    shallowWaterSimulationB<<< numBlocks, blocksize>>>(m_grid->getGridReference(),cs,m_phiPlusKBuffer.getVectorReference(),
-            m_vortPlusCor.getVectorReference(), m_timestep, !m_firstTimestep && m_useLeapfrog);
+    if(m_skipQuietTiles)
+    {
+        PROFILE_GPU_SCOPE("tile activity", int64_t(m_numTiles.x) * m_numTiles.y);
+        const int blocksize = 128;
+        updateTileActivity<<< mpu::numBlocks(m_numTiles.x * m_numTiles.y, blocksize), blocksize>>>(m_tileQuiet.data(), m_tileChanged.data(),
+                m_numTiles, cs.hasBoundary().x == 0);
+        assert_cuda(cudaMemsetAsync(m_tileChanged.data(), 0, m_tileChanged.size() * sizeof(int), cudaStreamPerThread));
+    }
+
+    // boundary cells of all attributes in one pass
+    {
+        PROFILE_GPU_SCOPE("boundaries", cells);
+        updateBoundaryConditions();
+        m_boundaries.apply(cs, *m_grid);
+    }
+
+    if(collectDiagnostics)
+    {
+        PROFILE_SCOPE("diagnostics");
+        m_diagnostics.record(m_step, m_totalSimulatedTime);
+    }
 
     m_totalSimulatedTime += m_timestep;
+    m_step++;
+    m_firstTimestep = false;
+}
+
+template <typename csT>
+void ShallowWaterModel::simulateBatchImpl(csT& cs, int numSteps)
+{
+    // as many blocks as can be resident at the same time, required for grid wide barriers and to wait on other blocks
+    // at most one block per row
+    const int blocksize = 256;
+    int device;
+    int numSMs;
+    int blocksPerSM;
+    assert_cuda(cudaGetDevice(&device));
+    assert_cuda(cudaDeviceGetAttribute(&numSMs, cudaDevAttrMultiProcessorCount, device));
+    assert_cuda(cudaOccupancyMaxActiveBlocksPerMultiprocessor(&blocksPerSM, shallowWaterPersistent<csT>, blocksize, 0));
+    const int numBands = std::min(blocksPerSM * numSMs, cs.getNumGridCells3d().y);
+    dim3 numBlocks{ static_cast<unsigned int>(numBands), 1, 1};
+
+    // buffers are rotated up front, the kernel leaves the grid in the same state as numSteps calls to simulateOnce() and swapBuffer()
+    updateBoundaryConditions();
+    std::vector<ShallowWaterGrid::ReferenceType> references = m_grid->getGridReferencesAndSwap(numSteps);
+    m_batchReferences.assign(references);
+
+    int* bandProgress = nullptr;
+    if(m_stepBatching == StepBatching::wavefront)
+    {
+        if(m_bandProgress.size() < static_cast<size_t>(numBands))
+            m_bandProgress = mpu::DeviceVector<int>(numBands);
+        bandProgress = m_bandProgress.data();
+        assert_cuda(cudaMemsetAsync(bandProgress, 0, numBands * sizeof(int), cudaStreamPerThread));
+    }
+
+    ShallowWaterParameters params{m_timestep, m_geopotDiffusion,
+                                  (m_cs->getType() == CSType::geographical2d) ? m_angularVelocity : m_coriolisParameter};
+    const ShallowWaterGrid::ReferenceType* grids = m_batchReferences.data();
+    mpu::VectorReference<float> phiPlusK = m_phiPlusKBuffer.getVectorReference();
+    mpu::VectorReference<float> vortPlusCor = m_vortPlusCor.getVectorReference();
+    bool firstLeapfrog = !m_firstTimestep && m_useLeapfrog;
+    BoundaryBand band = m_boundaries.getBand(cs);
+    void* args[] = {&grids, &numSteps, &cs, &phiPlusK, &vortPlusCor, &params, &m_useLeapfrog, &firstLeapfrog, &m_boundaries, &band,
+                    &bandProgress};
+
+    {
+        PROFILE_GPU_SCOPE("shallow water persistent", cs.getNumGridCells() * int64_t(numSteps));
+        assert_cuda(cudaLaunchCooperativeKernel(reinterpret_cast<void*>(shallowWaterPersistent<csT>), numBlocks, dim3(blocksize,1,1),
+                                                args, 0, cudaStreamPerThread));
+    }
+
+    m_totalSimulatedTime += m_timestep * numSteps;
+    m_step += numSteps;
     m_firstTimestep = false;
+    m_tileStateValid = false; // quiet counters do not know about the batched steps
 }
 
 GridBase& ShallowWaterModel::getGrid()
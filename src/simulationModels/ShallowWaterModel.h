@@ -17,6 +17,10 @@
 // includes
 //--------------------
 #include "Simulation.h"
+#include "../boundaryConditions.h"
+#include "../InitialConditionLoader.h"
+#include "ShallowWaterRefinement.h"
+#include "ShallowWaterNest.h"
 //--------------------
 
 //-------------------------------------------------------------------
@@ -28,7 +32,10 @@
  */
 class ShallowWaterModel : public Simulation
 {
+    friend class ShallowWaterNest; // steps the child model of a nested grid
 public:
+    ShallowWaterModel();
+
     void showCreationOptions() override;
     void showBoundaryOptions(const CoordinateSystem& cs) override;
 
@@ -36,24 +43,61 @@ public:
     void reset() override;
     std::unique_ptr<Simulation> clone() const override;
 
+    SimModel getModelType() const override {return SimModel::shallowWaterModel;}
+    SimulationState getState() const override;
+    void setState(const SimulationState& state) override;
+    std::vector<ModelParameter> getParameters() const override;
+    void setParameters(const std::vector<ModelParameter>& parameters) override;
+
+    ConservationDiagnostics* getDiagnostics() override {return &m_diagnostics;}
+
+    InitialConditionLoader& initialConditions() {return m_initialConditions;} //!< access to settings for loading initial conditions from files
+    void setUseInitialConditionFiles(bool useFiles) {m_useInitialConditionFiles = useFiles;} //!< load initial conditions using initialConditions() instead of the gaussian
+    void setDisturbance(float2 position, float stdDev, float multiplier) {m_gaussianPosition=position; m_stdDev=stdDev; m_multiplier=multiplier;} //!< gaussian initial disturbance, used on the next reset()
+
+    void setTimestep(float timestep) {m_timestep = timestep;} //!< simulation timestep
+    void setDiffusion(float diffusion) {m_geopotDiffusion = diffusion;} //!< geopotential diffusion
+    void setCoriolisParameter(float coriolis) {m_coriolisParameter = coriolis;} //!< coriolis parameter used in cartesian coordinates
+    void setAngularVelocity(float angularVelocity) {m_angularVelocity = angularVelocity;} //!< angular velocity used in geographical coordinates
+    void setStepBatching(StepBatching batching) {m_stepBatching = batching;} //!< how steps nobody looks at are simulated
+    ShallowWaterRefinement& refinement() {return m_refinement;} //!< access to mesh refinement settings, only used with cartesian coordinates
+    ShallowWaterNest& nest() {return m_nest;} //!< access to the nested regional grid, only used with geographical coordinates
+
 private:
     void showSimulationOptions() override;
     void simulateOnce() override;
+    int simulateBatch(int maxSteps) override;
     GridBase& getGrid() override;
     std::string getDisplayName() override;
 
     template <typename csT>
     void simulateOnceImpl(csT& cs); //!< implementation of simulate once to allow different coordinate systems to be used
     std::function<void()> m_simOnceFunc; //!< will be set to use the correct template specialisation based on type of coordinate system used
+    template <typename csT>
+    void simulateBatchImpl(csT& cs, int numSteps); //!< simulate numSteps steps in a single persistent kernel
+    std::function<void(int)> m_batchFunc; //!< will be set to use the correct template specialisation based on type of coordinate system used
 
     // creation settings
     float2 m_gaussianPosition{0,0}; //!< position of the gaussian disturbance
     float m_stdDev{0.1f}; //!< standard deviation of gaussian disturbance
     float m_multiplier{0.1f}; //!< value is multiplied with the gaussian
+    bool m_useInitialConditionFiles{false}; //!< load initial conditions from files instead of using the gaussian
+    InitialConditionLoader m_initialConditions; //!< loads initial conditions from files
+
+    // boundary settings
+    BoundaryType m_boundaryTypeX{BoundaryType::zeroGradient}; //!< zeroGradient: free slip wall, mirror: no slip wall, sponge: open boundary
+    BoundaryType m_boundaryTypeY{BoundaryType::zeroGradient}; //!< zeroGradient: free slip wall, mirror: no slip wall, sponge: open boundary
+    int m_spongeWidth{16}; //!< width of sponge layers in cells
+    float m_spongeStrength{0.05f}; //!< relaxation factor of sponge layers
+    BoundaryConditions<AT::velocityX,AT::velocityY,AT::geopotential> m_boundaries; //!< boundary conditions build from the above settings
+    void updateBoundaryConditions(); //!< rebuild m_boundaries from the boundary settings
 
     // sim settings
     float m_timestep{0.0001}; //!< simulation timestep used
     bool m_useLeapfrog{true}; //!< should leapfrog be used
+    bool m_skipQuietTiles{false}; //!< do not compute tiles where nothing changed in the last step, approximation: changes below the tolerance are lost
+    float m_tileTolerance{1.0e-7f}; //!< changes smaller than this do not make a tile active
+    StepBatching m_stepBatching{StepBatching::off}; //!< how steps nobody looks at are simulated, persistent kernels are opt-in and need support for cooperative launches
     float m_geopotDiffusion{0.0}; //!< diffusion amount
     float m_coriolisParameter{0.0}; //!< corrilois parameter for cartesian simulations
     float m_angularVelocity{7.2921e-5}; //!< angular velocity of earth
@@ -63,8 +107,18 @@ private:
     std::shared_ptr<ShallowWaterGrid> m_grid; //!< the grid to be used
     mpu::DeviceVector<float> m_phiPlusKBuffer; //!< stores geopotential + kinetic energy
     mpu::DeviceVector<float> m_vortPlusCor; //!< stores vorticity + corriolis parameter
+    mpu::DeviceVector<ShallowWaterGrid::ReferenceType> m_batchReferences; //!< grid references of all steps of the persistent kernel
+    mpu::DeviceVector<int> m_bandProgress; //!< last finished phase of every band of rows in wavefront mode
+    int2 m_numTiles{0,0}; //!< number of tiles used to track activity
+    mpu::DeviceVector<uint8_t> m_tileQuiet; //!< consecutive quiet steps of every tile, see TileActivity
+    mpu::DeviceVector<int> m_tileChanged; //!< tiles that changed in the current step
+    ShallowWaterRefinement m_refinement; //!< refined patches, only used with cartesian coordinates
+    ShallowWaterNest m_nest; //!< nested regional grid, only used with geographical coordinates
+    bool m_tileStateValid{false}; //!< m_tileQuiet matches the grid, otherwise all tiles are computed in the next step
     float m_totalSimulatedTime{0.0f};
+    int m_step{0}; //!< number of timesteps since the last reset
     bool m_firstTimestep{true};
+    ConservationDiagnostics m_diagnostics; //!< global integrals of conserved quantities, collected inside of kernel A
 };
 
 
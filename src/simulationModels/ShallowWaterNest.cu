@@ -0,0 +1,282 @@
+/*
+ * CIRCULATION
+ * ShallowWaterNest.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ShallowWaterNest class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "ShallowWaterNest.h"
+#include <cmath>
+#include <algorithm>
+
+#include <mpUtils/mpGraphics.h>
+
+#include "ShallowWaterModel.h"
+#include "../GridReference.h"
+//--------------------
+
+// kernels
+//-------------------------------------------------------------------
+
+//!< bilinear interpolation of attribute "attrib" of the parent grid at (x,y) in units of parent cells, between t and t+1
+template <AT attrib>
+__device__ float interpolateParent(ShallowWaterGrid::ReferenceType& grid, const GeographicalCoordinates2D& cs, float x, float y, float alpha)
+{
+    const int numCellsX = cs.getNumGridCells3d().x;
+    const int x0 = static_cast<int>(floorf(x));
+    const int y0 = static_cast<int>(floorf(y));
+    const float wx = x - x0;
+    const float wy = y - y0;
+
+    float result = 0.0f;
+    for(int j : {0,1})
+        for(int i : {0,1})
+        {
+            const int cellId = cs.getCellId(int3{(x0 + i + numCellsX) % numCellsX, y0+j, 0});
+            float value = grid.read<attrib>(cellId);
+            if(alpha > 0.0f)
+                value = (1.0f-alpha) * value + alpha * grid.readNext<attrib>(cellId);
+            result += ((i==0) ? 1.0f-wx : wx) * ((j==0) ? 1.0f-wy : wy) * value;
+        }
+    return result;
+}
+
+/**
+ * @brief relaxes the child values at t+1 towards the parent at time t + alpha
+ *      The weight of the parent decreases linearly from 1 at the edge of the child to 0 at "width" cells from the edge.
+ * @param width width of the relaxation zone, 0 to replace all cells by the parent values
+ */
+__global__ void relaxNestedChild(ShallowWaterGrid::ReferenceType child, GeographicalCoordinates2D childCs,
+                                 ShallowWaterGrid::ReferenceType parent, GeographicalCoordinates2D parentCs, int width, float alpha)
+{
+    const int3 numCells = childCs.getNumGridCells3d();
+    const float2 parentMin = make_float2(parentCs.getMinCoord());
+    const float2 parentCellSize = make_float2(parentCs.getCellSize());
+    const float2 childCellSize = make_float2(childCs.getCellSize());
+
+    for(int x : mpu::gridStrideRange(numCells.x))
+        for(int y : mpu::gridStrideRangeY(numCells.y))
+        {
+            const int distance = min(min(x, numCells.x-1-x), min(y, numCells.y-1-y));
+            if(width > 0 && distance >= width)
+                continue;
+            const float weight = (width > 0) ? 1.0f - float(distance) / float(width) : 1.0f;
+
+            // parent index space, velocities are stored on the right / forward face
+            int3 cell{x,y,0};
+            int cellId = childCs.getCellId(cell);
+            const float2 p = (make_float2(childCs.getCellCoordinate3d(cell)) - parentMin) / parentCellSize;
+            const float2 face = 0.5f * childCellSize / parentCellSize;
+            const float phi = interpolateParent<AT::geopotential>(parent, parentCs, p.x, p.y, alpha);
+            const float velX = interpolateParent<AT::velocityX>(parent, parentCs, p.x + face.x - 0.5f, p.y, alpha);
+            const float velY = interpolateParent<AT::velocityY>(parent, parentCs, p.x, p.y + face.y - 0.5f, alpha);
+
+            if(weight < 1.0f)
+            {
+                child.write<AT::geopotential>(cellId, (1.0f-weight) * child.readNext<AT::geopotential>(cellId) + weight * phi);
+                child.write<AT::velocityX>(cellId, (1.0f-weight) * child.readNext<AT::velocityX>(cellId) + weight * velX);
+                child.write<AT::velocityY>(cellId, (1.0f-weight) * child.readNext<AT::velocityY>(cellId) + weight * velY);
+            }
+            else
+            {
+                child.write<AT::geopotential>(cellId, phi);
+                child.write<AT::velocityX>(cellId, velX);
+                child.write<AT::velocityY>(cellId, velY);
+            }
+        }
+}
+
+/**
+ * @brief averages the child, which reached t+1 of the parent, onto the parent at t+1, except for "margin" parent cells at the edge of the child
+ *      The right / forward face of a parent cell is covered by the right / forward faces of "ratio" child cells.
+ */
+__global__ void feedbackNestedChild(ShallowWaterGrid::ReferenceType parent, GeographicalCoordinates2D parentCs,
+                                    ShallowWaterGrid::ReferenceType child, GeographicalCoordinates2D childCs,
+                                    int2 firstParentCell, int2 numParentCells, int ratio, int margin, TileActivity tiles)
+{
+    for(int x : mpu::gridStrideRange(firstParentCell.x + margin, firstParentCell.x + numParentCells.x - margin))
+        for(int y : mpu::gridStrideRangeY(firstParentCell.y + margin, firstParentCell.y + numParentCells.y - margin))
+        {
+            const int cx = (x - firstParentCell.x) * ratio;
+            const int cy = (y - firstParentCell.y) * ratio;
+
+            float mass = 0.0f;
+            float area = 0.0f;
+            float velX = 0.0f;
+            float velY = 0.0f;
+            for(int j = 0; j < ratio; j++)
+                for(int i = 0; i < ratio; i++)
+                {
+                    const int childCell = childCs.getCellId(int3{cx+i, cy+j, 0});
+                    const float cellArea = childCs.getCellArea(childCell);
+                    mass += cellArea * child.read<AT::geopotential>(childCell);
+                    area += cellArea;
+                }
+            for(int i = 0; i < ratio; i++)
+            {
+                velX += child.read<AT::velocityX>(childCs.getCellId(int3{cx+ratio-1, cy+i, 0}));
+                velY += child.read<AT::velocityY>(childCs.getCellId(int3{cx+i, cy+ratio-1, 0}));
+            }
+
+            const int cellId = parentCs.getCellId(int3{x,y,0});
+            parent.write<AT::geopotential>(cellId, mass / area);
+            parent.write<AT::velocityX>(cellId, velX / ratio);
+            parent.write<AT::velocityY>(cellId, velY / ratio);
+
+            // the parent tiles stay active, their values come from the child
+            if(tiles.changed)
+                tiles.changed[tiles.tile(x,y)] = 1;
+        }
+}
+
+// function definitions of the ShallowWaterNest class
+//-------------------------------------------------------------------
+
+ShallowWaterNest::~ShallowWaterNest() = default;
+
+ShallowWaterNest::ShallowWaterNest(const ShallowWaterNest& other)
+    : m_enabled(other.m_enabled), m_regionMin(other.m_regionMin), m_regionMax(other.m_regionMax), m_ratio(other.m_ratio),
+      m_relaxationWidth(other.m_relaxationWidth), m_feedback(other.m_feedback)
+{
+}
+
+ShallowWaterNest& ShallowWaterNest::operator=(const ShallowWaterNest& other)
+{
+    m_enabled = other.m_enabled;
+    m_regionMin = other.m_regionMin;
+    m_regionMax = other.m_regionMax;
+    m_ratio = other.m_ratio;
+    m_relaxationWidth = other.m_relaxationWidth;
+    m_feedback = other.m_feedback;
+    clear();
+    return *this;
+}
+
+int ShallowWaterNest::getNumChildCells() const
+{
+    return m_child ? m_numParentCells.x * m_numParentCells.y * m_ratio * m_ratio : 0;
+}
+
+void ShallowWaterNest::clear()
+{
+    m_child.reset();
+    m_childValid = false;
+}
+
+void ShallowWaterNest::showGui()
+{
+    bool changed = ImGui::Checkbox("Nested grid", &m_enabled);
+    if(m_enabled)
+    {
+        changed = ImGui::DragFloat2("Region min (lon, lat)", &m_regionMin.x, 0.001f) || changed;
+        changed = ImGui::DragFloat2("Region max (lon, lat)", &m_regionMax.x, 0.001f) || changed;
+        changed = ImGui::DragInt("Refinement ratio", &m_ratio, 0.05f, 1, 16) || changed;
+        ImGui::DragInt("Relaxation width", &m_relaxationWidth, 0.1f, 1, 64);
+        ImGui::Checkbox("Feed back to parent", &m_feedback);
+        ImGui::Text("Child grid: %i x %i cells", m_numParentCells.x * m_ratio, m_numParentCells.y * m_ratio);
+    }
+    if(changed)
+    {
+        m_ratio = std::max(m_ratio,1);
+        clear();
+    }
+}
+
+void ShallowWaterNest::rebuild(const GeographicalCoordinates2D& cs)
+{
+    // snap the region to parent cells, keep away from the boundary rows of the parent
+    // interpolation of the outermost child cells reads one parent row further out
+    const float2 parentMin = make_float2(cs.getMinCoord());
+    const float2 cellSize = make_float2(cs.getCellSize());
+    const int3 numCells = cs.getNumGridCells3d();
+    auto clampCell = [](int cell, int lowest, int highest){ return std::min(std::max(cell, lowest), highest); };
+    const int2 first{ clampCell(static_cast<int>(std::ceil((m_regionMin.x - parentMin.x) / cellSize.x)), 0, numCells.x-1),
+                      clampCell(static_cast<int>(std::ceil((m_regionMin.y - parentMin.y) / cellSize.y)), 2, numCells.y-3) };
+    const int2 last{ clampCell(static_cast<int>(std::floor((m_regionMax.x - parentMin.x) / cellSize.x)), first.x, numCells.x-1),
+                     clampCell(static_cast<int>(std::floor((m_regionMax.y - parentMin.y) / cellSize.y)), first.y, numCells.y-3) };
+    m_firstParentCell = first;
+    m_numParentCells = make_int2(last.x - first.x + 1, last.y - first.y + 1);
+
+    // child cells cover the parent cells exactly, child cell centers are on the ends of the range
+    const float2 childCellSize = cellSize / float(m_ratio);
+    const float2 childMin = parentMin + (make_float2(first) - 0.5f) * cellSize + 0.5f * childCellSize;
+    const float2 childMax = parentMin + (make_float2(last) + 0.5f) * cellSize - 0.5f * childCellSize;
+    const int3 childCells{m_numParentCells.x * m_ratio, m_numParentCells.y * m_ratio, 1};
+
+    m_child = std::make_unique<ShallowWaterModel>();
+    m_child->setHeadless(true);
+    m_child->recreate(std::make_shared<GeographicalCoordinates2D>(childMin.x, childMax.x, childMin.y, childMax.y, childCells, cs.getMinCoord().z));
+    m_childValid = false;
+
+    logINFO("ShallowWaterNest") << "Created nested grid of " << childCells.x << "x" << childCells.y << " cells covering "
+                                << m_numParentCells.x << "x" << m_numParentCells.y << " parent cells.";
+    if(m_numParentCells.x <= 2 || m_numParentCells.y <= 2)
+        logWARNING("ShallowWaterNest") << "Nested region is very small, check the region settings.";
+}
+
+void ShallowWaterNest::initialize(ShallowWaterModel& parent, const GeographicalCoordinates2D& cs)
+{
+    ShallowWaterGrid& childGrid = *m_child->m_grid;
+    const GeographicalCoordinates2D& childCs = static_cast<const GeographicalCoordinates2D&>(*m_child->m_cs);
+
+    const dim3 blocksize{16,16,1};
+    const dim3 blocks{ static_cast<unsigned int>(mpu::numBlocks(childCs.getNumGridCells3d().x, blocksize.x)),
+                       static_cast<unsigned int>(mpu::numBlocks(childCs.getNumGridCells3d().y, blocksize.y)), 1};
+    for(int level = 0; level < 3; level++)
+    {
+        relaxNestedChild<<< blocks, blocksize >>>(childGrid.getGridReference(), childCs, parent.m_grid->getGridReference(), cs, 0, 0.0f);
+        childGrid.swapBuffer();
+    }
+
+    m_child->setState(SimulationState{});
+    m_childValid = true;
+}
+
+void ShallowWaterNest::step(ShallowWaterModel& parent, const GeographicalCoordinates2D& cs, TileActivity tiles)
+{
+    if(!m_enabled)
+        return;
+    if(!m_child)
+        rebuild(cs);
+    if(!m_childValid)
+        initialize(parent, cs);
+
+    // child follows the parent settings with a smaller timestep, quiet tiles do not know about the relaxation zone
+    m_child->m_timestep = parent.m_timestep / float(m_ratio);
+    m_child->m_geopotDiffusion = parent.m_geopotDiffusion;
+    m_child->m_angularVelocity = parent.m_angularVelocity;
+    m_child->m_useLeapfrog = parent.m_useLeapfrog;
+    m_child->m_skipQuietTiles = false;
+
+    ShallowWaterGrid& childGrid = *m_child->m_grid;
+    const GeographicalCoordinates2D& childCs = static_cast<const GeographicalCoordinates2D&>(*m_child->m_cs);
+    const dim3 blocksize{16,16,1};
+    const dim3 blocks{ static_cast<unsigned int>(mpu::numBlocks(childCs.getNumGridCells3d().x, blocksize.x)),
+                       static_cast<unsigned int>(mpu::numBlocks(childCs.getNumGridCells3d().y, blocksize.y)), 1};
+
+    // the parent already holds t+1, so the child boundary is interpolated in time between t and t+1
+    for(int substep = 0; substep < m_ratio; substep++)
+    {
+        m_child->simulateOnce();
+        relaxNestedChild<<< blocks, blocksize >>>(childGrid.getGridReference(), childCs, parent.m_grid->getGridReference(), cs,
+                                                  m_relaxationWidth, float(substep+1) / float(m_ratio));
+        childGrid.swapBuffer();
+    }
+
+    if(m_feedback)
+    {
+        const int margin = (m_relaxationWidth + m_ratio - 1) / m_ratio + 1;
+        const dim3 parentBlocks{ static_cast<unsigned int>(mpu::numBlocks(m_numParentCells.x, blocksize.x)),
+                                 static_cast<unsigned int>(mpu::numBlocks(m_numParentCells.y, blocksize.y)), 1};
+        feedbackNestedChild<<< parentBlocks, blocksize >>>(parent.m_grid->getGridReference(), cs, childGrid.getGridReference(), childCs,
+                                                           m_firstParentCell, m_numParentCells, m_ratio, margin, tiles);
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * CIRCULATION
+ * ShallowWaterNest.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ShallowWaterNest class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_SHALLOWWATERNEST_H
+#define CIRCULATION_SHALLOWWATERNEST_H
+
+// includes
+//--------------------
+#include <memory>
+#include <algorithm>
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+
+#include "../coordinateSystems/GeographicalCoordinates2D.h"
+#include "../tileActivity.h"
+//--------------------
+
+// forward declarations
+//--------------------
+class ShallowWaterModel;
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * class ShallowWaterNest
+ *
+ * Two way nested regional grid with higher resolution inside of a global geographical shallow water simulation.
+ *
+ * usage:
+ * Set the region in longitude and latitude (radians) and the refinement ratio. The region is snapped to cells of the
+ * parent grid and the child grid gets ratio x ratio cells for every parent cell, so parent cells are exactly covered
+ * by child cells. Call step() after the parent was advanced to t+1 (before boundaries are applied).
+ * The child is a headless ShallowWaterModel on a regional GeographicalCoordinates2D and does "ratio" steps of
+ * a fraction of the parent timestep. After each of them the outer cells of the child are relaxed towards the parent
+ * values, interpolated in space and time. With feedback enabled the child is averaged back onto the parent
+ * everywhere except in the relaxation zone, the geopotential is weighted by cell area so mass is conserved.
+ * The child is created from the parent values in the next step after settings change or invalidate() is called.
+ * Checkpoints only store the parent, the child is created again after a restore.
+ *
+ */
+class ShallowWaterNest
+{
+public:
+    ShallowWaterNest() = default;
+    ~ShallowWaterNest();
+    ShallowWaterNest(const ShallowWaterNest& other); //!< copies the settings, the child is created again on the next step
+    ShallowWaterNest& operator=(const ShallowWaterNest& other); //!< copies the settings, the child is created again on the next step
+
+    void setEnabled(bool enabled) {m_enabled = enabled; clear();} //!< enable or disable the nested grid
+    bool isEnabled() const {return m_enabled;} //!< is the nested grid enabled
+    void setRegion(float2 minCoord, float2 maxCoord) {m_regionMin = minCoord; m_regionMax = maxCoord; clear();} //!< region in longitude and latitude (radians)
+    void setRatio(int ratio) {m_ratio = std::max(ratio,1); clear();} //!< child cells along each side of a parent cell, also the number of child steps per parent step
+    void setRelaxationWidth(int width) {m_relaxationWidth = std::max(width,1);} //!< width in child cells of the zone that is relaxed towards the parent
+    void setFeedback(bool feedback) {m_feedback = feedback;} //!< average the child back onto the parent
+    int getNumChildCells() const; //!< number of cells of the child grid, 0 if it was not created yet
+
+    void invalidate() {m_childValid = false;} //!< initialize the child from the parent again in the next step
+    void clear(); //!< remove the child grid, it is created again in the next step
+    void showGui(); //!< draws settings into the current window
+
+    void step(ShallowWaterModel& parent, const GeographicalCoordinates2D& cs, TileActivity tiles); //!< advance the child to t+1 of the parent and feed it back
+    template <typename csT>
+    void step(ShallowWaterModel& parent, const csT& cs, TileActivity tiles) {} //!< only geographical grids are nested
+
+private:
+    void rebuild(const GeographicalCoordinates2D& cs); //!< create the child grid covering the region
+    void initialize(ShallowWaterModel& parent, const GeographicalCoordinates2D& cs); //!< set all time levels of the child to the parent values at t
+
+    // settings
+    bool m_enabled{false}; //!< run the nested grid
+    float2 m_regionMin{0.5f, 0.2f}; //!< smallest longitude and latitude of the region
+    float2 m_regionMax{1.5f, 0.9f}; //!< largest longitude and latitude of the region
+    int m_ratio{3}; //!< child cells along each side of a parent cell and child steps per parent step
+    int m_relaxationWidth{4}; //!< width in child cells of the zone that is relaxed towards the parent
+    bool m_feedback{true}; //!< average the child back onto the parent
+
+    // child
+    std::unique_ptr<ShallowWaterModel> m_child; //!< simulation on the regional grid
+    bool m_childValid{false}; //!< child was initialized from the parent
+    int2 m_firstParentCell{0,0}; //!< first parent cell covered by the child
+    int2 m_numParentCells{0,0}; //!< number of parent cells covered by the child
+};
+
+#endif //CIRCULATION_SHALLOWWATERNEST_H
@@ -0,0 +1,553 @@
+/*
+ * CIRCULATION
+ * ShallowWaterRefinement.cpp
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ShallowWaterRefinement class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+// includes
+//--------------------
+#include "ShallowWaterRefinement.h"
+
+#include <mpUtils/mpGraphics.h>
+
+#include "../GridReference.h"
+#include "../finiteDifferences.h"
+//--------------------
+
+// variables
+//--------------------
+constexpr int RefinedPatches::coarseSize;
+constexpr int RefinedPatches::fineSize;
+constexpr int RefinedPatches::ghosts;
+constexpr int RefinedPatches::size;
+constexpr int RefinedPatches::cells;
+//--------------------
+
+// kernels
+//-------------------------------------------------------------------
+
+constexpr int compactBlocksize = 512; //!< threads of the kernel that builds the patch list
+
+//!< rounds towards negative infinity
+__device__ inline int floorDiv(int a, int b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+//!< bilinear interpolation of attribute "attrib" of the coarse grid at (x,y) in units of coarse cells
+//!< alpha > 0 interpolates between t and t+1, alpha < 0 between t and t-1
+template <AT attrib>
+__device__ float interpolateCoarse(ShallowWaterGrid::ReferenceType& grid, const CartesianCoordinates2D& cs, float x, float y, float alpha)
+{
+    const int x0 = static_cast<int>(floorf(x));
+    const int y0 = static_cast<int>(floorf(y));
+    const float wx = x - x0;
+    const float wy = y - y0;
+
+    float result = 0.0f;
+    for(int j : {0,1})
+        for(int i : {0,1})
+        {
+            const int cellId = cs.getCellId(int3{x0+i, y0+j, 0});
+            float value = grid.read<attrib>(cellId);
+            if(alpha > 0.0f)
+                value = (1.0f-alpha) * value + alpha * grid.readNext<attrib>(cellId);
+            else if(alpha < 0.0f)
+                value = (1.0f+alpha) * value - alpha * grid.readPrev<attrib>(cellId);
+            result += ((i==0) ? 1.0f-wx : wx) * ((j==0) ? 1.0f-wy : wy) * value;
+        }
+    return result;
+}
+
+//!< sets cell "local" of patch "patch" in time level "level" by interpolation from the coarse grid
+__device__ void prolongate(RefinedPatches& patches, int level, int patch, int local, ShallowWaterGrid::ReferenceType& grid,
+                           const CartesianCoordinates2D& cs, float alpha)
+{
+    constexpr int S = RefinedPatches::size;
+    constexpr int G = RefinedPatches::ghosts;
+    constexpr int F = RefinedPatches::fineSize;
+
+    // fine cell in a global fine grid, fine cell centers are a quarter coarse cell away from the coarse cell centers
+    // velocities are on the right / forward face of a fine cell
+    const int2 tile = patches.tile[patch];
+    const int fx = tile.x * F + local % S - G;
+    const int fy = tile.y * F + local / S - G;
+    const float x = 0.5f * fx - 0.25f;
+    const float y = 0.5f * fy - 0.25f;
+
+    const int i = patch * RefinedPatches::cells + local;
+    patches.phi[level][i] = interpolateCoarse<AT::geopotential>(grid, cs, x, y, alpha);
+    patches.velX[level][i] = interpolateCoarse<AT::velocityX>(grid, cs, 0.5f * fx - 0.5f, y, alpha);
+    patches.velY[level][i] = interpolateCoarse<AT::velocityY>(grid, cs, x, 0.5f * fy - 0.5f, alpha);
+}
+
+//!< largest magnitude of the refinement criterion in every tile at time t
+__global__ void refinementCriterion(ShallowWaterGrid::ReferenceType grid, CartesianCoordinates2D cs, RefinementCriterion criterion,
+                                    TileActivity tiles, unsigned int* tileCriterion)
+{
+    for(int x : mpu::gridStrideRange( cs.hasBoundary().x, cs.getNumGridCells3d().x-cs.hasBoundary().x ))
+        for(int y : mpu::gridStrideRangeY( cs.hasBoundary().y, cs.getNumGridCells3d().y-cs.hasBoundary().y ))
+        {
+            int3 cell{x,y,0};
+            int cellId = cs.getCellId(cell);
+            float2 cellPos = make_float2( cs.getCellCoordinate3d(cell) );
+
+            float value;
+            if(criterion == RefinementCriterion::vorticity)
+                value = fabsf(curl2d(grid.read<AT::velocityY>(cellId), grid.read<AT::velocityY>(cs.getRightNeighbor(cellId)),
+                                     grid.read<AT::velocityX>(cellId), grid.read<AT::velocityX>(cs.getForwardNeighbor(cellId)), cellPos, cs));
+            else
+            {
+                const float phi = grid.read<AT::geopotential>(cellId);
+                const float2 grad = gradient2d(phi, grid.read<AT::geopotential>(cs.getRightNeighbor(cellId)),
+                                               phi, grid.read<AT::geopotential>(cs.getForwardNeighbor(cellId)), cellPos, cs);
+                value = sqrtf(grad.x * grad.x + grad.y * grad.y);
+            }
+
+            if(value > 0.0f)
+                atomicMax(&tileCriterion[tiles.tile(x,y)], __float_as_uint(value));
+        }
+}
+
+//!< flags tiles where the criterion of the tile or a neighbor exceeds the threshold and lists them in row major order
+//!< runs in a single block, so the patch order does not depend on scheduling and kept patches keep their index
+//!< result[0] is the number of patches, result[1] is 1 if the set of refined tiles changed
+__global__ void compactRefinedTiles(const unsigned int* tileCriterion, int2 numTiles, int2 numCells, BoundaryBand band,
+                                    float threshold, int maxPatches, const int* oldPatchOfTile, int2* tile, int* patchOfTile,
+                                    int* oldIndex, int* result)
+{
+    constexpr int C = RefinedPatches::coarseSize;
+    __shared__ int scan[compactBlocksize];
+    __shared__ int changed;
+    if(threadIdx.x == 0)
+        changed = 0;
+
+    int numPatches = 0;
+    const int totalTiles = numTiles.x * numTiles.y;
+    for(int first = 0; first < totalTiles; first += compactBlocksize)
+    {
+        const int t = first + threadIdx.x;
+        const int tx = t % numTiles.x;
+        const int ty = t / numTiles.x;
+
+        // flagged tiles and their neighbors are refined, so features do not leave the patches before the next regrid
+        // ghost cells are interpolated from coarse cells up to two cells outside of the tile, which need to be computed by the coarse step
+        int flag = 0;
+        if(t < totalTiles && tx * C >= band.colsLow + 2 && (tx+1) * C + 2 <= numCells.x - band.colsHigh
+                          && ty * C >= band.rowsLow + 2 && (ty+1) * C + 2 <= numCells.y - band.rowsHigh)
+            for(int y = max(ty-1, 0); y <= min(ty+1, numTiles.y-1); y++)
+                for(int x = max(tx-1, 0); x <= min(tx+1, numTiles.x-1); x++)
+                    if(__uint_as_float(tileCriterion[y * numTiles.x + x]) > threshold)
+                        flag = 1;
+
+        // inclusive prefix sum of the flags
+        scan[threadIdx.x] = flag;
+        __syncthreads();
+        for(int offset = 1; offset < compactBlocksize; offset <<= 1)
+        {
+            const int v = (threadIdx.x >= offset) ? scan[threadIdx.x - offset] : 0;
+            __syncthreads();
+            scan[threadIdx.x] += v;
+            __syncthreads();
+        }
+
+        if(t < totalTiles)
+        {
+            const int index = numPatches + scan[threadIdx.x] - 1;
+            const int patch = (flag && index < maxPatches) ? index : -1;
+            patchOfTile[t] = patch;
+            if(patch >= 0)
+            {
+                tile[patch] = int2{tx,ty};
+                oldIndex[patch] = oldPatchOfTile[t];
+            }
+            if((patch >= 0) != (oldPatchOfTile[t] >= 0))
+                changed = 1;
+        }
+        numPatches += scan[compactBlocksize-1];
+        __syncthreads();
+    }
+
+    if(threadIdx.x == 0)
+    {
+        result[0] = min(numPatches, maxPatches);
+        result[1] = changed;
+    }
+}
+
+//!< copies kept patches from their old storage and prolongates new patches from the coarse grid at t and t-1/2
+__global__ void initializeRefinedPatches(RefinedPatches patches, RefinedPatches oldPatches, const int* oldIndex,
+                                         ShallowWaterGrid::ReferenceType grid, CartesianCoordinates2D cs, int prev, int cur)
+{
+    for(int i : mpu::gridStrideRange(patches.numPatches * RefinedPatches::cells))
+    {
+        const int patch = i / RefinedPatches::cells;
+        const int local = i % RefinedPatches::cells;
+
+        const int old = oldIndex[patch];
+        if(old >= 0)
+        {
+            const int j = old * RefinedPatches::cells + local;
+            for(int level = 0; level < 3; level++)
+            {
+                patches.phi[level][i] = oldPatches.phi[level][j];
+                patches.velX[level][i] = oldPatches.velX[level][j];
+                patches.velY[level][i] = oldPatches.velY[level][j];
+            }
+            continue;
+        }
+
+        prolongate(patches, cur, patch, local, grid, cs, 0.0f);
+        prolongate(patches, prev, patch, local, grid, cs, -0.5f);
+    }
+}
+
+//!< fills ghost cells of time level "level" from neighboring patches, or from the coarse grid at time t + alpha
+__global__ void fillRefinedGhosts(RefinedPatches patches, int level, ShallowWaterGrid::ReferenceType grid,
+                                  CartesianCoordinates2D cs, float alpha)
+{
+    constexpr int S = RefinedPatches::size;
+    constexpr int G = RefinedPatches::ghosts;
+    constexpr int F = RefinedPatches::fineSize;
+
+    for(int i : mpu::gridStrideRange(patches.numPatches * RefinedPatches::cells))
+    {
+        const int patch = i / RefinedPatches::cells;
+        const int local = i % RefinedPatches::cells;
+        const int gx = local % S;
+        const int gy = local / S;
+        if(gx >= G && gx < G+F && gy >= G && gy < G+F)
+            continue;
+
+        // tile of the ghost cell, patches never touch the grid boundary so the tile always exists
+        const int2 tile = patches.tile[patch];
+        const int fx = tile.x * F + gx - G;
+        const int fy = tile.y * F + gy - G;
+        const int tx = floorDiv(fx, F);
+        const int ty = floorDiv(fy, F);
+        const int neighbor = patches.patchOfTile[ty * patches.numTiles.x + tx];
+
+        if(neighbor >= 0)
+        {
+            const int j = RefinedPatches::cell(neighbor, fx - tx * F + G, fy - ty * F + G);
+            patches.phi[level][i] = patches.phi[level][j];
+            patches.velX[level][i] = patches.velX[level][j];
+            patches.velY[level][i] = patches.velY[level][j];
+        }
+        else
+            prolongate(patches, level, patch, local, grid, cs, alpha);
+    }
+}
+
+/**
+ * @brief advances all patches by one fine timestep, blocks take patches from a shared counter until all are done
+ * @param fineCs coordinate system of a single patch including ghost cells
+ * @param workCounter zero initialized counter of patches taken by blocks
+ */
+__global__ void stepRefinedPatches(RefinedPatches patches, CartesianCoordinates2D fineCs, ShallowWaterParameters params,
+                                   int prev, int cur, int next, bool useLeapfrog, int* workCounter)
+{
+    constexpr int S = RefinedPatches::size;
+    constexpr int G = RefinedPatches::ghosts;
+    constexpr int F = RefinedPatches::fineSize;
+    constexpr int E = F + 2; // interior and first ring of ghost cells
+
+    __shared__ float phiPlusK[RefinedPatches::cells];
+    __shared__ float vortPlusCor[RefinedPatches::cells];
+    __shared__ int patch;
+    const CartesianCoordinates2D& cs = fineCs;
+
+    while(true)
+    {
+        if(threadIdx.x == 0)
+            patch = atomicAdd(workCounter, 1);
+        __syncthreads();
+        if(patch >= patches.numPatches)
+            break;
+
+        const int offset = patch * RefinedPatches::cells;
+        const float* phi = patches.phi[cur] + offset;
+        const float* velX = patches.velX[cur] + offset;
+        const float* velY = patches.velY[cur] + offset;
+
+        // first half, the second half needs phi+K and vorticity in the first ring of ghost cells as well
+        for(int i = threadIdx.x; i < E*E; i += blockDim.x)
+        {
+            const int x = G-1 + i % E;
+            const int y = G-1 + i / E;
+            const int c = y * S + x;
+
+            ShallowWaterStencilA s;
+            s.phi = phi[c];
+            s.velRightX = velX[c];
+            s.velForY = velY[c];
+            s.velLeftX = velX[c-1];
+            s.velBackY = velY[c-S];
+            s.velForX = velX[c+S];
+            s.velRightY = velY[c+1];
+            s.phiLeft = phi[c-1];
+            s.phiRight = phi[c+1];
+            s.phiFor = phi[c+S];
+            s.phiBack = phi[c-S];
+            s.prevPhi = useLeapfrog ? patches.phi[prev][offset + c] : 0.0f;
+
+            const ShallowWaterResultA r = shallowWaterStepA(s, make_float2(cs.getCellCoordinate3d(int3{x,y,0})), cs, params, useLeapfrog);
+            phiPlusK[c] = r.kinEnergy + s.phi;
+            vortPlusCor[c] = r.vortPlusCor;
+            if(x >= G && x < G+F && y >= G && y < G+F)
+                patches.phi[next][offset + c] = r.nextPhi;
+        }
+        __syncthreads();
+
+        // second half, velocities on the faces between patch and ghost cells belong to the cell on the left / backward side
+        for(int i = threadIdx.x; i < F*F; i += blockDim.x)
+        {
+            const int x = G + i % F;
+            const int y = G + i / F;
+            const int c = y * S + x;
+
+            ShallowWaterStencilB s;
+            s.phiKRight = phiPlusK[c+1];
+            s.phiKForward = phiPlusK[c+S];
+            s.phiK = phiPlusK[c];
+            s.vortCorLeft = vortPlusCor[c-1];
+            s.vortCorBack = vortPlusCor[c-S];
+            s.vortCor = vortPlusCor[c];
+            s.velX = velX[c];
+            s.velY = velY[c];
+            s.prevVelX = useLeapfrog ? patches.velX[prev][offset + c] : 0.0f;
+            s.prevVelY = useLeapfrog ? patches.velY[prev][offset + c] : 0.0f;
+
+            const float2 nextVel = shallowWaterStepB(s, make_float2(cs.getCellCoordinate3d(int3{x,y,0})), cs, params.timestep, useLeapfrog);
+            patches.velX[next][offset + c] = nextVel.x;
+            patches.velY[next][offset + c] = nextVel.y;
+        }
+        __syncthreads(); // shared memory is reused for the next patch
+    }
+}
+
+//!< averages time level "level" of all patches onto the t+1 buffer of the coarse grid and marks refined tiles as changed
+__global__ void restrictRefinedPatches(RefinedPatches patches, int level, ShallowWaterGrid::ReferenceType grid,
+                                       CartesianCoordinates2D cs, TileActivity tiles)
+{
+    constexpr int C = RefinedPatches::coarseSize;
+    constexpr int G = RefinedPatches::ghosts;
+
+    for(int i : mpu::gridStrideRange(patches.numPatches * C * C))
+    {
+        const int patch = i / (C*C);
+        const int x = patches.tile[patch].x * C + (i % (C*C)) % C;
+        const int y = patches.tile[patch].y * C + (i % (C*C)) / C;
+        const int cellId = cs.getCellId(int3{x,y,0});
+
+        // the right / forward face of a coarse cell is covered by the right / forward faces of two fine cells
+        const int fx = G + 2 * (x % C);
+        const int fy = G + 2 * (y % C);
+        const float* phi = patches.phi[level];
+        const float* velX = patches.velX[level];
+        const float* velY = patches.velY[level];
+        grid.write<AT::geopotential>(cellId, 0.25f * ( phi[RefinedPatches::cell(patch,fx,fy)] + phi[RefinedPatches::cell(patch,fx+1,fy)]
+                                                     + phi[RefinedPatches::cell(patch,fx,fy+1)] + phi[RefinedPatches::cell(patch,fx+1,fy+1)]));
+        grid.write<AT::velocityX>(cellId, 0.5f * (velX[RefinedPatches::cell(patch,fx+1,fy)] + velX[RefinedPatches::cell(patch,fx+1,fy+1)]));
+        grid.write<AT::velocityY>(cellId, 0.5f * (velY[RefinedPatches::cell(patch,fx,fy+1)] + velY[RefinedPatches::cell(patch,fx+1,fy+1)]));
+
+        // refined tiles stay active, the coarse values do not show what happens inside of the patch
+        if(tiles.changed && x % C == 0 && y % C == 0)
+            tiles.changed[tiles.tile(x,y)] = 1;
+    }
+}
+
+// function definitions of the ShallowWaterRefinement class
+//-------------------------------------------------------------------
+
+void ShallowWaterRefinement::clear()
+{
+    m_numPatches = 0;
+    m_regridPending = false;
+    Storage& storage = m_storage[m_current];
+    if(storage.patchOfTile.size() > 0)
+        assert_cuda(cudaMemsetAsync(storage.patchOfTile.data(), 0xff, storage.patchOfTile.size() * sizeof(int), cudaStreamPerThread)); // all bytes 0xff is -1
+}
+
+void ShallowWaterRefinement::showGui()
+{
+    bool enabled = m_enabled;
+    if(ImGui::Checkbox("Refine mesh", &enabled))
+        setEnabled(enabled);
+    if(!m_enabled)
+        return;
+
+    int criterion = static_cast<int>(m_criterion);
+    if(ImGui::Combo("Refinement criterion", &criterion, "Vorticity\0Geopotential gradient\0\0"))
+        m_criterion = static_cast<RefinementCriterion>(criterion);
+    ImGui::DragFloat("Refinement threshold", &m_threshold, 0.01f, 0.0f, 10000.0f);
+    if(ImGui::DragInt("Regrid interval", &m_regridInterval, 0.1f, 1, 1000))
+        setRegridInterval(m_regridInterval);
+    if(ImGui::DragInt("Max patches", &m_maxPatches, 1.0f, 0, 100000))
+        setMaxPatches(m_maxPatches);
+    ImGui::Text("Refined patches: %i", getNumPatches());
+}
+
+RefinedPatches ShallowWaterRefinement::getPatches(Storage& storage)
+{
+    RefinedPatches patches;
+    for(int level = 0; level < 3; level++)
+    {
+        patches.phi[level] = storage.phi[level].data();
+        patches.velX[level] = storage.velX[level].data();
+        patches.velY[level] = storage.velY[level].data();
+    }
+    patches.tile = storage.tile.data();
+    patches.patchOfTile = storage.patchOfTile.data();
+    patches.numTiles = m_numTiles;
+    patches.numPatches = getNumPatches();
+    return patches;
+}
+
+void ShallowWaterRefinement::reserve(Storage& storage, int numPatches)
+{
+    const size_t cells = static_cast<size_t>(numPatches) * RefinedPatches::cells;
+    for(int level = 0; level < 3; level++)
+        if(storage.phi[level].size() < cells)
+        {
+            storage.phi[level].resize(cells);
+            storage.velX[level].resize(cells);
+            storage.velY[level].resize(cells);
+        }
+}
+
+void ShallowWaterRefinement::regrid(ShallowWaterGrid& grid, const CartesianCoordinates2D& cs, const BoundaryBand& band)
+{
+    const int2 numCells = make_int2(cs.getNumGridCells3d());
+    const int2 tiles = numTiles(numCells);
+    const int totalTiles = tiles.x * tiles.y;
+    if(tiles.x != m_numTiles.x || tiles.y != m_numTiles.y)
+    {
+        m_numTiles = tiles;
+        for(auto& storage : m_storage)
+            storage.patchOfTile.resize(totalTiles);
+        clear();
+    }
+    if(!m_regridDone)
+    {
+        auto event = new cudaEvent_t;
+        assert_cuda(cudaEventCreateWithFlags(event, cudaEventDisableTiming));
+        m_regridDone = std::shared_ptr<cudaEvent_t>(event, [](cudaEvent_t* e){ cudaEventDestroy(*e); delete e; });
+        int* result;
+        assert_cuda(cudaMallocHost(&result, 2 * sizeof(int)));
+        m_regridResult = std::shared_ptr<int>(result, [](int* r){ cudaFreeHost(r); });
+    }
+
+    // largest value of the criterion in each tile
+    if(m_tileCriterion.size() != static_cast<size_t>(totalTiles))
+        m_tileCriterion.resize(totalTiles);
+    assert_cuda(cudaMemsetAsync(m_tileCriterion.data(), 0, totalTiles * sizeof(unsigned int), cudaStreamPerThread));
+    TileActivity tileActivity;
+    tileActivity.tilesX = tiles.x;
+    const dim3 blocksize{16,16,1};
+    const dim3 blocks{ static_cast<unsigned int>(mpu::numBlocks(numCells.x, blocksize.x)),
+                       static_cast<unsigned int>(mpu::numBlocks(numCells.y, blocksize.y)), 1};
+    refinementCriterion<<< blocks, blocksize >>>(grid.getGridReference(), cs, m_criterion, tileActivity, m_tileCriterion.data());
+
+    // the new patch list is built in the other storage, only the number of patches is downloaded
+    Storage& newStorage = m_storage[1 - m_current];
+    const size_t capacity = static_cast<size_t>(std::min(m_maxPatches, totalTiles));
+    if(newStorage.tile.size() < capacity)
+        newStorage.tile.resize(capacity);
+    if(m_oldIndex.size() < capacity)
+        m_oldIndex.resize(capacity);
+    if(m_regridCounts.size() < 2)
+        m_regridCounts.resize(2);
+    compactRefinedTiles<<< 1, compactBlocksize >>>(m_tileCriterion.data(), tiles, numCells, band, m_threshold, m_maxPatches,
+            m_storage[m_current].patchOfTile.data(), newStorage.tile.data(), newStorage.patchOfTile.data(), m_oldIndex.data(),
+            m_regridCounts.data());
+    assert_cuda(cudaMemcpyAsync(m_regridResult.get(), m_regridCounts.data(), 2 * sizeof(int), cudaMemcpyDeviceToHost, cudaStreamPerThread));
+    assert_cuda(cudaEventRecord(*m_regridDone, cudaStreamPerThread));
+    m_regridPending = true;
+}
+
+void ShallowWaterRefinement::finishRegrid(ShallowWaterGrid& grid, const CartesianCoordinates2D& cs)
+{
+    // the coarse step was launched after regrid(), so the device stays busy while we wait for the result
+    m_regridPending = false;
+    assert_cuda(cudaEventSynchronize(*m_regridDone));
+    const int numPatches = m_regridResult.get()[0];
+    const bool changed = m_regridResult.get()[1] != 0;
+    if(!changed)
+        return;
+
+    // patches that stay are copied from the old storage, new ones are interpolated from the coarse grid at t and t-1/2
+    const RefinedPatches oldPatches = getPatches(m_storage[m_current]);
+    const int oldNumPatches = m_numPatches;
+    m_current = 1 - m_current;
+    m_numPatches = numPatches;
+    if(numPatches > 0)
+    {
+        reserve(m_storage[m_current], numPatches);
+        const int blocksize = 128;
+        initializeRefinedPatches<<< mpu::numBlocks(numPatches * RefinedPatches::cells, blocksize), blocksize >>>(
+                getPatches(m_storage[m_current]), oldPatches, m_oldIndex.data(), grid.getGridReference(), cs, m_prev, m_cur);
+    }
+
+    if(numPatches != oldNumPatches)
+        logINFO("ShallowWaterRefinement") << "Refined " << numPatches << " of " << m_numTiles.x * m_numTiles.y << " tiles.";
+}
+
+void ShallowWaterRefinement::step(ShallowWaterGrid& grid, const CartesianCoordinates2D& cs, const ShallowWaterParameters& params,
+                                  bool useLeapfrog, bool firstLeapfrog, TileActivity tiles)
+{
+    if(m_regridPending)
+        finishRegrid(grid, cs);
+    if(m_numPatches == 0)
+        return;
+
+    RefinedPatches patches = getPatches(m_storage[m_current]);
+    const int numPatches = getNumPatches();
+
+    // finite differences in cartesian coordinates only depend on the cell size, so one coordinate system fits all patches
+    const float3 fineCellSize = 0.5f * cs.getCellSize();
+    const CartesianCoordinates2D fineCs(make_float3(0,0,0),
+                                        make_float3(fineCellSize.x * (RefinedPatches::size-1), fineCellSize.y * (RefinedPatches::size-1), 0),
+                                        int3{RefinedPatches::size, RefinedPatches::size, 1});
+    ShallowWaterParameters fineParams = params;
+    fineParams.timestep = 0.5f * params.timestep;
+
+    // one block per patch at most, idle blocks take the next patch that is not done
+    const int blocksize = 256;
+    int device;
+    int numSMs;
+    int blocksPerSM;
+    assert_cuda(cudaGetDevice(&device));
+    assert_cuda(cudaDeviceGetAttribute(&numSMs, cudaDevAttrMultiProcessorCount, device));
+    assert_cuda(cudaOccupancyMaxActiveBlocksPerMultiprocessor(&blocksPerSM, stepRefinedPatches, blocksize, 0));
+    const int numBlocks = std::max(std::min(blocksPerSM * numSMs, numPatches), 1);
+    if(m_workCounter.size() < 1)
+        m_workCounter.resize(1);
+
+    const int ghostBlocksize = 128;
+    const int ghostBlocks = mpu::numBlocks(numPatches * RefinedPatches::cells, ghostBlocksize);
+    for(int substep : {0,1})
+    {
+        // ghost cells at the time of the substep, the coarse grid already holds t+1
+        fillRefinedGhosts<<< ghostBlocks, ghostBlocksize >>>(patches, m_cur, grid.getGridReference(), cs, 0.5f * substep);
+
+        assert_cuda(cudaMemsetAsync(m_workCounter.data(), 0, sizeof(int), cudaStreamPerThread));
+        stepRefinedPatches<<< numBlocks, blocksize >>>(patches, fineCs, fineParams, m_prev, m_cur, m_next,
+                                                       (substep == 0) ? firstLeapfrog : useLeapfrog, m_workCounter.data());
+
+        const int prev = m_prev;
+        m_prev = m_cur;
+        m_cur = m_next;
+        m_next = prev;
+    }
+
+    restrictRefinedPatches<<< mpu::numBlocks(numPatches * RefinedPatches::coarseSize * RefinedPatches::coarseSize, ghostBlocksize), ghostBlocksize >>>(
+            patches, m_cur, grid.getGridReference(), cs, tiles);
+}
@@ -0,0 +1,138 @@
+/*
+ * CIRCULATION
+ * ShallowWaterRefinement.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Implements the ShallowWaterRefinement class
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+
+#ifndef CIRCULATION_SHALLOWWATERREFINEMENT_H
+#define CIRCULATION_SHALLOWWATERREFINEMENT_H
+
+// includes
+//--------------------
+#include <memory>
+#include <algorithm>
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+
+#include "../Grid.h"
+#include "../coordinateSystems/CartesianCoordinates2D.h"
+#include "../boundaryConditions.h"
+#include "../tileActivity.h"
+#include "../enums.h"
+#include "shallowWaterPhysics.h"
+//--------------------
+
+//-------------------------------------------------------------------
+/**
+ * @brief device pointers to the refined patches of one time level set, see ShallowWaterRefinement
+ *  Patches are stored one after the other, cells of a patch row major including ghost cells.
+ *  Staggering is the same as on the coarse grid, velocityX on the right and velocityY on the forward face.
+ */
+struct RefinedPatches
+{
+    static constexpr int coarseSize = TileActivity::tileSize; //!< coarse cells along each side of a patch
+    static constexpr int fineSize = 2 * coarseSize; //!< fine interior cells along each side of a patch
+    static constexpr int ghosts = 2; //!< ghost cells on each side
+    static constexpr int size = fineSize + 2*ghosts; //!< fine cells along each side of a patch including ghost cells
+    static constexpr int cells = size * size; //!< fine cells per patch including ghost cells
+
+    float* phi[3]; //!< geopotential of each time level
+    float* velX[3]; //!< velocity in x direction of each time level
+    float* velY[3]; //!< velocity in y direction of each time level
+    const int2* tile; //!< coarse tile refined by each patch
+    const int* patchOfTile; //!< index of the patch refining a coarse tile, -1 if the tile is not refined
+    int2 numTiles; //!< number of coarse tiles
+    int numPatches; //!< number of patches
+
+    CUDAHOSTDEV static int cell(int patch, int fx, int fy) {return patch * cells + fy * size + fx;} //!< index of fine cell (fx,fy) of patch including ghosts
+};
+
+//-------------------------------------------------------------------
+/**
+ * class ShallowWaterRefinement
+ *
+ * Block structured mesh refinement of a cartesian shallow water grid.
+ *
+ * usage:
+ * Coarse tiles (see TileActivity) where the refinement criterion exceeds the threshold are covered by patches with
+ * twice the resolution. Call regrid() before a coarse step when isRegridDue() and step() after the coarse grid was
+ * advanced to t+1 (before boundaries are applied), also if there are no patches yet. step() advances all patches with two substeps of half the timestep,
+ * ghost cells are copied from neighboring patches or interpolated in space and time from the coarse grid.
+ * Afterwards the patches are averaged back onto the coarse grid, so the coarse grid (which is rendered and written)
+ * always holds the best available solution. The geopotential is restricted by area average, which conserves mass
+ * inside of patches, fluxes across coarse-fine interfaces are not corrected.
+ * Refined tiles keep a distance of two coarse cells to the boundary band and are marked active in the tile activity.
+ * Patches are distributed over thread blocks by an atomic counter, idle blocks take the next patch. Intermediate
+ * values of a substep are kept in shared memory.
+ * Tiles are flagged and compacted into the patch list on the device. regrid() only starts an asynchronous download of
+ * the number of patches, step() waits for it after the coarse step was launched and then initializes the new patches.
+ *
+ */
+class ShallowWaterRefinement
+{
+public:
+    void clear(); //!< remove all patches
+    bool isEnabled() const {return m_enabled;} //!< is refinement enabled
+    void setEnabled(bool enabled) {m_enabled = enabled; if(!enabled) clear();} //!< enable or disable refinement
+    int getNumPatches() const {return m_numPatches;} //!< number of refined patches, changes in the step() after regrid()
+    bool isRegridDue(int step) const {return m_enabled && step % m_regridInterval == 0;} //!< should regrid() be called before step
+    void showGui(); //!< draws settings into the current window
+
+    void setCriterion(RefinementCriterion criterion) {m_criterion = criterion;} //!< quantity that decides where to refine
+    void setThreshold(float threshold) {m_threshold = threshold;} //!< refine where the criterion exceeds threshold
+    void setRegridInterval(int interval) {m_regridInterval = std::max(interval,1);} //!< regrid every interval coarse steps
+    void setMaxPatches(int maxPatches) {m_maxPatches = std::max(maxPatches,0);} //!< upper bound of refined patches
+
+    void regrid(ShallowWaterGrid& grid, const CartesianCoordinates2D& cs, const BoundaryBand& band); //!< choose patches from the coarse grid at time t
+    template <typename csT>
+    void regrid(ShallowWaterGrid& grid, const csT& cs, const BoundaryBand& band) {} //!< only cartesian grids are refined
+    void step(ShallowWaterGrid& grid, const CartesianCoordinates2D& cs, const ShallowWaterParameters& params,
+              bool useLeapfrog, bool firstLeapfrog, TileActivity tiles); //!< advance patches to t+1 and restrict to the coarse grid
+    template <typename csT>
+    void step(ShallowWaterGrid& grid, const csT& cs, const ShallowWaterParameters& params,
+              bool useLeapfrog, bool firstLeapfrog, TileActivity tiles) {} //!< only cartesian grids are refined
+
+private:
+    struct Storage //!< time levels of all patches, see RefinedPatches
+    {
+        mpu::DeviceVector<float> phi[3]; //!< geopotential
+        mpu::DeviceVector<float> velX[3]; //!< velocity in x direction
+        mpu::DeviceVector<float> velY[3]; //!< velocity in y direction
+        mpu::DeviceVector<int2> tile; //!< coarse tile of every patch
+        mpu::DeviceVector<int> patchOfTile; //!< patch of every tile, -1 if the tile is not refined
+    };
+
+    RefinedPatches getPatches(Storage& storage); //!< device pointers to the patches in storage
+    void reserve(Storage& storage, int numPatches); //!< make sure storage can hold numPatches patches
+    void finishRegrid(ShallowWaterGrid& grid, const CartesianCoordinates2D& cs); //!< wait for the patch list of the last regrid() and initialize new patches
+
+    // settings
+    bool m_enabled{false}; //!< refine the grid
+    RefinementCriterion m_criterion{RefinementCriterion::vorticity}; //!< quantity that decides where to refine
+    float m_threshold{1.0f}; //!< refine where the criterion exceeds the threshold
+    int m_regridInterval{8}; //!< regrid every m_regridInterval coarse steps
+    int m_maxPatches{1024}; //!< upper bound of refined patches
+
+    // patches
+    int m_numPatches{0}; //!< number of patches in the current storage
+    int2 m_numTiles{0,0}; //!< number of coarse tiles
+    Storage m_storage[2]; //!< values and tiles of all patches, the second one is used while regridding
+    int m_current{0}; //!< storage in use
+    int m_prev{0}, m_cur{1}, m_next{2}; //!< time level indices of t-1, t and t+1
+    mpu::DeviceVector<unsigned int> m_tileCriterion; //!< bits of the largest value of the criterion in each tile, non negative floats sort like unsigned integers
+    mpu::DeviceVector<int> m_oldIndex; //!< patch index before regridding of every new patch, -1 for new patches
+    mpu::DeviceVector<int> m_regridCounts; //!< number of patches and changed flag computed by the last regrid
+    std::shared_ptr<int> m_regridResult; //!< pinned host copy of m_regridCounts
+    std::shared_ptr<cudaEvent_t> m_regridDone; //!< recorded after the download of m_regridCounts
+    bool m_regridPending{false}; //!< regrid() was called, but finishRegrid() was not
+    mpu::DeviceVector<int> m_workCounter; //!< next patch to be taken by a thread block
+};
+
+#endif //CIRCULATION_SHALLOWWATERREFINEMENT_H
@@ -17,6 +17,9 @@
 // includes
 //--------------------
 #include <memory>
+#include <functional>
+#include <string>
+#include <vector>
 
 #include <mpUtils/mpUtils.h>
 #include <mpUtils/mpGraphics.h>
@@ -24,14 +27,46 @@
 
 #include "../Grid.h"
 #include "../coordinateSystems/CoordinateSystem.h"
+#include "../ConservationDiagnostics.h"
+#include "../HardwareCounters.h"
+#include "../StepScheduler.h"
+#include "../enums.h"
 //--------------------
 
+//-------------------------------------------------------------------
+/**
+ * @brief state of the time integration that is not stored in the grid, used to write and restore checkpoints
+ */
+struct SimulationState
+{
+    double totalSimulatedTime{0.0}; //!< simulated time since the last reset
+    int step{0}; //!< number of timesteps since the last reset
+    bool firstTimestep{true}; //!< the next step is the first one after a reset (no t-1 data available)
+};
+
+//-------------------------------------------------------------------
+/**
+ * @brief a model parameter that is not part of the state (eg the timestep), stored in checkpoints
+ *  Integers and enums are stored as float as well.
+ */
+struct ModelParameter
+{
+    std::string name; //!< identifies the parameter
+    float value; //!< value of the parameter
+};
+
 //-------------------------------------------------------------------
 /**
  * class Simulation
  *
  * Base class for different simulation models.
  * Used to control and run different simulations.
+ * Diagnostic fields (eg gradients or vorticity) are only computed on steps that are rendered, requested by the
+ * diagnostic fields filter or by requestDiagnosticFields(), models check diagnosticFieldsDue() in simulateOnce().
+ * On all other steps these attributes hold outdated values.
+ * Consecutive steps that are neither rendered nor accepted by the filter are passed to simulateBatch(), so models can
+ * simulate them without returning to the host in between. The step callback is not called for them, so when a callback
+ * is set, the filter needs to accept every step the callback is interested in.
  *
  */
 class Simulation
@@ -43,7 +78,7 @@ public:
     virtual void showCreationOptions()=0; //!< draws part of a ui window that enables changing of options in the "create new simulation"-dialog
     virtual void showBoundaryOptions(const CoordinateSystem& cs)=0; //!< draws part of a ui window that enables changing boundary conditions
     virtual std::shared_ptr<GridBase> recreate(std::shared_ptr<CoordinateSystem> cs)=0; //!< recreate simulation using current creation options, returns new coordinate system, feel free to call reset() here
-    virtual void reset()=0; //!< reset the simulation to the initial conditions, keep allocated memory and settings
+    virtual void reset()=0; //!< reset the simulation to the initial conditions, keep allocated memory and settings, also reset m_stepScheduler
     virtual std::unique_ptr<Simulation> clone() const =0; //!< deep copy of the simulation
 
     // running the simulation
@@ -54,33 +89,140 @@ public:
     bool isPaused() {return m_isPaused;} //!< checks if the simulation should be paused
 
     void setIterations(int iterations) {m_simIterations=iterations;} //!< sets number of iterations per run() call
+    StepScheduler& stepScheduler() {return m_stepScheduler;} //!< chooses the number of iterations per run() call, uses the value set by setIterations() in fixed mode
+    void setHeadless(bool headless) {m_headless=headless;} //!< when headless, grids created by recreate() will have no render buffers and no openGL context is needed
+    void setStepCallback(std::function<void(GridBase&, const SimulationState&)> callback) {m_stepCallback=std::move(callback);} //!< callback is called after every timestep, when t is the newly computed timestep (eg for output)
+    void setDiagnosticFieldsFilter(std::function<bool(int)> filter) {m_diagnosticFieldsFilter=std::move(filter);} //!< filter(step) returns true if diagnostic fields are needed at step (as in SimulationState::step after the step), eg for output
+    void requestDiagnosticFields() {m_diagnosticFieldsRequested=true;} //!< compute diagnostic fields in the next step, even if it is not rendered
+
+    // checkpoints
+    virtual SimModel getModelType() const =0; //!< identify the type of simulation model using SimModel from enums.h
+    virtual SimulationState getState() const {return {};} //!< get time integration state for checkpoints
+    virtual void setState(const SimulationState& state) {} //!< restore time integration state from a checkpoint
+    virtual std::vector<ModelParameter> getParameters() const {return {};} //!< get model parameters for checkpoints
+    virtual void setParameters(const std::vector<ModelParameter>& parameters) {} //!< restore model parameters from a checkpoint, unknown names are ignored
+
+    // diagnostics
+    virtual ConservationDiagnostics* getDiagnostics() {return nullptr;} //!< access to conservation diagnostics, nullptr if the model does not support them
 
 protected:
+    bool diagnosticFieldsDue() const {return m_diagnosticFieldsDue;} //!< models only compute diagnostic fields (derived attributes that are not needed to advance in time) if this is true
+
     bool m_isPaused{false};
     int m_simIterations{10};
+    StepScheduler m_stepScheduler; //!< picks the iterations per run() call
+    bool m_headless{false};
+    std::function<void(GridBase&, const SimulationState&)> m_stepCallback; //!< called after every timestep
 
 private:
     virtual void showSimulationOptions()=0; //!< draws part of a ui window to handle all live settings that can be changed while the simulation is running if you want you can call "showBoundaryOptions" here as well
     virtual void simulateOnce()=0; //!< simulate one timestep
     virtual GridBase& getGrid()=0; //!< access to the simulation grid
     virtual std::string getDisplayName()=0; //!< name of the simulation to be displayed in the ui
+
+    virtual int simulateBatch(int maxSteps) {return 0;} //!< simulate up to maxSteps steps that are not rendered or looked at, including buffer swaps, returns number of steps done, 0 to fall back to simulateOnce()
+    void prepareStep(bool published); //!< decide if the next step needs diagnostic fields
+    int countQuietSteps(int maxSteps); //!< number of upcoming steps (at most maxSteps) where no consumer needs the grid
+
+    std::function<bool(int)> m_diagnosticFieldsFilter; //!< steps where consumers need diagnostic fields
+    bool m_diagnosticFieldsRequested{false}; //!< diagnostic fields are needed in the next step
+    bool m_diagnosticFieldsDue{true}; //!< the current step computes diagnostic fields
 };
 
+inline int Simulation::countQuietSteps(int maxSteps)
+{
+    // without a filter we can not know which steps the callback is interested in
+    if(m_diagnosticFieldsRequested || (m_stepCallback && !m_diagnosticFieldsFilter))
+        return 0;
+
+    const int nextStep = getState().step + 1;
+    int steps = 0;
+    while(steps < maxSteps && !(m_diagnosticFieldsFilter && m_diagnosticFieldsFilter(nextStep + steps)))
+        steps++;
+    return steps;
+}
+
+inline void Simulation::prepareStep(bool published)
+{
+    m_diagnosticFieldsDue = published || m_diagnosticFieldsRequested
+                            || (m_diagnosticFieldsFilter && m_diagnosticFieldsFilter(getState().step + 1));
+    m_diagnosticFieldsRequested = false;
+}
+
 inline void Simulation::run()
 {
     if(m_isPaused)
         return;
 
+    const int iterations = m_stepScheduler.stepsForFrame(m_simIterations);
+
     // simulate all iterations but one
-    for(int i=0; i<m_simIterations-1; i++)
+    for(int i=0; i<iterations-1; i++)
+    {
+        // steps nobody looks at can be simulated at once by the model
+        const int quietSteps = countQuietSteps(iterations-1-i);
+        if(quietSteps > 1)
+        {
+            int stepsDone;
+            {
+                PROFILE_SCOPE("step batch");
+                PROFILE_COUNTERS("step batch", 0);
+                stepsDone = simulateBatch(quietSteps);
+            }
+            if(stepsDone > 0)
+            {
+                i += stepsDone-1;
+                continue;
+            }
+        }
+
+        prepareStep(false);
+        {
+            PROFILE_SCOPE("step");
+            PROFILE_COUNTERS("step", 0);
+            simulateOnce();
+        }
+        {
+            PROFILE_SCOPE("swap buffer");
+            PROFILE_COUNTERS("swap buffer", 0);
+            getGrid().swapBuffer();
+        }
+        if(m_stepCallback)
+        {
+            PROFILE_SCOPE("step callback");
+            PROFILE_COUNTERS("step callback", 0);
+            m_stepCallback(getGrid(), getState());
+        }
+    }
+
+    // simulate the final iteration, if it is published it is rendered so diagnostic fields are always computed
+    const bool publish = m_stepScheduler.publishDue();
+    prepareStep(publish);
     {
+        PROFILE_SCOPE("step");
+        PROFILE_COUNTERS("step", 0);
         simulateOnce();
+    }
+    if(publish)
+    {
+        PROFILE_SCOPE("swap and render");
+        PROFILE_COUNTERS("swap and render", 0);
+        getGrid().swapAndRender();
+    }
+    else
+    {
+        PROFILE_SCOPE("swap buffer");
+        PROFILE_COUNTERS("swap buffer", 0);
         getGrid().swapBuffer();
     }
+    if(m_stepCallback)
+    {
+        PROFILE_SCOPE("step callback");
+        PROFILE_COUNTERS("step callback", 0);
+        m_stepCallback(getGrid(), getState());
+    }
 
-    // simulate the final iteration
-    simulateOnce();
-    getGrid().swapAndRender();
+    m_stepScheduler.frameSimulated(iterations, getState().totalSimulatedTime);
 }
 
 inline void Simulation::showGui(bool* show)
@@ -101,7 +243,7 @@ inline void Simulation::showGui(bool* show)
         ImGui::SameLine();
         if( ImGui::Button("Reset")) reset();
 
-        ImGui::DragInt("Timesteps per Rendering",&m_simIterations,0.1);
+        m_stepScheduler.showGui(m_simIterations);
 
         ImGui::Separator();
         showSimulationOptions();
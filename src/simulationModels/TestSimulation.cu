@@ -19,6 +19,9 @@
 #include "../coordinateSystems/GeographicalCoordinates2D.h"
 #include "../finiteDifferences.h"
 #include "../boundaryConditions.h"
+#include "../semiLagrangian.h"
+#include "../stencil.h"
+#include "../LaunchTuner.h"
 //--------------------
 
 // function definitions of the TestSimulation class
@@ -33,41 +36,45 @@ void TestSimulation::showCreationOptions()
 
 void TestSimulation::showBoundaryOptions(const CoordinateSystem& cs)
 {
-    if(cs.hasBoundary().x)
+    auto boundaryTypeOptions = [this](const char* axis, BoundaryType& type, float& temperature)
     {
-        ImGui::Text("X-Axis Boundary:");
-        if(ImGui::RadioButton("Isolated##X",m_boundaryIsolatedX))
-            m_boundaryIsolatedX = true;
-
-        ImGui::SameLine();
-        if(ImGui::RadioButton("Const. temperature##X", !m_boundaryIsolatedX))
+        ImGui::PushID(axis);
+        ImGui::Text("%s-Axis Boundary:", axis);
+        const BoundaryType types[] = {BoundaryType::fixedValue, BoundaryType::zeroGradient, BoundaryType::periodic, BoundaryType::sponge};
+        int selected = static_cast<int>(std::find(std::begin(types), std::end(types), type) - std::begin(types));
+        if(ImGui::Combo("Type", &selected, "Const. temperature\0Isolated\0Periodic\0Sponge\0\0"))
+            type = types[selected];
+
+        if(type == BoundaryType::fixedValue || type == BoundaryType::sponge)
+            ImGui::DragFloat("Temperature on boundary", &temperature, 0.1);
+        if(type == BoundaryType::sponge)
         {
-            m_boundaryIsolatedX = false;
-            m_needUpdateBoundaries = true;
+            ImGui::DragInt("Sponge width", &m_spongeWidth, 0.1, 1, 256);
+            ImGui::DragFloat("Sponge strength", &m_spongeStrength, 0.001, 0.0f, 1.0f);
         }
+        ImGui::PopID();
+    };
 
-        if(!m_boundaryIsolatedX)
-            if(ImGui::DragFloat("Temperature on boundary##X", &m_boundaryTemperatureX, 0.1))
-                m_needUpdateBoundaries = true;
-    }
-
+    if(cs.hasBoundary().x)
+        boundaryTypeOptions("X", m_boundaryTypeX, m_boundaryTemperatureX);
     if(cs.hasBoundary().y)
-    {
-        ImGui::Text("Y-Axis Boundary:");
-        if(ImGui::RadioButton("Isolated##Y",m_boundaryIsolatedY))
-            m_boundaryIsolatedY = true;
-
-        ImGui::SameLine();
-        if(ImGui::RadioButton("Const. temperature##Y", !m_boundaryIsolatedY))
-        {
-            m_boundaryIsolatedY = false;
-            m_needUpdateBoundaries = true;
-        }
+        boundaryTypeOptions("Y", m_boundaryTypeY, m_boundaryTemperatureY);
+}
 
-        if(!m_boundaryIsolatedY)
-            if(ImGui::DragFloat("Temperature on boundary##Y", &m_boundaryTemperatureY, 0.1))
-                m_needUpdateBoundaries = true;
-    }
+void TestSimulation::updateBoundaryConditions()
+{
+    FaceBoundary x;
+    x.type = m_boundaryTypeX;
+    x.value = m_boundaryTemperatureX;
+    x.spongeWidth = m_spongeWidth;
+    x.spongeStrength = m_spongeStrength;
+
+    FaceBoundary y = x;
+    y.type = m_boundaryTypeY;
+    y.value = m_boundaryTemperatureY;
+
+    m_boundaries.get<AT::temperature>().setAxis(0,x);
+    m_boundaries.get<AT::temperature>().setAxis(1,y);
 }
 
 void TestSimulation::showSimulationOptions()
@@ -76,6 +83,12 @@ void TestSimulation::showSimulationOptions()
     ImGui::Checkbox("use divergence of gradient instead of laplacian",&m_useDivOfGrad);
     ImGui::Checkbox("use leapfrog (unstable)",&m_leapfrogIntegrattion);
     ImGui::Checkbox("advect heat",&m_advectHeat);
+    if(m_advectHeat)
+    {
+        int interpolation = static_cast<int>(m_advectionInterpolation);
+        if(ImGui::Combo("Advection interpolation", &interpolation, "bilinear\0monotone cubic\0\0"))
+            m_advectionInterpolation = static_cast<AdvectionInterpolation>(interpolation);
+    }
     ImGui::DragFloat("Heat Coefficient",&m_heatCoefficient,0.0001,0.0001f,1.0,"%.4f");
     ImGui::DragFloat("Timestep",&m_timestep,0.0001,0.0001f,1.0,"%.4f");
     ImGui::Text("Biggest maybe stable timestep is %f.",
@@ -89,7 +102,7 @@ void TestSimulation::showSimulationOptions()
 std::shared_ptr<GridBase> TestSimulation::recreate(std::shared_ptr<CoordinateSystem> cs)
 {
     m_cs = cs;
-    m_grid = std::make_shared<TestSimGrid>(m_cs->getNumGridCells());
+    m_grid = std::make_shared<TestSimGrid>(m_cs->getNumGridCells(), !m_headless);
     m_offsettedCurl.resize(m_cs->getNumGridCells());
 
     // select coordinate system
@@ -109,6 +122,8 @@ std::shared_ptr<GridBase> TestSimulation::recreate(std::shared_ptr<CoordinateSys
 
 void TestSimulation::reset()
 {
+    m_stepScheduler.reset();
+
     // generate some data
     std::default_random_engine rng(mpu::getRanndomSeed());
     std::normal_distribution<float> dist(10,4);
@@ -136,9 +151,16 @@ void TestSimulation::reset()
     }
 
     // initialize boundary
-    initializeFixedValueBoundaries<AT::temperature>(!m_boundaryIsolatedX && m_cs->hasBoundary().x,
-                                                    !m_boundaryIsolatedY && m_cs->hasBoundary().y,
-                                                    m_boundaryTemperatureX, m_boundaryTemperatureY, *m_cs, *m_grid);
+    updateBoundaryConditions();
+    switch(m_cs->getType())
+    {
+        case CSType::cartesian2d:
+            m_boundaries.applyOnHost(static_cast<CartesianCoordinates2D&>(*m_cs), *m_grid);
+            break;
+        case CSType::geographical2d:
+            m_boundaries.applyOnHost(static_cast<GeographicalCoordinates2D&>(*m_cs), *m_grid);
+            break;
+    }
 
     // swap buffers and ready for rendering
     m_grid->pushCachToDevice();
@@ -146,8 +168,8 @@ void TestSimulation::reset()
 
     // reset simulation state
     m_totalSimulatedTime = 0;
+    m_step = 0;
     m_firstTimestep = true;
-    m_needUpdateBoundaries = false;
 }
 
 std::unique_ptr<Simulation> TestSimulation::clone() const
@@ -155,14 +177,58 @@ std::unique_ptr<Simulation> TestSimulation::clone() const
     return std::make_unique<TestSimulation>(*this);
 }
 
+SimulationState TestSimulation::getState() const
+{
+    SimulationState state;
+    state.totalSimulatedTime = m_totalSimulatedTime;
+    state.step = m_step;
+    state.firstTimestep = m_firstTimestep;
+    return state;
+}
+
+void TestSimulation::setState(const SimulationState& state)
+{
+    m_totalSimulatedTime = static_cast<float>(state.totalSimulatedTime);
+    m_step = state.step;
+    m_firstTimestep = state.firstTimestep;
+}
+
+std::vector<ModelParameter> TestSimulation::getParameters() const
+{
+    return {{"timestep", m_timestep},
+            {"heat coefficient", m_heatCoefficient},
+            {"boundary type x", float(static_cast<int>(m_boundaryTypeX))},
+            {"boundary temperature x", m_boundaryTemperatureX},
+            {"boundary type y", float(static_cast<int>(m_boundaryTypeY))},
+            {"boundary temperature y", m_boundaryTemperatureY},
+            {"sponge width", float(m_spongeWidth)},
+            {"sponge strength", m_spongeStrength}};
+}
+
+void TestSimulation::setParameters(const std::vector<ModelParameter>& parameters)
+{
+    for(const auto& p : parameters)
+    {
+        if(p.name == "timestep") m_timestep = p.value;
+        else if(p.name == "heat coefficient") m_heatCoefficient = p.value;
+        else if(p.name == "boundary type x") m_boundaryTypeX = static_cast<BoundaryType>(static_cast<int>(p.value));
+        else if(p.name == "boundary temperature x") m_boundaryTemperatureX = p.value;
+        else if(p.name == "boundary type y") m_boundaryTypeY = static_cast<BoundaryType>(static_cast<int>(p.value));
+        else if(p.name == "boundary temperature y") m_boundaryTemperatureY = p.value;
+        else if(p.name == "sponge width") m_spongeWidth = static_cast<int>(p.value);
+        else if(p.name == "sponge strength") m_spongeStrength = p.value;
+    }
+    updateBoundaryConditions();
+}
+
 void TestSimulation::simulateOnce()
 {
     m_simOnceFunc(); // calls correct template specialization
 }
 
+// computes the diagnostic fields, only launched on steps that need them
 template <typename csT>
-__global__ void testSimulationA(TestSimGrid::ReferenceType grid, csT coordinateSystem, mpu::VectorReference<float> offsettedCurl,
-        bool diffuseHeat, bool advectHeat, float heatCoefficient, bool useDivOfGrad, float timestep)
+__global__ void testSimulationA(TestSimGrid::ReferenceType grid, csT coordinateSystem, mpu::VectorReference<float> offsettedCurl)
 {
     csT cs = coordinateSystem;
 
@@ -171,7 +237,6 @@ __global__ void testSimulationA(TestSimGrid::ReferenceType grid, csT coordinateS
     {
         int3 cell{x,y,0};
         int cellId = cs.getCellId(cell);
-        float2 cellPos = make_float2( cs.getCellCoordinate3d(cell) );
 
         // do bounds checking
         int3 leftNeigbour = cs.getCellId3d(cs.getRightNeighbor(cellId));
@@ -193,68 +258,46 @@ __global__ void testSimulationA(TestSimGrid::ReferenceType grid, csT coordinateS
         if(oob(forwardNeigbor))
             printf("Forward neighbor out of bounds! cell (%i,%i) \n",x,y);
 
-        float rho = grid.read<AT::density>(cellId);
-        float velX = grid.read<AT::velocityX>(cellId);
-        float velY = grid.read<AT::velocityY>(cellId);
+        // all neighborhoods are loaded once, the operators only read from registers
+        StencilPoint<csT> p(cs, cell);
+        auto rho = field<AT::density>(grid, p);
+        auto velX = fieldX<AT::velocityX>(grid, p);
+        auto velY = fieldY<AT::velocityY>(grid, p);
+        auto temp = field<AT::temperature>(grid, p);
 
         // calculate gradient using central difference
         // since we use the density at at i and i+1 we get the gradient halfway in between the cells,
         // on the edge between cell i and i+1
-        float rhoRight     = grid.read<AT::density>(cs.getRightNeighbor(cellId));
-        float rhoForward   = grid.read<AT::density>(cs.getForwardNeighbor(cellId));
-
-        float2 gradRho = gradient2d(rho, rhoRight, rho, rhoForward, cellPos, cs);
-
-        grid.write<AT::densityGradX>(cellId, gradRho.x);
-        grid.write<AT::densityGradY>(cellId, gradRho.y);
+        grid.write<AT::densityGradX>(cellId, evaluate<1,0>(ddx(rho), p));
+        grid.write<AT::densityGradY>(cellId, evaluate<0,1>(ddy(rho), p));
 
         // calculate divergence of the velocity field
         // remember, velocities are defined half way between the nodes,
         // we want the divergence at the node, so we get a central difference by looking at the velocities left and backwards from us
         // and compare them to our velocities
-        float velLeftX = grid.read<AT::velocityX>(cs.getLeftNeighbor(cellId));
-        float velBackwardY = grid.read<AT::velocityY>(cs.getBackwardNeighbor(cellId));
-
-        float velDiv = divergence2d(velLeftX,velX,velBackwardY,velY,cellPos,cs);
-
-        grid.write<AT::velocityDiv>(cellId, velDiv);
+        grid.write<AT::velocityDiv>(cellId, evaluate(div(velX, velY), p));
 
         // laplace
-        float rhoLeft     = grid.read<AT::density>(cs.getLeftNeighbor(cellId));
-        float rhoBackward   = grid.read<AT::density>(cs.getBackwardNeighbor(cellId));
-
-        float laplace = laplace2d(rhoLeft,rhoRight,rhoBackward,rhoForward,rho,cellPos,cs);
-
-        grid.write<AT::densityLaplace>(cellId, laplace);
+        grid.write<AT::densityLaplace>(cellId, evaluate(laplace(rho), p));
 
         // curl is more difficult, as we can only compute it at cell corners
         // offsetted from where we want to visualize it
         // so we need to compute 4 curls and average them
 
-        // forward right quadrant
-        float velRightY = grid.read<AT::velocityY>(cs.getRightNeighbor(cellId));
-        float velForwardX = grid.read<AT::velocityX>(cs.getForwardNeighbor(cellId));
-
-        float forwardRightCurl = curl2d(velY,velRightY, velX, velForwardX,cellPos,cs);
+        // forward right quadrant, metric terms are taken at the latitude of the corner
         // averaging is done in the next kernel
-        offsettedCurl[cellId] = forwardRightCurl;
+        offsettedCurl[cellId] = evaluate<1,1>(curl(velX, velY), p);
 
         // temperature gradient
-
-        float temp = grid.read<AT::temperature>(cellId);
-        float tempRight = grid.read<AT::temperature>(cs.getRightNeighbor(cellId));
-        float tempForward = grid.read<AT::temperature>(cs.getForwardNeighbor(cellId));
-
-        float2 tempGrad = gradient2d(temp,tempRight,temp,tempForward,cellPos,cs);
-
-        grid.write<AT::temperatureGradX>(cellId,tempGrad.x);
-        grid.write<AT::temperatureGradY>(cellId,tempGrad.y);
+        grid.write<AT::temperatureGradX>(cellId, evaluate<1,0>(ddx(temp), p));
+        grid.write<AT::temperatureGradY>(cellId, evaluate<0,1>(ddy(temp), p));
     }
 }
 
 template <typename csT>
 __global__ void testSimulationB(TestSimGrid::ReferenceType grid, csT coordinateSystem, mpu::VectorReference<const float> offsettedCurl,
-                                bool useLeapfrog, bool diffuseHeat, bool advectHeat, float heatCoefficient, bool useDivOfGrad, float timestep)
+                                bool computeDiagnostics, bool useLeapfrog, bool diffuseHeat, bool advectHeat,
+                                AdvectionInterpolation interpolation, float heatCoefficient, bool useDivOfGrad, float timestep)
 {
     csT cs = coordinateSystem;
 
@@ -263,18 +306,20 @@ __global__ void testSimulationB(TestSimGrid::ReferenceType grid, csT coordinateS
         {
             int3 cell{x,y,0};
             int cellId = cs.getCellId(cell);
-            float2 cellPos = make_float2( cs.getCellCoordinate3d(cell) );
 
-            // only forward right curl was computed above, so now curl must be interpolated
-            float curlForwardRight = offsettedCurl[cellId];
-            float curlForwardLeft = offsettedCurl[cs.getLeftNeighbor(cellId)];
-            float curlBackwardsRight = offsettedCurl[cs.getBackwardNeighbor(cellId)];
-            float curlBackwardsLeft = offsettedCurl[cs.getLeftNeighbor(cs.getBackwardNeighbor(cellId))];
+            if(computeDiagnostics)
+            {
+                // only forward right curl was computed above, so now curl must be interpolated
+                float curlForwardRight = offsettedCurl[cellId];
+                float curlForwardLeft = offsettedCurl[cs.getLeftNeighbor(cellId)];
+                float curlBackwardsRight = offsettedCurl[cs.getBackwardNeighbor(cellId)];
+                float curlBackwardsLeft = offsettedCurl[cs.getLeftNeighbor(cs.getBackwardNeighbor(cellId))];
 
-            float averageCurl = curlForwardRight + curlForwardLeft + curlBackwardsRight + curlBackwardsLeft;
-            averageCurl *= 0.25;
+                float averageCurl = curlForwardRight + curlForwardLeft + curlBackwardsRight + curlBackwardsLeft;
+                averageCurl *= 0.25;
 
-            grid.write<AT::velocityCurl>(cellId, averageCurl);
+                grid.write<AT::velocityCurl>(cellId, averageCurl);
+            }
 
             // solve the heat equation
             if(diffuseHeat || advectHeat)
@@ -284,41 +329,31 @@ __global__ void testSimulationB(TestSimGrid::ReferenceType grid, csT coordinateS
 
                 if(diffuseHeat)
                 {
-                    float tempGradX = grid.readNext<AT::temperatureGradX>(cellId);
-                    float tempGradY = grid.readNext<AT::temperatureGradY>(cellId);
-                    float tempGradXLeft = grid.readNext<AT::temperatureGradX>(cs.getLeftNeighbor(cellId));
-                    float tempGradYBack = grid.readNext<AT::temperatureGradY>(cs.getBackwardNeighbor(cellId));
-
-                    float heatDivGrad = divergence2d(tempGradXLeft, tempGradX, tempGradYBack, tempGradY, cellPos, cs);
-
-                    float tempLeft = grid.read<AT::temperature>(cs.getLeftNeighbor(cellId));
-                    float tempRight = grid.read<AT::temperature>(cs.getRightNeighbor(cellId));
-                    float tempForward = grid.read<AT::temperature>(cs.getForwardNeighbor(cellId));
-                    float tempBackward = grid.read<AT::temperature>(cs.getBackwardNeighbor(cellId));
-
-                    float heatLaplace = laplace2d(tempLeft,tempRight,tempBackward,tempForward,temp,cellPos,cs);
+                    // divergence of the gradient is fused, no need for the gradient computed in the first kernel
+                    StencilPoint<csT> p(cs, cell);
+                    auto T = field<AT::temperature>(grid, p);
 
                     if(useDivOfGrad)
-                        temp_dt += heatCoefficient * heatDivGrad;
+                        temp_dt += heatCoefficient * evaluate(div(grad(T)), p);
                     else
-                        temp_dt += heatCoefficient *heatLaplace;
+                        temp_dt += heatCoefficient * evaluate(laplace(T), p);
                 }
 
+                float previousTemp;
                 if(advectHeat)
                 {
-                    temp_dt -= grid.readNext<AT::velocityDiv>(cellId) * temp;
+                    // semi-lagrangian advection, start from the value at the departure point
+                    // with leapfrog we go from t-1 over two timesteps
+                    float2 departure = departurePoint(grid, make_float2(x,y), useLeapfrog ? 2.0f*timestep : timestep, cs);
+                    previousTemp = sampleGrid<AT::temperature>(grid, departure, make_float2(0.0f,0.0f), cs, interpolation, useLeapfrog);
                 }
-
-                float previousTemp;
-                if(useLeapfrog)
-                {
+                else if(useLeapfrog)
                     previousTemp = grid.readPrev<AT::temperature>(cellId);
-                    timestep *=2.0f;
-                }
                 else
-                {
                     previousTemp = temp;
-                }
+
+                if(useLeapfrog)
+                    timestep *=2.0f;
 
                 float nextTemp =  previousTemp + temp_dt * timestep;
                 grid.write<AT::temperature>(cellId,nextTemp);
@@ -331,31 +366,50 @@ __global__ void testSimulationB(TestSimGrid::ReferenceType grid, csT coordinateS
 template <typename csT>
 void TestSimulation::simulateOnceImpl(csT& cs)
 {
-    dim3 blocksize{16,16,1};
-    dim3 numBlocks{ static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().x ,blocksize.x)),
-                    static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().y ,blocksize.y)), 1};
-
-    if(m_needUpdateBoundaries)
+    auto numBlocksFor = [&cs](dim3 blocksize)
     {
-//        m_grid->cacheOnHost();
-        initializeFixedValueBoundaries<AT::temperature>(!m_boundaryIsolatedX && m_cs->hasBoundary().x,
-                                                        !m_boundaryIsolatedY && m_cs->hasBoundary().y,
-                                                        m_boundaryTemperatureX, m_boundaryTemperatureY, *m_cs, *m_grid);
-//        m_grid->pushCachToDevice();
-    }
+        return dim3{ static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().x ,blocksize.x)),
+                     static_cast<unsigned int>(mpu::numBlocks( cs.getNumGridCells3d().y ,blocksize.y)), 1};
+    };
 
-    handleMirroredBoundaries<AT::temperature>(m_boundaryIsolatedX && cs.hasBoundary().x,
-                                              m_boundaryIsolatedY && cs.hasBoundary().y,
-                                              cs, *m_grid);
+    updateBoundaryConditions();
 
-    if(m_diffuseHeat)
+    if(m_diffuseHeat || m_advectHeat)
         m_totalSimulatedTime += m_timestep;
 
-    testSimulationA<<< numBlocks, blocksize>>>(m_grid->getGridReference(),cs,m_offsettedCurl.getVectorReference(),
-            m_diffuseHeat,m_advectHeat,m_heatCoefficient,m_useDivOfGrad,m_timestep);
-    testSimulationB<<< numBlocks, blocksize>>>(m_grid->getGridReference(),cs,m_offsettedCurl.getVectorReference(),
-            !m_firstTimestep && m_leapfrogIntegrattion,m_diffuseHeat,m_advectHeat,m_heatCoefficient,m_useDivOfGrad,m_timestep);
+    const int64_t cells = cs.getNumGridCells();
+    const bool computeDiagnostics = diagnosticFieldsDue();
+
+    // kernels read time levels t and t-1 and write t+1, so they can be launched repeatedly while tuning
+    auto launchA = [&](dim3 blocksize)
+    {
+        testSimulationA<<< numBlocksFor(blocksize), blocksize>>>(m_grid->getGridReference(),cs,m_offsettedCurl.getVectorReference());
+    };
+    auto launchB = [&](dim3 blocksize)
+    {
+        testSimulationB<<< numBlocksFor(blocksize), blocksize>>>(m_grid->getGridReference(),cs,m_offsettedCurl.getVectorReference(),
+                computeDiagnostics, !m_firstTimestep && m_leapfrogIntegrattion,m_diffuseHeat,m_advectHeat,m_advectionInterpolation,m_heatCoefficient,m_useDivOfGrad,m_timestep);
+    };
+
+    if(computeDiagnostics)
+    {
+        const dim3 blocksize = LaunchTuner::instance().blockSize("testSimulationA", cs.getNumGridCells3d(), LaunchTuner::candidates2d(), launchA);
+        PROFILE_GPU_SCOPE("test simulation A", cells);
+        launchA(blocksize);
+    }
+    {
+        const dim3 blocksize = LaunchTuner::instance().blockSize("testSimulationB", cs.getNumGridCells3d(), LaunchTuner::candidates2d(), launchB);
+        PROFILE_GPU_SCOPE("test simulation B", cells);
+        launchB(blocksize);
+    }
+
+    // boundary cells of all attributes in one pass
+    {
+        PROFILE_GPU_SCOPE("boundaries", cells);
+        m_boundaries.apply(cs, *m_grid);
+    }
 
+    m_step++;
     m_firstTimestep = false;
 }
 
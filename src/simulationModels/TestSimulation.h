@@ -17,6 +17,7 @@
 // includes
 //--------------------
 #include "Simulation.h"
+#include "../boundaryConditions.h"
 //--------------------
 
 //-------------------------------------------------------------------
@@ -36,6 +37,12 @@ public:
     void reset() override;
     std::unique_ptr<Simulation> clone() const override;
 
+    SimModel getModelType() const override {return SimModel::testSimulation;}
+    SimulationState getState() const override;
+    void setState(const SimulationState& state) override;
+    std::vector<ModelParameter> getParameters() const override;
+    void setParameters(const std::vector<ModelParameter>& parameters) override;
+
 private:
     void showSimulationOptions() override;
     void simulateOnce() override;
@@ -51,17 +58,23 @@ private:
     float2 m_vectorValue;
 
     // boundary settings
-    bool m_boundaryIsolatedX{false};
+    BoundaryType m_boundaryTypeX{BoundaryType::fixedValue};
     float m_boundaryTemperatureX{6.0f};
-    bool m_boundaryIsolatedY{false};
+    BoundaryType m_boundaryTypeY{BoundaryType::fixedValue};
     float m_boundaryTemperatureY{6.0f};
+    int m_spongeWidth{8};
+    float m_spongeStrength{0.1f};
+    BoundaryConditions<AT::temperature> m_boundaries; //!< boundary conditions build from the above settings
+    void updateBoundaryConditions(); //!< rebuild m_boundaries from the boundary settings
 
     // sim options
     bool m_diffuseHeat{false};
-    bool m_advectHeat{false};
+    bool m_advectHeat{false}; //!< semi-lagrangian advection of the temperature, not limited by the advective CFL condition
+    AdvectionInterpolation m_advectionInterpolation{AdvectionInterpolation::monotoneCubic}; //!< interpolation at the departure points
     float m_heatCoefficient{0.01f};
     float m_timestep{0.001f}; // 0.006
     float m_totalSimulatedTime{0.0f};
+    int m_step{0}; //!< number of timesteps since the last reset
     bool m_useDivOfGrad{false};
     bool m_leapfrogIntegrattion{false};
 
@@ -71,7 +84,6 @@ private:
 
     mpu::DeviceVector<float> m_offsettedCurl; //!< offsetted curl is moved from kernel A to kernel B using this buffer
     bool m_firstTimestep{true};
-    bool m_needUpdateBoundaries{false};
 };
 
 
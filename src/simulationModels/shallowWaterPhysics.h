@@ -0,0 +1,148 @@
+/*
+ * CIRCULATION
+ * shallowWaterPhysics.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * per cell computations of the shallow water equations on the C grid,
+ * shared by the ShallowWaterModel and the ShallowWaterEnsemble
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+#ifndef CIRCULATION_SHALLOWWATERPHYSICS_H
+#define CIRCULATION_SHALLOWWATERPHYSICS_H
+
+// includes
+//--------------------
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+#include "../enums.h"
+#include "../finiteDifferences.h"
+//--------------------
+
+/**
+ * @brief parameters of the shallow water equations that can be different for every ensemble member
+ */
+struct ShallowWaterParameters
+{
+    float timestep; //!< simulation timestep
+    float diffusion; //!< geopotential diffusion
+    float corOrAngvel; //!< coriolis parameter for cartesian and angular velocity for geographical coordinates
+};
+
+/**
+ * @brief values around a cell needed for the first half of a timestep
+ */
+struct ShallowWaterStencilA
+{
+    float phi; //!< geopotential at the cell center
+    float phiLeft, phiRight, phiBack, phiFor; //!< geopotential of the neighbouring cells
+    float velLeftX, velRightX, velBackY, velForY; //!< velocities on the faces of the cell
+    float velForX, velRightY; //!< velocities needed for the vorticity at the forward right corner
+    float prevPhi; //!< geopotential at t-1, only used with leapfrog
+};
+
+/**
+ * @brief results of the first half of a timestep for one cell
+ */
+struct ShallowWaterResultA
+{
+    float kinEnergy; //!< kinetic energy per unit mass at the cell center
+    float vort; //!< relative vorticity at the forward right corner
+    float vortPlusCor; //!< absolute vorticity at the forward right corner
+    float nextPhi; //!< geopotential at t+1
+};
+
+/**
+ * @brief values around a cell needed for the second half of a timestep
+ */
+struct ShallowWaterStencilB
+{
+    float phiK, phiKRight, phiKForward; //!< geopotential + kinetic energy of the cell and its neighbours
+    float vortCor, vortCorLeft, vortCorBack; //!< absolute vorticity of the cell and its neighbours
+    float velX, velY; //!< velocities on the right and forward face at t
+    float prevVelX, prevVelY; //!< velocities on the right and forward face at t-1, only used with leapfrog
+};
+
+/**
+ * @brief computes kinetic energy, vorticity and the geopotential at t+1 for one cell
+ * @param s values around the cell
+ * @param cellPos position of the cell center
+ * @param cs the coordinate system
+ * @param p parameters of the equations
+ * @param useLeapfrog use leapfrog instead of forward euler integration
+ */
+template <typename csT>
+CUDAHOSTDEV inline ShallowWaterResultA shallowWaterStepA(const ShallowWaterStencilA& s, const float2& cellPos, const csT& cs,
+                                                         const ShallowWaterParameters& p, bool useLeapfrog)
+{
+    ShallowWaterResultA r;
+
+    // compute kinetic energy per unit mass
+    const float velX = (s.velLeftX + s.velRightX) * 0.5f;
+    const float velY = (s.velForY + s.velBackY) * 0.5f;
+    r.kinEnergy = (velX * velX + velY * velY) * 0.5f;
+
+    // calculate vorticity and coriolis parameter
+    // if this looks strange consider where values are located on the C grid
+    const float2 vortPos = cellPos + 0.5f * make_float2(cs.getCellSize()); // position where vorticity is computed
+    r.vort = curl2d(s.velForY, s.velRightY, s.velRightX, s.velForX, vortPos, cs);
+    float cor;
+    if(cs.getType() == CSType::geographical2d)
+        cor = 2*p.corOrAngvel*sin(vortPos.y);
+    else if(cs.getType() == CSType::cartesian2d)
+        cor = p.corOrAngvel;
+    else
+        cor = 0.0f;
+    r.vortPlusCor = r.vort + cor;
+
+    // compute geopotential advection time derivative dPhi/dt
+    float phiHalfLeft = (s.phi+s.phiLeft)*0.5;
+    float phiHalfRight = (s.phi+s.phiRight)*0.5;
+    float phiHalfBack = (s.phi+s.phiBack)*0.5;
+    float phiHalfFor = (s.phi+s.phiFor)*0.5;
+    float dphi_dt = -divergence2d( s.velLeftX*phiHalfLeft, s.velRightX*phiHalfRight, s.velBackY*phiHalfBack, s.velForY*phiHalfFor, cellPos, cs);
+
+    if(p.diffusion > 0)
+    {
+        // compute geopotential diffusion
+        const float lapphi = laplace2d(s.phiLeft,s.phiRight,s.phiBack,s.phiFor,s.phi,cellPos,cs);
+        dphi_dt += p.diffusion * lapphi;
+    }
+
+    // compute values at t+1
+    if(useLeapfrog)
+        r.nextPhi = s.prevPhi + dphi_dt * 2.0f*p.timestep;
+    else
+        r.nextPhi = s.phi + dphi_dt * p.timestep;
+
+    return r;
+}
+
+/**
+ * @brief computes the velocities at t+1 on the right and forward face of one cell
+ * @param s values around the cell
+ * @param cellPos position of the cell center
+ * @param cs the coordinate system
+ * @param timestep the simulation timestep
+ * @param useLeapfrog use leapfrog instead of forward euler integration
+ */
+template <typename csT>
+CUDAHOSTDEV inline float2 shallowWaterStepB(const ShallowWaterStencilB& s, const float2& cellPos, const csT& cs,
+                                            float timestep, bool useLeapfrog)
+{
+    // compute dvX/dt and dvY/dt
+    const float2 gradPhiK = gradient2d(s.phiK,s.phiKRight,s.phiK,s.phiKForward,cellPos,cs);
+    const float dvX_dt = (s.vortCor+s.vortCorBack)*0.5f*s.velY -gradPhiK.x;
+    const float dvY_dt = -(s.vortCor+s.vortCorLeft)*0.5f*s.velX -gradPhiK.y;
+
+    // compute values at t+1
+    if(useLeapfrog)
+        return float2{ s.prevVelX + dvX_dt * 2.0f*timestep, s.prevVelY + dvY_dt * 2.0f*timestep };
+    else
+        return float2{ s.velX + dvX_dt * timestep, s.velY + dvY_dt * timestep };
+}
+
+#endif //CIRCULATION_SHALLOWWATERPHYSICS_H
@@ -0,0 +1,403 @@
+/*
+ * CIRCULATION
+ * stencil.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+#ifndef CIRCULATION_STENCIL_H
+#define CIRCULATION_STENCIL_H
+
+// includes
+//--------------------
+#include <type_traits>
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+#include "coordinateSystems/GeographicalCoordinates2D.h"
+#include "Grid.h"
+//--------------------
+
+/*
+ * Finite difference operators as expression templates, so composite operators like div(grad(T)) are evaluated directly
+ * from the loaded values without writing intermediate results to the grid.
+ *
+ * usage:
+ * Create a StencilPoint for the cell, load the attributes needed with field(), fieldX() or fieldY() and combine them
+ * with the operators below. Call evaluate<ox,oy>() to compute the expression at an offset from the cell center given in
+ * half cells, eg (0,0) at the cell center, (1,0) on the right face and (1,1) at the forward right corner.
+ *
+ *  StencilPoint<csT> p(cs, cell);
+ *  auto T = field<AT::temperature>(grid, p);
+ *  float heatDivGrad = evaluate(div(grad(T)), p);
+ *  float cornerCurl = evaluate<1,1>(curl(fieldX<AT::velocityX>(grid,p), fieldY<AT::velocityY>(grid,p)), p);
+ *
+ * Loading an attribute reads its 3x3 neighborhood once into registers, the expression only reads from there. Offsets
+ * are compile time constants, so all index math is resolved by the compiler and unused loads are removed. An expression
+ * can reach at most one cell from the center, operators that need more fail to compile.
+ * Differences are taken over one cell, as in finiteDifferences.h. Metric terms of the coordinate system are
+ * evaluated at the latitude of the offset where the operator is applied.
+ * Stencils read neighbors of the cell, so only evaluate them on cells which are not part of the boundary.
+ */
+
+//-------------------------------------------------------------------
+// metric of the coordinate system
+
+/**
+ * @brief factor that turns a difference over one cell along the first axis into a derivative
+ */
+template <typename csT>
+CUDAHOSTDEV inline float stencilScaleX(float latitude, const csT& cs)
+{
+    static_assert(csT::isCartesian, "This overload only works for cartesian coordinates.");
+    return 1.0f / cs.getCellSize().x;
+}
+
+template <>
+CUDAHOSTDEV inline float stencilScaleX<GeographicalCoordinates2D>(float latitude, const GeographicalCoordinates2D& cs)
+{
+    return 1.0f / (cs.getMinCoord().z * cos(latitude) * cs.getCellSize().x);
+}
+
+/**
+ * @brief factor that turns a difference over one cell along the second axis into a derivative
+ */
+template <typename csT>
+CUDAHOSTDEV inline float stencilScaleY(float latitude, const csT& cs)
+{
+    static_assert(csT::isCartesian, "This overload only works for cartesian coordinates.");
+    return 1.0f / cs.getCellSize().y;
+}
+
+template <>
+CUDAHOSTDEV inline float stencilScaleY<GeographicalCoordinates2D>(float latitude, const GeographicalCoordinates2D& cs)
+{
+    return 1.0f / (cs.getMinCoord().z * cs.getCellSize().y);
+}
+
+/**
+ * @brief factor of the first derivative along the second axis in the laplace operator, zero in cartesian coordinates
+ */
+template <typename csT>
+CUDAHOSTDEV inline float stencilLaplaceMetric(float latitude, const csT& cs)
+{
+    static_assert(csT::isCartesian, "This overload only works for cartesian coordinates.");
+    return 0.0f;
+}
+
+template <>
+CUDAHOSTDEV inline float stencilLaplaceMetric<GeographicalCoordinates2D>(float latitude, const GeographicalCoordinates2D& cs)
+{
+    return sin(latitude) / (cos(latitude) * cs.getMinCoord().z * cs.getMinCoord().z);
+}
+
+/**
+ * @brief length of the cell faces normal to the second axis relative to the cartesian case, used by div and curl
+ */
+template <typename csT>
+CUDAHOSTDEV inline float stencilFaceWeight(float latitude, const csT& cs)
+{
+    static_assert(csT::isCartesian, "This overload only works for cartesian coordinates.");
+    return 1.0f;
+}
+
+template <>
+CUDAHOSTDEV inline float stencilFaceWeight<GeographicalCoordinates2D>(float latitude, const GeographicalCoordinates2D& cs)
+{
+    return cos(latitude);
+}
+
+//-------------------------------------------------------------------
+/**
+ * @brief the cell a stencil is evaluated at, knows the ids of all neighbors and the location of the cell
+ */
+template <typename csT>
+struct StencilPoint
+{
+    CUDAHOSTDEV StencilPoint(const csT& coordinateSystem, const int3& cell)
+        : cs(coordinateSystem), latitude(coordinateSystem.getCellCoordinate3d(cell).y)
+    {
+        const int center = cs.getCellId(cell);
+        ids[1][1] = center;
+        ids[1][0] = cs.getLeftNeighbor(center);
+        ids[1][2] = cs.getRightNeighbor(center);
+        for(int i = 0; i < 3; i++)
+        {
+            ids[0][i] = cs.getBackwardNeighbor(ids[1][i]);
+            ids[2][i] = cs.getForwardNeighbor(ids[1][i]);
+        }
+    }
+
+    CUDAHOSTDEV float latitudeAt(int halfCellsY) const {return latitude + 0.5f * halfCellsY * cs.getCellSize().y;} //!< latitude at an offset from the cell center
+    CUDAHOSTDEV int cellId() const {return ids[1][1];} //!< id of the cell itself
+
+    const csT& cs; //!< the coordinate system
+    float latitude; //!< second coordinate of the cell center
+    int ids[3][3]; //!< ids of the neighborhood, ids[1+dy][1+dx]
+};
+
+//-------------------------------------------------------------------
+// expressions
+
+//!< true for types that define StencilTag, which all stencil expressions do
+template <typename T, typename = void>
+struct isStencilExpression : std::false_type {};
+template <typename T>
+struct isStencilExpression<T, typename T::StencilTag> : std::true_type {};
+
+/**
+ * @brief values of attribute Param in the neighborhood of a cell, the value of cell (i,j) is located at (2i+sx, 2j+sy) half cells
+ */
+template <AT Param, int sx, int sy>
+struct StencilField
+{
+    using StencilTag = void;
+
+    template <int ox, int oy, typename csT>
+    CUDAHOSTDEV float at(const StencilPoint<csT>& p) const
+    {
+        static_assert((ox - sx) % 2 == 0 && (oy - sy) % 2 == 0, "Attribute is not defined at this offset, apply an operator first.");
+        static_assert((ox - sx) / 2 >= -1 && (ox - sx) / 2 <= 1 && (oy - sy) / 2 >= -1 && (oy - sy) / 2 <= 1,
+                      "Stencil expression reaches more than one cell from the center.");
+        return values[1 + (oy - sy) / 2][1 + (ox - sx) / 2];
+    }
+
+    float values[3][3]; //!< values[1+dy][1+dx]
+};
+
+/**
+ * @brief derivative along the first axis, difference over one cell
+ */
+template <typename E>
+struct StencilDdx
+{
+    using StencilTag = void;
+
+    template <int ox, int oy, typename csT>
+    CUDAHOSTDEV float at(const StencilPoint<csT>& p) const
+    {
+        return stencilScaleX(p.latitudeAt(oy), p.cs) * (e.template at<ox+1,oy>(p) - e.template at<ox-1,oy>(p));
+    }
+
+    E e;
+};
+
+/**
+ * @brief derivative along the second axis, difference over one cell
+ */
+template <typename E>
+struct StencilDdy
+{
+    using StencilTag = void;
+
+    template <int ox, int oy, typename csT>
+    CUDAHOSTDEV float at(const StencilPoint<csT>& p) const
+    {
+        return stencilScaleY(p.latitudeAt(oy), p.cs) * (e.template at<ox,oy+1>(p) - e.template at<ox,oy-1>(p));
+    }
+
+    E e;
+};
+
+/**
+ * @brief divergence of the vector field (x,y)
+ */
+template <typename X, typename Y>
+struct StencilDiv
+{
+    using StencilTag = void;
+
+    template <int ox, int oy, typename csT>
+    CUDAHOSTDEV float at(const StencilPoint<csT>& p) const
+    {
+        const float lat = p.latitudeAt(oy);
+        const float dy = stencilFaceWeight(p.latitudeAt(oy+1), p.cs) * y.template at<ox,oy+1>(p)
+                         - stencilFaceWeight(p.latitudeAt(oy-1), p.cs) * y.template at<ox,oy-1>(p);
+        return stencilScaleX(lat, p.cs) * (x.template at<ox+1,oy>(p) - x.template at<ox-1,oy>(p))
+               + stencilScaleY(lat, p.cs) / stencilFaceWeight(lat, p.cs) * dy;
+    }
+
+    X x;
+    Y y;
+};
+
+/**
+ * @brief curl (vertical component) of the vector field (x,y)
+ *  The metric is taken at the latitude of the offset and the face weights at the latitudes where x is stored.
+ *  Evaluated at a corner of a staggered grid this differs from curl2d() in finiteDifferences.h called with the cell
+ *  center: curl2d() puts the metric half a cell backward of the corner and weights x with the cosine half a cell away from
+ *  where it is stored, the relative difference is about tan(latitude) * cellSize.y / 2.
+ */
+template <typename X, typename Y>
+struct StencilCurl
+{
+    using StencilTag = void;
+
+    template <int ox, int oy, typename csT>
+    CUDAHOSTDEV float at(const StencilPoint<csT>& p) const
+    {
+        const float lat = p.latitudeAt(oy);
+        const float dx = stencilFaceWeight(p.latitudeAt(oy+1), p.cs) * x.template at<ox,oy+1>(p)
+                         - stencilFaceWeight(p.latitudeAt(oy-1), p.cs) * x.template at<ox,oy-1>(p);
+        return stencilScaleX(lat, p.cs) * (y.template at<ox+1,oy>(p) - y.template at<ox-1,oy>(p))
+               - stencilScaleY(lat, p.cs) / stencilFaceWeight(lat, p.cs) * dx;
+    }
+
+    X x;
+    Y y;
+};
+
+/**
+ * @brief laplace operator from second differences, same discretization as laplace2d() in finiteDifferences.h
+ */
+template <typename E>
+struct StencilLaplace
+{
+    using StencilTag = void;
+
+    template <int ox, int oy, typename csT>
+    CUDAHOSTDEV float at(const StencilPoint<csT>& p) const
+    {
+        const float lat = p.latitudeAt(oy);
+        const float sx = stencilScaleX(lat, p.cs);
+        const float sy = stencilScaleY(lat, p.cs);
+        const float center = e.template at<ox,oy>(p);
+        const float backward = e.template at<ox,oy-2>(p);
+        const float forward = e.template at<ox,oy+2>(p);
+        return sx * sx * (e.template at<ox-2,oy>(p) - 2.0f * center + e.template at<ox+2,oy>(p))
+               + sy * sy * (backward - 2.0f * center + forward)
+               + stencilLaplaceMetric(lat, p.cs) * (forward - backward) / (2.0f * p.cs.getCellSize().y);
+    }
+
+    E e;
+};
+
+/**
+ * @brief element wise combination of two expressions or an expression and a constant
+ */
+template <typename A, typename B, typename Op>
+struct StencilBinary
+{
+    using StencilTag = void;
+
+    template <int ox, int oy, typename csT>
+    CUDAHOSTDEV float at(const StencilPoint<csT>& p) const
+    {
+        return Op::apply(valueAt<ox,oy>(a,p), valueAt<ox,oy>(b,p));
+    }
+
+    template <int ox, int oy, typename T, typename csT>
+    CUDAHOSTDEV static float valueAt(const T& t, const StencilPoint<csT>& p, std::true_type) {return t.template at<ox,oy>(p);}
+    template <int ox, int oy, typename T, typename csT>
+    CUDAHOSTDEV static float valueAt(const T& t, const StencilPoint<csT>& p, std::false_type) {return t;}
+    template <int ox, int oy, typename T, typename csT>
+    CUDAHOSTDEV static float valueAt(const T& t, const StencilPoint<csT>& p) {return valueAt<ox,oy>(t, p, isStencilExpression<T>{});}
+
+    A a;
+    B b;
+};
+
+struct StencilAdd { CUDAHOSTDEV static float apply(float a, float b) {return a + b;} };
+struct StencilSubtract { CUDAHOSTDEV static float apply(float a, float b) {return a - b;} };
+struct StencilMultiply { CUDAHOSTDEV static float apply(float a, float b) {return a * b;} };
+
+/**
+ * @brief pair of expressions that form a vector field, x and y can be located at different offsets
+ */
+template <typename X, typename Y>
+struct StencilVector
+{
+    X x;
+    Y y;
+};
+
+//-------------------------------------------------------------------
+// loading attributes
+
+/**
+ * @brief load attribute Param in the neighborhood of p, values are stored at the cell centers
+ */
+template <AT Param, int sx=0, int sy=0, typename GridRefT, typename csT>
+CUDAHOSTDEV StencilField<Param,sx,sy> field(GridRefT& grid, const StencilPoint<csT>& p)
+{
+    StencilField<Param,sx,sy> f;
+    #pragma unroll
+    for(int y = 0; y < 3; y++)
+        #pragma unroll
+        for(int x = 0; x < 3; x++)
+            f.values[y][x] = grid.template read<Param>(p.ids[y][x]);
+    return f;
+}
+
+/**
+ * @brief load attribute Param in the neighborhood of p, values are stored on the right face of the cells (eg velocityX)
+ */
+template <AT Param, typename GridRefT, typename csT>
+CUDAHOSTDEV StencilField<Param,1,0> fieldX(GridRefT& grid, const StencilPoint<csT>& p)
+{
+    return field<Param,1,0>(grid,p);
+}
+
+/**
+ * @brief load attribute Param in the neighborhood of p, values are stored on the forward face of the cells (eg velocityY)
+ */
+template <AT Param, typename GridRefT, typename csT>
+CUDAHOSTDEV StencilField<Param,0,1> fieldY(GridRefT& grid, const StencilPoint<csT>& p)
+{
+    return field<Param,0,1>(grid,p);
+}
+
+//-------------------------------------------------------------------
+// operators
+
+template <typename E, std::enable_if_t<isStencilExpression<E>::value, int> = 0>
+CUDAHOSTDEV StencilDdx<E> ddx(const E& e) {return {e};} //!< derivative along the first axis
+
+template <typename E, std::enable_if_t<isStencilExpression<E>::value, int> = 0>
+CUDAHOSTDEV StencilDdy<E> ddy(const E& e) {return {e};} //!< derivative along the second axis
+
+template <typename E, std::enable_if_t<isStencilExpression<E>::value, int> = 0>
+CUDAHOSTDEV StencilVector<StencilDdx<E>,StencilDdy<E>> grad(const E& e) {return {ddx(e), ddy(e)};} //!< gradient, components are located half a cell from where e is
+
+template <typename X, typename Y>
+CUDAHOSTDEV StencilDiv<X,Y> div(const X& x, const Y& y) {return {x, y};} //!< divergence of the vector field (x,y)
+
+template <typename X, typename Y>
+CUDAHOSTDEV StencilDiv<X,Y> div(const StencilVector<X,Y>& v) {return {v.x, v.y};} //!< divergence of a vector expression
+
+template <typename X, typename Y>
+CUDAHOSTDEV StencilCurl<X,Y> curl(const X& x, const Y& y) {return {x, y};} //!< curl of the vector field (x,y)
+
+template <typename X, typename Y>
+CUDAHOSTDEV StencilCurl<X,Y> curl(const StencilVector<X,Y>& v) {return {v.x, v.y};} //!< curl of a vector expression
+
+template <typename E, std::enable_if_t<isStencilExpression<E>::value, int> = 0>
+CUDAHOSTDEV StencilLaplace<E> laplace(const E& e) {return {e};} //!< laplace operator from second differences, div(grad(e)) uses the metric of the faces instead
+
+template <typename A, typename B>
+using enableStencilOperator = std::enable_if_t<isStencilExpression<A>::value || isStencilExpression<B>::value, int>;
+
+template <typename A, typename B, enableStencilOperator<A,B> = 0>
+CUDAHOSTDEV StencilBinary<A,B,StencilAdd> operator+(const A& a, const B& b) {return {a, b};}
+
+template <typename A, typename B, enableStencilOperator<A,B> = 0>
+CUDAHOSTDEV StencilBinary<A,B,StencilSubtract> operator-(const A& a, const B& b) {return {a, b};}
+
+template <typename A, typename B, enableStencilOperator<A,B> = 0>
+CUDAHOSTDEV StencilBinary<A,B,StencilMultiply> operator*(const A& a, const B& b) {return {a, b};}
+
+//-------------------------------------------------------------------
+// evaluation
+
+/**
+ * @brief evaluate the expression at an offset from the center of p in half cells
+ */
+template <int ox=0, int oy=0, typename E, typename csT>
+CUDAHOSTDEV float evaluate(const E& e, const StencilPoint<csT>& p)
+{
+    return e.template at<ox,oy>(p);
+}
+
+#endif //CIRCULATION_STENCIL_H
@@ -0,0 +1,64 @@
+/*
+ * CIRCULATION
+ * tileActivity.h
+ *
+ * @author: Hendrik Schwanekamp
+ * @mail:   hendrik.schwanekamp@gmx.net
+ *
+ * Copyright (c) 2020 Hendrik Schwanekamp
+ *
+ */
+#ifndef CIRCULATION_TILEACTIVITY_H
+#define CIRCULATION_TILEACTIVITY_H
+
+// includes
+//--------------------
+#include <cstdint>
+#include <mpUtils/mpUtils.h>
+#include <mpUtils/mpCuda.h>
+//--------------------
+
+/**
+ * @brief activity of square tiles of a 2d grid, lets step kernels skip regions where nothing happens
+ *  A tile is quiet if neither it nor any of its 8 neighbors changed by more than the tolerance in the last step.
+ *  Kernels do not compute quiet tiles but copy time level t to t+1 instead. After "settled" quiet steps all three
+ *  time levels hold the same values and quiet tiles are not touched at all, unless the grid recycled a buffer that was
+ *  waiting for rendering as t+1 buffer (see Grid::isWriteBufferRecycled()). That buffer holds values of an older
+ *  step, so settled tiles are copied as well when recycledNext is set.
+ *  Activity spreads by one tile per step, so it is only valid for schemes whose stencil is smaller than a tile
+ *  and whose signals travel less than a tile per step.
+ *  Skipping is an approximation: changes below the tolerance are dropped and all time levels of a settled tile freeze,
+ *  so results differ from computing every tile. It is therefore opt-in.
+ */
+struct TileActivity
+{
+    static constexpr int tileSize = 16; //!< cells along each side of a tile
+    static constexpr uint8_t settled = 3; //!< quiet steps after which all time levels of a tile are identical
+
+    const uint8_t* quiet{nullptr}; //!< number of consecutive quiet steps of every tile (saturates at settled), nullptr if all tiles are active
+    int* changed{nullptr}; //!< set to 1 for tiles where a value changed by more than tolerance, nullptr to not track changes
+    int tilesX{0}; //!< number of tiles in x direction
+    float tolerance{0.0f}; //!< changes below tolerance do not count as activity
+    bool recycledNext{false}; //!< the t+1 buffer holds values older than t-1, settled tiles need to be copied as well
+
+    CUDAHOSTDEV bool needsCopy(uint8_t quietSteps) const {return quietSteps < settled || recycledNext;} //!< values of a quiet tile need to be copied from t to t+1
+
+    CUDAHOSTDEV int tile(int x, int y) const {return (y / tileSize) * tilesX + x / tileSize;} //!< tile of cell (x,y)
+    CUDAHOSTDEV uint8_t quietSteps(int x, int y) const {return quiet ? quiet[tile(x,y)] : 0;} //!< 0 if the tile of cell (x,y) needs to be computed
+    __device__ void reportChange(int x, int y, float change) //!< record the change of a value of cell (x,y)
+    {
+        if(changed && change > tolerance)
+            changed[tile(x,y)] = 1;
+    }
+};
+
+/**
+ * @brief number of tiles in each direction of a grid with numGridCells cells
+ */
+CUDAHOSTDEV inline int2 numTiles(int2 numGridCells)
+{
+    return make_int2( (numGridCells.x + TileActivity::tileSize-1) / TileActivity::tileSize,
+                      (numGridCells.y + TileActivity::tileSize-1) / TileActivity::tileSize);
+}
+
+#endif //CIRCULATION_TILEACTIVITY_H